@@ -0,0 +1 @@
+#include <socketcan/can/j1939.h>
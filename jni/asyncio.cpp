@@ -0,0 +1,1110 @@
+#include<algorithm>
+#include<new>
+#include<vector>
+
+#include<cstring>
+#include<cstdint>
+#include<cerrno>
+#include<climits>
+#include<ctime>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <linux/can.h>
+}
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+extern "C" {
+#include <linux/io_uring.h>
+}
+#endif
+#endif
+
+/* multishot recvmsg and provided buffer rings need 6.0 era headers */
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_FEAT_EXT_ARG) && \
+	defined(__NR_io_uring_setup)
+#define HAVE_IO_URING 1
+#endif
+
+#if defined(ANDROID) || defined(__ANDROID__)
+#include "jni.h"
+#else
+#include "de_entropia_can_AsyncCanIo.h"
+#endif
+
+#include "jniutil.h"
+#include "canio.h"
+#include "txshaper.h"
+#include "clocks.h"
+
+/*
+ * Event driven I/O over many CAN sockets with two backends.
+ *
+ * The io_uring backend keeps one multishot recvmsg posted per registered
+ * socket. Received frames land in a ring of provided buffers, so the
+ * kernel delivers frames of all sockets without any system call per
+ * frame; sends are queued as sendmsg requests and submitted together with
+ * a single io_uring_enter. Completions are reaped into a backlog from
+ * which Java fetches batches.
+ *
+ * The poll backend is used where io_uring, provided buffer rings or
+ * multishot recvmsg are missing (kernels before 6.0, seccomp filters). It
+ * polls all sockets and drains the ready ones with recvmmsg, and sends
+ * with one sendmmsg per batch.
+ *
+ * Frames sent and received are also counted in the SocketStats of their
+ * socket, and sends pass the shaper of their socket without waiting: a
+ * frame over budget ends the submission early, as a full queue does.
+ *
+ * An instance must be driven by one thread at a time.
+ */
+
+enum {
+	BACKEND_IO_URING,
+	BACKEND_POLL
+};
+
+/* indices of the stats array filled by _stats */
+enum {
+	ST_RECV_FRAMES,
+	ST_SENT_FRAMES,
+	ST_SEND_ERRORS,
+	ST_SYSCALLS,
+	ST_REARMS,
+	ST_MALFORMED,
+	ST_FIELDS
+};
+
+struct rx_frame {
+	int32_t tag;
+	int32_t if_index;
+	struct can_frame frame;
+};
+
+struct async_socket {
+	int fd;
+	io_stats *stats;
+	bool active;
+	bool armed;
+	struct msghdr msg;
+};
+
+struct send_slot {
+	int tag;
+	struct can_frame frame;
+	struct sockaddr_can addr;
+	struct iovec iov;
+	struct msghdr msg;
+};
+
+struct async_io {
+	int backend;
+	std::vector<async_socket> sockets;
+	/* frames reaped but not fetched yet, a ring of power of two size */
+	std::vector<rx_frame> backlog;
+	size_t backlog_head;
+	size_t backlog_tail;
+	int64_t stats[ST_FIELDS];
+	/* poll backend */
+	std::vector<struct pollfd> pollfds;
+	size_t poll_next;
+#ifdef HAVE_IO_URING
+	int ring_fd;
+	void *sq_ring;
+	size_t sq_ring_len;
+	void *cq_ring;
+	size_t cq_ring_len;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned to_submit;
+	struct io_uring_buf_ring *buf_ring;
+	size_t buf_ring_len;
+	uint8_t *bufs;
+	unsigned nbufs;
+	std::vector<send_slot> slots;
+	std::vector<unsigned> free_slots;
+	/* receive completions reaped while the backlog was full */
+	std::vector<struct io_uring_cqe> deferred;
+#endif
+};
+
+static size_t backlogSize(const async_io *io)
+{
+	return io->backlog_tail - io->backlog_head;
+}
+
+static bool backlogFull(const async_io *io)
+{
+	return backlogSize(io) == io->backlog.size();
+}
+
+static void backlogPush(async_io *io, int tag, int if_index,
+			const struct can_frame& frame)
+{
+	rx_frame& rx = io->backlog[io->backlog_tail & (io->backlog.size() - 1)];
+	rx.tag = tag;
+	rx.if_index = if_index;
+	rx.frame = frame;
+	io->backlog_tail++;
+	io->stats[ST_RECV_FRAMES]++;
+	io_shard& shard = ioShard(io->sockets[tag].stats);
+	ioAdd(shard, IO_FRAMES_IN, 1);
+	ioAdd(shard, IO_BYTES_IN, std::min(frame.can_dlc,
+					   static_cast<__u8>(CAN_MAX_DLEN)));
+}
+
+static size_t nextPowerOfTwo(size_t n)
+{
+	size_t p = 1;
+	while (p < n) {
+		p <<= 1;
+	}
+	return p;
+}
+
+#ifdef HAVE_IO_URING
+
+/* buffer group of the provided receive buffers */
+static const uint16_t BUFFER_GROUP = 0;
+/* io_uring_recvmsg_out, sockaddr_can and can_frame, rounded up */
+static const unsigned BUFFER_SIZE = 64;
+static const uint64_t KIND_SHIFT = 56;
+static const uint64_t KIND_RECV = 1;
+static const uint64_t KIND_SEND = 2;
+static const uint64_t KIND_CANCEL = 3;
+static const uint64_t KIND_PROBE = 4;
+
+static int uringSetup(unsigned entries, struct io_uring_params *p)
+{
+	return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int uringEnter(async_io *io, unsigned submit, unsigned min_complete,
+		      unsigned flags, const struct timespec *timeout)
+{
+	struct io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	struct __kernel_timespec ts;
+	if (timeout != NULL) {
+		ts.tv_sec = timeout->tv_sec;
+		ts.tv_nsec = timeout->tv_nsec;
+		arg.ts = reinterpret_cast<uint64_t>(&ts);
+	}
+	io->stats[ST_SYSCALLS]++;
+	return static_cast<int>(syscall(__NR_io_uring_enter, io->ring_fd,
+					submit, min_complete,
+					flags | IORING_ENTER_EXT_ARG, &arg,
+					sizeof(arg)));
+}
+
+static int uringRegister(async_io *io, unsigned opcode, void *arg,
+			 unsigned nr)
+{
+	return static_cast<int>(syscall(__NR_io_uring_register, io->ring_fd,
+					opcode, arg, nr));
+}
+
+/* submits queued requests, returns false with errno set on failure */
+static bool uringFlush(async_io *io)
+{
+	while (io->to_submit > 0) {
+		const int n = uringEnter(io, io->to_submit, 0, 0, NULL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		io->to_submit -= n;
+		if (n == 0) {
+			errno = EBUSY;
+			return false;
+		}
+	}
+	return true;
+}
+
+/* next free submission entry, flushing the queue if it is full */
+static struct io_uring_sqe *uringSqe(async_io *io)
+{
+	const unsigned head = __atomic_load_n(io->sq_head, __ATOMIC_ACQUIRE);
+	unsigned tail = *io->sq_tail;
+	if (tail - head == io->sq_entries) {
+		if (!uringFlush(io)) {
+			return NULL;
+		}
+		if (tail - __atomic_load_n(io->sq_head, __ATOMIC_ACQUIRE) ==
+		    io->sq_entries) {
+			errno = EBUSY;
+			return NULL;
+		}
+	}
+	const unsigned idx = tail & io->sq_mask;
+	struct io_uring_sqe *const sqe = &io->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	io->sq_array[idx] = idx;
+	__atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	io->to_submit++;
+	return sqe;
+}
+
+static void uringProvideBuffer(async_io *io, unsigned bid, unsigned offset)
+{
+	const unsigned mask = io->nbufs - 1;
+	const uint16_t tail = io->buf_ring->tail;
+	/* not bufs[], the flexible array is misplaced when compiled as C++ */
+	struct io_uring_buf *const buf =
+		reinterpret_cast<struct io_uring_buf *>(io->buf_ring) +
+		((tail + offset) & mask);
+	buf->addr = reinterpret_cast<uint64_t>(io->bufs + bid * BUFFER_SIZE);
+	buf->len = BUFFER_SIZE;
+	buf->bid = static_cast<uint16_t>(bid);
+}
+
+static void uringAdvanceBuffers(async_io *io, unsigned count)
+{
+	const uint16_t tail = io->buf_ring->tail;
+	__atomic_store_n(&io->buf_ring->tail, static_cast<uint16_t>(tail + count),
+			 __ATOMIC_RELEASE);
+}
+
+static bool uringArm(async_io *io, int tag)
+{
+	async_socket& s = io->sockets[tag];
+	struct io_uring_sqe *const sqe = uringSqe(io);
+	if (sqe == NULL) {
+		return false;
+	}
+	memset(&s.msg, 0, sizeof(s.msg));
+	s.msg.msg_namelen = sizeof(struct sockaddr_can);
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = s.fd;
+	sqe->addr = reinterpret_cast<uint64_t>(&s.msg);
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = BUFFER_GROUP;
+	sqe->user_data = KIND_RECV << KIND_SHIFT | static_cast<uint32_t>(tag);
+	s.armed = true;
+	return true;
+}
+
+static void uringRecvCompletion(async_io *io, int tag, int res,
+				unsigned flags)
+{
+	if (flags & IORING_CQE_F_BUFFER) {
+		const unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		const uint8_t *const buf = io->bufs + bid * BUFFER_SIZE;
+		const async_socket& s = io->sockets[tag];
+		const struct io_uring_recvmsg_out *out =
+			reinterpret_cast<const struct io_uring_recvmsg_out *>(buf);
+		if (res >= static_cast<int>(sizeof(*out)) && s.active &&
+		    out->namelen == sizeof(struct sockaddr_can) &&
+		    out->payloadlen == sizeof(struct can_frame) &&
+		    !(out->flags & MSG_TRUNC)) {
+			struct sockaddr_can addr;
+			struct can_frame frame;
+			const uint8_t *const name = buf + sizeof(*out);
+			memcpy(&addr, name, sizeof(addr));
+			memcpy(&frame, name + s.msg.msg_namelen +
+			       s.msg.msg_controllen, sizeof(frame));
+			backlogPush(io, tag, addr.can_ifindex, frame);
+		} else if (s.active) {
+			io->stats[ST_MALFORMED]++;
+		}
+		uringProvideBuffer(io, bid, 0);
+		uringAdvanceBuffers(io, 1);
+	}
+	if (!(flags & IORING_CQE_F_MORE)) {
+		async_socket& s = io->sockets[tag];
+		s.armed = false;
+		/* ENOBUFS ends the multishot when the buffers ran out */
+		if (s.active && res != -EBADF && res != -ECANCELED &&
+		    uringArm(io, tag)) {
+			io->stats[ST_REARMS]++;
+		}
+	}
+}
+
+/*
+ * Processes all completions. Receives that find the backlog full are
+ * deferred with their buffer; once the buffers run out the kernel ends
+ * the multishot receives until the backlog drains. Sends never wait
+ * behind them, so their slots always come back.
+ */
+static void uringReap(async_io *io)
+{
+	size_t done = 0;
+	while (done < io->deferred.size() && !backlogFull(io)) {
+		const struct io_uring_cqe& cqe = io->deferred[done++];
+		uringRecvCompletion(io, static_cast<uint32_t>(cqe.user_data),
+				    cqe.res, cqe.flags);
+	}
+	io->deferred.erase(io->deferred.begin(), io->deferred.begin() + done);
+	unsigned head = *io->cq_head;
+	for (;;) {
+		const unsigned tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			break;
+		}
+		const struct io_uring_cqe *const cqe = &io->cqes[head & io->cq_mask];
+		const uint64_t kind = cqe->user_data >> KIND_SHIFT;
+		const uint32_t id = static_cast<uint32_t>(cqe->user_data);
+		if (kind == KIND_RECV) {
+			/* keep the order of frames behind deferred ones */
+			if (backlogFull(io) || !io->deferred.empty()) {
+				io->deferred.push_back(*cqe);
+			} else {
+				uringRecvCompletion(io, id, cqe->res, cqe->flags);
+			}
+		} else if (kind == KIND_SEND) {
+			const send_slot& slot = io->slots[id];
+			const async_socket& s = io->sockets[slot.tag];
+			/* the stats of an unregistered socket may be reused */
+			io_shard& shard = ioShard(s.active ? s.stats : NULL);
+			if (cqe->res == sizeof(struct can_frame)) {
+				io->stats[ST_SENT_FRAMES]++;
+				ioAdd(shard, IO_FRAMES_OUT, 1);
+				ioAdd(shard, IO_BYTES_OUT, slot.frame.can_dlc);
+			} else {
+				io->stats[ST_SEND_ERRORS]++;
+				countSendError(shard, -cqe->res);
+			}
+			io->free_slots.push_back(id);
+		}
+		head++;
+		__atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+	}
+}
+
+static void uringClose(async_io *io)
+{
+	if (io->bufs != NULL) {
+		free(io->bufs);
+	}
+	if (io->buf_ring != NULL) {
+		munmap(io->buf_ring, io->buf_ring_len);
+	}
+	if (io->sqes != NULL) {
+		munmap(io->sqes, io->sqes_len);
+	}
+	if (io->cq_ring != NULL && io->cq_ring != io->sq_ring) {
+		munmap(io->cq_ring, io->cq_ring_len);
+	}
+	if (io->sq_ring != NULL) {
+		munmap(io->sq_ring, io->sq_ring_len);
+	}
+	if (io->ring_fd >= 0) {
+		close(io->ring_fd);
+	}
+}
+
+/*
+ * Checks that multishot recvmsg is supported by posting one on a socket
+ * pair with a datagram waiting. Old kernels fail the request with EINVAL.
+ */
+static bool uringProbeMultishot(async_io *io)
+{
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, sv) != 0) {
+		return false;
+	}
+	const char probe = 0;
+	bool supported = false;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	struct io_uring_sqe *sqe;
+	if (send(sv[1], &probe, sizeof(probe), 0) == sizeof(probe) &&
+	    (sqe = uringSqe(io)) != NULL) {
+		sqe->opcode = IORING_OP_RECVMSG;
+		sqe->fd = sv[0];
+		sqe->addr = reinterpret_cast<uint64_t>(&msg);
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = BUFFER_GROUP;
+		sqe->user_data = KIND_PROBE << KIND_SHIFT;
+		if (uringFlush(io)) {
+			/* wait until the recvmsg has terminated */
+			bool done = false;
+			bool cancelled = false;
+			while (!done) {
+				struct timespec ts = { 1, 0 };
+				if (uringEnter(io, 0, 1, IORING_ENTER_GETEVENTS,
+					       &ts) < 0 && errno != EINTR) {
+					break;
+				}
+				unsigned head = *io->cq_head;
+				while (head != __atomic_load_n(io->cq_tail,
+							       __ATOMIC_ACQUIRE)) {
+					const struct io_uring_cqe *const cqe =
+						&io->cqes[head & io->cq_mask];
+					if ((cqe->user_data >> KIND_SHIFT) == KIND_PROBE) {
+						if (cqe->flags & IORING_CQE_F_BUFFER) {
+							uringProvideBuffer(io,
+								cqe->flags >> IORING_CQE_BUFFER_SHIFT, 0);
+							uringAdvanceBuffers(io, 1);
+						}
+						if (cqe->res >= 0 &&
+						    (cqe->flags & IORING_CQE_F_MORE)) {
+							supported = true;
+						}
+						if (!(cqe->flags & IORING_CQE_F_MORE)) {
+							done = true;
+						}
+					}
+					head++;
+					__atomic_store_n(io->cq_head, head,
+							 __ATOMIC_RELEASE);
+				}
+				if (!done && !cancelled &&
+				    (sqe = uringSqe(io)) != NULL) {
+					sqe->opcode = IORING_OP_ASYNC_CANCEL;
+					sqe->addr = KIND_PROBE << KIND_SHIFT;
+					sqe->user_data = KIND_CANCEL << KIND_SHIFT;
+					cancelled = uringFlush(io);
+				}
+			}
+			supported = supported && done;
+		}
+	}
+	close(sv[0]);
+	close(sv[1]);
+	return supported;
+}
+
+/* returns false with errno set if io_uring cannot be used */
+static bool uringOpen(async_io *io, unsigned entries)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	io->ring_fd = uringSetup(entries, &p);
+	if (io->ring_fd < 0) {
+		return false;
+	}
+	const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+		IORING_FEAT_EXT_ARG;
+	if ((p.features & required) != required) {
+		errno = ENOTSUP;
+		return false;
+	}
+	io->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	io->cq_ring_len = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	io->sq_ring_len = std::max(io->sq_ring_len, io->cq_ring_len);
+	void *const ring = mmap(NULL, io->sq_ring_len, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, io->ring_fd,
+				IORING_OFF_SQ_RING);
+	if (ring == MAP_FAILED) {
+		return false;
+	}
+	io->sq_ring = io->cq_ring = ring;
+	io->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	void *const sqes = mmap(NULL, io->sqes_len, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, io->ring_fd,
+				IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		return false;
+	}
+	io->sqes = static_cast<struct io_uring_sqe *>(sqes);
+	uint8_t *const base = static_cast<uint8_t *>(ring);
+	io->sq_head = reinterpret_cast<unsigned *>(base + p.sq_off.head);
+	io->sq_tail = reinterpret_cast<unsigned *>(base + p.sq_off.tail);
+	io->sq_mask = *reinterpret_cast<unsigned *>(base + p.sq_off.ring_mask);
+	io->sq_array = reinterpret_cast<unsigned *>(base + p.sq_off.array);
+	io->sq_entries = p.sq_entries;
+	io->cq_head = reinterpret_cast<unsigned *>(base + p.cq_off.head);
+	io->cq_tail = reinterpret_cast<unsigned *>(base + p.cq_off.tail);
+	io->cq_mask = *reinterpret_cast<unsigned *>(base + p.cq_off.ring_mask);
+	io->cqes = reinterpret_cast<struct io_uring_cqe *>(base + p.cq_off.cqes);
+
+	/* buffer rings hold at most 32768 entries */
+	io->nbufs = std::min<size_t>(nextPowerOfTwo(2 * p.cq_entries), 32768);
+	io->buf_ring_len = io->nbufs * sizeof(struct io_uring_buf);
+	void *const buf_ring = mmap(NULL, io->buf_ring_len,
+				    PROT_READ | PROT_WRITE,
+				    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf_ring == MAP_FAILED) {
+		return false;
+	}
+	io->buf_ring = static_cast<struct io_uring_buf_ring *>(buf_ring);
+	if (posix_memalign(reinterpret_cast<void **>(&io->bufs), 64,
+			   io->nbufs * BUFFER_SIZE) != 0) {
+		io->bufs = NULL;
+		errno = ENOMEM;
+		return false;
+	}
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = reinterpret_cast<uint64_t>(io->buf_ring);
+	reg.ring_entries = io->nbufs;
+	reg.bgid = BUFFER_GROUP;
+	if (uringRegister(io, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+		return false;
+	}
+	io->buf_ring->tail = 0;
+	for (unsigned i = 0; i < io->nbufs; i++) {
+		uringProvideBuffer(io, i, i);
+	}
+	uringAdvanceBuffers(io, io->nbufs);
+
+	try {
+		io->slots.resize(p.sq_entries);
+		/* a buffer per deferred receive, plus a final one per socket */
+		io->deferred.reserve(io->nbufs + 64);
+		for (unsigned i = p.sq_entries; i > 0; i--) {
+			io->free_slots.push_back(i - 1);
+		}
+	} catch (const std::bad_alloc&) {
+		errno = ENOMEM;
+		return false;
+	}
+	if (!uringProbeMultishot(io)) {
+		errno = ENOTSUP;
+		return false;
+	}
+	return true;
+}
+
+static int uringSubmit(async_io *io, int tag, const jint *ifindex,
+		       const jint *canid, const jbyte *dlc,
+		       const uint8_t *data, int count)
+{
+	uringReap(io);
+	const async_socket& s = io->sockets[tag];
+	const shaper_ref ref(s.stats);
+	int queued = 0;
+	while (queued < count) {
+		if (io->free_slots.empty()) {
+			/* sends to CAN sockets mostly complete inline */
+			if (!uringFlush(io)) {
+				return queued > 0 ? queued : -1;
+			}
+			uringReap(io);
+			if (io->free_slots.empty()) {
+				break;
+			}
+		}
+		const unsigned id = io->free_slots.back();
+		send_slot& slot = io->slots[id];
+		memset(&slot, 0, sizeof(slot));
+		slot.tag = tag;
+		slot.frame.can_id = canid[queued];
+		slot.frame.can_dlc = std::min<int>(std::max<int>(dlc[queued], 0),
+						   CAN_MAX_DLEN);
+		memcpy(slot.frame.data, data + queued * CAN_MAX_DLEN,
+		       CAN_MAX_DLEN);
+		slot.iov.iov_base = &slot.frame;
+		slot.iov.iov_len = sizeof(slot.frame);
+		slot.msg.msg_iov = &slot.iov;
+		slot.msg.msg_iovlen = 1;
+		if (ifindex[queued] != 0) {
+			slot.addr.can_family = AF_CAN;
+			slot.addr.can_ifindex = ifindex[queued];
+			slot.msg.msg_name = &slot.addr;
+			slot.msg.msg_namelen = sizeof(slot.addr);
+		}
+		if (ref.shaper != NULL) {
+			const shape_verdict verdict = shapeFrame(ref.shaper,
+					ifindex[queued], slot.frame, false);
+			if (verdict == SHAPE_DROP) {
+				queued++;
+				continue;
+			} else if (verdict == SHAPE_REJECT) {
+				ioAdd(ioShard(s.stats), IO_WOULD_BLOCK, 1);
+				break;
+			}
+		}
+		struct io_uring_sqe *const sqe = uringSqe(io);
+		if (sqe == NULL) {
+			break;
+		}
+		io->free_slots.pop_back();
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = s.fd;
+		sqe->addr = reinterpret_cast<uint64_t>(&slot.msg);
+		sqe->len = 1;
+		sqe->user_data = KIND_SEND << KIND_SHIFT | id;
+		queued++;
+	}
+	if (!uringFlush(io)) {
+		return -1;
+	}
+	return queued;
+}
+
+/*
+ * Waits until frames are waiting or the timeout passed. Completions of
+ * sends wake the wait as well, so it resumes until a receive arrives.
+ */
+static bool uringWait(async_io *io, jlong timeoutNanos)
+{
+	uringReap(io);
+	if (backlogSize(io) > 0 || timeoutNanos == 0) {
+		return uringFlush(io);
+	}
+	const int64_t deadline = timeoutNanos < 0 ? 0 :
+		monotonicNanos() + timeoutNanos;
+	for (;;) {
+		struct timespec ts;
+		if (timeoutNanos >= 0) {
+			const int64_t left = deadline - monotonicNanos();
+			if (left <= 0) {
+				return uringFlush(io);
+			}
+			ts.tv_sec = left / 1000000000;
+			ts.tv_nsec = left % 1000000000;
+		}
+		const int n = uringEnter(io, io->to_submit, 1,
+					 IORING_ENTER_GETEVENTS,
+					 timeoutNanos < 0 ? NULL : &ts);
+		if (n < 0) {
+			if (errno == ETIME) {
+				uringReap(io);
+				return true;
+			} else if (errno != EINTR) {
+				return false;
+			}
+		} else {
+			io->to_submit -= n;
+		}
+		uringReap(io);
+		if (backlogSize(io) > 0) {
+			return true;
+		}
+	}
+}
+
+static bool uringUnregister(async_io *io, int tag)
+{
+	async_socket& s = io->sockets[tag];
+	s.active = false;
+	if (!s.armed) {
+		return true;
+	}
+	struct io_uring_sqe *const sqe = uringSqe(io);
+	if (sqe == NULL) {
+		return false;
+	}
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = KIND_RECV << KIND_SHIFT | static_cast<uint32_t>(tag);
+	sqe->user_data = KIND_CANCEL << KIND_SHIFT;
+	return uringFlush(io);
+}
+
+#endif
+
+static bool pollWait(async_io *io, jlong timeoutNanos)
+{
+	if (backlogSize(io) > 0) {
+		return true;
+	}
+	const size_t n = io->pollfds.size();
+	int timeout = -1;
+	if (timeoutNanos >= 0) {
+		timeout = static_cast<int>(std::min<jlong>(
+			(timeoutNanos + 999999) / 1000000, INT_MAX));
+	}
+	io->stats[ST_SYSCALLS]++;
+	int ready = poll(io->pollfds.data(), n, timeout);
+	if (ready < 0) {
+		return errno == EINTR;
+	}
+	struct frame_burst burst;
+	/* start behind the socket served first last time for fairness */
+	for (size_t k = 0; k < n && ready > 0 && !backlogFull(io); k++) {
+		const size_t i = (io->poll_next + k) % n;
+		struct pollfd& pfd = io->pollfds[i];
+		if (pfd.fd < 0 || pfd.revents == 0) {
+			continue;
+		}
+		ready--;
+		const int room = static_cast<int>(io->backlog.size() -
+						  backlogSize(io));
+		io->stats[ST_SYSCALLS]++;
+		io_shard& shard = ioShard(io->sockets[i].stats);
+		const int got = recvBurst(pfd.fd, burst,
+					  std::min(room, RECV_BATCH_MAX),
+					  MSG_DONTWAIT);
+		ioAdd(shard, IO_RECV_CALLS, 1);
+		if (got < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				ioAdd(shard, IO_EXCEPTIONS, 1);
+				return false;
+			}
+			ioAdd(shard, IO_WOULD_BLOCK, 1);
+			continue;
+		}
+		for (int j = 0; j < got; j++) {
+			if (burst.msgs[j].msg_len != sizeof(struct can_frame) ||
+			    burst.msgs[j].msg_hdr.msg_namelen !=
+			    sizeof(burst.addrs[j])) {
+				io->stats[ST_MALFORMED]++;
+				continue;
+			}
+			backlogPush(io, static_cast<int>(i),
+				    burst.addrs[j].can_ifindex, burst.frames[j]);
+		}
+	}
+	io->poll_next = (io->poll_next + 1) % std::max<size_t>(n, 1);
+	return true;
+}
+
+static int pollSubmit(async_io *io, int tag, const jint *ifindex,
+		      const jint *canid, const jbyte *dlc,
+		      const uint8_t *data, int count)
+{
+	const int fd = io->sockets[tag].fd;
+	io_shard& shard = ioShard(io->sockets[tag].stats);
+	io_timer timer(shard, IO_SEND_NANOS);
+	const shaper_ref ref(io->sockets[tag].stats);
+	int done = 0;
+	while (done < count) {
+		const int chunk = std::min(count - done, RECV_BATCH_MAX);
+		struct can_frame frames[RECV_BATCH_MAX];
+		struct sockaddr_can addrs[RECV_BATCH_MAX];
+		struct iovec iovs[RECV_BATCH_MAX];
+		struct mmsghdr msgs[RECV_BATCH_MAX];
+		/* chunk offset of every message, shaping may drop frames in between */
+		int slots[RECV_BATCH_MAX + 1];
+		int n = 0;
+		int taken = chunk;
+		memset(msgs, 0, sizeof(msgs[0]) * chunk);
+		for (int i = 0; i < chunk; i++) {
+			const int k = done + i;
+			struct can_frame& frame = frames[n];
+			memset(&frame, 0, sizeof(frame));
+			frame.can_id = canid[k];
+			frame.can_dlc = std::min<int>(std::max<int>(dlc[k], 0),
+						      CAN_MAX_DLEN);
+			memcpy(frame.data, data + k * CAN_MAX_DLEN, CAN_MAX_DLEN);
+			if (ref.shaper != NULL) {
+				const shape_verdict verdict =
+					shapeFrame(ref.shaper, ifindex[k], frame, false);
+				if (verdict == SHAPE_DROP) {
+					continue;
+				} else if (verdict == SHAPE_REJECT) {
+					ioAdd(shard, IO_WOULD_BLOCK, 1);
+					taken = i;
+					break;
+				}
+			}
+			iovs[n].iov_base = &frame;
+			iovs[n].iov_len = sizeof(frame);
+			msgs[n].msg_hdr.msg_iov = &iovs[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+			if (ifindex[k] != 0) {
+				memset(&addrs[n], 0, sizeof(addrs[n]));
+				addrs[n].can_family = AF_CAN;
+				addrs[n].can_ifindex = ifindex[k];
+				msgs[n].msg_hdr.msg_name = &addrs[n];
+				msgs[n].msg_hdr.msg_namelen = sizeof(addrs[n]);
+			}
+			slots[n++] = i;
+		}
+		slots[n] = taken;
+		int sent = 0;
+		if (n > 0) {
+			/* frames shaped already, a retry must not shape them again */
+			do {
+				io->stats[ST_SYSCALLS]++;
+				sent = sendmmsg(fd, msgs, n, 0);
+				ioAdd(shard, IO_SEND_CALLS, 1);
+			} while (sent < 0 && errno == EINTR);
+			if (sent < 0) {
+				io->stats[ST_SEND_ERRORS]++;
+				countSendError(shard, errno);
+				/* dropped frames ahead of the first message are done */
+				done += slots[0];
+				return done > 0 ? done : -1;
+			}
+		}
+		uint64_t bytes = 0;
+		for (int i = 0; i < sent; i++) {
+			bytes += frames[i].can_dlc;
+		}
+		ioAdd(shard, IO_FRAMES_OUT, sent);
+		ioAdd(shard, IO_BYTES_OUT, bytes);
+		io->stats[ST_SENT_FRAMES] += sent;
+		done += slots[sent];
+		if (sent < n || taken < chunk) {
+			break;
+		}
+	}
+	return done;
+}
+
+static void freeAsyncIo(async_io *io)
+{
+#ifdef HAVE_IO_URING
+	if (io->backend == BACKEND_IO_URING) {
+		/* closing the ring cancels everything still posted */
+		uringClose(io);
+	}
+#endif
+	delete io;
+}
+
+/* returns NULL if out of memory */
+static async_io *newAsyncIo(unsigned entries, bool allow_uring)
+{
+	async_io *const io = new (std::nothrow) async_io();
+	if (io == NULL) {
+		return NULL;
+	}
+	io->backend = BACKEND_POLL;
+	io->backlog_head = io->backlog_tail = 0;
+	io->poll_next = 0;
+	memset(io->stats, 0, sizeof(io->stats));
+#ifdef HAVE_IO_URING
+	io->ring_fd = -1;
+	io->sq_ring = io->cq_ring = NULL;
+	io->sqes = NULL;
+	io->buf_ring = NULL;
+	io->bufs = NULL;
+	io->to_submit = 0;
+	if (allow_uring) {
+		if (uringOpen(io, entries)) {
+			io->backend = BACKEND_IO_URING;
+		} else {
+			uringClose(io);
+			io->ring_fd = -1;
+			io->sq_ring = io->cq_ring = NULL;
+			io->sqes = NULL;
+			io->buf_ring = NULL;
+			io->bufs = NULL;
+			io->slots.clear();
+			io->free_slots.clear();
+			io->deferred.clear();
+			memset(io->stats, 0, sizeof(io->stats));
+		}
+	}
+#endif
+	try {
+		io->backlog.resize(nextPowerOfTwo(2 * std::max(entries, 64u)));
+	} catch (const std::bad_alloc&) {
+		freeAsyncIo(io);
+		return NULL;
+	}
+	return io;
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_AsyncCanIo__1create
+(JNIEnv *env, jclass clazz, jint entries, jboolean allowIoUring)
+{
+	if (entries < 1 || entries > 4096) {
+		throwIllegalArgumentException(env, "entries out of range");
+		return 0;
+	}
+	async_io *const io = newAsyncIo(entries, allowIoUring == JNI_TRUE);
+	if (io == NULL) {
+		throwOutOfMemoryError(env, "could not allocate async io");
+		return 0;
+	}
+	return reinterpret_cast<jlong>(io);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_AsyncCanIo__1free
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	freeAsyncIo(reinterpret_cast<async_io *>(handle));
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_AsyncCanIo__1backend
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	return reinterpret_cast<async_io *>(handle)->backend;
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_AsyncCanIo__1register
+(JNIEnv *env, jclass clazz, jlong handle, jint fd, jlong stats)
+{
+	async_io *const io = reinterpret_cast<async_io *>(handle);
+	const int tag = static_cast<int>(io->sockets.size());
+	async_socket s;
+	memset(&s, 0, sizeof(s));
+	s.fd = fd;
+	s.stats = reinterpret_cast<io_stats *>(stats);
+	s.active = true;
+	io->sockets.push_back(s);
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	io->pollfds.push_back(pfd);
+#ifdef HAVE_IO_URING
+	if (io->backend == BACKEND_IO_URING &&
+	    (!uringArm(io, tag) || !uringFlush(io))) {
+		io->sockets[tag].active = false;
+		io->pollfds[tag].fd = -1;
+		throwIOExceptionErrno(env, errno);
+		return -1;
+	}
+#endif
+	return tag;
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_AsyncCanIo__1unregister
+(JNIEnv *env, jclass clazz, jlong handle, jint tag)
+{
+	async_io *const io = reinterpret_cast<async_io *>(handle);
+	if (tag < 0 || tag >= static_cast<jint>(io->sockets.size()) ||
+	    !io->sockets[tag].active) {
+		throwIllegalArgumentException(env, "socket not registered");
+		return;
+	}
+	io->pollfds[tag].fd = -1;
+	io->sockets[tag].active = false;
+#ifdef HAVE_IO_URING
+	if (io->backend == BACKEND_IO_URING && !uringUnregister(io, tag)) {
+		throwIOExceptionErrno(env, errno);
+	}
+#endif
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_AsyncCanIo__1submit
+(JNIEnv *env, jclass clazz, jlong handle, jint tag, jintArray ifIndices,
+ jintArray canIds, jbyteArray dlcs, jbyteArray data, jint count)
+{
+	async_io *const io = reinterpret_cast<async_io *>(handle);
+	if (tag < 0 || tag >= static_cast<jint>(io->sockets.size()) ||
+	    !io->sockets[tag].active) {
+		throwIllegalArgumentException(env, "socket not registered");
+		return -1;
+	}
+	if (count < 0 || env->GetArrayLength(ifIndices) < count ||
+	    env->GetArrayLength(canIds) < count ||
+	    env->GetArrayLength(dlcs) < count ||
+	    env->GetArrayLength(data) / CAN_MAX_DLEN < count) {
+		throwIllegalArgumentException(env, "batch columns too short");
+		return -1;
+	}
+	std::vector<jint> ifidx(count);
+	std::vector<jint> ids(count);
+	std::vector<jbyte> lens(count);
+	std::vector<uint8_t> payload(count * CAN_MAX_DLEN);
+	env->GetIntArrayRegion(ifIndices, 0, count, ifidx.data());
+	env->GetIntArrayRegion(canIds, 0, count, ids.data());
+	env->GetByteArrayRegion(dlcs, 0, count, lens.data());
+	env->GetByteArrayRegion(data, 0, count * CAN_MAX_DLEN,
+				reinterpret_cast<jbyte *>(payload.data()));
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return -1;
+	}
+	int queued;
+#ifdef HAVE_IO_URING
+	if (io->backend == BACKEND_IO_URING) {
+		queued = uringSubmit(io, tag, ifidx.data(), ids.data(),
+				     lens.data(), payload.data(), count);
+	} else
+#endif
+	queued = pollSubmit(io, tag, ifidx.data(), ids.data(), lens.data(),
+			    payload.data(), count);
+	if (queued < 0) {
+		throwIOExceptionErrno(env, errno);
+	}
+	return queued;
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_AsyncCanIo__1poll
+(JNIEnv *env, jclass clazz, jlong handle, jintArray tags,
+ jintArray ifIndices, jintArray canIds, jbyteArray dlcs, jbyteArray data,
+ jlong timeoutNanos)
+{
+	async_io *const io = reinterpret_cast<async_io *>(handle);
+	const jsize capacity = env->GetArrayLength(canIds);
+	if (env->GetArrayLength(ifIndices) < capacity ||
+	    env->GetArrayLength(dlcs) < capacity ||
+	    env->GetArrayLength(data) / CAN_MAX_DLEN < capacity ||
+	    (tags != NULL && env->GetArrayLength(tags) < capacity)) {
+		throwIllegalArgumentException(env, "batch columns too short");
+		return -1;
+	}
+	bool ok;
+#ifdef HAVE_IO_URING
+	if (io->backend == BACKEND_IO_URING) {
+		ok = uringWait(io, timeoutNanos);
+	} else
+#endif
+	ok = pollWait(io, timeoutNanos);
+	if (!ok) {
+		throwIOExceptionErrno(env, errno);
+		return -1;
+	}
+	jint tag_buf[RECV_BATCH_MAX];
+	jint ifidx_buf[RECV_BATCH_MAX];
+	jint canid_buf[RECV_BATCH_MAX];
+	jbyte dlc_buf[RECV_BATCH_MAX];
+	jbyte data_buf[RECV_BATCH_MAX * CAN_MAX_DLEN];
+	jsize received = 0;
+	while (received < capacity && backlogSize(io) > 0) {
+		const int chunk = static_cast<int>(std::min<size_t>(
+			std::min(capacity - received, RECV_BATCH_MAX),
+			backlogSize(io)));
+		for (int i = 0; i < chunk; i++) {
+			const rx_frame& rx = io->backlog[io->backlog_head++ &
+							 (io->backlog.size() - 1)];
+			tag_buf[i] = rx.tag;
+			ifidx_buf[i] = rx.if_index;
+			canid_buf[i] = rx.frame.can_id;
+			dlc_buf[i] = std::min(rx.frame.can_dlc,
+					      static_cast<__u8>(CAN_MAX_DLEN));
+			memcpy(data_buf + i * CAN_MAX_DLEN, rx.frame.data,
+			       CAN_MAX_DLEN);
+		}
+		if (tags != NULL) {
+			env->SetIntArrayRegion(tags, received, chunk, tag_buf);
+		}
+		env->SetIntArrayRegion(ifIndices, received, chunk, ifidx_buf);
+		env->SetIntArrayRegion(canIds, received, chunk, canid_buf);
+		env->SetByteArrayRegion(dlcs, received, chunk, dlc_buf);
+		env->SetByteArrayRegion(data, received * CAN_MAX_DLEN,
+					chunk * CAN_MAX_DLEN, data_buf);
+		if (env->ExceptionCheck() == JNI_TRUE) {
+			return -1;
+		}
+		received += chunk;
+#ifdef HAVE_IO_URING
+		/* completions left behind by a full backlog */
+		if (io->backend == BACKEND_IO_URING) {
+			uringReap(io);
+		}
+#endif
+	}
+	return received;
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_AsyncCanIo__1stats
+(JNIEnv *env, jclass clazz, jlong handle, jlongArray out)
+{
+	async_io *const io = reinterpret_cast<async_io *>(handle);
+	env->SetLongArrayRegion(out, 0, ST_FIELDS, io->stats);
+}
+
+JNIEXPORT jboolean JNICALL Java_de_entropia_can_AsyncCanIo__1isIoUringAvailable
+(JNIEnv *env, jclass clazz)
+{
+	async_io *const io = newAsyncIo(8, true);
+	if (io == NULL) {
+		throwOutOfMemoryError(env, "could not allocate async io");
+		return JNI_FALSE;
+	}
+	const bool available = io->backend == BACKEND_IO_URING;
+	freeAsyncIo(io);
+	return available ? JNI_TRUE : JNI_FALSE;
+}
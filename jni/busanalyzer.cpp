@@ -0,0 +1,560 @@
+#include<algorithm>
+#include<mutex>
+#include<new>
+
+#include<cmath>
+#include<cstring>
+#include<cstdint>
+#include<cerrno>
+#include<ctime>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+}
+
+#if defined(ANDROID) || defined(__ANDROID__)
+#include "jni.h"
+#else
+#include "de_entropia_can_BusAnalyzer.h"
+#endif
+
+#include "jniutil.h"
+#include "canio.h"
+#include "wirebits.h"
+#include "clocks.h"
+
+/*
+ * Bus load is accounted in a ring of LOAD_BUCKETS time buckets that
+ * together span the load window. Every frame adds its exact on-wire length
+ * (stuff bits included) to the bucket of its receive time; the load is the
+ * sum of the window over the bit time available in it.
+ *
+ * Cycle times are kept per (interface, CAN id) in an open addressing table
+ * that is claimed on first use. Periods are accumulated with Welford's
+ * algorithm, the jitter is their standard deviation.
+ *
+ * All state is guarded by one mutex, the receive path takes it once per
+ * burst. A receive waiting for frames also polls wake_fd, an eventfd
+ * written by _wake when the analyzer is closed.
+ */
+
+static const int MAX_INTERFACES = 16;
+static const int LOAD_BUCKETS = 64;
+
+/* bit times following the CAN FD CRC delimiter: ACK, EOF, IFS */
+static const int FD_TRAILER_BITS = 2 + 7 + 3;
+
+/* flags of _worstCaseBits */
+enum {
+	WC_EFF = 1,
+	WC_RTR = 2,
+	WC_FD = 4
+};
+
+/* indices of the array filled by _busStats */
+enum {
+	BUS_IF_INDEX,
+	BUS_BITRATE,
+	BUS_FRAMES,
+	BUS_BITS,
+	BUS_WINDOW_BITS,
+	BUS_WINDOW_NANOS,
+	BUS_FIELDS
+};
+
+/* per row indices of the stats array filled by _snapshot */
+enum {
+	ID_FRAMES,
+	ID_BITS,
+	ID_LAST_NANOS,
+	ID_MIN_PERIOD,
+	ID_MAX_PERIOD,
+	ID_MEAN_PERIOD,
+	ID_JITTER,
+	ID_FIELDS
+};
+
+struct bus_stats {
+	int if_index;
+	int64_t bitrate;
+	int64_t frames;
+	int64_t bits;
+	int64_t first;
+	/* absolute number of the newest bucket, -1 before the first frame */
+	int64_t bucket;
+	int64_t bucket_bits[LOAD_BUCKETS];
+};
+
+struct id_stats {
+	/* interface index << 32 | CAN id, valid if used is set */
+	uint64_t key;
+	bool used;
+	int64_t frames;
+	int64_t periods;
+	int64_t last;
+	int64_t min_period;
+	int64_t max_period;
+	double mean;
+	double m2;
+	int32_t bits;
+	bool seen;
+};
+
+struct bus_analyzer {
+	std::mutex lock;
+	int64_t bitrate;
+	int64_t bucket_nanos;
+	int64_t overflows;
+	int buses_used;
+	bus_stats buses[MAX_INTERFACES];
+	id_stats *ids;
+	size_t id_mask;
+	int wake_fd;
+};
+
+static int fdLength(int len)
+{
+	static const int lengths[] = { 12, 16, 20, 24, 32, 48, 64 };
+	if (len <= 8) {
+		return std::max(len, 0);
+	}
+	for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		if (len <= lengths[i]) {
+			return lengths[i];
+		}
+	}
+	return CANFD_MAX_DLEN;
+}
+
+/*
+ * Upper bound of the frame length in bit times with the worst case number
+ * of stuff bits. For CAN FD the bits are split into the arbitration phase
+ * (nominal bit rate) and the data phase from the BRS sample point to the
+ * CRC delimiter.
+ */
+static void worstCaseBits(int flags, int len, int& nominal, int& data)
+{
+	if (!(flags & WC_FD)) {
+		const int n = (flags & WC_RTR) ? 0 : 8 * std::min(std::max(len, 0),
+								   CAN_MAX_DLEN);
+		const int stuffable = ((flags & WC_EFF) ? 54 : 34) + n;
+		nominal = stuffable + CLASSIC_TRAILER_BITS + (stuffable - 1) / 4;
+		data = 0;
+		return;
+	}
+	len = fdLength(len);
+	/* SOF .. BRS */
+	const int arbitration = (flags & WC_EFF) ? 36 : 17;
+	/* ESI, DLC, data field */
+	const int payload = 1 + 4 + 8 * len;
+	const int crc = len > 16 ? 21 : 17;
+	/* stuff count and CRC carry a fixed stuff bit every fourth bit */
+	const int fixed_stuff = 1 + (4 + crc - 1) / 4;
+	const int arbitration_stuff = (arbitration - 1) / 4;
+	const int dynamic_stuff = (arbitration + payload - 1) / 4;
+	nominal = arbitration + arbitration_stuff + FD_TRAILER_BITS;
+	data = payload + dynamic_stuff - arbitration_stuff + 4 + crc +
+		fixed_stuff + 1;
+}
+
+static inline uint32_t hashKey(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return static_cast<uint32_t>(key);
+}
+
+/* caller holds a->lock */
+static bus_stats *lookupBus(bus_analyzer *a, int if_index, bool create)
+{
+	for (int i = 0; i < a->buses_used; i++) {
+		if (a->buses[i].if_index == if_index) {
+			return &a->buses[i];
+		}
+	}
+	if (!create || a->buses_used == MAX_INTERFACES) {
+		return NULL;
+	}
+	bus_stats *const bus = &a->buses[a->buses_used++];
+	memset(bus, 0, sizeof(*bus));
+	bus->if_index = if_index;
+	bus->bitrate = a->bitrate;
+	bus->bucket = -1;
+	return bus;
+}
+
+/* caller holds a->lock */
+static id_stats *lookupId(bus_analyzer *a, uint64_t key)
+{
+	size_t pos = hashKey(key) & a->id_mask;
+	for (size_t probe = 0; probe <= a->id_mask; probe++) {
+		id_stats *const ids = &a->ids[pos];
+		if (!ids->used) {
+			/* id 0 on interface 0 is a valid key, not a free slot */
+			ids->key = key;
+			ids->used = true;
+			return ids;
+		}
+		if (ids->key == key) {
+			return ids;
+		}
+		pos = (pos + 1) & a->id_mask;
+	}
+	return NULL;
+}
+
+/* moves the newest bucket forward to b, clearing the buckets passed */
+static void advanceBuckets(bus_stats *bus, int64_t b)
+{
+	if (bus->bucket < 0) {
+		memset(bus->bucket_bits, 0, sizeof(bus->bucket_bits));
+		bus->bucket = b;
+		return;
+	}
+	const int64_t steps = std::min<int64_t>(b - bus->bucket, LOAD_BUCKETS);
+	for (int64_t k = 1; k <= steps; k++) {
+		bus->bucket_bits[(bus->bucket + k) % LOAD_BUCKETS] = 0;
+	}
+	if (b > bus->bucket) {
+		bus->bucket = b;
+	}
+}
+
+/* caller holds a->lock, t must not be negative */
+static void analyze(bus_analyzer *a, int if_index, uint32_t can_id,
+		    const uint8_t *data, int dlc, int64_t t)
+{
+	/* error frames are generated by the controller, not seen on the bus */
+	if (can_id & CAN_ERR_FLAG) {
+		return;
+	}
+	bus_stats *const bus = lookupBus(a, if_index, true);
+	if (bus == NULL) {
+		a->overflows++;
+		return;
+	}
+	const int bits = frameWireBits(can_id, data, dlc);
+	if (bus->frames == 0) {
+		bus->first = t;
+	}
+	bus->frames++;
+	bus->bits += bits;
+	const int64_t b = t / a->bucket_nanos;
+	advanceBuckets(bus, b);
+	if (b > bus->bucket - LOAD_BUCKETS) {
+		bus->bucket_bits[b % LOAD_BUCKETS] += bits;
+	}
+
+	const uint32_t id = (can_id & CAN_EFF_FLAG)
+		? can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_EFF_MASK)
+		: can_id & (CAN_RTR_FLAG | CAN_SFF_MASK);
+	id_stats *const ids = lookupId(a, static_cast<uint64_t>(
+		static_cast<uint32_t>(if_index)) << 32 | id);
+	if (ids == NULL) {
+		a->overflows++;
+		return;
+	}
+	if (ids->seen && t >= ids->last) {
+		const int64_t period = t - ids->last;
+		if (ids->periods == 0) {
+			ids->min_period = period;
+			ids->max_period = period;
+		} else {
+			ids->min_period = std::min(ids->min_period, period);
+			ids->max_period = std::max(ids->max_period, period);
+		}
+		ids->periods++;
+		const double delta = period - ids->mean;
+		ids->mean += delta / ids->periods;
+		ids->m2 += delta * (period - ids->mean);
+	}
+	ids->frames++;
+	ids->seen = true;
+	ids->last = t;
+	ids->bits = bits;
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_BusAnalyzer__1create
+(JNIEnv *env, jclass clazz, jint bitrate, jlong windowNanos, jint idCapacity)
+{
+	if (idCapacity < 1 || (idCapacity & (idCapacity - 1)) != 0) {
+		throwIllegalArgumentException(env, "capacity must be a power of two");
+		return 0;
+	}
+	if (bitrate <= 0 || windowNanos < LOAD_BUCKETS) {
+		throwIllegalArgumentException(env, "illegal bitrate or window");
+		return 0;
+	}
+	id_stats *const ids = new (std::nothrow) id_stats[idCapacity];
+	if (ids == NULL) {
+		throwOutOfMemoryError(env, "could not allocate id table");
+		return 0;
+	}
+	memset(ids, 0, sizeof(id_stats) * idCapacity);
+	const int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd == -1) {
+		delete[] ids;
+		throwIOExceptionErrno(env, errno);
+		return 0;
+	}
+	bus_analyzer *const a = new (std::nothrow) bus_analyzer();
+	if (a == NULL) {
+		close(wake_fd);
+		delete[] ids;
+		throwOutOfMemoryError(env, "could not allocate bus analyzer");
+		return 0;
+	}
+	a->bitrate = bitrate;
+	a->bucket_nanos = windowNanos / LOAD_BUCKETS;
+	a->overflows = 0;
+	a->buses_used = 0;
+	a->ids = ids;
+	a->id_mask = idCapacity - 1;
+	a->wake_fd = wake_fd;
+	return reinterpret_cast<jlong>(a);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_BusAnalyzer__1free
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	bus_analyzer *const a = reinterpret_cast<bus_analyzer *>(handle);
+	close(a->wake_fd);
+	delete[] a->ids;
+	delete a;
+}
+
+/* makes a receive waiting for frames, and all later ones, fail */
+JNIEXPORT void JNICALL Java_de_entropia_can_BusAnalyzer__1wake
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	const uint64_t one = 1;
+	const int wake_fd = reinterpret_cast<bus_analyzer *>(handle)->wake_fd;
+	if (write(wake_fd, &one, sizeof(one)) == -1) {
+		/* counter overflow, the analyzer is woken anyway */
+	}
+}
+
+JNIEXPORT jboolean JNICALL Java_de_entropia_can_BusAnalyzer__1setBitrate
+(JNIEnv *env, jclass clazz, jlong handle, jint ifIndex, jint bitrate)
+{
+	bus_analyzer *const a = reinterpret_cast<bus_analyzer *>(handle);
+	if (bitrate <= 0) {
+		throwIllegalArgumentException(env, "bitrate must be positive");
+		return JNI_FALSE;
+	}
+	std::lock_guard<std::mutex> guard(a->lock);
+	bus_stats *const bus = lookupBus(a, ifIndex, true);
+	if (bus == NULL) {
+		return JNI_FALSE;
+	}
+	bus->bitrate = bitrate;
+	return JNI_TRUE;
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_BusAnalyzer__1receive
+(JNIEnv *env, jclass clazz, jlong handle, jint fd, jlong stats)
+{
+	bus_analyzer *const a = reinterpret_cast<bus_analyzer *>(handle);
+	struct frame_burst burst;
+	const int n = recvBurstBlocking(env, fd,
+					reinterpret_cast<io_stats *>(stats),
+					a->wake_fd, burst);
+	if (n == -1) {
+		return -1;
+	}
+	const int64_t now = realtimeNanos();
+	std::lock_guard<std::mutex> guard(a->lock);
+	for (int i = 0; i < n; i++) {
+		const struct can_frame& frame = burst.frames[i];
+		const int64_t t = burstTimestamp(burst, i);
+		analyze(a, burst.addrs[i].can_ifindex, frame.can_id, frame.data,
+			frame.can_dlc, t != 0 ? t : now);
+	}
+	return n;
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_BusAnalyzer__1aggregate
+(JNIEnv *env, jclass clazz, jlong handle, jintArray ifIndices,
+ jintArray canIds, jbyteArray dlcs, jbyteArray data, jlongArray timestamps,
+ jint count)
+{
+	bus_analyzer *const a = reinterpret_cast<bus_analyzer *>(handle);
+	if (count < 0 || env->GetArrayLength(ifIndices) < count ||
+	    env->GetArrayLength(canIds) < count ||
+	    env->GetArrayLength(dlcs) < count ||
+	    env->GetArrayLength(timestamps) < count ||
+	    env->GetArrayLength(data) / CAN_MAX_DLEN < count) {
+		throwIllegalArgumentException(env, "batch columns too short");
+		return;
+	}
+	jint ifidx[RECV_BATCH_MAX];
+	jint ids[RECV_BATCH_MAX];
+	jbyte lens[RECV_BATCH_MAX];
+	jlong times[RECV_BATCH_MAX];
+	uint8_t payload[RECV_BATCH_MAX * CAN_MAX_DLEN];
+	for (jint done = 0; done < count; ) {
+		const jint chunk = std::min(count - done, RECV_BATCH_MAX);
+		env->GetIntArrayRegion(ifIndices, done, chunk, ifidx);
+		env->GetIntArrayRegion(canIds, done, chunk, ids);
+		env->GetByteArrayRegion(dlcs, done, chunk, lens);
+		env->GetLongArrayRegion(timestamps, done, chunk, times);
+		env->GetByteArrayRegion(data, done * CAN_MAX_DLEN,
+					chunk * CAN_MAX_DLEN,
+					reinterpret_cast<jbyte *>(payload));
+		if (env->ExceptionCheck() == JNI_TRUE) {
+			return;
+		}
+		/* a negative time would index before the load buckets */
+		for (jint i = 0; i < chunk; i++) {
+			if (times[i] < 0) {
+				throwIllegalArgumentException(env,
+					"negative timestamp");
+				return;
+			}
+		}
+		std::lock_guard<std::mutex> guard(a->lock);
+		for (jint i = 0; i < chunk; i++) {
+			analyze(a, ifidx[i], ids[i], payload + i * CAN_MAX_DLEN,
+				lens[i], times[i]);
+		}
+		done += chunk;
+	}
+}
+
+JNIEXPORT jboolean JNICALL Java_de_entropia_can_BusAnalyzer__1busStats
+(JNIEnv *env, jclass clazz, jlong handle, jint ifIndex, jlong nowNanos,
+ jlongArray out)
+{
+	bus_analyzer *const a = reinterpret_cast<bus_analyzer *>(handle);
+	const int64_t now = nowNanos != 0 ? nowNanos : realtimeNanos();
+	jlong stats[BUS_FIELDS];
+	{
+		std::lock_guard<std::mutex> guard(a->lock);
+		bus_stats *const bus = lookupBus(a, ifIndex, false);
+		if (bus == NULL) {
+			return JNI_FALSE;
+		}
+		int64_t window_bits = 0;
+		int64_t window_nanos = 0;
+		if (bus->bucket >= 0) {
+			advanceBuckets(bus, now / a->bucket_nanos);
+			for (int i = 0; i < LOAD_BUCKETS; i++) {
+				window_bits += bus->bucket_bits[i];
+			}
+			window_nanos = (LOAD_BUCKETS - 1) * a->bucket_nanos +
+				now - bus->bucket * a->bucket_nanos;
+			window_nanos = std::min(window_nanos, now - bus->first);
+		}
+		stats[BUS_IF_INDEX] = bus->if_index;
+		stats[BUS_BITRATE] = bus->bitrate;
+		stats[BUS_FRAMES] = bus->frames;
+		stats[BUS_BITS] = bus->bits;
+		stats[BUS_WINDOW_BITS] = window_bits;
+		stats[BUS_WINDOW_NANOS] = std::max<int64_t>(window_nanos, 0);
+	}
+	env->SetLongArrayRegion(out, 0, BUS_FIELDS, stats);
+	return JNI_TRUE;
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_BusAnalyzer__1snapshot
+(JNIEnv *env, jclass clazz, jlong handle, jintArray ifIndices,
+ jintArray canIds, jlongArray stats, jboolean reset)
+{
+	bus_analyzer *const a = reinterpret_cast<bus_analyzer *>(handle);
+	const jsize capacity = std::min(env->GetArrayLength(ifIndices),
+					env->GetArrayLength(canIds));
+	if (capacity <= static_cast<jsize>(a->id_mask) ||
+	    env->GetArrayLength(stats) / ID_FIELDS < capacity) {
+		throwIllegalArgumentException(env, "snapshot smaller than table");
+		return 0;
+	}
+	const size_t slots = a->id_mask + 1;
+	jint *const ifidx = new (std::nothrow) jint[slots];
+	jint *const ids = new (std::nothrow) jint[slots];
+	jlong *const rows = new (std::nothrow) jlong[slots * ID_FIELDS];
+	if (ifidx == NULL || ids == NULL || rows == NULL) {
+		delete[] ifidx;
+		delete[] ids;
+		delete[] rows;
+		throwOutOfMemoryError(env, "could not allocate snapshot buffers");
+		return 0;
+	}
+	jint n = 0;
+	{
+		std::lock_guard<std::mutex> guard(a->lock);
+		for (size_t pos = 0; pos < slots; pos++) {
+			id_stats *const s = &a->ids[pos];
+			if (!s->used) {
+				continue;
+			}
+			jlong *const row = rows + n * ID_FIELDS;
+			ifidx[n] = static_cast<jint>(s->key >> 32);
+			ids[n] = static_cast<jint>(s->key);
+			row[ID_FRAMES] = s->frames;
+			row[ID_BITS] = s->bits;
+			row[ID_LAST_NANOS] = s->last;
+			row[ID_MIN_PERIOD] = s->min_period;
+			row[ID_MAX_PERIOD] = s->max_period;
+			row[ID_MEAN_PERIOD] = std::llround(s->mean);
+			row[ID_JITTER] = s->periods > 1
+				? std::llround(std::sqrt(s->m2 / (s->periods - 1))) : 0;
+			n++;
+			if (reset == JNI_TRUE) {
+				/* keep the last timestamp for the next period */
+				s->frames = 0;
+				s->periods = 0;
+				s->min_period = 0;
+				s->max_period = 0;
+				s->mean = 0;
+				s->m2 = 0;
+			}
+		}
+	}
+	env->SetIntArrayRegion(ifIndices, 0, n, ifidx);
+	env->SetIntArrayRegion(canIds, 0, n, ids);
+	env->SetLongArrayRegion(stats, 0, n * ID_FIELDS, rows);
+	delete[] ifidx;
+	delete[] ids;
+	delete[] rows;
+	return n;
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_BusAnalyzer__1overflows
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	bus_analyzer *const a = reinterpret_cast<bus_analyzer *>(handle);
+	std::lock_guard<std::mutex> guard(a->lock);
+	return a->overflows;
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_BusAnalyzer__1frameBits
+(JNIEnv *env, jclass clazz, jint canId, jbyteArray data)
+{
+	uint8_t d[CAN_MAX_DLEN];
+	const jsize len = env->GetArrayLength(data);
+	if (len > CAN_MAX_DLEN) {
+		throwIllegalArgumentException(env, "payload too long");
+		return 0;
+	}
+	env->GetByteArrayRegion(data, 0, len, reinterpret_cast<jbyte *>(d));
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return 0;
+	}
+	return frameWireBits(canId, d, len);
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_BusAnalyzer__1worstCaseBits
+(JNIEnv *env, jclass clazz, jint flags, jint length, jintArray phases)
+{
+	int nominal, data;
+	worstCaseBits(flags, length, nominal, data);
+	const jint bits[2] = { nominal, data };
+	env->SetIntArrayRegion(phases, 0, 2, bits);
+	return nominal + data;
+}
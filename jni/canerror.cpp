@@ -0,0 +1,398 @@
+#include<algorithm>
+#include<mutex>
+#include<new>
+
+#include<cstring>
+#include<cstdint>
+#include<cerrno>
+#include<ctime>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/error.h>
+}
+
+#if defined(ANDROID) || defined(__ANDROID__)
+#include "jni.h"
+#else
+#include "de_entropia_can_CanErrorEvent.h"
+#include "de_entropia_can_ErrorMonitor.h"
+#endif
+
+#include "jniutil.h"
+#include "canio.h"
+#include "clocks.h"
+
+/* newer kernel additions missing from older headers */
+#ifndef CAN_ERR_CNT
+#define CAN_ERR_CNT 0x00000200U
+#endif
+#ifndef CAN_ERR_CRTL_ACTIVE
+#define CAN_ERR_CRTL_ACTIVE 0x40
+#endif
+
+/*
+ * The error classes are reported to Java as bit mask over the ordinals of
+ * CanErrorEvent.ErrorClass, which follows the bit order of the error class
+ * flags in can_id (CAN_ERR_TX_TIMEOUT .. CAN_ERR_CNT). Likewise the
+ * protocol violation bits of data[2] map one to one to
+ * CanErrorEvent.ProtocolViolation. Protocol locations and controller states
+ * are passed as ordinals of the respective Java enums.
+ */
+
+static const uint32_t ERROR_CLASS_MASK = (CAN_ERR_CNT << 1) - 1;
+static const int ERROR_CLASSES = 10;
+static const int PROTOCOL_VIOLATIONS = 8;
+
+/* CAN_ERR_PROT_LOC_* in the order of CanErrorEvent.ProtocolLocation */
+static const uint8_t PROTOCOL_LOCATIONS[] = {
+	CAN_ERR_PROT_LOC_UNSPEC,
+	CAN_ERR_PROT_LOC_SOF,
+	CAN_ERR_PROT_LOC_ID28_21,
+	CAN_ERR_PROT_LOC_ID20_18,
+	CAN_ERR_PROT_LOC_SRTR,
+	CAN_ERR_PROT_LOC_IDE,
+	CAN_ERR_PROT_LOC_ID17_13,
+	CAN_ERR_PROT_LOC_ID12_05,
+	CAN_ERR_PROT_LOC_ID04_00,
+	CAN_ERR_PROT_LOC_RTR,
+	CAN_ERR_PROT_LOC_RES1,
+	CAN_ERR_PROT_LOC_RES0,
+	CAN_ERR_PROT_LOC_DLC,
+	CAN_ERR_PROT_LOC_DATA,
+	CAN_ERR_PROT_LOC_CRC_SEQ,
+	CAN_ERR_PROT_LOC_CRC_DEL,
+	CAN_ERR_PROT_LOC_ACK,
+	CAN_ERR_PROT_LOC_ACK_DEL,
+	CAN_ERR_PROT_LOC_EOF,
+	CAN_ERR_PROT_LOC_INTERM
+};
+static const int PROTOCOL_LOCATION_COUNT =
+	sizeof(PROTOCOL_LOCATIONS) / sizeof(PROTOCOL_LOCATIONS[0]);
+
+/* CanErrorEvent.ControllerState */
+enum {
+	STATE_UNKNOWN,
+	STATE_ERROR_ACTIVE,
+	STATE_ERROR_WARNING,
+	STATE_ERROR_PASSIVE,
+	STATE_BUS_OFF
+};
+
+/* indices of the event array filled by CanErrorEvent._decode */
+enum {
+	EV_CLASSES,
+	EV_STATE,
+	EV_CONTROLLER_FLAGS,
+	EV_VIOLATIONS,
+	EV_LOCATION,
+	EV_TRANSCEIVER,
+	EV_LOST_ARBITRATION_BIT,
+	EV_TX_ERRORS,
+	EV_RX_ERRORS,
+	EV_FIELDS
+};
+
+/* indices of the summary array filled by ErrorMonitor._snapshot */
+enum {
+	SUM_ERROR_FRAMES,
+	SUM_OTHER_FRAMES,
+	SUM_STATE,
+	SUM_STATE_CHANGES,
+	SUM_TX_ERRORS,
+	SUM_RX_ERRORS,
+	SUM_MAX_TX_ERRORS,
+	SUM_MAX_RX_ERRORS,
+	SUM_BURSTS,
+	SUM_BURST_LENGTH,
+	SUM_MAX_BURST_LENGTH,
+	SUM_FIRST_NANOS,
+	SUM_LAST_NANOS,
+	SUM_CLASS_BASE,
+	SUM_VIOLATION_BASE = SUM_CLASS_BASE + ERROR_CLASSES,
+	SUM_LOCATION_BASE = SUM_VIOLATION_BASE + PROTOCOL_VIOLATIONS,
+	SUM_FIELDS = SUM_LOCATION_BASE + PROTOCOL_LOCATION_COUNT
+};
+
+struct error_event {
+	jint fields[EV_FIELDS];
+};
+
+struct error_monitor {
+	std::mutex lock;
+	int64_t burst_gap;
+	jlong sum[SUM_FIELDS];
+	/* written by _wake, ends a receive waiting for frames */
+	int wake_fd;
+};
+
+static int protocolLocation(uint8_t code)
+{
+	for (int i = 0; i < PROTOCOL_LOCATION_COUNT; i++) {
+		if (PROTOCOL_LOCATIONS[i] == code) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+static int stateFromCounters(int tx, int rx)
+{
+	const int worst = std::max(tx, rx);
+	if (worst >= 256) {
+		return STATE_BUS_OFF;
+	} else if (worst >= 128) {
+		return STATE_ERROR_PASSIVE;
+	} else if (worst >= 96) {
+		return STATE_ERROR_WARNING;
+	}
+	return STATE_ERROR_ACTIVE;
+}
+
+/* returns false if can_id does not denote an error frame */
+static bool decodeError(uint32_t can_id, const uint8_t *data, int len,
+			error_event& ev)
+{
+	if (!(can_id & CAN_ERR_FLAG)) {
+		return false;
+	}
+	uint8_t d[CAN_ERR_DLC];
+	memset(d, 0, sizeof(d));
+	memcpy(d, data, std::min(std::max(len, 0), CAN_ERR_DLC));
+	memset(&ev, 0, sizeof(ev));
+
+	const uint32_t classes = can_id & ERROR_CLASS_MASK;
+	ev.fields[EV_CLASSES] = classes;
+	if (classes & CAN_ERR_LOSTARB) {
+		ev.fields[EV_LOST_ARBITRATION_BIT] = d[0];
+	}
+	if (classes & CAN_ERR_CRTL) {
+		ev.fields[EV_CONTROLLER_FLAGS] = d[1];
+	}
+	if (classes & CAN_ERR_PROT) {
+		ev.fields[EV_VIOLATIONS] = d[2];
+		ev.fields[EV_LOCATION] = protocolLocation(d[3]);
+	}
+	if (classes & CAN_ERR_TRX) {
+		ev.fields[EV_TRANSCEIVER] = d[4];
+	}
+	/*
+	 * drivers fill the counters without always setting CAN_ERR_CNT, so
+	 * every error frame reports them, here and in the monitor summary
+	 */
+	ev.fields[EV_TX_ERRORS] = d[6];
+	ev.fields[EV_RX_ERRORS] = d[7];
+
+	int state = STATE_UNKNOWN;
+	if (classes & CAN_ERR_BUSOFF) {
+		state = STATE_BUS_OFF;
+	} else if (classes & CAN_ERR_CRTL) {
+		if (d[1] & (CAN_ERR_CRTL_RX_PASSIVE | CAN_ERR_CRTL_TX_PASSIVE)) {
+			state = STATE_ERROR_PASSIVE;
+		} else if (d[1] & (CAN_ERR_CRTL_RX_WARNING | CAN_ERR_CRTL_TX_WARNING)) {
+			state = STATE_ERROR_WARNING;
+		} else if (d[1] & CAN_ERR_CRTL_ACTIVE) {
+			state = STATE_ERROR_ACTIVE;
+		}
+	} else if (classes & CAN_ERR_RESTARTED) {
+		state = STATE_ERROR_ACTIVE;
+	}
+	if (state == STATE_UNKNOWN && (classes & CAN_ERR_CNT)) {
+		state = stateFromCounters(d[6], d[7]);
+	}
+	ev.fields[EV_STATE] = state;
+	return true;
+}
+
+/* caller holds mon->lock */
+static void aggregate(error_monitor *mon, uint32_t can_id,
+		      const uint8_t *data, int len, int64_t now)
+{
+	jlong *const sum = mon->sum;
+	error_event ev;
+	if (!decodeError(can_id, data, len, ev)) {
+		sum[SUM_OTHER_FRAMES]++;
+		return;
+	}
+	if (sum[SUM_ERROR_FRAMES] == 0) {
+		sum[SUM_FIRST_NANOS] = now;
+	}
+	sum[SUM_ERROR_FRAMES]++;
+	if (sum[SUM_BURST_LENGTH] == 0 ||
+	    now - sum[SUM_LAST_NANOS] > mon->burst_gap) {
+		sum[SUM_BURSTS]++;
+		sum[SUM_BURST_LENGTH] = 0;
+	}
+	sum[SUM_BURST_LENGTH]++;
+	sum[SUM_MAX_BURST_LENGTH] = std::max(sum[SUM_MAX_BURST_LENGTH],
+					     sum[SUM_BURST_LENGTH]);
+	sum[SUM_LAST_NANOS] = now;
+
+	for (int i = 0; i < ERROR_CLASSES; i++) {
+		if (ev.fields[EV_CLASSES] & (1 << i)) {
+			sum[SUM_CLASS_BASE + i]++;
+		}
+	}
+	for (int i = 0; i < PROTOCOL_VIOLATIONS; i++) {
+		if (ev.fields[EV_VIOLATIONS] & (1 << i)) {
+			sum[SUM_VIOLATION_BASE + i]++;
+		}
+	}
+	if (ev.fields[EV_CLASSES] & CAN_ERR_PROT) {
+		sum[SUM_LOCATION_BASE + ev.fields[EV_LOCATION]]++;
+	}
+	if (ev.fields[EV_STATE] != STATE_UNKNOWN &&
+	    ev.fields[EV_STATE] != sum[SUM_STATE]) {
+		sum[SUM_STATE] = ev.fields[EV_STATE];
+		sum[SUM_STATE_CHANGES]++;
+	}
+	sum[SUM_TX_ERRORS] = ev.fields[EV_TX_ERRORS];
+	sum[SUM_RX_ERRORS] = ev.fields[EV_RX_ERRORS];
+	sum[SUM_MAX_TX_ERRORS] = std::max<jlong>(sum[SUM_MAX_TX_ERRORS],
+						ev.fields[EV_TX_ERRORS]);
+	sum[SUM_MAX_RX_ERRORS] = std::max<jlong>(sum[SUM_MAX_RX_ERRORS],
+						ev.fields[EV_RX_ERRORS]);
+}
+
+JNIEXPORT jboolean JNICALL Java_de_entropia_can_CanErrorEvent__1decode
+(JNIEnv *env, jclass clazz, jint canId, jbyteArray data, jint offset,
+ jint length, jintArray fields)
+{
+	uint8_t d[CAN_ERR_DLC];
+	const jint len = std::min(length, CAN_ERR_DLC);
+	if (len < 0 || offset < 0 ||
+	    offset + len > env->GetArrayLength(data)) {
+		throwIllegalArgumentException(env, "illegal payload range");
+		return JNI_FALSE;
+	}
+	env->GetByteArrayRegion(data, offset, len, reinterpret_cast<jbyte *>(d));
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return JNI_FALSE;
+	}
+	error_event ev;
+	if (!decodeError(canId, d, len, ev)) {
+		return JNI_FALSE;
+	}
+	env->SetIntArrayRegion(fields, 0, EV_FIELDS, ev.fields);
+	return JNI_TRUE;
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_ErrorMonitor__1create
+(JNIEnv *env, jclass clazz, jlong burstGapNanos)
+{
+	const int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd == -1) {
+		throwIOExceptionErrno(env, errno);
+		return 0;
+	}
+	error_monitor *const mon = new (std::nothrow) error_monitor();
+	if (mon == NULL) {
+		close(wake_fd);
+		throwOutOfMemoryError(env, "could not allocate error monitor");
+		return 0;
+	}
+	mon->burst_gap = burstGapNanos;
+	memset(mon->sum, 0, sizeof(mon->sum));
+	mon->wake_fd = wake_fd;
+	return reinterpret_cast<jlong>(mon);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_ErrorMonitor__1free
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	error_monitor *const mon = reinterpret_cast<error_monitor *>(handle);
+	close(mon->wake_fd);
+	delete mon;
+}
+
+/* makes a receive waiting for frames, and all later ones, fail */
+JNIEXPORT void JNICALL Java_de_entropia_can_ErrorMonitor__1wake
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	const uint64_t one = 1;
+	const int wake_fd = reinterpret_cast<error_monitor *>(handle)->wake_fd;
+	if (write(wake_fd, &one, sizeof(one)) == -1) {
+		/* counter overflow, the monitor is woken anyway */
+	}
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_ErrorMonitor__1receive
+(JNIEnv *env, jclass clazz, jlong handle, jint fd, jlong stats)
+{
+	error_monitor *const mon = reinterpret_cast<error_monitor *>(handle);
+	struct frame_burst burst;
+	const int n = recvBurstBlocking(env, fd,
+					reinterpret_cast<io_stats *>(stats),
+					mon->wake_fd, burst);
+	if (n == -1) {
+		return -1;
+	}
+	const int64_t now = monotonicNanos();
+	std::lock_guard<std::mutex> guard(mon->lock);
+	for (int i = 0; i < n; i++) {
+		const struct can_frame& frame = burst.frames[i];
+		aggregate(mon, frame.can_id, frame.data, frame.can_dlc, now);
+	}
+	return n;
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_ErrorMonitor__1aggregate
+(JNIEnv *env, jclass clazz, jlong handle, jintArray canIds, jbyteArray dlcs,
+ jbyteArray data, jint count)
+{
+	error_monitor *const mon = reinterpret_cast<error_monitor *>(handle);
+	if (count < 0 || env->GetArrayLength(canIds) < count ||
+	    env->GetArrayLength(dlcs) < count ||
+	    env->GetArrayLength(data) / CAN_MAX_DLEN < count) {
+		throwIllegalArgumentException(env, "batch columns too short");
+		return;
+	}
+	const int64_t now = monotonicNanos();
+	jint ids[RECV_BATCH_MAX];
+	jbyte lens[RECV_BATCH_MAX];
+	uint8_t payload[RECV_BATCH_MAX * CAN_MAX_DLEN];
+	for (jint done = 0; done < count; ) {
+		const jint chunk = std::min(count - done, RECV_BATCH_MAX);
+		env->GetIntArrayRegion(canIds, done, chunk, ids);
+		env->GetByteArrayRegion(dlcs, done, chunk, lens);
+		env->GetByteArrayRegion(data, done * CAN_MAX_DLEN,
+					chunk * CAN_MAX_DLEN,
+					reinterpret_cast<jbyte *>(payload));
+		if (env->ExceptionCheck() == JNI_TRUE) {
+			return;
+		}
+		std::lock_guard<std::mutex> guard(mon->lock);
+		for (jint i = 0; i < chunk; i++) {
+			aggregate(mon, ids[i], payload + i * CAN_MAX_DLEN, lens[i],
+				  now);
+		}
+		done += chunk;
+	}
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_ErrorMonitor__1snapshot
+(JNIEnv *env, jclass clazz, jlong handle, jlongArray out, jboolean reset)
+{
+	error_monitor *const mon = reinterpret_cast<error_monitor *>(handle);
+	jlong copy[SUM_FIELDS];
+	{
+		std::lock_guard<std::mutex> guard(mon->lock);
+		memcpy(copy, mon->sum, sizeof(copy));
+		if (reset == JNI_TRUE) {
+			/* controller state and error counters are levels */
+			const jlong state = mon->sum[SUM_STATE];
+			const jlong tx = mon->sum[SUM_TX_ERRORS];
+			const jlong rx = mon->sum[SUM_RX_ERRORS];
+			memset(mon->sum, 0, sizeof(mon->sum));
+			mon->sum[SUM_STATE] = state;
+			mon->sum[SUM_TX_ERRORS] = tx;
+			mon->sum[SUM_RX_ERRORS] = rx;
+		}
+	}
+	env->SetLongArrayRegion(out, 0, SUM_FIELDS, copy);
+}
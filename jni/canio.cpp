@@ -0,0 +1,136 @@
+#include<algorithm>
+
+#include<cstring>
+#include<cerrno>
+
+extern "C" {
+#include <poll.h>
+}
+
+#include "canio.h"
+#include "jniutil.h"
+
+int recvBurst(int fd, struct frame_burst& burst, int max, int flags)
+{
+	if (max > RECV_BATCH_MAX) {
+		max = RECV_BATCH_MAX;
+	}
+	memset(burst.msgs, 0, sizeof(burst.msgs[0]) * max);
+	for (int i = 0; i < max; i++) {
+		burst.iovs[i].iov_base = &burst.frames[i];
+		burst.iovs[i].iov_len = sizeof(burst.frames[i]);
+		burst.msgs[i].msg_hdr.msg_name = &burst.addrs[i];
+		burst.msgs[i].msg_hdr.msg_namelen = sizeof(burst.addrs[i]);
+		burst.msgs[i].msg_hdr.msg_iov = &burst.iovs[i];
+		burst.msgs[i].msg_hdr.msg_iovlen = 1;
+		burst.msgs[i].msg_hdr.msg_control = burst.ctrl[i];
+		burst.msgs[i].msg_hdr.msg_controllen = sizeof(burst.ctrl[i]);
+	}
+	return recvmmsg(fd, burst.msgs, max, flags, NULL);
+}
+
+bool checkBurst(JNIEnv *env, const struct frame_burst& burst, int n)
+{
+	for (int i = 0; i < n; i++) {
+		if (burst.msgs[i].msg_hdr.msg_namelen != sizeof(burst.addrs[i])) {
+			throwIllegalArgumentException(env, "illegal AF_CAN address");
+			return false;
+		}
+		if (burst.msgs[i].msg_len != sizeof(burst.frames[i])) {
+			throwIOExceptionMsg(env, "invalid length of received frame");
+			return false;
+		}
+	}
+	return true;
+}
+
+int recvBurstBlocking(JNIEnv *env, int fd, io_stats *stats, int wake_fd,
+		      struct frame_burst& burst)
+{
+	io_shard& shard = ioShard(stats);
+	io_timer timer(shard, IO_RECV_NANOS);
+	int n;
+	/* wait in poll rather than in recvmmsg, so close can wake us */
+	for (;;) {
+		n = recvBurst(fd, burst, RECV_BATCH_MAX, MSG_DONTWAIT);
+		ioAdd(shard, IO_RECV_CALLS, 1);
+		if (n != -1 || (errno != EAGAIN && errno != EWOULDBLOCK &&
+				errno != EINTR)) {
+			break;
+		}
+		if (errno != EINTR &&
+		    !awaitReadable(env, fd, stats, wake_fd)) {
+			return -1;
+		}
+	}
+	if (n == -1) {
+		const int err = errno;
+		ioAdd(shard, IO_EXCEPTIONS, 1);
+		throwIOExceptionErrno(env, err);
+		return -1;
+	}
+	if (!checkBurst(env, burst, n)) {
+		ioAdd(shard, IO_EXCEPTIONS, 1);
+		return -1;
+	}
+	uint64_t bytes = 0;
+	for (int i = 0; i < n; i++) {
+		bytes += std::min(burst.frames[i].can_dlc,
+				  static_cast<__u8>(CAN_MAX_DLEN));
+	}
+	ioAdd(shard, IO_FRAMES_IN, n);
+	ioAdd(shard, IO_BYTES_IN, bytes);
+	return n;
+}
+
+int64_t msgTimestamp(const struct msghdr& msg)
+{
+	struct msghdr *const hdr = const_cast<struct msghdr *>(&msg);
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			return static_cast<int64_t>(ts.tv_sec) * 1000000000 +
+				ts.tv_nsec;
+		}
+	}
+	return 0;
+}
+
+bool awaitReadable(JNIEnv *env, int fd, const io_stats *stats)
+{
+	return awaitReadable(env, fd, stats, -1);
+}
+
+bool awaitReadable(JNIEnv *env, int fd, const io_stats *stats, int wake_fd)
+{
+	struct pollfd pfd[3];
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	/* poll skips negative descriptors */
+	pfd[1].fd = stats != NULL ? stats->wake_fd : -1;
+	pfd[1].events = POLLIN;
+	pfd[2].fd = wake_fd;
+	pfd[2].events = POLLIN;
+	for (;;) {
+		pfd[0].revents = 0;
+		pfd[1].revents = 0;
+		pfd[2].revents = 0;
+		if (poll(pfd, 3, -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throwIOExceptionErrno(env, errno);
+			return false;
+		}
+		if (pfd[1].revents != 0 || pfd[2].revents != 0) {
+			/* the eventfds are never drained, this holds from now on */
+			throwAsynchronousCloseException(env);
+			return false;
+		}
+		/* errors on fd are reported by the receive that follows */
+		return true;
+	}
+}
@@ -0,0 +1,78 @@
+#ifndef CANIO_H
+#define CANIO_H
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include <linux/can.h>
+}
+
+#include<cstdint>
+
+#include "jni.h"
+#include "iostats.h"
+
+/* frames fetched per recvmmsg call */
+static const int RECV_BATCH_MAX = 64;
+
+struct frame_burst {
+	struct can_frame frames[RECV_BATCH_MAX];
+	struct sockaddr_can addrs[RECV_BATCH_MAX];
+	struct iovec iovs[RECV_BATCH_MAX];
+	struct mmsghdr msgs[RECV_BATCH_MAX];
+	/* room for one SO_TIMESTAMPNS control message per frame */
+	char ctrl[RECV_BATCH_MAX][CMSG_SPACE(sizeof(struct timespec))];
+};
+
+/*
+ * Receives up to max (at most RECV_BATCH_MAX) frames with one recvmmsg
+ * call. Returns the number of frames or -1 with errno set.
+ */
+int recvBurst(int fd, struct frame_burst& burst, int max, int flags);
+
+/*
+ * Blocks for a burst of up to RECV_BATCH_MAX frames, for native consumers
+ * of a CanSocket, and counts it in the socket's stats. Closing the socket
+ * wakes the wait through the wake_fd of stats, closing the consumer
+ * through its own wake_fd, -1 if it has none. Returns the number of
+ * frames, or -1 with an exception pending if the receive failed, either
+ * was closed or a frame was malformed.
+ */
+int recvBurstBlocking(JNIEnv *env, int fd, io_stats *stats, int wake_fd,
+		      struct frame_burst& burst);
+
+/*
+ * Validates address and frame length of the first n entries of a burst,
+ * throws and returns false on malformed ones.
+ */
+bool checkBurst(JNIEnv *env, const struct frame_burst& burst, int n);
+
+/*
+ * Kernel receive time of a message in CLOCK_REALTIME nanoseconds, 0 unless
+ * SO_TIMESTAMPNS is enabled on the socket.
+ */
+int64_t msgTimestamp(const struct msghdr& hdr);
+
+/* msgTimestamp of frame i */
+static inline int64_t burstTimestamp(const struct frame_burst& burst, int i)
+{
+	return msgTimestamp(burst.msgs[i].msg_hdr);
+}
+
+/*
+ * Blocks until fd is readable, for receives that found nothing queued
+ * with MSG_DONTWAIT. Returns false with an exception pending if the
+ * socket of stats was closed meanwhile or polling failed. Without stats
+ * only fd is waited for.
+ */
+bool awaitReadable(JNIEnv *env, int fd, const io_stats *stats);
+
+/*
+ * awaitReadable that also ends with AsynchronousCloseException once
+ * wake_fd, the eventfd of the native consumer reading fd, is signalled.
+ */
+bool awaitReadable(JNIEnv *env, int fd, const io_stats *stats, int wake_fd);
+
+#endif
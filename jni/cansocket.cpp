@@ -1,16 +1,20 @@
 #include<string>
 #include<algorithm>
 #include<utility>
+#include<vector>
 
 #include<cstring>
 #include<cstddef>
 #include<cerrno>
+#include<ctime>
 
 extern "C" {
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
+#include <sched.h>
 
 #include <net/if.h>
 #include <linux/can.h>
@@ -23,53 +27,11 @@ extern "C" {
 #include "de_entropia_can_CanSocket.h"
 #endif
 
-static const int ERRNO_BUFFER_LEN = 1024;
-
-static void throwException(JNIEnv *env, const std::string& exception_name,
-			   const std::string& msg)
-{
-	const jclass exception = env->FindClass(exception_name.c_str());
-	if (exception == NULL) {
-		return;
-	}
-	env->ThrowNew(exception, msg.c_str());
-}
-
-static void throwIOExceptionMsg(JNIEnv *env, const std::string& msg)
-{
-	throwException(env, "java/io/IOException", msg);
-}
-
-static void throwIOExceptionErrno(JNIEnv *env, const int exc_errno)
-{
-	char message[ERRNO_BUFFER_LEN];
-	const char *const msg = (char *) strerror_r(exc_errno, message, ERRNO_BUFFER_LEN);
-	if (((long)msg) == 0) {
-		// POSIX strerror_r, success
-		throwIOExceptionMsg(env, std::string(message));
-	} else if (((long)msg) == -1) {
-		// POSIX strerror_r, failure
-		// (Strictly, POSIX only guarantees a value other than 0. The safest
-		// way to implement this function is to use C++ and overload on the
-		// type of strerror_r to accurately distinguish GNU from POSIX. But
-		// realistic implementations will always return -1.)
-		snprintf(message, ERRNO_BUFFER_LEN, "errno %d", exc_errno);
-		throwIOExceptionMsg(env, std::string(message));
-	} else {
-		// glibc strerror_r returning a string
-		throwIOExceptionMsg(env, std::string(msg));
-	}
-}
-
-static void throwIllegalArgumentException(JNIEnv *env, const std::string& message)
-{
-	throwException(env, "java/lang/IllegalArgumentException", message);
-}
-
-static void throwOutOfMemoryError(JNIEnv *env, const std::string& message)
-{
-    	throwException(env, "java/lang/OutOfMemoryError", message);
-}
+#include "jniutil.h"
+#include "canio.h"
+#include "iostats.h"
+#include "txshaper.h"
+#include "clocks.h"
 
 static jint newCanSocket(JNIEnv *env, int socket_type, int protocol)
 {
@@ -94,6 +56,12 @@ JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1openSocketBCM
 	return newCanSocket(env, SOCK_DGRAM, CAN_BCM);
 }
 
+JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1openSocketJ1939
+(JNIEnv *env, jclass obj)
+{
+	return newCanSocket(env, SOCK_DGRAM, CAN_J1939);
+}
+
 JNIEXPORT void JNICALL Java_de_entropia_can_CanSocket__1close
 (JNIEnv *env, jclass obj, jint fd)
 {
@@ -155,10 +123,26 @@ JNIEXPORT void JNICALL Java_de_entropia_can_CanSocket__1bindToSocket
 	}
 }
 
-JNIEXPORT void JNICALL Java_de_entropia_can_CanSocket__1sendFrame
-(JNIEnv *env, jclass obj, jint fd, jint if_idx, jint canid, jbyteArray data)
+/*
+ * Send errors that only mean the socket or the device queue is congested
+ * right now. The try* entry points return them as negative status instead
+ * of paying for an exception on every retry.
+ */
+static bool isTransient(const int err)
+{
+	return err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS ||
+		err == EINTR;
+}
+
+/*
+ * Sends one frame built from the Java arguments. Returns 0 on success or
+ * if the shaper dropped the frame, an errno value if sendto failed or the
+ * shaper refused the frame (EAGAIN), or -1 with a pending Java exception.
+ */
+static int sendOneFrame(JNIEnv *env, io_shard& shard, tx_shaper *shaper,
+			jint fd, jint if_idx, jint canid, jbyteArray data,
+			const int flags)
 {
-	const int flags = 0;
 	ssize_t nbytes;
 	struct sockaddr_can addr;
 	struct can_frame frame;
@@ -168,48 +152,202 @@ JNIEXPORT void JNICALL Java_de_entropia_can_CanSocket__1sendFrame
 	addr.can_ifindex = if_idx;
 	const jsize len = env->GetArrayLength(data);
 	if (env->ExceptionCheck() == JNI_TRUE) {
-		return;
+		return -1;
 	}
 	frame.can_id = canid;
 	frame.can_dlc = static_cast<__u8>(len);
 	env->GetByteArrayRegion(data, 0, len, reinterpret_cast<jbyte *>(&frame.data));
 	if (env->ExceptionCheck() == JNI_TRUE) {
-		return;
+		return -1;
+	}
+	if (shaper != NULL) {
+		switch (shapeFrame(shaper, if_idx, frame,
+				   (flags & MSG_DONTWAIT) == 0)) {
+		case SHAPE_PASS:
+			break;
+		case SHAPE_DROP:
+			return 0;
+		case SHAPE_REJECT:
+			ioAdd(shard, IO_WOULD_BLOCK, 1);
+			return EAGAIN;
+		}
 	}
 	nbytes = sendto(fd, &frame, sizeof(frame), flags,
 			reinterpret_cast<struct sockaddr *>(&addr),
 			sizeof(addr));
+	ioAdd(shard, IO_SEND_CALLS, 1);
 	if (nbytes == -1) {
-		throwIOExceptionErrno(env, errno);
+		const int err = errno;
+		countSendError(shard, err);
+		return err;
 	} else if (nbytes != sizeof(frame)) {
+		ioAdd(shard, IO_EXCEPTIONS, 1);
 		throwIOExceptionMsg(env, "send partial frame");
+		return -1;
 	}
+	ioAdd(shard, IO_FRAMES_OUT, 1);
+	ioAdd(shard, IO_BYTES_OUT, frame.can_dlc);
+	return 0;
 }
 
-JNIEXPORT jobject JNICALL Java_de_entropia_can_CanSocket__1recvFrame
-(JNIEnv *env, jclass obj, jint fd)
+JNIEXPORT void JNICALL Java_de_entropia_can_CanSocket__1sendFrame
+(JNIEnv *env, jclass obj, jint fd, jlong stats, jint if_idx, jint canid,
+ jbyteArray data)
 {
-	const int flags = 0;
-	ssize_t nbytes;
-	struct sockaddr_can addr;
-	socklen_t len = sizeof(addr);
-	struct can_frame frame;
+	io_stats *const io = reinterpret_cast<io_stats *>(stats);
+	io_shard& shard = ioShard(io);
+	io_timer timer(shard, IO_SEND_NANOS);
+	const shaper_ref ref(io);
+	const int err = sendOneFrame(env, shard, ref.shaper, fd, if_idx,
+				     canid, data, 0);
+	if (err > 0) {
+		ioAdd(shard, IO_EXCEPTIONS, 1);
+		throwIOExceptionErrno(env, err);
+	}
+}
 
-	memset(&addr, 0, sizeof(addr));
-	memset(&frame, 0, sizeof(frame));
-	nbytes = recvfrom(fd, &frame, sizeof(frame), flags,
-			  reinterpret_cast<struct sockaddr *>(&addr), &len);
-	if (len != sizeof(addr)) {
-		throwIllegalArgumentException(env, "illegal AF_CAN address");
-		return NULL;
+JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1trySendFrame
+(JNIEnv *env, jclass obj, jint fd, jlong stats, jint if_idx, jint canid,
+ jbyteArray data)
+{
+	io_stats *const io = reinterpret_cast<io_stats *>(stats);
+	io_shard& shard = ioShard(io);
+	io_timer timer(shard, IO_SEND_NANOS);
+	const shaper_ref ref(io);
+	const int err = sendOneFrame(env, shard, ref.shaper, fd, if_idx,
+				     canid, data, MSG_DONTWAIT);
+	if (err == 0) {
+		return 1;
+	} else if (err == -1) {
+		return 0;
+	} else if (isTransient(err)) {
+		return err == EWOULDBLOCK ? -EAGAIN : -err;
 	}
-	if (nbytes == -1) {
-		throwIOExceptionErrno(env, errno);
-		return NULL;
-	} else if (nbytes != sizeof(frame)) {
-		throwIOExceptionMsg(env, "invalid length of received frame");
-		return NULL;
+	ioAdd(shard, IO_EXCEPTIONS, 1);
+	throwIOExceptionErrno(env, err);
+	return 0;
+}
+
+/* frames handed to one sendmmsg call */
+static const int SEND_BATCH_MAX = 64;
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1trySendFrames
+(JNIEnv *env, jclass obj, jint fd, jlong stats, jintArray ifIndices,
+ jintArray canIds, jbyteArray dlcs, jbyteArray data, jint from, jint to)
+{
+	io_stats *const io = reinterpret_cast<io_stats *>(stats);
+	io_shard& shard = ioShard(io);
+	io_timer timer(shard, IO_SEND_NANOS);
+	const shaper_ref ref(io);
+	tx_shaper *const shaper = ref.shaper;
+	struct can_frame frames[SEND_BATCH_MAX];
+	struct sockaddr_can addrs[SEND_BATCH_MAX];
+	struct iovec iovs[SEND_BATCH_MAX];
+	struct mmsghdr msgs[SEND_BATCH_MAX];
+	/* chunk offset of every message, shaping may drop frames in between */
+	int slots[SEND_BATCH_MAX + 1];
+	jint ifidx_buf[SEND_BATCH_MAX];
+	jint canid_buf[SEND_BATCH_MAX];
+	jbyte dlc_buf[SEND_BATCH_MAX];
+
+	const jsize capacity = env->GetArrayLength(canIds);
+	if (from < 0 || to < from || to > capacity ||
+	    env->GetArrayLength(ifIndices) < capacity ||
+	    env->GetArrayLength(dlcs) < capacity ||
+	    env->GetArrayLength(data) / CAN_MAX_DLEN < capacity) {
+		throwIllegalArgumentException(env, "illegal batch range");
+		return 0;
+	}
+	jint sent = 0;
+	while (from + sent < to) {
+		const int first = from + sent;
+		const int chunk = std::min(to - first, SEND_BATCH_MAX);
+		env->GetIntArrayRegion(ifIndices, first, chunk, ifidx_buf);
+		env->GetIntArrayRegion(canIds, first, chunk, canid_buf);
+		env->GetByteArrayRegion(dlcs, first, chunk, dlc_buf);
+		uint64_t bytes = 0;
+		int count = 0;
+		int taken = chunk;
+		for (int i = 0; i < chunk; i++) {
+			struct can_frame& frame = frames[count];
+			const int dlc = dlc_buf[i];
+			if (dlc < 0 || dlc > CAN_MAX_DLEN) {
+				throwIllegalArgumentException(env, "illegal dlc");
+				return 0;
+			}
+			memset(&frame, 0, sizeof(frame));
+			frame.can_id = canid_buf[i];
+			frame.can_dlc = static_cast<__u8>(dlc);
+			env->GetByteArrayRegion(data, (first + i) * CAN_MAX_DLEN,
+						CAN_MAX_DLEN,
+						reinterpret_cast<jbyte *>(frame.data));
+			if (shaper != NULL) {
+				const shape_verdict verdict =
+					shapeFrame(shaper, ifidx_buf[i], frame, false);
+				if (verdict == SHAPE_DROP) {
+					continue;
+				} else if (verdict == SHAPE_REJECT) {
+					ioAdd(shard, IO_WOULD_BLOCK, 1);
+					taken = i;
+					break;
+				}
+			}
+			bytes += dlc;
+			memset(&addrs[count], 0, sizeof(addrs[count]));
+			addrs[count].can_family = AF_CAN;
+			addrs[count].can_ifindex = ifidx_buf[i];
+			iovs[count].iov_base = &frame;
+			iovs[count].iov_len = sizeof(frame);
+			memset(&msgs[count], 0, sizeof(msgs[count]));
+			msgs[count].msg_hdr.msg_name = &addrs[count];
+			msgs[count].msg_hdr.msg_namelen = sizeof(addrs[count]);
+			msgs[count].msg_hdr.msg_iov = &iovs[count];
+			msgs[count].msg_hdr.msg_iovlen = 1;
+			slots[count++] = i;
+		}
+		slots[count] = taken;
+		if (env->ExceptionCheck() == JNI_TRUE) {
+			return 0;
+		}
+		int n = 0;
+		if (count > 0) {
+			n = sendmmsg(fd, msgs, count, MSG_DONTWAIT);
+			ioAdd(shard, IO_SEND_CALLS, 1);
+			if (n == -1) {
+				const int err = errno;
+				countSendError(shard, err);
+				/* dropped frames ahead of the first message are done */
+				sent += slots[0];
+				if (sent > 0) {
+					break;
+				} else if (isTransient(err)) {
+					return err == EWOULDBLOCK ? -EAGAIN : -err;
+				}
+				ioAdd(shard, IO_EXCEPTIONS, 1);
+				throwIOExceptionErrno(env, err);
+				return 0;
+			}
+			if (n < count) {
+				bytes = 0;
+				for (int i = 0; i < n; i++) {
+					bytes += frames[i].can_dlc;
+				}
+			}
+			ioAdd(shard, IO_FRAMES_OUT, n);
+			ioAdd(shard, IO_BYTES_OUT, bytes);
+		}
+		sent += slots[n];
+		if (n < count || taken < chunk) {
+			break;
+		}
 	}
+	/* only a shaper refusing the very first frame gets here empty */
+	return sent == 0 && from < to ? -EAGAIN : sent;
+}
+
+static jobject newCanFrame(JNIEnv *env, const struct sockaddr_can& addr,
+			   const struct can_frame& frame, const ssize_t nbytes)
+{
 	const jsize fsize = static_cast<jsize>(std::min(static_cast<size_t>(frame.can_dlc),
 							static_cast<size_t>(nbytes - offsetof(struct can_frame, data))));
 	const jclass can_frame_clazz = env->FindClass("de/entropia/can/"
@@ -229,7 +367,7 @@ JNIEXPORT jobject JNICALL Java_de_entropia_can_CanSocket__1recvFrame
 		}
 		return NULL;
 	}
-	env->SetByteArrayRegion(data, 0, fsize, reinterpret_cast<jbyte *>(&frame.data));
+	env->SetByteArrayRegion(data, 0, fsize, reinterpret_cast<const jbyte *>(&frame.data));
 	if (env->ExceptionCheck() == JNI_TRUE) {
 		return NULL;
 	}
@@ -239,6 +377,551 @@ JNIEXPORT jobject JNICALL Java_de_entropia_can_CanSocket__1recvFrame
 	return ret;
 }
 
+JNIEXPORT jobject JNICALL Java_de_entropia_can_CanSocket__1recvFrame
+(JNIEnv *env, jclass obj, jint fd, jlong stats)
+{
+	io_stats *const io = reinterpret_cast<io_stats *>(stats);
+	io_shard& shard = ioShard(io);
+	io_timer timer(shard, IO_RECV_NANOS);
+	ssize_t nbytes;
+	struct sockaddr_can addr;
+	socklen_t len;
+	struct can_frame frame;
+
+	memset(&addr, 0, sizeof(addr));
+	memset(&frame, 0, sizeof(frame));
+	/* wait in poll rather than in recvfrom, so close can wake us */
+	for (;;) {
+		len = sizeof(addr);
+		nbytes = recvfrom(fd, &frame, sizeof(frame), MSG_DONTWAIT,
+				  reinterpret_cast<struct sockaddr *>(&addr), &len);
+		ioAdd(shard, IO_RECV_CALLS, 1);
+		if (nbytes != -1 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			break;
+		}
+		if (!awaitReadable(env, fd, io)) {
+			return NULL;
+		}
+	}
+	if (len != sizeof(addr)) {
+		ioAdd(shard, IO_EXCEPTIONS, 1);
+		throwIllegalArgumentException(env, "illegal AF_CAN address");
+		return NULL;
+	}
+	if (nbytes == -1) {
+		ioAdd(shard, IO_EXCEPTIONS, 1);
+		throwIOExceptionErrno(env, errno);
+		return NULL;
+	} else if (nbytes != sizeof(frame)) {
+		ioAdd(shard, IO_EXCEPTIONS, 1);
+		throwIOExceptionMsg(env, "invalid length of received frame");
+		return NULL;
+	}
+	ioAdd(shard, IO_FRAMES_IN, 1);
+	ioAdd(shard, IO_BYTES_IN, frame.can_dlc);
+	return newCanFrame(env, addr, frame, nbytes);
+}
+
+JNIEXPORT jobject JNICALL Java_de_entropia_can_CanSocket__1recvFrameSpin
+(JNIEnv *env, jclass obj, jint fd, jlong stats, jlong spinNanos)
+{
+	io_stats *const io = reinterpret_cast<io_stats *>(stats);
+	io_shard& shard = ioShard(io);
+	io_timer timer(shard, IO_RECV_NANOS);
+	ssize_t nbytes;
+	struct sockaddr_can addr;
+	socklen_t len;
+	struct can_frame frame;
+
+	const int64_t deadline = spinNanos > 0
+		? monotonicNanos() + spinNanos : 0;
+	for (;;) {
+		len = sizeof(addr);
+		nbytes = recvfrom(fd, &frame, sizeof(frame), MSG_DONTWAIT,
+				  reinterpret_cast<struct sockaddr *>(&addr), &len);
+		ioAdd(shard, IO_RECV_CALLS, 1);
+		if (nbytes != -1) {
+			break;
+		}
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			ioAdd(shard, IO_EXCEPTIONS, 1);
+			throwIOExceptionErrno(env, errno);
+			return NULL;
+		}
+		if (errno != EINTR) {
+			ioAdd(shard, IO_WOULD_BLOCK, 1);
+		}
+		/* never sleeps in poll, so it has to notice close itself */
+		if (io != NULL && io->closed.load(std::memory_order_acquire)) {
+			throwAsynchronousCloseException(env);
+			return NULL;
+		}
+		if (deadline == 0 || monotonicNanos() >= deadline) {
+			return NULL;
+		}
+	}
+	if (len != sizeof(addr)) {
+		ioAdd(shard, IO_EXCEPTIONS, 1);
+		throwIllegalArgumentException(env, "illegal AF_CAN address");
+		return NULL;
+	}
+	if (nbytes != sizeof(frame)) {
+		ioAdd(shard, IO_EXCEPTIONS, 1);
+		throwIOExceptionMsg(env, "invalid length of received frame");
+		return NULL;
+	}
+	ioAdd(shard, IO_FRAMES_IN, 1);
+	ioAdd(shard, IO_BYTES_IN, frame.can_dlc);
+	return newCanFrame(env, addr, frame, nbytes);
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_CanSocket__1createStats
+(JNIEnv *env, jclass obj)
+{
+	const int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd == -1) {
+		throwIOExceptionErrno(env, errno);
+		return 0;
+	}
+	io_stats *const stats = newIoStats();
+	if (stats == NULL) {
+		close(wake_fd);
+		throwOutOfMemoryError(env, "could not allocate socket stats");
+		return 0;
+	}
+	stats->wake_fd = wake_fd;
+	return reinterpret_cast<jlong>(stats);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_CanSocket__1freeStats
+(JNIEnv *env, jclass obj, jlong stats)
+{
+	io_stats *const io = reinterpret_cast<io_stats *>(stats);
+	swapShaper(io, NULL);
+	close(io->wake_fd);
+	io->wake_fd = -1;
+	freeIoStats(io);
+}
+
+/*
+ * Makes receives blocked on the socket, and all later ones, fail with
+ * AsynchronousCloseException.
+ */
+JNIEXPORT void JNICALL Java_de_entropia_can_CanSocket__1wakeReaders
+(JNIEnv *env, jclass obj, jlong stats)
+{
+	const uint64_t one = 1;
+	io_stats *const io = reinterpret_cast<io_stats *>(stats);
+	io->closed.store(true, std::memory_order_release);
+	if (write(io->wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+		throwIOExceptionErrno(env, errno);
+	}
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_CanSocket__1setShaper
+(JNIEnv *env, jclass obj, jlong stats, jlong shaper)
+{
+	swapShaper(reinterpret_cast<io_stats *>(stats),
+		   reinterpret_cast<tx_shaper *>(shaper));
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_CanSocket__1readStats
+(JNIEnv *env, jclass obj, jlong stats, jlongArray out)
+{
+	int64_t v[IO_FIELDS];
+	readIoStats(reinterpret_cast<io_stats *>(stats), v);
+	jlong copy[IO_FIELDS];
+	std::copy(v, v + IO_FIELDS, copy);
+	env->SetLongArrayRegion(out, 0, IO_FIELDS, copy);
+}
+
+JNIEXPORT jboolean JNICALL Java_de_entropia_can_CanSocket__1setBusyPoll
+(JNIEnv *env, jclass obj, jint fd, jint usecs)
+{
+#ifdef SO_BUSY_POLL
+	const int _usecs = usecs;
+	if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &_usecs,
+		       sizeof(_usecs)) == 0) {
+		return JNI_TRUE;
+	}
+	if (errno != ENOPROTOOPT && errno != EPERM) {
+		throwIOExceptionErrno(env, errno);
+	}
+#endif
+	return JNI_FALSE;
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_CanSocket__1setKernelTimestamps
+(JNIEnv *env, jclass obj, jint fd, jboolean on)
+{
+	const int _on = on == JNI_TRUE ? 1 : 0;
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &_on, sizeof(_on)) != 0) {
+		throwIOExceptionErrno(env, errno);
+	}
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_CanSocket__1setFilters
+(JNIEnv *env, jclass obj, jint fd, jintArray canIds, jintArray masks)
+{
+	const jsize n = env->GetArrayLength(canIds);
+	if (env->GetArrayLength(masks) != n) {
+		throwIllegalArgumentException(env, "ids and masks differ in length");
+		return;
+	}
+	std::vector<jint> ids(n);
+	std::vector<jint> ms(n);
+	env->GetIntArrayRegion(canIds, 0, n, ids.data());
+	env->GetIntArrayRegion(masks, 0, n, ms.data());
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return;
+	}
+	std::vector<struct can_filter> filters(n);
+	for (jsize i = 0; i < n; i++) {
+		filters[i].can_id = ids[i];
+		filters[i].can_mask = ms[i];
+	}
+	if (setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters.data(),
+		       n * sizeof(struct can_filter)) != 0) {
+		throwIOExceptionErrno(env, errno);
+	}
+}
+
+JNIEXPORT jboolean JNICALL Java_de_entropia_can_CanSocket__1getKernelTimestamps
+(JNIEnv *env, jclass obj, jint fd)
+{
+	int on = 0;
+	socklen_t len = sizeof(on);
+	if (getsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, &len) != 0) {
+		throwIOExceptionErrno(env, errno);
+		return JNI_FALSE;
+	}
+	return on != 0 ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_CanSocket__1setCurrentThreadAffinity
+(JNIEnv *env, jclass obj, jintArray cpus)
+{
+	const jsize ncpus = env->GetArrayLength(cpus);
+	std::vector<jint> ids(ncpus);
+	env->GetIntArrayRegion(cpus, 0, ncpus, ids.data());
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (jsize i = 0; i < ncpus; i++) {
+		if (ids[i] < 0 || ids[i] >= CPU_SETSIZE) {
+			throwIllegalArgumentException(env, "illegal cpu number");
+			return;
+		}
+		CPU_SET(ids[i], &set);
+	}
+	if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+		throwIOExceptionErrno(env, errno);
+	}
+}
+
+/*
+ * Fills the batch columns with one burst. With wait set, blocks for the
+ * first frame; otherwise returns the negative errno if none is queued
+ * and the error is transient.
+ */
+static jint recvFrames(JNIEnv *env, jint fd, jlong stats, jintArray ifIndices,
+		       jintArray canIds, jbyteArray dlcs, jbyteArray data,
+		       const bool wait)
+{
+	io_stats *const io = reinterpret_cast<io_stats *>(stats);
+	io_shard& shard = ioShard(io);
+	io_timer timer(shard, IO_RECV_NANOS);
+	struct frame_burst burst;
+	jint ifidx_buf[RECV_BATCH_MAX];
+	jint canid_buf[RECV_BATCH_MAX];
+	jbyte dlc_buf[RECV_BATCH_MAX];
+
+	const jsize capacity = env->GetArrayLength(canIds);
+	if (env->GetArrayLength(ifIndices) < capacity ||
+	    env->GetArrayLength(dlcs) < capacity ||
+	    env->GetArrayLength(data) / CAN_MAX_DLEN < capacity) {
+		throwIllegalArgumentException(env, "batch columns too short");
+		return -1;
+	}
+	jsize received = 0;
+	while (received < capacity) {
+		const int chunk = std::min(capacity - received, RECV_BATCH_MAX);
+		const int n = recvBurst(fd, burst, chunk, MSG_DONTWAIT);
+		ioAdd(shard, IO_RECV_CALLS, 1);
+		if (n == -1) {
+			const int err = errno;
+			if (err == EAGAIN || err == EWOULDBLOCK) {
+				/* block for the first frame only, in poll */
+				if (received == 0 && wait) {
+					if (!awaitReadable(env, fd, io)) {
+						return -1;
+					}
+					continue;
+				}
+				ioAdd(shard, IO_WOULD_BLOCK, 1);
+				if (received > 0) {
+					break;
+				}
+				return -EAGAIN;
+			} else if (err == EINTR && received == 0 && !wait) {
+				return -EINTR;
+			}
+			ioAdd(shard, IO_EXCEPTIONS, 1);
+			throwIOExceptionErrno(env, err);
+			return -1;
+		}
+		if (!checkBurst(env, burst, n)) {
+			ioAdd(shard, IO_EXCEPTIONS, 1);
+			return -1;
+		}
+		uint64_t bytes = 0;
+		for (int i = 0; i < n; i++) {
+			const struct can_frame& frame = burst.frames[i];
+			ifidx_buf[i] = burst.addrs[i].can_ifindex;
+			canid_buf[i] = frame.can_id;
+			dlc_buf[i] = std::min(frame.can_dlc,
+					      static_cast<__u8>(CAN_MAX_DLEN));
+			bytes += dlc_buf[i];
+			env->SetByteArrayRegion(data, (received + i) * CAN_MAX_DLEN,
+						CAN_MAX_DLEN,
+						reinterpret_cast<const jbyte *>(frame.data));
+		}
+		env->SetIntArrayRegion(ifIndices, received, n, ifidx_buf);
+		env->SetIntArrayRegion(canIds, received, n, canid_buf);
+		env->SetByteArrayRegion(dlcs, received, n, dlc_buf);
+		if (env->ExceptionCheck() == JNI_TRUE) {
+			return -1;
+		}
+		ioAdd(shard, IO_FRAMES_IN, n);
+		ioAdd(shard, IO_BYTES_IN, bytes);
+		received += n;
+		if (n < chunk) {
+			break;
+		}
+	}
+	return received;
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1recvFrames
+(JNIEnv *env, jclass obj, jint fd, jlong stats, jintArray ifIndices,
+ jintArray canIds, jbyteArray dlcs, jbyteArray data)
+{
+	return recvFrames(env, fd, stats, ifIndices, canIds, dlcs, data, true);
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1tryRecvFrames
+(JNIEnv *env, jclass obj, jint fd, jlong stats, jintArray ifIndices,
+ jintArray canIds, jbyteArray dlcs, jbyteArray data)
+{
+	return recvFrames(env, fd, stats, ifIndices, canIds, dlcs, data, false);
+}
+
+/*
+ * DirectFrameBatch memory: capacity struct can_frame entries followed by
+ * capacity interface indices. recvmmsg and sendmmsg work on the frames in
+ * place, only the addresses live on the stack.
+ */
+static_assert(sizeof(struct can_frame) == 16,
+	      "DirectFrameBatch.FRAME_SIZE does not match struct can_frame");
+static inline struct can_frame *directFrames(void *const address)
+{
+	return static_cast<struct can_frame *>(address);
+}
+
+static inline char *directIfIndices(void *const address, const jint capacity)
+{
+	return static_cast<char *>(address) +
+		static_cast<size_t>(capacity) * sizeof(struct can_frame);
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_CanSocket__1directAddress
+(JNIEnv *env, jclass obj, jobject buffer)
+{
+	void *const address = env->GetDirectBufferAddress(buffer);
+	if (address == NULL) {
+		throwIllegalArgumentException(env, "no direct buffer access");
+		return 0;
+	}
+	return reinterpret_cast<jlong>(address);
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1recvDirect
+(JNIEnv *env, jclass obj, jint fd, jlong stats, jobject buffer,
+ jint capacity, jboolean wait)
+{
+	void *const address = env->GetDirectBufferAddress(buffer);
+	if (address == NULL) {
+		throwIllegalArgumentException(env, "no direct buffer access");
+		return 0;
+	}
+	io_stats *const io = reinterpret_cast<io_stats *>(stats);
+	io_shard& shard = ioShard(io);
+	io_timer timer(shard, IO_RECV_NANOS);
+	struct can_frame *const frames = directFrames(address);
+	char *const ifindices = directIfIndices(address, capacity);
+	struct sockaddr_can addrs[RECV_BATCH_MAX];
+	struct iovec iovs[RECV_BATCH_MAX];
+	struct mmsghdr msgs[RECV_BATCH_MAX];
+
+	jint received = 0;
+	while (received < capacity) {
+		const int chunk = std::min(capacity - received, RECV_BATCH_MAX);
+		memset(msgs, 0, sizeof(msgs[0]) * chunk);
+		for (int i = 0; i < chunk; i++) {
+			iovs[i].iov_base = &frames[received + i];
+			iovs[i].iov_len = sizeof(struct can_frame);
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		const int n = recvmmsg(fd, msgs, chunk, MSG_DONTWAIT, NULL);
+		ioAdd(shard, IO_RECV_CALLS, 1);
+		if (n == -1) {
+			const int err = errno;
+			if (err == EAGAIN || err == EWOULDBLOCK) {
+				/* block for the first frame only, in poll */
+				if (received == 0 && wait) {
+					if (!awaitReadable(env, fd, io)) {
+						return -1;
+					}
+					continue;
+				}
+				ioAdd(shard, IO_WOULD_BLOCK, 1);
+				if (received > 0) {
+					break;
+				}
+				return -EAGAIN;
+			} else if (err == EINTR && received == 0 && !wait) {
+				return -EINTR;
+			}
+			ioAdd(shard, IO_EXCEPTIONS, 1);
+			throwIOExceptionErrno(env, err);
+			return -1;
+		}
+		uint64_t bytes = 0;
+		for (int i = 0; i < n; i++) {
+			if (msgs[i].msg_hdr.msg_namelen != sizeof(addrs[i])) {
+				ioAdd(shard, IO_EXCEPTIONS, 1);
+				throwIllegalArgumentException(env, "illegal AF_CAN address");
+				return -1;
+			}
+			if (msgs[i].msg_len != sizeof(struct can_frame)) {
+				ioAdd(shard, IO_EXCEPTIONS, 1);
+				throwIOExceptionMsg(env, "invalid length of received frame");
+				return -1;
+			}
+			const jint ifindex = addrs[i].can_ifindex;
+			memcpy(ifindices + (received + i) * sizeof(jint), &ifindex,
+			       sizeof(ifindex));
+			bytes += std::min(frames[received + i].can_dlc,
+					  static_cast<__u8>(CAN_MAX_DLEN));
+		}
+		ioAdd(shard, IO_FRAMES_IN, n);
+		ioAdd(shard, IO_BYTES_IN, bytes);
+		received += n;
+		if (n < chunk) {
+			break;
+		}
+	}
+	return received;
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1sendDirect
+(JNIEnv *env, jclass obj, jint fd, jlong stats, jobject buffer,
+ jint capacity, jint from, jint to, jboolean wait)
+{
+	void *const address = env->GetDirectBufferAddress(buffer);
+	if (address == NULL) {
+		throwIllegalArgumentException(env, "no direct buffer access");
+		return 0;
+	}
+	io_stats *const io = reinterpret_cast<io_stats *>(stats);
+	io_shard& shard = ioShard(io);
+	io_timer timer(shard, IO_SEND_NANOS);
+	const shaper_ref ref(io);
+	tx_shaper *const shaper = ref.shaper;
+	struct can_frame *const frames = directFrames(address);
+	const char *const ifindices = directIfIndices(address, capacity);
+	struct sockaddr_can addrs[SEND_BATCH_MAX];
+	struct iovec iovs[SEND_BATCH_MAX];
+	struct mmsghdr msgs[SEND_BATCH_MAX];
+	int slots[SEND_BATCH_MAX + 1];
+	const int flags = wait ? 0 : MSG_DONTWAIT;
+
+	jint sent = 0;
+	while (from + sent < to) {
+		const int first = from + sent;
+		const int chunk = std::min(to - first, SEND_BATCH_MAX);
+		int count = 0;
+		int taken = chunk;
+		for (int i = 0; i < chunk; i++) {
+			struct sockaddr_can& addr = addrs[count];
+			memset(&addr, 0, sizeof(addr));
+			addr.can_family = AF_CAN;
+			memcpy(&addr.can_ifindex,
+			       ifindices + (first + i) * sizeof(jint), sizeof(jint));
+			if (shaper != NULL) {
+				const shape_verdict verdict =
+					shapeFrame(shaper, addr.can_ifindex,
+						   frames[first + i], wait);
+				if (verdict == SHAPE_DROP) {
+					continue;
+				} else if (verdict == SHAPE_REJECT) {
+					ioAdd(shard, IO_WOULD_BLOCK, 1);
+					taken = i;
+					break;
+				}
+			}
+			iovs[count].iov_base = &frames[first + i];
+			iovs[count].iov_len = sizeof(struct can_frame);
+			memset(&msgs[count], 0, sizeof(msgs[count]));
+			msgs[count].msg_hdr.msg_name = &addr;
+			msgs[count].msg_hdr.msg_namelen = sizeof(addr);
+			msgs[count].msg_hdr.msg_iov = &iovs[count];
+			msgs[count].msg_hdr.msg_iovlen = 1;
+			slots[count++] = i;
+		}
+		slots[count] = taken;
+		int n = 0;
+		if (count > 0) {
+			n = sendmmsg(fd, msgs, count, flags);
+			ioAdd(shard, IO_SEND_CALLS, 1);
+			if (n == -1) {
+				const int err = errno;
+				countSendError(shard, err);
+				sent += slots[0];
+				if (!wait && sent > 0) {
+					break;
+				} else if (!wait && isTransient(err)) {
+					return err == EWOULDBLOCK ? -EAGAIN : -err;
+				}
+				ioAdd(shard, IO_EXCEPTIONS, 1);
+				throwIOExceptionErrno(env, err);
+				return -1;
+			}
+			uint64_t bytes = 0;
+			for (int i = 0; i < n; i++) {
+				bytes += frames[first + slots[i]].can_dlc;
+			}
+			ioAdd(shard, IO_FRAMES_OUT, n);
+			ioAdd(shard, IO_BYTES_OUT, bytes);
+		}
+		sent += slots[n];
+		if (taken < chunk && wait) {
+			/* the fail fast policy refuses to block */
+			ioAdd(shard, IO_EXCEPTIONS, 1);
+			throwIOExceptionErrno(env, EAGAIN);
+			return -1;
+		} else if ((n < count || taken < chunk) && !wait) {
+			break;
+		}
+	}
+	return sent == 0 && from < to && !wait ? -EAGAIN : sent;
+}
+
 JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1fetchInterfaceMtu
 (JNIEnv *env, jclass obj, jint fd, jstring ifName)
 {
@@ -301,6 +984,30 @@ JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1fetch_1CAN_1FD_1MTU
 	return CANFD_MTU;
 }
 
+JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1fetch_1EAGAIN
+(JNIEnv *env, jclass obj)
+{
+	return EAGAIN;
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1fetch_1EINTR
+(JNIEnv *env, jclass obj)
+{
+	return EINTR;
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1fetch_1ENOBUFS
+(JNIEnv *env, jclass obj)
+{
+	return ENOBUFS;
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1fetch_1ENETDOWN
+(JNIEnv *env, jclass obj)
+{
+	return ENETDOWN;
+}
+
 /*** ioctls ***/
 JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1fetch_1CAN_1RAW_1FILTER
 (JNIEnv *env, jclass obj)
@@ -0,0 +1,26 @@
+#ifndef CLOCKS_H
+#define CLOCKS_H
+
+#include<cstdint>
+#include<ctime>
+
+/* current time of clock in nanoseconds */
+static inline int64_t clockNanos(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static inline int64_t monotonicNanos()
+{
+	return clockNanos(CLOCK_MONOTONIC);
+}
+
+/* the clock of kernel receive timestamps */
+static inline int64_t realtimeNanos()
+{
+	return clockNanos(CLOCK_REALTIME);
+}
+
+#endif
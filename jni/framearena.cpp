@@ -0,0 +1,139 @@
+#include<algorithm>
+
+#include<cstring>
+#include<cstddef>
+#include<cstdint>
+#include<cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include <linux/can.h>
+}
+
+#if defined(ANDROID) || defined(__ANDROID__)
+#include "jni.h"
+#else
+#include "de_entropia_can_FrameArena.h"
+#endif
+
+#include "jniutil.h"
+#include "canio.h"
+#include "iostats.h"
+
+/*
+ * One slot of a FrameArena slab. FrameArena.Frame reads the fields at
+ * these offsets; reference counts and the free list stay on the Java side.
+ */
+struct arena_slot {
+	struct can_frame frame;
+	int64_t timestamp;
+	int32_t ifindex;
+	int32_t reserved;
+};
+
+static_assert(sizeof(struct arena_slot) == 32,
+	      "FrameArena.SLOT_SIZE does not match struct arena_slot");
+static_assert(offsetof(struct arena_slot, timestamp) == 16 &&
+	      offsetof(struct arena_slot, ifindex) == 24,
+	      "FrameArena slot offsets do not match struct arena_slot");
+
+/*
+ * Receives up to count frames straight into the slots at addresses, with
+ * one recvmmsg per RECV_BATCH_MAX slots: the kernel copies each frame into
+ * its slot, only the interface index and the timestamp are filled in
+ * afterwards. With wait set, blocks for the first frame; otherwise
+ * returns the negative errno if none is queued and the error is
+ * transient.
+ */
+JNIEXPORT jint JNICALL Java_de_entropia_can_FrameArena__1recv
+(JNIEnv *env, jclass clazz, jint fd, jlong stats, jlongArray addresses,
+ jint count, jboolean wait)
+{
+	io_stats *const io = reinterpret_cast<io_stats *>(stats);
+	io_shard& shard = ioShard(io);
+	io_timer timer(shard, IO_RECV_NANOS);
+	jlong slot_addrs[RECV_BATCH_MAX];
+	struct sockaddr_can addrs[RECV_BATCH_MAX];
+	struct iovec iovs[RECV_BATCH_MAX];
+	struct mmsghdr msgs[RECV_BATCH_MAX];
+	char ctrl[RECV_BATCH_MAX][CMSG_SPACE(sizeof(struct timespec))];
+
+	if (count < 0 || env->GetArrayLength(addresses) < count) {
+		throwIllegalArgumentException(env, "illegal slot count");
+		return -1;
+	}
+	jint received = 0;
+	while (received < count) {
+		const int chunk = std::min(count - received, RECV_BATCH_MAX);
+		env->GetLongArrayRegion(addresses, received, chunk, slot_addrs);
+		if (env->ExceptionCheck() == JNI_TRUE) {
+			return -1;
+		}
+		memset(msgs, 0, sizeof(msgs[0]) * chunk);
+		for (int i = 0; i < chunk; i++) {
+			struct arena_slot *const slot =
+				reinterpret_cast<struct arena_slot *>(slot_addrs[i]);
+			iovs[i].iov_base = &slot->frame;
+			iovs[i].iov_len = sizeof(slot->frame);
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = ctrl[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+		}
+		const int n = recvmmsg(fd, msgs, chunk, MSG_DONTWAIT, NULL);
+		ioAdd(shard, IO_RECV_CALLS, 1);
+		if (n == -1) {
+			const int err = errno;
+			if (err == EAGAIN || err == EWOULDBLOCK) {
+				/* block for the first frame only, in poll */
+				if (received == 0 && wait) {
+					if (!awaitReadable(env, fd, io)) {
+						return -1;
+					}
+					continue;
+				}
+				ioAdd(shard, IO_WOULD_BLOCK, 1);
+				if (received > 0) {
+					break;
+				}
+				return -EAGAIN;
+			} else if (err == EINTR && received == 0 && !wait) {
+				return -EINTR;
+			}
+			ioAdd(shard, IO_EXCEPTIONS, 1);
+			throwIOExceptionErrno(env, err);
+			return -1;
+		}
+		uint64_t bytes = 0;
+		for (int i = 0; i < n; i++) {
+			if (msgs[i].msg_hdr.msg_namelen != sizeof(addrs[i])) {
+				ioAdd(shard, IO_EXCEPTIONS, 1);
+				throwIllegalArgumentException(env, "illegal AF_CAN address");
+				return -1;
+			}
+			if (msgs[i].msg_len != sizeof(struct can_frame)) {
+				ioAdd(shard, IO_EXCEPTIONS, 1);
+				throwIOExceptionMsg(env, "invalid length of received frame");
+				return -1;
+			}
+			struct arena_slot *const slot =
+				reinterpret_cast<struct arena_slot *>(slot_addrs[i]);
+			slot->ifindex = addrs[i].can_ifindex;
+			slot->timestamp = msgTimestamp(msgs[i].msg_hdr);
+			bytes += std::min(slot->frame.can_dlc,
+					  static_cast<__u8>(CAN_MAX_DLEN));
+		}
+		ioAdd(shard, IO_FRAMES_IN, n);
+		ioAdd(shard, IO_BYTES_IN, bytes);
+		received += n;
+		if (n < chunk) {
+			break;
+		}
+	}
+	return received;
+}
@@ -0,0 +1,676 @@
+#include<algorithm>
+#include<memory>
+#include<new>
+#include<vector>
+
+#include<cstring>
+#include<cstdint>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <linux/can.h>
+}
+
+#if defined(ANDROID) || defined(__ANDROID__)
+#include "jni.h"
+#else
+#include "de_entropia_can_FrameCapture.h"
+#endif
+
+#include "jniutil.h"
+
+/*
+ * Block codec of FrameCapture. A block holds up to MAX_BLOCK_FRAMES frames
+ * and decodes on its own: the per id state starts empty in every block.
+ * Each frame is one record
+ *
+ *   varint  slot << 2 | kind
+ *   [u32 can_id]                          kind NEW only
+ *   varint  zigzag timestamp delta
+ *   [varint ifindex, u8 dlc, dlc bytes]   kinds NEW and LITERAL
+ *   [u8 mask, one byte per mask bit]      kind XOR
+ *
+ * where slot numbers the ids of the block in order of appearance. The
+ * timestamp of a new id is relative to the previous frame of the block,
+ * that of a known id to the previous frame of the id plus the interval
+ * before that, so periodic ids cost a byte or two of jitter. SAME repeats
+ * the previous payload of the id, XOR lists the non-zero bytes of the
+ * XOR with it, which is typically a counter and a checksum.
+ *
+ * The records are then compressed with a small LZ77 coder in the LZ4
+ * sequence layout (token, literals, 16 bit offset, match length), or
+ * stored when that does not pay off. All little endian.
+ */
+
+enum {
+	KIND_SAME,
+	KIND_XOR,
+	KIND_LITERAL,
+	KIND_NEW
+};
+
+/* flags of the block header */
+enum {
+	BLOCK_COMPRESSED = 1
+};
+
+static const int MAX_BLOCK_FRAMES = 4096;
+/* record size bound: header, id, timestamp, ifindex, dlc, payload */
+static const int MAX_RECORD = 5 + 4 + 10 + 5 + 1 + CAN_MAX_DLEN;
+/* compressed length, raw length, frames, flags, base timestamp */
+static const int BLOCK_HEADER = 4 + 4 + 4 + 1 + 8;
+static const int SLOT_HASH_SIZE = 2 * MAX_BLOCK_FRAMES;
+static const int LZ_HASH_BITS = 14;
+static const int LZ_MIN_MATCH = 4;
+static const int LZ_MAX_OFFSET = 0xffff;
+
+struct id_state {
+	int64_t last_ts;
+	int64_t last_delta;
+	uint32_t can_id;
+	int32_t ifindex;
+	uint8_t dlc;
+	uint8_t data[CAN_MAX_DLEN];
+};
+
+struct encode_scratch {
+	std::vector<jint> ifindex;
+	std::vector<jint> can_id;
+	std::vector<jbyte> dlc;
+	std::vector<uint8_t> data;
+	std::vector<jlong> ts;
+	std::vector<uint8_t> raw;
+	std::vector<uint8_t> out;
+	int16_t slot_hash[SLOT_HASH_SIZE];
+	int32_t lz_hash[1 << LZ_HASH_BITS];
+	id_state ids[MAX_BLOCK_FRAMES];
+};
+
+struct decode_scratch {
+	std::vector<uint8_t> in;
+	std::vector<uint8_t> raw;
+	std::vector<jint> ifindex;
+	std::vector<jint> can_id;
+	std::vector<jbyte> dlc;
+	std::vector<uint8_t> data;
+	std::vector<jlong> ts;
+	id_state ids[MAX_BLOCK_FRAMES];
+};
+
+/*
+ * Scratch of the calling thread, kept between blocks so the hot path does
+ * not allocate. Its buffers are bounded by one block of MAX_BLOCK_FRAMES
+ * frames, a few hundred KiB each, and freed when the thread exits.
+ */
+static thread_local std::unique_ptr<encode_scratch> enc_scratch;
+static thread_local std::unique_ptr<decode_scratch> dec_scratch;
+
+static inline uint8_t *putVarint(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = static_cast<uint8_t>(v) | 0x80;
+		v >>= 7;
+	}
+	*p++ = static_cast<uint8_t>(v);
+	return p;
+}
+
+static inline uint64_t zigzag(const int64_t v)
+{
+	return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+static inline int64_t unzigzag(const uint64_t v)
+{
+	return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+static inline void putLe32(uint8_t *p, const uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static inline uint32_t getLe32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static inline void putLe64(uint8_t *p, const uint64_t v)
+{
+	putLe32(p, static_cast<uint32_t>(v));
+	putLe32(p + 4, static_cast<uint32_t>(v >> 32));
+}
+
+static inline uint64_t getLe64(const uint8_t *p)
+{
+	return getLe32(p) | static_cast<uint64_t>(getLe32(p + 4)) << 32;
+}
+
+static inline uint32_t slotHash(const uint32_t can_id)
+{
+	return (can_id * 0x9e3779b1U) >> (32 - 13);
+}
+
+/* slot of can_id in the block, -1 if it is not known yet */
+static int findSlot(encode_scratch& s, const uint32_t can_id, uint32_t& pos)
+{
+	static_assert(SLOT_HASH_SIZE == 1 << 13, "slot hash size");
+	pos = slotHash(can_id);
+	for (;;) {
+		const int slot = s.slot_hash[pos];
+		if (slot == -1) {
+			return -1;
+		} else if (s.ids[slot].can_id == can_id) {
+			return slot;
+		}
+		pos = (pos + 1) & (SLOT_HASH_SIZE - 1);
+	}
+}
+
+/* writes the records of count frames to raw, returns their length */
+static size_t encodeRecords(encode_scratch& s, const int count,
+			    const int64_t base_ts)
+{
+	memset(s.slot_hash, 0xff, sizeof(s.slot_hash));
+	int slots = 0;
+	int64_t prev_ts = base_ts;
+	uint8_t *p = s.raw.data();
+	for (int i = 0; i < count; i++) {
+		const uint32_t can_id = static_cast<uint32_t>(s.can_id[i]);
+		const int32_t ifindex = s.ifindex[i];
+		const uint8_t dlc = static_cast<uint8_t>(
+			std::max(0, std::min<int>(s.dlc[i], CAN_MAX_DLEN)));
+		const uint8_t *const data = &s.data[i * CAN_MAX_DLEN];
+		const int64_t ts = s.ts[i];
+		uint32_t pos;
+		const int slot = findSlot(s, can_id, pos);
+		if (slot == -1) {
+			id_state& id = s.ids[slots];
+			s.slot_hash[pos] = static_cast<int16_t>(slots++);
+			p = putVarint(p, KIND_NEW);
+			putLe32(p, can_id);
+			p += 4;
+			p = putVarint(p, zigzag(ts - prev_ts));
+			p = putVarint(p, static_cast<uint32_t>(ifindex));
+			*p++ = dlc;
+			memcpy(p, data, dlc);
+			p += dlc;
+			id.can_id = can_id;
+			id.ifindex = ifindex;
+			id.dlc = dlc;
+			memset(id.data, 0, CAN_MAX_DLEN);
+			memcpy(id.data, data, dlc);
+			id.last_ts = ts;
+			id.last_delta = 0;
+		} else {
+			id_state& id = s.ids[slot];
+			const int64_t delta = ts - id.last_ts;
+			const uint64_t header = static_cast<uint64_t>(slot) << 2;
+			if (id.ifindex != ifindex || id.dlc != dlc) {
+				p = putVarint(p, header | KIND_LITERAL);
+				p = putVarint(p, zigzag(delta - id.last_delta));
+				p = putVarint(p, static_cast<uint32_t>(ifindex));
+				*p++ = dlc;
+				memcpy(p, data, dlc);
+				p += dlc;
+				id.ifindex = ifindex;
+				id.dlc = dlc;
+			} else if (memcmp(id.data, data, dlc) == 0) {
+				p = putVarint(p, header | KIND_SAME);
+				p = putVarint(p, zigzag(delta - id.last_delta));
+			} else {
+				p = putVarint(p, header | KIND_XOR);
+				p = putVarint(p, zigzag(delta - id.last_delta));
+				uint8_t *const mask = p++;
+				*mask = 0;
+				for (int b = 0; b < dlc; b++) {
+					const uint8_t x = id.data[b] ^ data[b];
+					if (x != 0) {
+						*mask |= 1 << b;
+						*p++ = x;
+					}
+				}
+			}
+			memset(id.data, 0, CAN_MAX_DLEN);
+			memcpy(id.data, data, dlc);
+			id.last_delta = delta;
+			id.last_ts = ts;
+		}
+		prev_ts = ts;
+	}
+	return p - s.raw.data();
+}
+
+static inline uint32_t lzHash(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *putLength(uint8_t *p, size_t len)
+{
+	while (len >= 255) {
+		*p++ = 255;
+		len -= 255;
+	}
+	*p++ = static_cast<uint8_t>(len);
+	return p;
+}
+
+static uint8_t *putSequence(uint8_t *p, const uint8_t *literals,
+			    const size_t literal_len, const size_t offset,
+			    const size_t match_len)
+{
+	uint8_t *const token = p++;
+	const size_t ml = match_len == 0 ? 0 : match_len - LZ_MIN_MATCH;
+	*token = static_cast<uint8_t>(std::min<size_t>(literal_len, 15) << 4 |
+				      std::min<size_t>(ml, 15));
+	if (literal_len >= 15) {
+		p = putLength(p, literal_len - 15);
+	}
+	memcpy(p, literals, literal_len);
+	p += literal_len;
+	if (match_len != 0) {
+		*p++ = static_cast<uint8_t>(offset);
+		*p++ = static_cast<uint8_t>(offset >> 8);
+		if (ml >= 15) {
+			p = putLength(p, ml - 15);
+		}
+	}
+	return p;
+}
+
+/*
+ * Greedy LZ77 with one hash table probe per position. Returns the
+ * compressed length, at most len + len / 255 + 16.
+ */
+static size_t lzCompress(encode_scratch& s, const uint8_t *in,
+			 const size_t len, uint8_t *out)
+{
+	uint8_t *p = out;
+	const uint8_t *anchor = in;
+	if (len > LZ_MIN_MATCH) {
+		std::fill(s.lz_hash, s.lz_hash + (1 << LZ_HASH_BITS), -1);
+		const uint8_t *const limit = in + len - LZ_MIN_MATCH;
+		const uint8_t *ip = in;
+		while (ip <= limit) {
+			const uint32_t h = lzHash(ip);
+			const int32_t cand = s.lz_hash[h];
+			s.lz_hash[h] = static_cast<int32_t>(ip - in);
+			if (cand < 0 || ip - in - cand > LZ_MAX_OFFSET ||
+			    memcmp(in + cand, ip, LZ_MIN_MATCH) != 0) {
+				ip++;
+				continue;
+			}
+			const uint8_t *match = in + cand + LZ_MIN_MATCH;
+			const uint8_t *end = ip + LZ_MIN_MATCH;
+			while (end < in + len && *end == *match) {
+				end++;
+				match++;
+			}
+			p = putSequence(p, anchor, ip - anchor, ip - (in + cand),
+					end - ip);
+			/* index the inside of the match sparsely */
+			for (const uint8_t *q = ip + 1; q < end && q <= limit;
+			     q += 2) {
+				s.lz_hash[lzHash(q)] = static_cast<int32_t>(q - in);
+			}
+			ip = anchor = end;
+		}
+	}
+	p = putSequence(p, anchor, in + len - anchor, 0, 0);
+	return p - out;
+}
+
+/* returns false if the input is corrupt or does not fill out exactly */
+static bool lzDecompress(const uint8_t *in, const size_t in_len,
+			 uint8_t *out, const size_t out_len)
+{
+	const uint8_t *ip = in;
+	const uint8_t *const iend = in + in_len;
+	uint8_t *op = out;
+	uint8_t *const oend = out + out_len;
+	for (;;) {
+		if (ip >= iend) {
+			return false;
+		}
+		const unsigned token = *ip++;
+		size_t literal_len = token >> 4;
+		if (literal_len == 15) {
+			unsigned b;
+			do {
+				if (ip >= iend) {
+					return false;
+				}
+				b = *ip++;
+				literal_len += b;
+			} while (b == 255);
+		}
+		if (literal_len > static_cast<size_t>(iend - ip) ||
+		    literal_len > static_cast<size_t>(oend - op)) {
+			return false;
+		}
+		memcpy(op, ip, literal_len);
+		ip += literal_len;
+		op += literal_len;
+		if (ip == iend) {
+			/* the last sequence has no match */
+			return op == oend;
+		}
+		if (iend - ip < 2) {
+			return false;
+		}
+		const size_t offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		size_t match_len = token & 15;
+		if (match_len == 15) {
+			unsigned b;
+			do {
+				if (ip >= iend) {
+					return false;
+				}
+				b = *ip++;
+				match_len += b;
+			} while (b == 255);
+		}
+		match_len += LZ_MIN_MATCH;
+		if (offset == 0 || offset > static_cast<size_t>(op - out) ||
+		    match_len > static_cast<size_t>(oend - op)) {
+			return false;
+		}
+		const uint8_t *match = op - offset;
+		if (offset >= 8) {
+			/* words cannot overlap the match, copy exactly match_len */
+			uint8_t *const end = op + match_len;
+			while (op + 8 <= end) {
+				memcpy(op, match, 8);
+				op += 8;
+				match += 8;
+			}
+			while (op < end) {
+				*op++ = *match++;
+			}
+		} else {
+			for (size_t i = 0; i < match_len; i++) {
+				*op++ = *match++;
+			}
+		}
+	}
+}
+
+static inline bool getVarint(const uint8_t *&p, const uint8_t *end,
+			     uint64_t& v)
+{
+	uint64_t result = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (p >= end) {
+			return false;
+		}
+		const uint8_t b = *p++;
+		result |= static_cast<uint64_t>(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			v = result;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* returns false if the records are corrupt */
+static bool decodeRecords(decode_scratch& s, const uint8_t *p,
+			  const size_t len, const int count,
+			  const int64_t base_ts)
+{
+	const uint8_t *const end = p + len;
+	int slots = 0;
+	int64_t prev_ts = base_ts;
+	for (int i = 0; i < count; i++) {
+		uint64_t header, ts_code;
+		if (!getVarint(p, end, header)) {
+			return false;
+		}
+		const int kind = header & 3;
+		id_state *id;
+		int64_t ts;
+		if (kind == KIND_NEW) {
+			if (end - p < 4 || slots == MAX_BLOCK_FRAMES) {
+				return false;
+			}
+			id = &s.ids[slots++];
+			id->can_id = getLe32(p);
+			p += 4;
+			if (!getVarint(p, end, ts_code)) {
+				return false;
+			}
+			ts = prev_ts + unzigzag(ts_code);
+			id->last_delta = 0;
+		} else {
+			const uint64_t slot = header >> 2;
+			if (slot >= static_cast<uint64_t>(slots) ||
+			    !getVarint(p, end, ts_code)) {
+				return false;
+			}
+			id = &s.ids[slot];
+			const int64_t delta = id->last_delta + unzigzag(ts_code);
+			ts = id->last_ts + delta;
+			id->last_delta = delta;
+		}
+		id->last_ts = ts;
+		if (kind == KIND_NEW || kind == KIND_LITERAL) {
+			uint64_t ifindex;
+			if (!getVarint(p, end, ifindex) || p >= end) {
+				return false;
+			}
+			const uint8_t dlc = *p++;
+			if (dlc > CAN_MAX_DLEN || end - p < dlc) {
+				return false;
+			}
+			id->ifindex = static_cast<int32_t>(ifindex);
+			id->dlc = dlc;
+			memset(id->data, 0, CAN_MAX_DLEN);
+			memcpy(id->data, p, dlc);
+			p += dlc;
+		} else if (kind == KIND_XOR) {
+			if (p >= end) {
+				return false;
+			}
+			const uint8_t mask = *p++;
+			if (mask >> id->dlc) {
+				return false;
+			}
+			for (int b = 0; b < id->dlc; b++) {
+				if (mask & 1 << b) {
+					if (p >= end) {
+						return false;
+					}
+					id->data[b] ^= *p++;
+				}
+			}
+		}
+		s.ifindex[i] = id->ifindex;
+		s.can_id[i] = static_cast<jint>(id->can_id);
+		s.dlc[i] = static_cast<jbyte>(id->dlc);
+		memcpy(&s.data[i * CAN_MAX_DLEN], id->data, CAN_MAX_DLEN);
+		s.ts[i] = ts;
+		prev_ts = ts;
+	}
+	return p == end;
+}
+
+/* largest block holding raw bytes of records, incompressible included */
+static size_t blockBound(size_t raw)
+{
+	return BLOCK_HEADER + raw + raw / 255 + 16;
+}
+
+static size_t maxBlockSize(size_t frames)
+{
+	return blockBound(frames * MAX_RECORD);
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_FrameCapture__1maxBlockSize
+(JNIEnv *env, jclass clazz, jint frames)
+{
+	return static_cast<jint>(maxBlockSize(frames));
+}
+
+/*
+ * Encodes count frames into a complete block, header included, and
+ * returns its length.
+ */
+JNIEXPORT jint JNICALL Java_de_entropia_can_FrameCapture__1encode
+(JNIEnv *env, jclass clazz, jintArray ifIndices, jintArray canIds,
+ jbyteArray dlcs, jbyteArray data, jlongArray timestamps, jint count,
+ jbyteArray block)
+{
+	if (count < 0 || count > MAX_BLOCK_FRAMES ||
+	    env->GetArrayLength(ifIndices) < count ||
+	    env->GetArrayLength(canIds) < count ||
+	    env->GetArrayLength(dlcs) < count ||
+	    env->GetArrayLength(data) / CAN_MAX_DLEN < count ||
+	    env->GetArrayLength(timestamps) < count ||
+	    static_cast<size_t>(env->GetArrayLength(block)) <
+	    maxBlockSize(count)) {
+		throwIllegalArgumentException(env, "illegal block arguments");
+		return -1;
+	}
+	if (!enc_scratch) {
+		enc_scratch.reset(new (std::nothrow) encode_scratch());
+		if (!enc_scratch) {
+			throwOutOfMemoryError(env, "capture encoder");
+			return -1;
+		}
+	}
+	encode_scratch& s = *enc_scratch;
+	if (s.can_id.size() < static_cast<size_t>(count)) {
+		s.ifindex.resize(count);
+		s.can_id.resize(count);
+		s.dlc.resize(count);
+		s.data.resize(count * CAN_MAX_DLEN);
+		s.ts.resize(count);
+		s.raw.resize(count * MAX_RECORD);
+	}
+	env->GetIntArrayRegion(ifIndices, 0, count, s.ifindex.data());
+	env->GetIntArrayRegion(canIds, 0, count, s.can_id.data());
+	env->GetByteArrayRegion(dlcs, 0, count, s.dlc.data());
+	env->GetByteArrayRegion(data, 0, count * CAN_MAX_DLEN,
+				reinterpret_cast<jbyte *>(s.data.data()));
+	env->GetLongArrayRegion(timestamps, 0, count, s.ts.data());
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return -1;
+	}
+	const int64_t base_ts = count > 0 ? s.ts[0] : 0;
+	const size_t raw_len = encodeRecords(s, count, base_ts);
+	const size_t bound = blockBound(raw_len);
+	if (s.out.size() < bound) {
+		s.out.resize(bound);
+	}
+	uint8_t *const out = s.out.data();
+	size_t payload = lzCompress(s, s.raw.data(), raw_len,
+				    out + BLOCK_HEADER);
+	uint8_t flags = BLOCK_COMPRESSED;
+	if (payload >= raw_len) {
+		memcpy(out + BLOCK_HEADER, s.raw.data(), raw_len);
+		payload = raw_len;
+		flags = 0;
+	}
+	putLe32(out, static_cast<uint32_t>(payload));
+	putLe32(out + 4, static_cast<uint32_t>(raw_len));
+	putLe32(out + 8, static_cast<uint32_t>(count));
+	out[12] = flags;
+	putLe64(out + 13, static_cast<uint64_t>(base_ts));
+	const jint total = static_cast<jint>(BLOCK_HEADER + payload);
+	env->SetByteArrayRegion(block, 0, total,
+				reinterpret_cast<const jbyte *>(out));
+	return total;
+}
+
+/*
+ * Decodes the block whose header was read into header and payload into
+ * payload, filling the frame columns. Returns the number of frames.
+ */
+JNIEXPORT jint JNICALL Java_de_entropia_can_FrameCapture__1decode
+(JNIEnv *env, jclass clazz, jbyteArray header, jbyteArray payload,
+ jintArray ifIndices, jintArray canIds, jbyteArray dlcs, jbyteArray data,
+ jlongArray timestamps)
+{
+	uint8_t h[BLOCK_HEADER];
+	if (env->GetArrayLength(header) < BLOCK_HEADER) {
+		throwIllegalArgumentException(env, "short block header");
+		return -1;
+	}
+	env->GetByteArrayRegion(header, 0, BLOCK_HEADER,
+				reinterpret_cast<jbyte *>(h));
+	const uint32_t payload_len = getLe32(h);
+	const uint32_t raw_len = getLe32(h + 4);
+	const uint32_t count = getLe32(h + 8);
+	const uint8_t flags = h[12];
+	const int64_t base_ts = static_cast<int64_t>(getLe64(h + 13));
+	if (count > MAX_BLOCK_FRAMES || raw_len > count * MAX_RECORD ||
+	    payload_len > maxBlockSize(count) ||
+	    env->GetArrayLength(payload) < static_cast<jsize>(payload_len) ||
+	    (!(flags & BLOCK_COMPRESSED) && payload_len != raw_len)) {
+		throwIOExceptionMsg(env, "corrupt capture block header");
+		return -1;
+	}
+	if (env->GetArrayLength(ifIndices) < static_cast<jsize>(count) ||
+	    env->GetArrayLength(canIds) < static_cast<jsize>(count) ||
+	    env->GetArrayLength(dlcs) < static_cast<jsize>(count) ||
+	    env->GetArrayLength(data) / CAN_MAX_DLEN < static_cast<jsize>(count) ||
+	    env->GetArrayLength(timestamps) < static_cast<jsize>(count)) {
+		throwIllegalArgumentException(env, "frame columns too short");
+		return -1;
+	}
+	if (!dec_scratch) {
+		dec_scratch.reset(new (std::nothrow) decode_scratch());
+		if (!dec_scratch) {
+			throwOutOfMemoryError(env, "capture decoder");
+			return -1;
+		}
+	}
+	decode_scratch& s = *dec_scratch;
+	if (s.in.size() < payload_len) {
+		s.in.resize(payload_len);
+	}
+	if (s.raw.size() < raw_len) {
+		s.raw.resize(raw_len);
+	}
+	if (s.can_id.size() < count) {
+		s.ifindex.resize(count);
+		s.can_id.resize(count);
+		s.dlc.resize(count);
+		s.data.resize(count * CAN_MAX_DLEN);
+		s.ts.resize(count);
+	}
+	env->GetByteArrayRegion(payload, 0, payload_len,
+				reinterpret_cast<jbyte *>(s.in.data()));
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return -1;
+	}
+	const uint8_t *records = s.in.data();
+	if (flags & BLOCK_COMPRESSED) {
+		if (!lzDecompress(s.in.data(), payload_len, s.raw.data(),
+				  raw_len)) {
+			throwIOExceptionMsg(env, "corrupt capture block");
+			return -1;
+		}
+		records = s.raw.data();
+	}
+	if (!decodeRecords(s, records, raw_len, count, base_ts)) {
+		throwIOExceptionMsg(env, "corrupt capture records");
+		return -1;
+	}
+	env->SetIntArrayRegion(ifIndices, 0, count, s.ifindex.data());
+	env->SetIntArrayRegion(canIds, 0, count, s.can_id.data());
+	env->SetByteArrayRegion(dlcs, 0, count, s.dlc.data());
+	env->SetByteArrayRegion(data, 0, count * CAN_MAX_DLEN,
+				reinterpret_cast<const jbyte *>(s.data.data()));
+	env->SetLongArrayRegion(timestamps, 0, count, s.ts.data());
+	return static_cast<jint>(count);
+}
@@ -0,0 +1,422 @@
+#include<algorithm>
+#include<memory>
+#include<new>
+#include<unordered_map>
+#include<vector>
+
+#include<cstring>
+#include<cstdint>
+#include<cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <linux/can.h>
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_DISPATCH 1
+#endif
+
+#if defined(ANDROID) || defined(__ANDROID__)
+#include "jni.h"
+#else
+#include "de_entropia_can_FrameFilter.h"
+#endif
+
+#include "jniutil.h"
+#include "canio.h"
+#include "iostats.h"
+#include "framefilter.h"
+
+/*
+ * Compiled form of a large set of can_filter id/mask pairs with the
+ * semantics of CAN_RAW_FILTER: a frame passes if any pair matches, error
+ * frames never pass. Inverted filters (CAN_INV_FILTER) are not supported.
+ *
+ * Standard frames are looked up in a bitmap indexed by RTR flag and 11 bit
+ * id, so their cost does not depend on the number of filters. Extended
+ * frames are looked up in one sorted table of masked ids per distinct
+ * mask; filter sets usually use a handful of masks, so an extended frame
+ * costs a few binary searches instead of a scan of all pairs.
+ */
+
+/* bits of a can_id that take part in matching an extended frame */
+static const canid_t EFF_MATCH_BITS = CAN_RTR_FLAG | CAN_EFF_MASK;
+
+static inline unsigned sffSlot(canid_t id)
+{
+	return ((id & CAN_RTR_FLAG) >> 19) | (id & CAN_SFF_MASK);
+}
+
+static void addSff(frame_filter *f, canid_t id, canid_t mask)
+{
+	/* bits a standard frame cannot have set */
+	if ((id & mask & (CAN_EFF_FLAG | CAN_ERR_FLAG |
+			  (CAN_EFF_MASK & ~CAN_SFF_MASK))) != 0) {
+		return;
+	}
+	const unsigned fixed = id & mask & CAN_SFF_MASK;
+	const unsigned wild = ~mask & CAN_SFF_MASK;
+	for (int rtr = 0; rtr < 2; rtr++) {
+		const canid_t flag = rtr ? CAN_RTR_FLAG : 0;
+		if (((flag ^ id) & mask & CAN_RTR_FLAG) != 0) {
+			continue;
+		}
+		/* every id that agrees with the filter in the masked bits */
+		unsigned sub = 0;
+		do {
+			const unsigned slot = sffSlot(flag | fixed | sub);
+			f->sff[slot >> 5] |= 1u << (slot & 31);
+			sub = (sub - wild) & wild;
+		} while (sub != 0);
+	}
+}
+
+static void addEff(std::vector<mask_group>& groups,
+		   std::unordered_map<canid_t, size_t>& by_mask, canid_t id,
+		   canid_t mask)
+{
+	if ((mask & CAN_EFF_FLAG) && !(id & CAN_EFF_FLAG)) {
+		return;
+	}
+	const canid_t m = mask & EFF_MATCH_BITS;
+	const auto it = by_mask.find(m);
+	if (it != by_mask.end()) {
+		groups[it->second].ids.push_back(id & m);
+		return;
+	}
+	by_mask[m] = groups.size();
+	mask_group group;
+	group.mask = m;
+	group.ids.push_back(id & m);
+	groups.push_back(group);
+}
+
+static bool matchEff(const frame_filter *f, canid_t id)
+{
+	for (size_t i = 0; i < f->eff.size(); i++) {
+		const mask_group& g = f->eff[i];
+		if (std::binary_search(g.ids.begin(), g.ids.end(), id & g.mask)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static inline bool matchSff(const frame_filter *f, canid_t id)
+{
+	const unsigned slot = sffSlot(id);
+	return (f->sff[slot >> 5] >> (slot & 31)) & 1;
+}
+
+bool filterMatches(const frame_filter *f, canid_t id)
+{
+	if (id & CAN_ERR_FLAG) {
+		return false;
+	}
+	if (id & CAN_EFF_FLAG) {
+		return matchEff(f, id);
+	}
+	return matchSff(f, id);
+}
+
+static int matchScalar(const frame_filter *f, const canid_t *ids, int n,
+		       uint8_t *keep)
+{
+	int kept = 0;
+	for (int i = 0; i < n; i++) {
+		keep[i] = filterMatches(f, ids[i]);
+		kept += keep[i];
+	}
+	return kept;
+}
+
+#ifdef HAVE_AVX2_DISPATCH
+/*
+ * Looks up eight standard ids at once with a gather from the bitmap;
+ * lanes with extended or error frames fall back to matchOne.
+ */
+__attribute__((target("avx2")))
+static int matchAvx2(const frame_filter *f, const canid_t *ids, int n,
+		     uint8_t *keep)
+{
+	const __m256i sff_mask = _mm256_set1_epi32(CAN_SFF_MASK);
+	const __m256i rtr = _mm256_set1_epi32(CAN_RTR_FLAG);
+	const __m256i special = _mm256_set1_epi32(CAN_EFF_FLAG | CAN_ERR_FLAG);
+	const __m256i low5 = _mm256_set1_epi32(31);
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i zero = _mm256_setzero_si256();
+	const int *const words = reinterpret_cast<const int *>(f->sff);
+	int kept = 0;
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i id = _mm256_loadu_si256(
+			reinterpret_cast<const __m256i *>(ids + i));
+		const __m256i slot = _mm256_or_si256(
+			_mm256_srli_epi32(_mm256_and_si256(id, rtr), 19),
+			_mm256_and_si256(id, sff_mask));
+		const __m256i word = _mm256_i32gather_epi32(words,
+			_mm256_srli_epi32(slot, 5), 4);
+		const __m256i bit = _mm256_and_si256(_mm256_srlv_epi32(word,
+			_mm256_and_si256(slot, low5)), one);
+		const __m256i is_sff = _mm256_cmpeq_epi32(
+			_mm256_and_si256(id, special), zero);
+		const unsigned hit = _mm256_movemask_ps(_mm256_castsi256_ps(
+			_mm256_cmpeq_epi32(_mm256_and_si256(bit, is_sff), one)));
+		const unsigned sff = _mm256_movemask_ps(
+			_mm256_castsi256_ps(is_sff));
+		for (int j = 0; j < 8; j++) {
+			keep[i + j] = (sff >> j) & 1 ? (hit >> j) & 1 :
+				filterMatches(f, ids[i + j]);
+			kept += keep[i + j];
+		}
+	}
+	return kept + matchScalar(f, ids + i, n - i, keep + i);
+}
+#endif
+
+int filterBatch(const frame_filter *f, const canid_t *ids, int n,
+		uint8_t *keep)
+{
+#ifdef HAVE_AVX2_DISPATCH
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	if (avx2) {
+		return matchAvx2(f, ids, n, keep);
+	}
+#endif
+	return matchScalar(f, ids, n, keep);
+}
+
+frame_filter *compileFilter(const canid_t *ids, const canid_t *masks,
+			    int n)
+{
+	for (int i = 0; i < n; i++) {
+		if (ids[i] & CAN_INV_FILTER) {
+			return NULL;
+		}
+	}
+	/* freed again if growing a group throws */
+	std::unique_ptr<frame_filter> f(new frame_filter());
+	memset(f->sff, 0, sizeof(f->sff));
+	std::unordered_map<canid_t, size_t> by_mask;
+	for (int i = 0; i < n; i++) {
+		addSff(f.get(), ids[i], masks[i]);
+		addEff(f->eff, by_mask, ids[i], masks[i]);
+	}
+	for (size_t i = 0; i < f->eff.size(); i++) {
+		std::vector<canid_t>& v = f->eff[i].ids;
+		std::sort(v.begin(), v.end());
+		v.erase(std::unique(v.begin(), v.end()), v.end());
+		v.shrink_to_fit();
+	}
+	/* a group that passes everything makes the others redundant */
+	for (size_t i = 0; i < f->eff.size(); i++) {
+		if (f->eff[i].mask == 0) {
+			mask_group all = f->eff[i];
+			f->eff.assign(1, all);
+			break;
+		}
+	}
+	return f.release();
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_FrameFilter__1compile
+(JNIEnv *env, jclass clazz, jintArray canIds, jintArray masks)
+{
+	const jsize n = env->GetArrayLength(canIds);
+	if (env->GetArrayLength(masks) != n) {
+		throwIllegalArgumentException(env, "ids and masks differ in length");
+		return 0;
+	}
+	std::vector<jint> ids(n);
+	std::vector<jint> ms(n);
+	env->GetIntArrayRegion(canIds, 0, n, ids.data());
+	env->GetIntArrayRegion(masks, 0, n, ms.data());
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return 0;
+	}
+	frame_filter *f;
+	try {
+		f = compileFilter(reinterpret_cast<const canid_t *>(ids.data()),
+				  reinterpret_cast<const canid_t *>(ms.data()), n);
+	} catch (const std::bad_alloc& e) {
+		throwOutOfMemoryError(env, "frame filter");
+		return 0;
+	}
+	if (f == NULL) {
+		throwIllegalArgumentException(env,
+			"inverted filters are not supported");
+		return 0;
+	}
+	return reinterpret_cast<jlong>(f);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_FrameFilter__1free
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	delete reinterpret_cast<frame_filter *>(handle);
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_FrameFilter__1maskGroups
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	return static_cast<jint>(reinterpret_cast<frame_filter *>(handle)->eff.size());
+}
+
+JNIEXPORT jboolean JNICALL Java_de_entropia_can_FrameFilter__1matches
+(JNIEnv *env, jclass clazz, jlong handle, jint canId)
+{
+	return filterMatches(reinterpret_cast<frame_filter *>(handle), canId) ?
+		JNI_TRUE : JNI_FALSE;
+}
+
+/*
+ * Removes the frames that do not pass from the first count rows of the
+ * batch columns, returns the number of rows left.
+ */
+JNIEXPORT jint JNICALL Java_de_entropia_can_FrameFilter__1filter
+(JNIEnv *env, jclass clazz, jlong handle, jintArray ifIndices,
+ jintArray canIds, jbyteArray dlcs, jbyteArray data, jint count)
+{
+	const frame_filter *const f = reinterpret_cast<frame_filter *>(handle);
+	jint ifidx_buf[RECV_BATCH_MAX];
+	jint canid_buf[RECV_BATCH_MAX];
+	jbyte dlc_buf[RECV_BATCH_MAX];
+	jbyte data_buf[RECV_BATCH_MAX * CAN_MAX_DLEN];
+	uint8_t keep[RECV_BATCH_MAX];
+
+	jint out = 0;
+	for (jint in = 0; in < count; in += RECV_BATCH_MAX) {
+		const int n = std::min(count - in, RECV_BATCH_MAX);
+		env->GetIntArrayRegion(canIds, in, n, canid_buf);
+		if (env->ExceptionCheck() == JNI_TRUE) {
+			return -1;
+		}
+		const int kept = filterBatch(f,
+			reinterpret_cast<const canid_t *>(canid_buf), n, keep);
+		if (kept == n && out == in) {
+			/* nothing removed so far, the rows stay where they are */
+			out += n;
+			continue;
+		}
+		env->GetIntArrayRegion(ifIndices, in, n, ifidx_buf);
+		env->GetByteArrayRegion(dlcs, in, n, dlc_buf);
+		env->GetByteArrayRegion(data, in * CAN_MAX_DLEN, n * CAN_MAX_DLEN,
+					data_buf);
+		if (env->ExceptionCheck() == JNI_TRUE) {
+			return -1;
+		}
+		int k = 0;
+		for (int i = 0; i < n; i++) {
+			if (!keep[i]) {
+				continue;
+			}
+			ifidx_buf[k] = ifidx_buf[i];
+			canid_buf[k] = canid_buf[i];
+			dlc_buf[k] = dlc_buf[i];
+			memmove(data_buf + k * CAN_MAX_DLEN,
+				data_buf + i * CAN_MAX_DLEN, CAN_MAX_DLEN);
+			k++;
+		}
+		env->SetIntArrayRegion(ifIndices, out, k, ifidx_buf);
+		env->SetIntArrayRegion(canIds, out, k, canid_buf);
+		env->SetByteArrayRegion(dlcs, out, k, dlc_buf);
+		env->SetByteArrayRegion(data, out * CAN_MAX_DLEN, k * CAN_MAX_DLEN,
+					data_buf);
+		out += k;
+	}
+	return out;
+}
+
+/*
+ * Like CanSocket._recvFrames but only copies frames that pass the filter;
+ * blocks until at least one does.
+ */
+JNIEXPORT jint JNICALL Java_de_entropia_can_FrameFilter__1recv
+(JNIEnv *env, jclass clazz, jlong handle, jint fd, jlong stats,
+ jintArray ifIndices, jintArray canIds, jbyteArray dlcs, jbyteArray data)
+{
+	const frame_filter *const f = reinterpret_cast<frame_filter *>(handle);
+	io_stats *const io = reinterpret_cast<io_stats *>(stats);
+	io_shard& shard = ioShard(io);
+	io_timer timer(shard, IO_RECV_NANOS);
+	struct frame_burst burst;
+	canid_t ids[RECV_BATCH_MAX];
+	uint8_t keep[RECV_BATCH_MAX];
+	jint ifidx_buf[RECV_BATCH_MAX];
+	jint canid_buf[RECV_BATCH_MAX];
+	jbyte dlc_buf[RECV_BATCH_MAX];
+	jbyte data_buf[RECV_BATCH_MAX * CAN_MAX_DLEN];
+
+	const jsize capacity = env->GetArrayLength(canIds);
+	if (env->GetArrayLength(ifIndices) < capacity ||
+	    env->GetArrayLength(dlcs) < capacity ||
+	    env->GetArrayLength(data) / CAN_MAX_DLEN < capacity) {
+		throwIllegalArgumentException(env, "batch columns too short");
+		return -1;
+	}
+	jsize received = 0;
+	while (received < capacity) {
+		const int chunk = std::min(capacity - received, RECV_BATCH_MAX);
+		const int n = recvBurst(fd, burst, chunk, MSG_DONTWAIT);
+		ioAdd(shard, IO_RECV_CALLS, 1);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				/* block until something passed, in poll */
+				if (received == 0) {
+					if (!awaitReadable(env, fd, io)) {
+						return -1;
+					}
+					continue;
+				}
+				ioAdd(shard, IO_WOULD_BLOCK, 1);
+				break;
+			}
+			ioAdd(shard, IO_EXCEPTIONS, 1);
+			throwIOExceptionErrno(env, errno);
+			return -1;
+		}
+		if (!checkBurst(env, burst, n)) {
+			ioAdd(shard, IO_EXCEPTIONS, 1);
+			return -1;
+		}
+		uint64_t bytes = 0;
+		for (int i = 0; i < n; i++) {
+			ids[i] = burst.frames[i].can_id;
+			bytes += std::min(burst.frames[i].can_dlc,
+					  static_cast<__u8>(CAN_MAX_DLEN));
+		}
+		ioAdd(shard, IO_FRAMES_IN, n);
+		ioAdd(shard, IO_BYTES_IN, bytes);
+		filterBatch(f, ids, n, keep);
+		int k = 0;
+		for (int i = 0; i < n; i++) {
+			if (!keep[i]) {
+				continue;
+			}
+			const struct can_frame& frame = burst.frames[i];
+			ifidx_buf[k] = burst.addrs[i].can_ifindex;
+			canid_buf[k] = frame.can_id;
+			dlc_buf[k] = std::min(frame.can_dlc,
+					      static_cast<__u8>(CAN_MAX_DLEN));
+			memcpy(data_buf + k * CAN_MAX_DLEN, frame.data, CAN_MAX_DLEN);
+			k++;
+		}
+		env->SetIntArrayRegion(ifIndices, received, k, ifidx_buf);
+		env->SetIntArrayRegion(canIds, received, k, canid_buf);
+		env->SetByteArrayRegion(dlcs, received, k, dlc_buf);
+		env->SetByteArrayRegion(data, received * CAN_MAX_DLEN,
+					k * CAN_MAX_DLEN, data_buf);
+		if (env->ExceptionCheck() == JNI_TRUE) {
+			return -1;
+		}
+		received += k;
+		if (n < chunk && received > 0) {
+			break;
+		}
+	}
+	return received;
+}
@@ -0,0 +1,40 @@
+#ifndef FRAMEFILTER_H
+#define FRAMEFILTER_H
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <linux/can.h>
+}
+
+#include<cstdint>
+#include<vector>
+
+/* standard id and RTR flag */
+static const int SFF_SLOTS = 2 << 11;
+static const int SFF_WORDS = SFF_SLOTS / 32;
+
+struct mask_group {
+	canid_t mask;
+	std::vector<canid_t> ids;
+};
+
+struct frame_filter {
+	uint32_t sff[SFF_WORDS];
+	std::vector<mask_group> eff;
+};
+
+/*
+ * Compiles n id/mask pairs with the semantics of CAN_RAW_FILTER. Returns
+ * NULL if a pair is an inverted filter, throws std::bad_alloc.
+ */
+frame_filter *compileFilter(const canid_t *ids, const canid_t *masks, int n);
+
+bool filterMatches(const frame_filter *f, canid_t id);
+
+/* sets keep[i] for the ids that pass, returns their number */
+int filterBatch(const frame_filter *f, const canid_t *ids, int n,
+		uint8_t *keep);
+
+#endif
@@ -0,0 +1,627 @@
+#include<atomic>
+#include<algorithm>
+#include<new>
+#include<unordered_map>
+#include<vector>
+
+#include<cstring>
+#include<cstdint>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <linux/can.h>
+#include <linux/can/gw.h>
+}
+
+#if defined(ANDROID) || defined(__ANDROID__)
+#include "jni.h"
+#else
+#include "de_entropia_can_FrameProtection.h"
+#endif
+
+#include "jniutil.h"
+
+/*
+ * End-to-end protection of CAN payloads the way the kernel CAN gateway
+ * (can-gw) applies it: an XOR and a table driven CRC8 checksum per CAN id,
+ * parameterized with the very structs of linux/can/gw.h and computed with
+ * the same index semantics and profiles, so frames protected here pass
+ * receivers that check against a can-gw job and vice versa. On top of that
+ * an alive counter per id may be placed into the payload before the
+ * checksums are computed, as AUTOSAR E2E profile 1 expects it for
+ * CGW_CRC8PRF_16U8.
+ *
+ * Rules of standard ids are found by direct indexing, those of extended ids
+ * by hashing. An instance must not be used from several threads at once.
+ */
+
+/* indices of the array filled by _stats */
+enum {
+	STAT_PROTECTED,
+	STAT_VERIFIED,
+	STAT_BAD_COUNTER,
+	STAT_BAD_XOR,
+	STAT_BAD_CRC8,
+	STAT_UNPROTECTED,
+	STAT_FIELDS
+};
+
+/* bits of the verification status of a frame, mirrored in Java */
+enum {
+	STATUS_BAD_COUNTER = 1,
+	STATUS_BAD_XOR = 2,
+	STATUS_BAD_CRC8 = 4,
+	STATUS_UNPROTECTED = 8
+};
+
+static const uint16_t NO_RULE = 0xffff;
+static const size_t MAX_RULES = NO_RULE;
+
+struct protect_rule {
+	canid_t key;
+	bool has_counter;
+	bool has_xor;
+	bool has_crc8;
+	int8_t counter_idx;
+	uint8_t counter_mask;
+	uint8_t counter_shift;
+	uint8_t counter_max_delta;
+	/* next counter to send */
+	uint8_t tx_counter;
+	bool rx_seen;
+	/* last counter received */
+	uint8_t rx_counter;
+	struct cgw_csum_xor xor_csum;
+	struct cgw_csum_crc8 crc8_csum;
+};
+
+struct frame_protection {
+	uint16_t sff[CAN_SFF_MASK + 1];
+	std::unordered_map<canid_t, uint16_t> eff;
+	std::vector<protect_rule> rules;
+	std::atomic<int64_t> stats[STAT_FIELDS];
+};
+
+static inline canid_t ruleKey(const canid_t can_id)
+{
+	return (can_id & CAN_EFF_FLAG) ?
+		can_id & (CAN_EFF_FLAG | CAN_EFF_MASK) : can_id & CAN_SFF_MASK;
+}
+
+static protect_rule *findRule(frame_protection *p, const canid_t can_id)
+{
+	uint16_t idx;
+	if (can_id & CAN_EFF_FLAG) {
+		if (p->eff.empty()) {
+			return NULL;
+		}
+		const auto it = p->eff.find(ruleKey(can_id));
+		if (it == p->eff.end()) {
+			return NULL;
+		}
+		idx = it->second;
+	} else {
+		idx = p->sff[can_id & CAN_SFF_MASK];
+	}
+	return idx == NO_RULE ? NULL : &p->rules[idx];
+}
+
+/* returns NULL with a pending exception if the rule table is full */
+static protect_rule *ruleFor(JNIEnv *env, frame_protection *p,
+			     const canid_t can_id)
+{
+	protect_rule *rule = findRule(p, can_id);
+	if (rule != NULL) {
+		return rule;
+	}
+	if (p->rules.size() == MAX_RULES) {
+		throwIllegalArgumentException(env, "too many protected ids");
+		return NULL;
+	}
+	const uint16_t idx = static_cast<uint16_t>(p->rules.size());
+	p->rules.push_back(protect_rule());
+	rule = &p->rules.back();
+	memset(rule, 0, sizeof(*rule));
+	rule->key = ruleKey(can_id);
+	if (can_id & CAN_EFF_FLAG) {
+		p->eff[rule->key] = idx;
+	} else {
+		p->sff[can_id & CAN_SFF_MASK] = idx;
+	}
+	return rule;
+}
+
+/* can-gw: negative indices count from the end of the payload */
+static inline int calcIdx(const int idx, const int len)
+{
+	return idx < 0 ? len + idx : idx;
+}
+
+/* the range check of cgw_chk_csum_parms for classic CAN */
+static inline bool validIdx(const int idx)
+{
+	return idx >= -CAN_MAX_DLEN && idx < CAN_MAX_DLEN;
+}
+
+/*
+ * cgw_csum_xor_rel: from_idx may be above to_idx, then the bytes are
+ * visited downwards. Returns the result index or -1 if an index falls
+ * before the payload.
+ */
+static int xorChecksum(const struct cgw_csum_xor& x, const uint8_t *data,
+		       const int len, uint8_t& value)
+{
+	const int from = calcIdx(x.from_idx, len);
+	const int to = calcIdx(x.to_idx, len);
+	const int res = calcIdx(x.result_idx, len);
+	if (from < 0 || to < 0 || res < 0) {
+		return -1;
+	}
+	uint8_t val = x.init_xor_val;
+	if (from <= to) {
+		for (int i = from; i <= to; i++) {
+			val ^= data[i];
+		}
+	} else {
+		for (int i = from; i >= to; i--) {
+			val ^= data[i];
+		}
+	}
+	value = val;
+	return res;
+}
+
+/* cgw_csum_crc8_rel including the profile specific trailing byte */
+static int crc8Checksum(const struct cgw_csum_crc8& c, const canid_t can_id,
+			const uint8_t *data, const int len, uint8_t& value)
+{
+	const int from = calcIdx(c.from_idx, len);
+	const int to = calcIdx(c.to_idx, len);
+	const int res = calcIdx(c.result_idx, len);
+	if (from < 0 || to < 0 || res < 0) {
+		return -1;
+	}
+	const uint8_t *const tab = c.crctab;
+	uint8_t crc = c.init_crc_val;
+	if (from <= to) {
+		for (int i = from; i <= to; i++) {
+			crc = tab[crc ^ data[i]];
+		}
+	} else {
+		for (int i = from; i >= to; i--) {
+			crc = tab[crc ^ data[i]];
+		}
+	}
+	switch (c.profile) {
+	case CGW_CRC8PRF_1U8:
+		crc = tab[crc ^ c.profile_data[0]];
+		break;
+	case CGW_CRC8PRF_16U8:
+		crc = tab[crc ^ c.profile_data[data[1] & 0xf]];
+		break;
+	case CGW_CRC8PRF_SFFID_XOR:
+		crc = tab[crc ^ (can_id & 0xff) ^ (can_id >> 8 & 0xff)];
+		break;
+	}
+	value = crc ^ c.final_xor_val;
+	return res;
+}
+
+static void protectFrame(protect_rule& rule, const canid_t can_id,
+			 uint8_t *data, const int len)
+{
+	uint8_t value;
+	if (rule.has_counter) {
+		const int idx = calcIdx(rule.counter_idx, len);
+		if (idx >= 0) {
+			data[idx] = (data[idx] & ~rule.counter_mask) |
+				((rule.tx_counter << rule.counter_shift) &
+				 rule.counter_mask);
+		}
+		rule.tx_counter = (rule.tx_counter + 1) &
+			(rule.counter_mask >> rule.counter_shift);
+	}
+	/* same order as can_can_gw_rcv */
+	if (rule.has_crc8) {
+		const int res = crc8Checksum(rule.crc8_csum, can_id, data, len,
+					     value);
+		if (res >= 0) {
+			data[res] = value;
+		}
+	}
+	if (rule.has_xor) {
+		const int res = xorChecksum(rule.xor_csum, data, len, value);
+		if (res >= 0) {
+			data[res] = value;
+		}
+	}
+}
+
+/*
+ * Recomputes the checksums over the received bytes. As the CRC8 is written
+ * first, a CRC8 range covering the XOR result cannot verify, the same
+ * restriction can-gw jobs have. A frame too short to hold a configured
+ * field fails that check.
+ */
+static int verifyFrame(protect_rule& rule, const canid_t can_id,
+		       const uint8_t *data, const int len)
+{
+	int status = 0;
+	uint8_t value;
+	if (rule.has_counter) {
+		const int idx = calcIdx(rule.counter_idx, len);
+		if (idx < 0) {
+			status |= STATUS_BAD_COUNTER;
+		} else {
+			const uint8_t range = rule.counter_mask >> rule.counter_shift;
+			const uint8_t counter =
+				(data[idx] & rule.counter_mask) >> rule.counter_shift;
+			if (rule.rx_seen) {
+				const uint8_t delta = (counter - rule.rx_counter) & range;
+				if (delta == 0 || delta > rule.counter_max_delta) {
+					status |= STATUS_BAD_COUNTER;
+				}
+			}
+			rule.rx_seen = true;
+			rule.rx_counter = counter;
+		}
+	}
+	if (rule.has_crc8) {
+		const int res = crc8Checksum(rule.crc8_csum, can_id, data, len,
+					     value);
+		if (res < 0 || data[res] != value) {
+			status |= STATUS_BAD_CRC8;
+		}
+	}
+	if (rule.has_xor) {
+		const int res = xorChecksum(rule.xor_csum, data, len, value);
+		if (res < 0 || data[res] != value) {
+			status |= STATUS_BAD_XOR;
+		}
+	}
+	return status;
+}
+
+static inline void statAdd(frame_protection *p, int stat, int64_t v)
+{
+	if (v != 0) {
+		p->stats[stat].fetch_add(v, std::memory_order_relaxed);
+	}
+}
+
+/* protects count frames, returns the number that matched a rule */
+template<typename Frames>
+static int64_t protectFrames(frame_protection *p, Frames& frames,
+			     const int count)
+{
+	int64_t done = 0;
+	for (int i = 0; i < count; i++) {
+		const canid_t can_id = frames.canId(i);
+		protect_rule *const rule = findRule(p, can_id);
+		if (rule != NULL) {
+			protectFrame(*rule, can_id, frames.data(i), frames.len(i));
+			done++;
+		}
+	}
+	statAdd(p, STAT_PROTECTED, done);
+	return done;
+}
+
+template<typename Frames>
+static jint verifyFrames(frame_protection *p, Frames& frames,
+			 const int count, jbyte *status)
+{
+	int64_t counts[STAT_FIELDS] = { 0 };
+	jint failed = 0;
+	for (int i = 0; i < count; i++) {
+		const canid_t can_id = frames.canId(i);
+		protect_rule *const rule = findRule(p, can_id);
+		int s;
+		if (rule == NULL) {
+			s = STATUS_UNPROTECTED;
+			counts[STAT_UNPROTECTED]++;
+		} else {
+			s = verifyFrame(*rule, can_id, frames.data(i),
+					frames.len(i));
+			counts[STAT_VERIFIED]++;
+			counts[STAT_BAD_COUNTER] += (s & STATUS_BAD_COUNTER) != 0;
+			counts[STAT_BAD_XOR] += (s & STATUS_BAD_XOR) != 0;
+			counts[STAT_BAD_CRC8] += (s & STATUS_BAD_CRC8) != 0;
+			failed += s != 0;
+		}
+		status[i] = static_cast<jbyte>(s);
+	}
+	for (int f = 0; f < STAT_FIELDS; f++) {
+		statAdd(p, f, counts[f]);
+	}
+	return failed;
+}
+
+/* CanFrameBatch columns copied out of the Java arrays */
+struct array_frames {
+	std::vector<jint> can_ids;
+	std::vector<jbyte> dlcs;
+	std::vector<uint8_t> payload;
+
+	canid_t canId(const int i) const
+	{
+		return static_cast<canid_t>(can_ids[i]);
+	}
+
+	uint8_t *data(const int i)
+	{
+		return &payload[i * CAN_MAX_DLEN];
+	}
+
+	int len(const int i) const
+	{
+		return std::max(0, std::min<int>(dlcs[i], CAN_MAX_DLEN));
+	}
+};
+
+/* frames of a DirectFrameBatch, modified in place */
+struct direct_frames {
+	struct can_frame *frames;
+
+	canid_t canId(const int i) const
+	{
+		return frames[i].can_id;
+	}
+
+	uint8_t *data(const int i)
+	{
+		return frames[i].data;
+	}
+
+	int len(const int i) const
+	{
+		return std::min<int>(frames[i].can_dlc, CAN_MAX_DLEN);
+	}
+};
+
+static thread_local array_frames scratch;
+
+static bool loadFrames(JNIEnv *env, jintArray canIds, jbyteArray dlcs,
+		       jbyteArray data, const jint count)
+{
+	if (count < 0 || env->GetArrayLength(canIds) < count ||
+	    env->GetArrayLength(dlcs) < count ||
+	    env->GetArrayLength(data) / CAN_MAX_DLEN < count) {
+		throwIllegalArgumentException(env, "illegal batch size");
+		return false;
+	}
+	array_frames& s = scratch;
+	if (s.can_ids.size() < static_cast<size_t>(count)) {
+		s.can_ids.resize(count);
+		s.dlcs.resize(count);
+		s.payload.resize(count * CAN_MAX_DLEN);
+	}
+	env->GetIntArrayRegion(canIds, 0, count, s.can_ids.data());
+	env->GetByteArrayRegion(dlcs, 0, count, s.dlcs.data());
+	env->GetByteArrayRegion(data, 0, count * CAN_MAX_DLEN,
+				reinterpret_cast<jbyte *>(s.payload.data()));
+	return env->ExceptionCheck() != JNI_TRUE;
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_FrameProtection__1create
+(JNIEnv *env, jclass clazz)
+{
+	frame_protection *const p = new (std::nothrow) frame_protection();
+	if (p == NULL) {
+		throwOutOfMemoryError(env, "could not allocate frame protection");
+		return 0;
+	}
+	std::fill(p->sff, p->sff + CAN_SFF_MASK + 1, NO_RULE);
+	for (int i = 0; i < STAT_FIELDS; i++) {
+		p->stats[i].store(0, std::memory_order_relaxed);
+	}
+	return reinterpret_cast<jlong>(p);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_FrameProtection__1free
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	delete reinterpret_cast<frame_protection *>(handle);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_FrameProtection__1setCounter
+(JNIEnv *env, jclass clazz, jlong handle, jint canId, jint index, jint mask,
+ jint maxDelta)
+{
+	frame_protection *const p = reinterpret_cast<frame_protection *>(handle);
+	if (!validIdx(index) || mask <= 0 || mask > 0xff) {
+		throwIllegalArgumentException(env, "illegal counter position");
+		return;
+	}
+	const int shift = __builtin_ctz(mask);
+	const int range = mask >> shift;
+	if ((range & (range + 1)) != 0) {
+		throwIllegalArgumentException(env, "counter mask not contiguous");
+		return;
+	}
+	if (maxDelta < 1 || maxDelta > range) {
+		throwIllegalArgumentException(env, "illegal counter delta");
+		return;
+	}
+	protect_rule *const rule = ruleFor(env, p, canId);
+	if (rule == NULL) {
+		return;
+	}
+	rule->has_counter = true;
+	rule->counter_idx = static_cast<int8_t>(index);
+	rule->counter_mask = static_cast<uint8_t>(mask);
+	rule->counter_shift = static_cast<uint8_t>(shift);
+	rule->counter_max_delta = static_cast<uint8_t>(maxDelta);
+	rule->tx_counter = 0;
+	rule->rx_seen = false;
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_FrameProtection__1setXor
+(JNIEnv *env, jclass clazz, jlong handle, jint canId, jint from, jint to,
+ jint result, jint init)
+{
+	frame_protection *const p = reinterpret_cast<frame_protection *>(handle);
+	if (!validIdx(from) || !validIdx(to) || !validIdx(result)) {
+		throwIllegalArgumentException(env, "illegal checksum index");
+		return;
+	}
+	protect_rule *const rule = ruleFor(env, p, canId);
+	if (rule == NULL) {
+		return;
+	}
+	rule->has_xor = true;
+	rule->xor_csum.from_idx = static_cast<__s8>(from);
+	rule->xor_csum.to_idx = static_cast<__s8>(to);
+	rule->xor_csum.result_idx = static_cast<__s8>(result);
+	rule->xor_csum.init_xor_val = static_cast<__u8>(init);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_FrameProtection__1setCrc8
+(JNIEnv *env, jclass clazz, jlong handle, jint canId, jint from, jint to,
+ jint result, jint init, jint finalXor, jbyteArray table, jint profile,
+ jbyteArray profileData)
+{
+	frame_protection *const p = reinterpret_cast<frame_protection *>(handle);
+	struct cgw_csum_crc8 crc8;
+	memset(&crc8, 0, sizeof(crc8));
+	if (!validIdx(from) || !validIdx(to) || !validIdx(result)) {
+		throwIllegalArgumentException(env, "illegal checksum index");
+		return;
+	}
+	if (profile < CGW_CRC8PRF_UNSPEC || profile > CGW_CRC8PRF_MAX) {
+		throwIllegalArgumentException(env, "unknown crc8 profile");
+		return;
+	}
+	const jsize profile_len = env->GetArrayLength(profileData);
+	if (env->GetArrayLength(table) != sizeof(crc8.crctab) ||
+	    profile_len > static_cast<jsize>(sizeof(crc8.profile_data))) {
+		throwIllegalArgumentException(env, "illegal crc8 table or profile "
+					      "data");
+		return;
+	}
+	env->GetByteArrayRegion(table, 0, sizeof(crc8.crctab),
+				reinterpret_cast<jbyte *>(crc8.crctab));
+	env->GetByteArrayRegion(profileData, 0, profile_len,
+				reinterpret_cast<jbyte *>(crc8.profile_data));
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return;
+	}
+	protect_rule *const rule = ruleFor(env, p, canId);
+	if (rule == NULL) {
+		return;
+	}
+	crc8.from_idx = static_cast<__s8>(from);
+	crc8.to_idx = static_cast<__s8>(to);
+	crc8.result_idx = static_cast<__s8>(result);
+	crc8.init_crc_val = static_cast<__u8>(init);
+	crc8.final_xor_val = static_cast<__u8>(finalXor);
+	crc8.profile = static_cast<__u8>(profile);
+	rule->has_crc8 = true;
+	rule->crc8_csum = crc8;
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_FrameProtection__1protectFrame
+(JNIEnv *env, jclass clazz, jlong handle, jint canId, jbyteArray data)
+{
+	frame_protection *const p = reinterpret_cast<frame_protection *>(handle);
+	protect_rule *const rule = findRule(p, canId);
+	if (rule == NULL) {
+		return 0;
+	}
+	uint8_t payload[CAN_MAX_DLEN];
+	const jsize len = std::min<jsize>(env->GetArrayLength(data),
+					  CAN_MAX_DLEN);
+	memset(payload, 0, sizeof(payload));
+	env->GetByteArrayRegion(data, 0, len,
+				reinterpret_cast<jbyte *>(payload));
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return 0;
+	}
+	protectFrame(*rule, canId, payload, len);
+	env->SetByteArrayRegion(data, 0, len,
+				reinterpret_cast<const jbyte *>(payload));
+	statAdd(p, STAT_PROTECTED, 1);
+	return 1;
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_FrameProtection__1protect
+(JNIEnv *env, jclass clazz, jlong handle, jintArray canIds, jbyteArray dlcs,
+ jbyteArray data, jint count)
+{
+	frame_protection *const p = reinterpret_cast<frame_protection *>(handle);
+	if (!loadFrames(env, canIds, dlcs, data, count)) {
+		return 0;
+	}
+	const int64_t done = protectFrames(p, scratch, count);
+	if (done > 0) {
+		env->SetByteArrayRegion(data, 0, count * CAN_MAX_DLEN,
+					reinterpret_cast<const jbyte *>(
+						scratch.payload.data()));
+	}
+	return static_cast<jint>(done);
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_FrameProtection__1protectDirect
+(JNIEnv *env, jclass clazz, jlong handle, jobject buffer, jint count)
+{
+	frame_protection *const p = reinterpret_cast<frame_protection *>(handle);
+	void *const address = env->GetDirectBufferAddress(buffer);
+	if (address == NULL) {
+		throwIllegalArgumentException(env, "no direct buffer access");
+		return 0;
+	}
+	direct_frames frames = { static_cast<struct can_frame *>(address) };
+	return static_cast<jint>(protectFrames(p, frames, count));
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_FrameProtection__1verify
+(JNIEnv *env, jclass clazz, jlong handle, jintArray canIds, jbyteArray dlcs,
+ jbyteArray data, jint count, jbyteArray status)
+{
+	frame_protection *const p = reinterpret_cast<frame_protection *>(handle);
+	if (!loadFrames(env, canIds, dlcs, data, count)) {
+		return 0;
+	}
+	if (env->GetArrayLength(status) < count) {
+		throwIllegalArgumentException(env, "status array too short");
+		return 0;
+	}
+	std::vector<jbyte> out(count);
+	const jint failed = verifyFrames(p, scratch, count, out.data());
+	env->SetByteArrayRegion(status, 0, count, out.data());
+	return failed;
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_FrameProtection__1verifyDirect
+(JNIEnv *env, jclass clazz, jlong handle, jobject buffer, jint count,
+ jbyteArray status)
+{
+	frame_protection *const p = reinterpret_cast<frame_protection *>(handle);
+	if (env->GetArrayLength(status) < count) {
+		throwIllegalArgumentException(env, "status array too short");
+		return 0;
+	}
+	void *const address = env->GetDirectBufferAddress(buffer);
+	if (address == NULL) {
+		throwIllegalArgumentException(env, "no direct buffer access");
+		return 0;
+	}
+	direct_frames frames = { static_cast<struct can_frame *>(address) };
+	std::vector<jbyte> out(count);
+	const jint failed = verifyFrames(p, frames, count, out.data());
+	env->SetByteArrayRegion(status, 0, count, out.data());
+	return failed;
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_FrameProtection__1stats
+(JNIEnv *env, jclass clazz, jlong handle, jlongArray out)
+{
+	frame_protection *const p = reinterpret_cast<frame_protection *>(handle);
+	jlong values[STAT_FIELDS];
+	for (int i = 0; i < STAT_FIELDS; i++) {
+		values[i] = p->stats[i].load(std::memory_order_relaxed);
+	}
+	env->SetLongArrayRegion(out, 0, STAT_FIELDS, values);
+}
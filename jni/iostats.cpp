@@ -0,0 +1,99 @@
+#include<mutex>
+#include<new>
+#include<vector>
+
+#include<cstring>
+#include<ctime>
+
+#include "iostats.h"
+#include "clocks.h"
+
+static std::atomic<unsigned> next_shard(0);
+static thread_local int thread_shard = -1;
+static thread_local unsigned sample_tick = 0;
+static io_shard scratch_shard;
+
+/*
+ * Released counters are recycled instead of freed: a send or receive still
+ * running while its socket is closed may then at worst count into the
+ * counters of a newer socket, but never touches freed memory.
+ */
+static std::mutex released_lock;
+static std::vector<io_stats *> released;
+
+io_stats *newIoStats()
+{
+	io_stats *stats = NULL;
+	{
+		std::lock_guard<std::mutex> guard(released_lock);
+		if (!released.empty()) {
+			stats = released.back();
+			released.pop_back();
+		}
+	}
+	if (stats == NULL) {
+		stats = new (std::nothrow) io_stats();
+		if (stats == NULL) {
+			return NULL;
+		}
+	}
+	for (int s = 0; s < IO_SHARDS; s++) {
+		for (int f = 0; f < IO_FIELDS; f++) {
+			stats->shards[s].v[f].store(0, std::memory_order_relaxed);
+		}
+	}
+	stats->shaper.store(NULL, std::memory_order_relaxed);
+	stats->shaper_readers.store(0, std::memory_order_relaxed);
+	stats->wake_fd = -1;
+	stats->closed.store(false, std::memory_order_relaxed);
+	return stats;
+}
+
+void freeIoStats(io_stats *stats)
+{
+	std::lock_guard<std::mutex> guard(released_lock);
+	try {
+		released.push_back(stats);
+	} catch (const std::bad_alloc&) {
+		/* leak rather than free memory that may still be in use */
+	}
+}
+
+void readIoStats(const io_stats *stats, int64_t out[IO_FIELDS])
+{
+	memset(out, 0, sizeof(int64_t) * IO_FIELDS);
+	for (int s = 0; s < IO_SHARDS; s++) {
+		for (int f = 0; f < IO_FIELDS; f++) {
+			out[f] += stats->shards[s].v[f].load(std::memory_order_relaxed);
+		}
+	}
+}
+
+io_shard& ioShard(io_stats *stats)
+{
+	if (stats == NULL) {
+		return scratch_shard;
+	}
+	if (thread_shard < 0) {
+		thread_shard = next_shard.fetch_add(1, std::memory_order_relaxed) %
+			IO_SHARDS;
+	}
+	return stats->shards[thread_shard];
+}
+
+io_timer::io_timer(io_shard& shard, int nanos_field)
+	: shard(shard), field(nanos_field), start(0)
+{
+	if (sample_tick++ % IO_SAMPLE_PERIOD == 0) {
+		start = monotonicNanos();
+	}
+}
+
+io_timer::~io_timer()
+{
+	if (start != 0) {
+		ioAdd(shard, field, monotonicNanos() - start);
+		/* the samples counter follows the nanos counter */
+		ioAdd(shard, field + 1, 1);
+	}
+}
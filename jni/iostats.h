@@ -0,0 +1,87 @@
+#ifndef IOSTATS_H
+#define IOSTATS_H
+
+#include<atomic>
+#include<cstdint>
+#include<cerrno>
+
+/* counters of SocketStats, the Java side mirrors these indices */
+enum {
+	IO_FRAMES_IN,
+	IO_BYTES_IN,
+	IO_FRAMES_OUT,
+	IO_BYTES_OUT,
+	IO_RECV_CALLS,
+	IO_SEND_CALLS,
+	IO_WOULD_BLOCK,
+	IO_NO_BUFFER,
+	IO_RECV_NANOS,
+	IO_RECV_SAMPLES,
+	IO_SEND_NANOS,
+	IO_SEND_SAMPLES,
+	IO_EXCEPTIONS,
+	IO_FIELDS
+};
+
+/* number of counter stripes per socket, threads pick one round robin */
+static const int IO_SHARDS = 16;
+/* every IO_SAMPLE_PERIOD-th native send or receive of a thread is timed */
+static const unsigned IO_SAMPLE_PERIOD = 64;
+
+struct tx_shaper;
+
+struct alignas(64) io_shard {
+	std::atomic<uint64_t> v[IO_FIELDS];
+};
+
+/*
+ * Counters of one socket. Every thread updates its own stripe, so threads
+ * sharing a socket do not bounce cache lines; readers sum all stripes.
+ */
+struct io_stats {
+	io_shard shards[IO_SHARDS];
+	/* transmit shaping of the socket, NULL if none is attached */
+	std::atomic<tx_shaper *> shaper;
+	/* senders between loading and retaining shaper, see acquireShaper */
+	std::atomic<int> shaper_readers;
+	/* eventfd signalled when the socket is closed, wakes blocked readers */
+	int wake_fd;
+	/* set along with wake_fd, checked by receivers spinning without poll */
+	std::atomic<bool> closed;
+};
+
+io_stats *newIoStats();
+/* hands the counters back for reuse by a later newIoStats */
+void freeIoStats(io_stats *stats);
+void readIoStats(const io_stats *stats, int64_t out[IO_FIELDS]);
+
+/* stripe of the calling thread, a scratch stripe if stats is NULL */
+io_shard& ioShard(io_stats *stats);
+
+static inline void ioAdd(io_shard& shard, int field, uint64_t n)
+{
+	shard.v[field].fetch_add(n, std::memory_order_relaxed);
+}
+
+/* counts a failed send that is worth retrying */
+static inline void countSendError(io_shard& shard, const int err)
+{
+	if (err == ENOBUFS) {
+		ioAdd(shard, IO_NO_BUFFER, 1);
+	} else if (err == EAGAIN || err == EWOULDBLOCK) {
+		ioAdd(shard, IO_WOULD_BLOCK, 1);
+	}
+}
+
+/* times the enclosing scope if it is the sampled call of this thread */
+class io_timer {
+public:
+	io_timer(io_shard& shard, int nanos_field);
+	~io_timer();
+private:
+	io_shard& shard;
+	const int field;
+	int64_t start;
+};
+
+#endif
@@ -0,0 +1,327 @@
+#include<algorithm>
+#include<memory>
+#include<new>
+#include<vector>
+
+#include<cstring>
+#include<cstddef>
+#include<cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/j1939.h>
+}
+
+#if defined(ANDROID) || defined(__ANDROID__)
+#include "jni.h"
+#else
+#include "de_entropia_can_CanSocket.h"
+#endif
+
+#include "jniutil.h"
+#include "canio.h"
+#include "iostats.h"
+
+/*
+ * J1939 sockets of the kernel CAN_J1939 protocol. The kernel does address
+ * claiming bookkeeping, segmentation into TP and ETP sessions, BAM pacing
+ * and reassembly, so one send or receive here moves a whole message.
+ *
+ * The sockaddr_can of include/socketcan/can.h predates J1939 and lacks the
+ * can_addr.j1939 member; the kernel insists on the full size, so the J1939
+ * calls use this equivalent layout instead of widening the struct for all
+ * other protocols.
+ */
+struct sockaddr_j1939 {
+	sa_family_t can_family;
+	int can_ifindex;
+	union {
+		struct {
+			__u64 name;
+			__u32 pgn;
+			__u8 addr;
+		} j1939;
+		struct {
+			canid_t rx_id, tx_id;
+		} tp;
+	} can_addr;
+};
+
+static_assert(offsetof(struct sockaddr_j1939, can_addr) ==
+	      offsetof(struct sockaddr_can, can_addr),
+	      "J1939 address must extend struct sockaddr_can");
+
+/* largest message of the extended transport protocol */
+static const int J1939_MAX_ETP_SIZE = 7 * 0xffffff;
+
+/* message buffers up to this size stay cached per thread between calls */
+static const size_t MESSAGE_BUF_CACHED = 64 * 1024;
+
+static thread_local std::vector<jbyte> message_buf;
+
+static void j1939Address(struct sockaddr_j1939& addr, const jint ifIndex,
+			 const jlong name, const jint pgn, const jint sa)
+{
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifIndex;
+	addr.can_addr.j1939.name = static_cast<__u64>(name);
+	addr.can_addr.j1939.pgn = static_cast<__u32>(pgn);
+	addr.can_addr.j1939.addr = static_cast<__u8>(sa);
+}
+
+/*
+ * Buffer of at least size bytes: the cached one of the thread, or for
+ * larger messages one held by spill until the call returns, so a single
+ * ETP transfer does not pin megabytes to the thread. NULL if that
+ * allocation fails.
+ */
+static jbyte *messageBuffer(std::unique_ptr<jbyte[]>& spill, const size_t size)
+{
+	if (size > MESSAGE_BUF_CACHED) {
+		spill.reset(new (std::nothrow) jbyte[size]);
+		return spill.get();
+	}
+	if (message_buf.size() < size) {
+		message_buf.resize(size);
+	}
+	return message_buf.data();
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_CanSocket__1bindJ1939
+(JNIEnv *env, jclass obj, jint fd, jint ifIndex, jlong name, jint pgn,
+ jint addr)
+{
+	struct sockaddr_j1939 sa;
+	j1939Address(sa, ifIndex, name, pgn, addr);
+	if (bind(fd, reinterpret_cast<struct sockaddr *>(&sa), sizeof(sa)) != 0) {
+		throwIOExceptionErrno(env, errno);
+	}
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_CanSocket__1connectJ1939
+(JNIEnv *env, jclass obj, jint fd, jint ifIndex, jlong name, jint pgn,
+ jint addr)
+{
+	struct sockaddr_j1939 sa;
+	j1939Address(sa, ifIndex, name, pgn, addr);
+	if (connect(fd, reinterpret_cast<struct sockaddr *>(&sa),
+		    sizeof(sa)) != 0) {
+		throwIOExceptionErrno(env, errno);
+	}
+}
+
+/* SO_BROADCAST does not collide with the SO_J1939 option numbers */
+JNIEXPORT void JNICALL Java_de_entropia_can_CanSocket__1setsockoptJ1939
+(JNIEnv *env, jclass obj, jint fd, jint op, jint value)
+{
+	const int level = op == SO_BROADCAST ? SOL_SOCKET : SOL_CAN_J1939;
+	const int _value = value;
+	if (setsockopt(fd, level, op, &_value, sizeof(_value)) == -1) {
+		throwIOExceptionErrno(env, errno);
+	}
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1getsockoptJ1939
+(JNIEnv *env, jclass obj, jint fd, jint op)
+{
+	const int level = op == SO_BROADCAST ? SOL_SOCKET : SOL_CAN_J1939;
+	int value = 0;
+	socklen_t len = sizeof(value);
+	if (getsockopt(fd, level, op, &value, &len) == -1) {
+		throwIOExceptionErrno(env, errno);
+		return -1;
+	}
+	return value;
+}
+
+/*
+ * Sends data[off, off + len) as one J1939 message, to the given address or
+ * to the peer the socket is connected to.
+ */
+JNIEXPORT void JNICALL Java_de_entropia_can_CanSocket__1sendJ1939
+(JNIEnv *env, jclass obj, jint fd, jlong stats, jboolean toAddress,
+ jint ifIndex, jlong name, jint pgn, jint addr, jbyteArray data, jint off,
+ jint len)
+{
+	io_shard& shard = ioShard(reinterpret_cast<io_stats *>(stats));
+	io_timer timer(shard, IO_SEND_NANOS);
+	if (off < 0 || len < 0 || off > env->GetArrayLength(data) - len) {
+		throwIllegalArgumentException(env, "illegal message range");
+		return;
+	}
+	if (len > J1939_MAX_ETP_SIZE) {
+		throwIllegalArgumentException(env, "message too long for ETP");
+		return;
+	}
+	std::unique_ptr<jbyte[]> spill;
+	jbyte *const buf = messageBuffer(spill, std::max(len, 1));
+	if (buf == NULL) {
+		throwOutOfMemoryError(env, "could not allocate message buffer");
+		return;
+	}
+	env->GetByteArrayRegion(data, off, len, buf);
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return;
+	}
+	ssize_t nbytes;
+	if (toAddress) {
+		struct sockaddr_j1939 sa;
+		j1939Address(sa, ifIndex, name, pgn, addr);
+		nbytes = sendto(fd, buf, len, 0,
+				reinterpret_cast<struct sockaddr *>(&sa),
+				sizeof(sa));
+	} else {
+		nbytes = send(fd, buf, len, 0);
+	}
+	ioAdd(shard, IO_SEND_CALLS, 1);
+	if (nbytes == -1) {
+		const int err = errno;
+		if (err == ENOBUFS) {
+			ioAdd(shard, IO_NO_BUFFER, 1);
+		}
+		ioAdd(shard, IO_EXCEPTIONS, 1);
+		throwIOExceptionErrno(env, err);
+		return;
+	} else if (nbytes != len) {
+		ioAdd(shard, IO_EXCEPTIONS, 1);
+		throwIOExceptionMsg(env, "send partial message");
+		return;
+	}
+	ioAdd(shard, IO_FRAMES_OUT, 1);
+	ioAdd(shard, IO_BYTES_OUT, len);
+}
+
+/*
+ * Receives one message of at most capacity bytes together with its source
+ * from the address and its destination and priority from the control
+ * messages the kernel attaches to every J1939 message.
+ */
+JNIEXPORT jobject JNICALL Java_de_entropia_can_CanSocket__1recvJ1939
+(JNIEnv *env, jclass obj, jint fd, jlong stats, jint capacity)
+{
+	io_stats *const io = reinterpret_cast<io_stats *>(stats);
+	io_shard& shard = ioShard(io);
+	io_timer timer(shard, IO_RECV_NANOS);
+	if (capacity < 0 || capacity > J1939_MAX_ETP_SIZE) {
+		throwIllegalArgumentException(env, "illegal message capacity");
+		return NULL;
+	}
+	std::unique_ptr<jbyte[]> spill;
+	jbyte *const buf = messageBuffer(spill, std::max(capacity, 1));
+	if (buf == NULL) {
+		throwOutOfMemoryError(env, "could not allocate message buffer");
+		return NULL;
+	}
+	struct sockaddr_j1939 sa;
+	struct iovec iov;
+	struct msghdr msg;
+	char ctrl[CMSG_SPACE(sizeof(__u8)) * 2 + CMSG_SPACE(sizeof(__u64))];
+	ssize_t nbytes;
+	/* wait in poll rather than in recvmsg, so close can wake us */
+	for (;;) {
+		memset(&sa, 0, sizeof(sa));
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf;
+		iov.iov_len = capacity;
+		msg.msg_name = &sa;
+		msg.msg_namelen = sizeof(sa);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+		/* J1939 rejects MSG_TRUNC, msg_flags still reports truncation */
+		nbytes = recvmsg(fd, &msg, MSG_DONTWAIT);
+		ioAdd(shard, IO_RECV_CALLS, 1);
+		if (nbytes != -1 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			break;
+		}
+		if (!awaitReadable(env, fd, io)) {
+			return NULL;
+		}
+	}
+	if (nbytes == -1) {
+		ioAdd(shard, IO_EXCEPTIONS, 1);
+		throwIOExceptionErrno(env, errno);
+		return NULL;
+	}
+	if (nbytes > capacity || (msg.msg_flags & MSG_TRUNC)) {
+		ioAdd(shard, IO_EXCEPTIONS, 1);
+		throwIOExceptionMsg(env, "message exceeds capacity of " +
+				    std::to_string(capacity) + " bytes");
+		return NULL;
+	}
+	jint dst_addr = J1939_NO_ADDR;
+	jlong dst_name = J1939_NO_NAME;
+	jint priority = -1;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_CAN_J1939) {
+			continue;
+		}
+		switch (cmsg->cmsg_type) {
+		case SCM_J1939_DEST_ADDR:
+			dst_addr = *CMSG_DATA(cmsg);
+			break;
+		case SCM_J1939_DEST_NAME: {
+			__u64 value;
+			memcpy(&value, CMSG_DATA(cmsg), sizeof(value));
+			dst_name = static_cast<jlong>(value);
+			break;
+		}
+		case SCM_J1939_PRIO:
+			priority = *CMSG_DATA(cmsg);
+			break;
+		}
+	}
+	ioAdd(shard, IO_FRAMES_IN, 1);
+	ioAdd(shard, IO_BYTES_IN, nbytes);
+
+	const jclass clazz = env->FindClass("de/entropia/can/J1939Message");
+	if (clazz == NULL) {
+		return NULL;
+	}
+	const jmethodID cstr = env->GetMethodID(clazz, "<init>",
+						"(IJIIJII[B)V");
+	if (cstr == NULL) {
+		return NULL;
+	}
+	const jbyteArray data = env->NewByteArray(static_cast<jsize>(nbytes));
+	if (data == NULL) {
+		if (env->ExceptionCheck() != JNI_TRUE) {
+			throwOutOfMemoryError(env, "could not allocate ByteArray");
+		}
+		return NULL;
+	}
+	env->SetByteArrayRegion(data, 0, static_cast<jsize>(nbytes), buf);
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return NULL;
+	}
+	return env->NewObject(clazz, cstr, sa.can_ifindex,
+			      static_cast<jlong>(sa.can_addr.j1939.name),
+			      static_cast<jint>(sa.can_addr.j1939.pgn),
+			      static_cast<jint>(sa.can_addr.j1939.addr),
+			      dst_name, dst_addr, priority, data);
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1fetch_1SO_1J1939_1PROMISC
+(JNIEnv *env, jclass obj)
+{
+	return SO_J1939_PROMISC;
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1fetch_1SO_1J1939_1SEND_1PRIO
+(JNIEnv *env, jclass obj)
+{
+	return SO_J1939_SEND_PRIO;
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_CanSocket__1fetch_1SO_1BROADCAST
+(JNIEnv *env, jclass obj)
+{
+	return SO_BROADCAST;
+}
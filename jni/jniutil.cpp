@@ -0,0 +1,77 @@
+#include<string>
+
+#include<cstdio>
+#include<cstring>
+
+#include "jniutil.h"
+
+static const int ERRNO_BUFFER_LEN = 1024;
+
+void throwException(JNIEnv *env, const std::string& exception_name,
+		    const std::string& msg)
+{
+	const jclass exception = env->FindClass(exception_name.c_str());
+	if (exception == NULL) {
+		return;
+	}
+	env->ThrowNew(exception, msg.c_str());
+}
+
+void throwIOExceptionMsg(JNIEnv *env, const std::string& msg)
+{
+	throwException(env, "java/io/IOException", msg);
+}
+
+void throwIOExceptionErrno(JNIEnv *env, const int exc_errno)
+{
+	char message[ERRNO_BUFFER_LEN];
+	const char *const msg = (char *) strerror_r(exc_errno, message, ERRNO_BUFFER_LEN);
+	if (((long)msg) == 0) {
+		// POSIX strerror_r, success
+		throwIOExceptionMsg(env, std::string(message));
+	} else if (((long)msg) == -1) {
+		// POSIX strerror_r, failure
+		// (Strictly, POSIX only guarantees a value other than 0. The safest
+		// way to implement this function is to use C++ and overload on the
+		// type of strerror_r to accurately distinguish GNU from POSIX. But
+		// realistic implementations will always return -1.)
+		snprintf(message, ERRNO_BUFFER_LEN, "errno %d", exc_errno);
+		throwIOExceptionMsg(env, std::string(message));
+	} else {
+		// glibc strerror_r returning a string
+		throwIOExceptionMsg(env, std::string(msg));
+	}
+}
+
+void throwIllegalArgumentException(JNIEnv *env, const std::string& message)
+{
+	throwException(env, "java/lang/IllegalArgumentException", message);
+}
+
+void throwIllegalStateException(JNIEnv *env, const std::string& message)
+{
+	throwException(env, "java/lang/IllegalStateException", message);
+}
+
+void throwAsynchronousCloseException(JNIEnv *env)
+{
+	/* no message constructor, so ThrowNew does not apply */
+	const jclass exception =
+		env->FindClass("java/nio/channels/AsynchronousCloseException");
+	if (exception == NULL) {
+		return;
+	}
+	const jmethodID cstr = env->GetMethodID(exception, "<init>", "()V");
+	if (cstr == NULL) {
+		return;
+	}
+	const jobject e = env->NewObject(exception, cstr);
+	if (e != NULL) {
+		env->Throw(static_cast<jthrowable>(e));
+	}
+}
+
+void throwOutOfMemoryError(JNIEnv *env, const std::string& message)
+{
+    	throwException(env, "java/lang/OutOfMemoryError", message);
+}
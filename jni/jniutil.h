@@ -0,0 +1,18 @@
+#ifndef JNIUTIL_H
+#define JNIUTIL_H
+
+#include<string>
+
+#include "jni.h"
+
+void throwException(JNIEnv *env, const std::string& exception_name,
+		    const std::string& msg);
+void throwIOExceptionMsg(JNIEnv *env, const std::string& msg);
+void throwIOExceptionErrno(JNIEnv *env, const int exc_errno);
+void throwIllegalArgumentException(JNIEnv *env, const std::string& message);
+void throwIllegalStateException(JNIEnv *env, const std::string& message);
+/* for a blocking call cut short because its socket was closed */
+void throwAsynchronousCloseException(JNIEnv *env);
+void throwOutOfMemoryError(JNIEnv *env, const std::string& message);
+
+#endif
@@ -0,0 +1,298 @@
+#include<atomic>
+#include<algorithm>
+#include<new>
+
+#include<cstring>
+#include<cstdint>
+#include<cerrno>
+#include<ctime>
+
+extern "C" {
+#include <stdlib.h>
+}
+
+#if defined(ANDROID) || defined(__ANDROID__)
+#include "jni.h"
+#else
+#include "de_entropia_can_LatestValueTable.h"
+#endif
+
+#include "jniutil.h"
+#include "canio.h"
+#include "clocks.h"
+
+/*
+ * One cache line per CAN id. Standard ids are indexed directly, extended
+ * ids live in an open addressing table whose slots are claimed on first
+ * use and never released.
+ *
+ * Every slot is guarded by a seqlock: writers make seq odd, update the
+ * payload and make it even again, readers retry until they saw the same
+ * even value before and after copying. seq / 2 thus counts the updates.
+ * Several receive threads may feed one table, writers of the same slot
+ * serialize on the odd sequence number.
+ *
+ * Remote and error frames are not stored: they share the id of the data
+ * frame whose slot they would overwrite without carrying its payload.
+ */
+
+static const size_t SFF_SLOTS = CAN_SFF_MASK + 1;
+
+/* indices of the meta array filled by _read */
+enum {
+	META_CAN_ID,
+	META_IF_INDEX,
+	META_DLC,
+	META_TIMESTAMP,
+	META_UPDATES,
+	META_FIELDS
+};
+
+struct alignas(64) value_slot {
+	std::atomic<uint64_t> seq;
+	std::atomic<uint32_t> key;
+	std::atomic<uint32_t> can_id;
+	std::atomic<int32_t> if_index;
+	std::atomic<uint32_t> dlc;
+	std::atomic<int64_t> timestamp;
+	std::atomic<uint64_t> data;
+};
+
+struct value_table {
+	value_slot *slots;
+	size_t eff_mask;
+	std::atomic<uint64_t> overflows;
+};
+
+static inline uint32_t hashId(uint32_t id)
+{
+	id ^= id >> 16;
+	id *= 0x7feb352dU;
+	id ^= id >> 15;
+	id *= 0x846ca68bU;
+	id ^= id >> 16;
+	return id;
+}
+
+/* returns NULL for unknown extended ids unless create is set */
+static value_slot *lookupSlot(value_table *table, uint32_t can_id,
+			      bool create)
+{
+	if (!(can_id & CAN_EFF_FLAG)) {
+		return &table->slots[can_id & CAN_SFF_MASK];
+	}
+	const uint32_t key = can_id & (CAN_EFF_FLAG | CAN_EFF_MASK);
+	value_slot *const eff = table->slots + SFF_SLOTS;
+	size_t pos = hashId(key) & table->eff_mask;
+	for (size_t probe = 0; probe <= table->eff_mask; probe++) {
+		value_slot *const slot = &eff[pos];
+		uint32_t cur = slot->key.load(std::memory_order_acquire);
+		if (cur == key) {
+			return slot;
+		}
+		if (cur == 0) {
+			if (!create) {
+				return NULL;
+			}
+			if (slot->key.compare_exchange_strong(cur, key,
+							      std::memory_order_acq_rel) ||
+			    cur == key) {
+				return slot;
+			}
+		}
+		pos = (pos + 1) & table->eff_mask;
+	}
+	if (create) {
+		table->overflows.fetch_add(1, std::memory_order_relaxed);
+	}
+	return NULL;
+}
+
+/* returns false if the frame was not stored */
+static bool storeFrame(value_table *table, const struct can_frame& frame,
+		       int if_index, int64_t timestamp)
+{
+	if (frame.can_id & (CAN_RTR_FLAG | CAN_ERR_FLAG)) {
+		return false;
+	}
+	value_slot *const slot = lookupSlot(table, frame.can_id, true);
+	if (slot == NULL) {
+		return false;
+	}
+	uint64_t seq = slot->seq.load(std::memory_order_relaxed);
+	for (;;) {
+		if ((seq & 1) == 0 &&
+		    slot->seq.compare_exchange_weak(seq, seq + 1,
+						    std::memory_order_acquire)) {
+			break;
+		}
+		seq = slot->seq.load(std::memory_order_relaxed);
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+	uint64_t data;
+	memcpy(&data, frame.data, sizeof(data));
+	slot->can_id.store(frame.can_id, std::memory_order_relaxed);
+	slot->if_index.store(if_index, std::memory_order_relaxed);
+	slot->dlc.store(frame.can_dlc, std::memory_order_relaxed);
+	slot->timestamp.store(timestamp, std::memory_order_relaxed);
+	slot->data.store(data, std::memory_order_relaxed);
+	slot->seq.store(seq + 2, std::memory_order_release);
+	return true;
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_LatestValueTable__1create
+(JNIEnv *env, jclass clazz, jint effCapacity)
+{
+	if (effCapacity < 1 || (effCapacity & (effCapacity - 1)) != 0) {
+		throwIllegalArgumentException(env, "capacity must be a power of two");
+		return 0;
+	}
+	const size_t count = SFF_SLOTS + effCapacity;
+	void *mem = NULL;
+	if (posix_memalign(&mem, alignof(value_slot),
+			   count * sizeof(value_slot)) != 0) {
+		throwOutOfMemoryError(env, "could not allocate value table");
+		return 0;
+	}
+	value_table *const table = new (std::nothrow) value_table();
+	if (table == NULL) {
+		free(mem);
+		throwOutOfMemoryError(env, "could not allocate value table");
+		return 0;
+	}
+	table->slots = static_cast<value_slot *>(mem);
+	for (size_t i = 0; i < count; i++) {
+		new (&table->slots[i]) value_slot();
+		table->slots[i].seq.store(0, std::memory_order_relaxed);
+		table->slots[i].key.store(0, std::memory_order_relaxed);
+	}
+	table->eff_mask = effCapacity - 1;
+	table->overflows.store(0, std::memory_order_relaxed);
+	return reinterpret_cast<jlong>(table);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_LatestValueTable__1free
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	value_table *const table = reinterpret_cast<value_table *>(handle);
+	free(table->slots);
+	delete table;
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_LatestValueTable__1receive
+(JNIEnv *env, jclass clazz, jlong handle, jint fd, jlong stats)
+{
+	value_table *const table = reinterpret_cast<value_table *>(handle);
+	struct frame_burst burst;
+	const int n = recvBurstBlocking(env, fd,
+					reinterpret_cast<io_stats *>(stats), -1,
+					burst);
+	if (n == -1) {
+		return -1;
+	}
+	const int64_t now = realtimeNanos();
+	int stored = 0;
+	for (int i = 0; i < n; i++) {
+		/* the kernel timestamp if SO_TIMESTAMPNS is on */
+		const int64_t ts = burstTimestamp(burst, i);
+		if (storeFrame(table, burst.frames[i], burst.addrs[i].can_ifindex,
+			       ts != 0 ? ts : now)) {
+			stored++;
+		}
+	}
+	return stored;
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_LatestValueTable__1update
+(JNIEnv *env, jclass clazz, jlong handle, jintArray ifIndices,
+ jintArray canIds, jbyteArray dlcs, jbyteArray data, jint count)
+{
+	value_table *const table = reinterpret_cast<value_table *>(handle);
+	jint ifidx_buf[RECV_BATCH_MAX];
+	jint canid_buf[RECV_BATCH_MAX];
+	jbyte dlc_buf[RECV_BATCH_MAX];
+	struct can_frame frame;
+
+	if (count < 0 || env->GetArrayLength(canIds) < count ||
+	    env->GetArrayLength(ifIndices) < count ||
+	    env->GetArrayLength(dlcs) < count ||
+	    env->GetArrayLength(data) / CAN_MAX_DLEN < count) {
+		throwIllegalArgumentException(env, "batch columns too short");
+		return;
+	}
+	const int64_t now = realtimeNanos();
+	memset(&frame, 0, sizeof(frame));
+	for (jint done = 0; done < count; ) {
+		const jint chunk = std::min(count - done, RECV_BATCH_MAX);
+		env->GetIntArrayRegion(ifIndices, done, chunk, ifidx_buf);
+		env->GetIntArrayRegion(canIds, done, chunk, canid_buf);
+		env->GetByteArrayRegion(dlcs, done, chunk, dlc_buf);
+		for (jint i = 0; i < chunk; i++) {
+			env->GetByteArrayRegion(data, (done + i) * CAN_MAX_DLEN,
+						CAN_MAX_DLEN,
+						reinterpret_cast<jbyte *>(frame.data));
+			if (env->ExceptionCheck() == JNI_TRUE) {
+				return;
+			}
+			frame.can_id = canid_buf[i];
+			frame.can_dlc = dlc_buf[i];
+			storeFrame(table, frame, ifidx_buf[i], now);
+		}
+		done += chunk;
+	}
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_LatestValueTable__1read
+(JNIEnv *env, jclass clazz, jlong handle, jint canId, jlongArray meta,
+ jbyteArray data)
+{
+	value_table *const table = reinterpret_cast<value_table *>(handle);
+	value_slot *const slot = lookupSlot(table, canId, false);
+	if (slot == NULL) {
+		return 0;
+	}
+	jlong values[META_FIELDS];
+	uint64_t payload;
+	uint64_t seq;
+	for (;;) {
+		seq = slot->seq.load(std::memory_order_acquire);
+		if (seq & 1) {
+			continue;
+		}
+		values[META_CAN_ID] = slot->can_id.load(std::memory_order_relaxed);
+		values[META_IF_INDEX] = slot->if_index.load(std::memory_order_relaxed);
+		values[META_DLC] = slot->dlc.load(std::memory_order_relaxed);
+		values[META_TIMESTAMP] = slot->timestamp.load(std::memory_order_relaxed);
+		payload = slot->data.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot->seq.load(std::memory_order_relaxed) == seq) {
+			break;
+		}
+	}
+	if (seq == 0) {
+		return 0;
+	}
+	values[META_UPDATES] = seq / 2;
+	env->SetLongArrayRegion(meta, 0, META_FIELDS, values);
+	env->SetByteArrayRegion(data, 0, CAN_MAX_DLEN,
+				reinterpret_cast<const jbyte *>(&payload));
+	return seq / 2;
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_LatestValueTable__1updateCount
+(JNIEnv *env, jclass clazz, jlong handle, jint canId)
+{
+	value_table *const table = reinterpret_cast<value_table *>(handle);
+	const value_slot *const slot = lookupSlot(table, canId, false);
+	if (slot == NULL) {
+		return 0;
+	}
+	return slot->seq.load(std::memory_order_acquire) / 2;
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_LatestValueTable__1overflows
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	const value_table *const table = reinterpret_cast<value_table *>(handle);
+	return table->overflows.load(std::memory_order_relaxed);
+}
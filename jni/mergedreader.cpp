@@ -0,0 +1,396 @@
+#include<atomic>
+#include<algorithm>
+#include<new>
+#include<queue>
+#include<vector>
+
+#include<cstring>
+#include<cstdint>
+#include<cerrno>
+#include<climits>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+}
+
+#if defined(ANDROID) || defined(__ANDROID__)
+#include "jni.h"
+#else
+#include "de_entropia_can_MergedReader.h"
+#endif
+
+#include "jniutil.h"
+#include "canio.h"
+#include "iostats.h"
+#include "clocks.h"
+
+/*
+ * K-way merge of the frames of several sockets by kernel receive time.
+ * Received frames wait in a min-heap ordered by timestamp. The oldest one
+ * is released when it is older than the reorder window, when every socket
+ * has already delivered a frame at least as new (each socket queues its
+ * frames in receive order, so nothing older can follow), or when the heap
+ * is full. Frames that arrive older than one already released are still
+ * delivered, right away, and counted as late.
+ *
+ * The last poll entry is an eventfd written by _wake when the reader is
+ * closed; a receive waiting in ppoll then fails instead of blocking on
+ * sockets that are about to be released.
+ */
+
+/* receive bursts per socket and wakeup */
+static const int RECV_BURSTS_MAX = 16;
+
+/* indices of the array filled by _stats */
+enum {
+	STAT_FRAMES,
+	STAT_WINDOW_RELEASES,
+	STAT_EARLY_RELEASES,
+	STAT_FORCED_RELEASES,
+	STAT_LATE,
+	STAT_BUFFERED,
+	STAT_MAX_BUFFERED,
+	STAT_FIELDS
+};
+
+struct merge_entry {
+	int64_t timestamp;
+	uint64_t seq;
+	int if_index;
+	struct can_frame frame;
+};
+
+struct merge_later {
+	bool operator()(const merge_entry& a, const merge_entry& b) const
+	{
+		if (a.timestamp != b.timestamp) {
+			return a.timestamp > b.timestamp;
+		}
+		return a.seq > b.seq;
+	}
+};
+
+struct merge_source {
+	int fd;
+	io_stats *io;
+	/* newest timestamp received, INT64_MIN before the first frame */
+	int64_t latest;
+};
+
+struct frame_merger {
+	std::vector<merge_source> sources;
+	/* one per source, followed by wake_fd */
+	std::vector<struct pollfd> pfds;
+	int wake_fd;
+	std::priority_queue<merge_entry, std::vector<merge_entry>,
+			    merge_later> heap;
+	int64_t window;
+	size_t capacity;
+	uint64_t seq;
+	int64_t released;
+	std::atomic<int64_t> stats[STAT_FIELDS];
+};
+
+static inline void statAdd(frame_merger *m, int field, int64_t n)
+{
+	m->stats[field].fetch_add(n, std::memory_order_relaxed);
+}
+
+/* newest time up to which every socket has delivered its frames */
+static int64_t commonLatest(const frame_merger *m)
+{
+	if (m->sources.size() < 2) {
+		/* one socket may mix interfaces, only the window applies */
+		return INT64_MIN;
+	}
+	int64_t latest = INT64_MAX;
+	for (size_t i = 0; i < m->sources.size(); i++) {
+		latest = std::min(latest, m->sources[i].latest);
+	}
+	return latest;
+}
+
+/* pops up to max frames that may be released at now */
+static int release(frame_merger *m, int64_t now, merge_entry *out, int max)
+{
+	const int64_t common = commonLatest(m);
+	int n = 0;
+	while (n < max && !m->heap.empty()) {
+		const merge_entry& top = m->heap.top();
+		int reason;
+		if (top.timestamp <= now - m->window) {
+			reason = STAT_WINDOW_RELEASES;
+		} else if (top.timestamp <= common) {
+			reason = STAT_EARLY_RELEASES;
+		} else if (m->heap.size() > m->capacity) {
+			reason = STAT_FORCED_RELEASES;
+		} else {
+			break;
+		}
+		statAdd(m, reason, 1);
+		m->released = std::max(m->released, top.timestamp);
+		out[n++] = top;
+		m->heap.pop();
+	}
+	m->stats[STAT_BUFFERED].store(m->heap.size(),
+				      std::memory_order_relaxed);
+	return n;
+}
+
+/* receives what is queued on source s; false with an exception on errors */
+static bool drain(JNIEnv *env, frame_merger *m, merge_source& s,
+		  struct frame_burst& burst)
+{
+	io_shard& shard = ioShard(s.io);
+	merge_entry e;
+	for (int b = 0; b < RECV_BURSTS_MAX; b++) {
+		const int n = recvBurst(s.fd, burst, RECV_BATCH_MAX,
+					MSG_DONTWAIT);
+		ioAdd(shard, IO_RECV_CALLS, 1);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				ioAdd(shard, IO_WOULD_BLOCK, 1);
+				return true;
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			ioAdd(shard, IO_EXCEPTIONS, 1);
+			throwIOExceptionErrno(env, errno);
+			return false;
+		}
+		if (!checkBurst(env, burst, n)) {
+			ioAdd(shard, IO_EXCEPTIONS, 1);
+			return false;
+		}
+		const int64_t now = clockNanos(CLOCK_REALTIME);
+		uint64_t bytes = 0;
+		for (int i = 0; i < n; i++) {
+			const int64_t t = burstTimestamp(burst, i);
+			e.timestamp = t != 0 ? t : now;
+			e.seq = m->seq++;
+			e.if_index = burst.addrs[i].can_ifindex;
+			e.frame = burst.frames[i];
+			bytes += std::min(e.frame.can_dlc,
+					  static_cast<__u8>(CAN_MAX_DLEN));
+			if (e.timestamp < m->released) {
+				statAdd(m, STAT_LATE, 1);
+			}
+			s.latest = std::max(s.latest, e.timestamp);
+			m->heap.push(e);
+		}
+		ioAdd(shard, IO_FRAMES_IN, n);
+		ioAdd(shard, IO_BYTES_IN, bytes);
+		statAdd(m, STAT_FRAMES, n);
+		if (n < RECV_BATCH_MAX) {
+			break;
+		}
+	}
+	const int64_t buffered = m->heap.size();
+	m->stats[STAT_BUFFERED].store(buffered, std::memory_order_relaxed);
+	if (buffered > m->stats[STAT_MAX_BUFFERED].load(
+			std::memory_order_relaxed)) {
+		m->stats[STAT_MAX_BUFFERED].store(buffered,
+				std::memory_order_relaxed);
+	}
+	return true;
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_MergedReader__1create
+(JNIEnv *env, jclass clazz, jintArray fds, jlongArray stats,
+ jlong windowNanos, jint capacity)
+{
+	const jsize n = env->GetArrayLength(fds);
+	if (n == 0) {
+		throwIllegalArgumentException(env, "no sockets to merge");
+		return 0;
+	}
+	if (env->GetArrayLength(stats) != n) {
+		throwIllegalArgumentException(env,
+			"sockets and stats differ in length");
+		return 0;
+	}
+	if (windowNanos < 0 || capacity <= 0) {
+		throwIllegalArgumentException(env,
+			"window and capacity must be positive");
+		return 0;
+	}
+	std::vector<jint> fd_buf(n);
+	std::vector<jlong> stats_buf(n);
+	env->GetIntArrayRegion(fds, 0, n, fd_buf.data());
+	env->GetLongArrayRegion(stats, 0, n, stats_buf.data());
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return 0;
+	}
+	const int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd == -1) {
+		throwIOExceptionErrno(env, errno);
+		return 0;
+	}
+	frame_merger *const m = new (std::nothrow) frame_merger();
+	if (m == NULL) {
+		close(wake_fd);
+		throwOutOfMemoryError(env, "frame merger");
+		return 0;
+	}
+	m->sources.resize(n);
+	m->pfds.resize(n + 1);
+	m->wake_fd = wake_fd;
+	m->pfds[n].fd = wake_fd;
+	m->pfds[n].events = POLLIN;
+	for (jsize i = 0; i < n; i++) {
+		m->sources[i].fd = fd_buf[i];
+		m->sources[i].io = reinterpret_cast<io_stats *>(stats_buf[i]);
+		m->sources[i].latest = INT64_MIN;
+		m->pfds[i].fd = fd_buf[i];
+		m->pfds[i].events = POLLIN;
+	}
+	m->window = windowNanos;
+	m->capacity = capacity;
+	m->seq = 0;
+	m->released = INT64_MIN;
+	for (int i = 0; i < STAT_FIELDS; i++) {
+		m->stats[i].store(0, std::memory_order_relaxed);
+	}
+	return reinterpret_cast<jlong>(m);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_MergedReader__1free
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	frame_merger *const m = reinterpret_cast<frame_merger *>(handle);
+	close(m->wake_fd);
+	delete m;
+}
+
+/* makes a receive waiting in ppoll, and all later ones, fail */
+JNIEXPORT void JNICALL Java_de_entropia_can_MergedReader__1wake
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	const uint64_t one = 1;
+	const int wake_fd = reinterpret_cast<frame_merger *>(handle)->wake_fd;
+	if (write(wake_fd, &one, sizeof(one)) == -1) {
+		/* counter overflow, the reader is woken anyway */
+	}
+}
+
+/*
+ * Fills the columns with frames in timestamp order, waiting up to
+ * timeoutNanos for the first one to become releasable.
+ */
+JNIEXPORT jint JNICALL Java_de_entropia_can_MergedReader__1receive
+(JNIEnv *env, jclass clazz, jlong handle, jlong timeoutNanos,
+ jintArray ifIndices, jintArray canIds, jbyteArray dlcs, jbyteArray data,
+ jlongArray timestamps)
+{
+	frame_merger *const m = reinterpret_cast<frame_merger *>(handle);
+	struct frame_burst burst;
+	merge_entry out[RECV_BATCH_MAX];
+	jint ifidx_buf[RECV_BATCH_MAX];
+	jint canid_buf[RECV_BATCH_MAX];
+	jbyte dlc_buf[RECV_BATCH_MAX];
+	jbyte data_buf[RECV_BATCH_MAX * CAN_MAX_DLEN];
+	jlong time_buf[RECV_BATCH_MAX];
+
+	const jsize capacity = env->GetArrayLength(canIds);
+	if (env->GetArrayLength(ifIndices) < capacity ||
+	    env->GetArrayLength(dlcs) < capacity ||
+	    env->GetArrayLength(timestamps) < capacity ||
+	    env->GetArrayLength(data) / CAN_MAX_DLEN < capacity) {
+		throwIllegalArgumentException(env, "batch columns too short");
+		return -1;
+	}
+
+	const int64_t deadline = timeoutNanos < 0 ? -1 :
+		clockNanos(CLOCK_MONOTONIC) + timeoutNanos;
+	jsize count = 0;
+	bool timed_out = false;
+	for (;;) {
+		const int64_t now = clockNanos(CLOCK_REALTIME);
+		while (count < capacity) {
+			const int chunk = std::min(capacity - count,
+						   RECV_BATCH_MAX);
+			const int n = release(m, now, out, chunk);
+			for (int i = 0; i < n; i++) {
+				ifidx_buf[i] = out[i].if_index;
+				canid_buf[i] = out[i].frame.can_id;
+				dlc_buf[i] = std::min(out[i].frame.can_dlc,
+					static_cast<__u8>(CAN_MAX_DLEN));
+				memcpy(data_buf + i * CAN_MAX_DLEN,
+				       out[i].frame.data, CAN_MAX_DLEN);
+				time_buf[i] = out[i].timestamp;
+			}
+			env->SetIntArrayRegion(ifIndices, count, n, ifidx_buf);
+			env->SetIntArrayRegion(canIds, count, n, canid_buf);
+			env->SetByteArrayRegion(dlcs, count, n, dlc_buf);
+			env->SetByteArrayRegion(data, count * CAN_MAX_DLEN,
+						n * CAN_MAX_DLEN, data_buf);
+			env->SetLongArrayRegion(timestamps, count, n, time_buf);
+			if (env->ExceptionCheck() == JNI_TRUE) {
+				return -1;
+			}
+			count += n;
+			if (n < chunk) {
+				break;
+			}
+		}
+		if (count > 0 || timed_out) {
+			return count;
+		}
+
+		/* sleep until new frames arrive or the oldest one times out */
+		int64_t wait = -1;
+		if (deadline >= 0) {
+			wait = std::max<int64_t>(0,
+				deadline - clockNanos(CLOCK_MONOTONIC));
+		}
+		if (!m->heap.empty()) {
+			const int64_t due = std::max<int64_t>(0,
+				m->heap.top().timestamp + m->window - now);
+			wait = wait < 0 ? due : std::min(wait, due);
+		}
+		struct timespec timeout;
+		timeout.tv_sec = wait / 1000000000;
+		timeout.tv_nsec = wait % 1000000000;
+		const int ready = ppoll(m->pfds.data(), m->pfds.size(),
+					wait < 0 ? NULL : &timeout, NULL);
+		if (ready < 0) {
+			if (errno == EINTR) {
+				return 0;
+			}
+			throwIOExceptionErrno(env, errno);
+			return -1;
+		}
+		if (m->pfds[m->sources.size()].revents != 0) {
+			/* the eventfd is never drained, later calls fail too */
+			throwAsynchronousCloseException(env);
+			return -1;
+		}
+		for (size_t i = 0; ready > 0 && i < m->sources.size(); i++) {
+			if (m->pfds[i].revents != 0 &&
+			    !drain(env, m, m->sources[i], burst)) {
+				return -1;
+			}
+		}
+		timed_out = ready == 0 && deadline >= 0 &&
+			clockNanos(CLOCK_MONOTONIC) >= deadline;
+	}
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_MergedReader__1stats
+(JNIEnv *env, jclass clazz, jlong handle, jlongArray out)
+{
+	frame_merger *const m = reinterpret_cast<frame_merger *>(handle);
+	jlong values[STAT_FIELDS];
+	for (int i = 0; i < STAT_FIELDS; i++) {
+		values[i] = m->stats[i].load(std::memory_order_relaxed);
+	}
+	env->SetLongArrayRegion(out, 0, STAT_FIELDS, values);
+}
@@ -0,0 +1,285 @@
+#include<algorithm>
+#include<deque>
+#include<mutex>
+#include<unordered_map>
+#include<vector>
+
+#include<cstring>
+#include<cstdint>
+#include<cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <time.h>
+
+#include <linux/can.h>
+}
+
+#if defined(ANDROID) || defined(__ANDROID__)
+#include "jni.h"
+#else
+#include "de_entropia_can_RequestClient.h"
+#endif
+
+#include "jniutil.h"
+#include "canio.h"
+#include "iostats.h"
+
+/*
+ * Pending responses of RequestClient. Expectations with an exact id mask,
+ * the common case of diagnostic requests, are looked up by id; the others
+ * are scanned in order. Among several expectations that match a frame the
+ * oldest one wins, so requests to the same node are answered in order.
+ */
+
+/* mask that compares every bit of the id including the EFF and RTR flags */
+static const canid_t EXACT_MASK = CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_EFF_MASK;
+/* receive bursts per call, bounds the time spent on unrelated traffic */
+static const int RECV_BURSTS_MAX = 16;
+
+struct expectation {
+	jint request;
+	jint if_index;
+	canid_t id;
+	canid_t mask;
+};
+
+struct expectation_ref {
+	bool exact;
+	canid_t id;
+};
+
+struct request_matcher {
+	std::mutex lock;
+	std::unordered_map<canid_t, std::deque<expectation> > exact;
+	std::vector<expectation> masked;
+	std::unordered_map<jint, expectation_ref> requests;
+	int64_t unmatched;
+};
+
+static bool matches(const expectation& e, int if_index,
+		    const struct can_frame& frame)
+{
+	return (e.if_index == 0 || e.if_index == if_index) &&
+		((frame.can_id ^ e.id) & e.mask) == 0;
+}
+
+/* request waiting for frame, -1 if none; called with the lock held */
+static jint claim(request_matcher *m, int if_index,
+		  const struct can_frame& frame)
+{
+	const canid_t key = frame.can_id & EXACT_MASK;
+	const auto it = m->exact.find(key);
+	if (it != m->exact.end()) {
+		std::deque<expectation>& queue = it->second;
+		for (auto e = queue.begin(); e != queue.end(); ++e) {
+			if (matches(*e, if_index, frame)) {
+				const jint request = e->request;
+				queue.erase(e);
+				if (queue.empty()) {
+					m->exact.erase(it);
+				}
+				m->requests.erase(request);
+				return request;
+			}
+		}
+	}
+	for (auto e = m->masked.begin(); e != m->masked.end(); ++e) {
+		if (matches(*e, if_index, frame)) {
+			const jint request = e->request;
+			m->masked.erase(e);
+			m->requests.erase(request);
+			return request;
+		}
+	}
+	return -1;
+}
+
+template<typename C>
+static bool eraseRequest(C& expectations, jint request)
+{
+	for (auto e = expectations.begin(); e != expectations.end(); ++e) {
+		if (e->request == request) {
+			expectations.erase(e);
+			return true;
+		}
+	}
+	return false;
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_RequestClient__1create
+(JNIEnv *env, jclass clazz)
+{
+	request_matcher *const m = new (std::nothrow) request_matcher();
+	if (m == NULL) {
+		throwOutOfMemoryError(env, "request matcher");
+		return 0;
+	}
+	m->unmatched = 0;
+	return reinterpret_cast<jlong>(m);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_RequestClient__1free
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	delete reinterpret_cast<request_matcher *>(handle);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_RequestClient__1expect
+(JNIEnv *env, jclass clazz, jlong handle, jint request, jint ifIndex,
+ jint canId, jint mask)
+{
+	request_matcher *const m = reinterpret_cast<request_matcher *>(handle);
+	expectation e;
+	e.request = request;
+	e.if_index = ifIndex;
+	e.mask = mask;
+	e.id = canId & e.mask;
+	std::lock_guard<std::mutex> guard(m->lock);
+	expectation_ref ref;
+	ref.exact = e.mask == EXACT_MASK;
+	ref.id = e.id;
+	if (ref.exact) {
+		m->exact[e.id].push_back(e);
+	} else {
+		m->masked.push_back(e);
+	}
+	m->requests[request] = ref;
+}
+
+JNIEXPORT jboolean JNICALL Java_de_entropia_can_RequestClient__1cancel
+(JNIEnv *env, jclass clazz, jlong handle, jint request)
+{
+	request_matcher *const m = reinterpret_cast<request_matcher *>(handle);
+	std::lock_guard<std::mutex> guard(m->lock);
+	const auto ref = m->requests.find(request);
+	if (ref == m->requests.end()) {
+		return JNI_FALSE;
+	}
+	if (ref->second.exact) {
+		const auto it = m->exact.find(ref->second.id);
+		if (it != m->exact.end() && eraseRequest(it->second, request) &&
+		    it->second.empty()) {
+			m->exact.erase(it);
+		}
+	} else {
+		eraseRequest(m->masked, request);
+	}
+	m->requests.erase(ref);
+	return JNI_TRUE;
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_RequestClient__1unmatched
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	request_matcher *const m = reinterpret_cast<request_matcher *>(handle);
+	std::lock_guard<std::mutex> guard(m->lock);
+	return m->unmatched;
+}
+
+/*
+ * Waits up to timeoutNanos for frames on fd and reports the ones claimed by
+ * a pending request. Other frames are dropped.
+ */
+JNIEXPORT jint JNICALL Java_de_entropia_can_RequestClient__1receive
+(JNIEnv *env, jclass clazz, jlong handle, jint fd, jlong stats,
+ jlong timeoutNanos, jintArray requests, jintArray ifIndices,
+ jintArray canIds, jbyteArray dlcs, jbyteArray data)
+{
+	request_matcher *const m = reinterpret_cast<request_matcher *>(handle);
+	io_shard& shard = ioShard(reinterpret_cast<io_stats *>(stats));
+	struct frame_burst burst;
+	jint request_buf[RECV_BATCH_MAX];
+	jint ifidx_buf[RECV_BATCH_MAX];
+	jint canid_buf[RECV_BATCH_MAX];
+	jbyte dlc_buf[RECV_BATCH_MAX];
+	jbyte data_buf[RECV_BATCH_MAX * CAN_MAX_DLEN];
+
+	const jsize capacity = env->GetArrayLength(canIds);
+	if (env->GetArrayLength(requests) < capacity ||
+	    env->GetArrayLength(ifIndices) < capacity ||
+	    env->GetArrayLength(dlcs) < capacity ||
+	    env->GetArrayLength(data) / CAN_MAX_DLEN < capacity) {
+		throwIllegalArgumentException(env, "batch columns too short");
+		return -1;
+	}
+
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	struct timespec timeout;
+	timeout.tv_sec = timeoutNanos / 1000000000;
+	timeout.tv_nsec = timeoutNanos % 1000000000;
+	const int ready = ppoll(&pfd, 1, timeoutNanos < 0 ? NULL : &timeout,
+				NULL);
+	if (ready == 0 || (ready < 0 && errno == EINTR)) {
+		return 0;
+	}
+	if (ready < 0) {
+		throwIOExceptionErrno(env, errno);
+		return -1;
+	}
+
+	jsize matched = 0;
+	for (int b = 0; b < RECV_BURSTS_MAX && matched < capacity; b++) {
+		const int chunk = std::min(capacity - matched, RECV_BATCH_MAX);
+		const int n = recvBurst(fd, burst, chunk, MSG_DONTWAIT);
+		ioAdd(shard, IO_RECV_CALLS, 1);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				ioAdd(shard, IO_WOULD_BLOCK, 1);
+				break;
+			}
+			ioAdd(shard, IO_EXCEPTIONS, 1);
+			throwIOExceptionErrno(env, errno);
+			return -1;
+		}
+		if (!checkBurst(env, burst, n)) {
+			ioAdd(shard, IO_EXCEPTIONS, 1);
+			return -1;
+		}
+		uint64_t bytes = 0;
+		int claimed = 0;
+		{
+			std::lock_guard<std::mutex> guard(m->lock);
+			for (int i = 0; i < n; i++) {
+				const struct can_frame& frame = burst.frames[i];
+				const jbyte dlc = std::min(frame.can_dlc,
+					static_cast<__u8>(CAN_MAX_DLEN));
+				bytes += dlc;
+				const jint request = (frame.can_id & CAN_ERR_FLAG) ?
+					-1 : claim(m, burst.addrs[i].can_ifindex, frame);
+				if (request < 0) {
+					m->unmatched++;
+					continue;
+				}
+				request_buf[claimed] = request;
+				ifidx_buf[claimed] = burst.addrs[i].can_ifindex;
+				canid_buf[claimed] = frame.can_id;
+				dlc_buf[claimed] = dlc;
+				memcpy(data_buf + claimed * CAN_MAX_DLEN, frame.data,
+				       CAN_MAX_DLEN);
+				claimed++;
+			}
+		}
+		ioAdd(shard, IO_FRAMES_IN, n);
+		ioAdd(shard, IO_BYTES_IN, bytes);
+		env->SetIntArrayRegion(requests, matched, claimed, request_buf);
+		env->SetIntArrayRegion(ifIndices, matched, claimed, ifidx_buf);
+		env->SetIntArrayRegion(canIds, matched, claimed, canid_buf);
+		env->SetByteArrayRegion(dlcs, matched, claimed, dlc_buf);
+		env->SetByteArrayRegion(data, matched * CAN_MAX_DLEN,
+					claimed * CAN_MAX_DLEN, data_buf);
+		if (env->ExceptionCheck() == JNI_TRUE) {
+			return -1;
+		}
+		matched += claimed;
+		if (n < chunk) {
+			break;
+		}
+	}
+	return matched;
+}
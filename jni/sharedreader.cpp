@@ -0,0 +1,652 @@
+#include<atomic>
+#include<algorithm>
+#include<mutex>
+#include<new>
+#include<thread>
+#include<vector>
+#include<system_error>
+
+#include<cstring>
+#include<cstdint>
+#include<cerrno>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+}
+
+#if defined(ANDROID) || defined(__ANDROID__)
+#include "jni.h"
+#else
+#include "de_entropia_can_SharedReader.h"
+#endif
+
+#include "jniutil.h"
+#include "canio.h"
+#include "iostats.h"
+#include "framefilter.h"
+
+/*
+ * One reader thread per socket hands the received frames to any number of
+ * subscribers. Every subscriber has an id/mask filter compiled as in
+ * FrameFilter and a bounded single-producer single-consumer ring that the
+ * reader fills and one Java thread drains. When a ring is full the
+ * subscriber's policy decides: drop the new frame, drop the oldest queued
+ * one, or make the reader wait for room, which stalls all subscribers.
+ *
+ * The subscriber list is only touched under the reader lock, which the
+ * reader holds while it dispatches a burst, so removed subscribers can be
+ * freed as soon as the lock has been taken once.
+ */
+
+static const int IDLE_WAIT_MS = 100;
+/* receive bursts before the reader polls again, bounds the lock hold time */
+static const int RECV_BURSTS_MAX = 16;
+
+/* overflow policies, the ordinals of SharedReader.OverflowPolicy */
+enum {
+	POLICY_DROP_OLDEST,
+	POLICY_DROP_NEWEST,
+	POLICY_BLOCK
+};
+
+/* indices of the array filled by _stats */
+enum {
+	STAT_FRAMES,
+	STAT_UNMATCHED,
+	STAT_DELIVERIES,
+	STAT_MALFORMED,
+	STAT_LAST_ERRNO,
+	STAT_FIELDS
+};
+
+/* indices of the array filled by _subscriptionStats */
+enum {
+	SUB_QUEUED,
+	SUB_DROPPED,
+	SUB_BLOCKED,
+	SUB_DEPTH,
+	SUB_FIELDS
+};
+
+struct rx_entry {
+	struct can_frame frame;
+	int if_index;
+};
+
+struct rx_reader;
+
+struct rx_subscriber {
+	rx_reader *reader;
+	/* NULL passes every frame */
+	frame_filter *filter;
+	int policy;
+	size_t mask;
+	rx_entry *ring;
+	/* signalled when frames arrive and the consumer waits */
+	int data_fd;
+	/* signalled when the consumer makes room and the reader waits */
+	int space_fd;
+	alignas(64) std::atomic<uint64_t> head;
+	std::atomic<bool> consumer_waiting;
+	alignas(64) std::atomic<uint64_t> tail;
+	std::atomic<bool> producer_waiting;
+	std::atomic<bool> closed;
+	std::atomic<int64_t> stats[SUB_FIELDS];
+};
+
+struct rx_reader {
+	int fd;
+	int wake_fd;
+	io_stats *io;
+	std::mutex lock;
+	std::vector<rx_subscriber *> subscribers;
+	std::atomic<bool> stop;
+	/* errno that ended the reader thread, 0 while it runs */
+	std::atomic<int> error;
+	std::atomic<int64_t> stats[STAT_FIELDS];
+	std::thread thread;
+};
+
+static void signalFd(int fd)
+{
+	const uint64_t one = 1;
+	if (write(fd, &one, sizeof(one)) == -1) {
+		/* counter overflow, the waiter is awake anyway */
+	}
+}
+
+static void drainFd(int fd)
+{
+	uint64_t v;
+	if (read(fd, &v, sizeof(v)) == -1) {
+		/* EAGAIN, another wakeup got there first */
+	}
+}
+
+static inline bool stopping(const rx_reader *r, const rx_subscriber *s)
+{
+	return s->closed.load(std::memory_order_acquire) ||
+		r->stop.load(std::memory_order_acquire);
+}
+
+static void wakeConsumer(rx_subscriber *s)
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (s->consumer_waiting.load(std::memory_order_relaxed)) {
+		signalFd(s->data_fd);
+	}
+}
+
+/* waits until the ring has room; false if the subscriber or reader closes */
+static bool waitForSpace(rx_reader *r, rx_subscriber *s)
+{
+	s->producer_waiting.store(true, std::memory_order_seq_cst);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	const bool full = s->tail.load(std::memory_order_relaxed) -
+		s->head.load(std::memory_order_seq_cst) > s->mask;
+	if (full && !stopping(r, s)) {
+		/* consumers are woken per burst, this one may not know yet */
+		wakeConsumer(s);
+		struct pollfd pfd[2];
+		pfd[0].fd = s->space_fd;
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
+		/* left for the reader loop to drain */
+		pfd[1].fd = r->wake_fd;
+		pfd[1].events = POLLIN;
+		pfd[1].revents = 0;
+		if (poll(pfd, 2, IDLE_WAIT_MS) > 0 && pfd[0].revents != 0) {
+			drainFd(s->space_fd);
+		}
+		s->stats[SUB_BLOCKED].fetch_add(1, std::memory_order_relaxed);
+	}
+	s->producer_waiting.store(false, std::memory_order_relaxed);
+	return !stopping(r, s);
+}
+
+static bool push(rx_reader *r, rx_subscriber *s, const rx_entry& e)
+{
+	const uint64_t tail = s->tail.load(std::memory_order_relaxed);
+	for (;;) {
+		uint64_t head = s->head.load(std::memory_order_acquire);
+		if (tail - head <= s->mask) {
+			break;
+		}
+		if (s->policy == POLICY_DROP_NEWEST) {
+			s->stats[SUB_DROPPED].fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		if (s->policy == POLICY_DROP_OLDEST) {
+			/* fails if the consumer made room meanwhile */
+			if (s->head.compare_exchange_strong(head, head + 1,
+					std::memory_order_acq_rel)) {
+				s->stats[SUB_DROPPED].fetch_add(1,
+						std::memory_order_relaxed);
+				break;
+			}
+			continue;
+		}
+		if (!waitForSpace(r, s)) {
+			return false;
+		}
+	}
+	s->ring[tail & s->mask] = e;
+	s->tail.store(tail + 1, std::memory_order_release);
+	s->stats[SUB_QUEUED].fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+/*
+ * Copies up to max queued frames and releases their slots. With
+ * POLICY_DROP_OLDEST the reader may recycle slots while they are copied;
+ * it moves head when it does, so the copy is only kept if head did not
+ * move.
+ */
+static int take(rx_subscriber *s, rx_entry *out, int max)
+{
+	uint64_t head = s->head.load(std::memory_order_acquire);
+	int n;
+	for (;;) {
+		const uint64_t tail = s->tail.load(std::memory_order_acquire);
+		n = static_cast<int>(std::min<uint64_t>(tail - head, max));
+		if (n == 0) {
+			return 0;
+		}
+		for (int i = 0; i < n; i++) {
+			out[i] = s->ring[(head + i) & s->mask];
+		}
+		if (s->head.compare_exchange_weak(head, head + n,
+				std::memory_order_acq_rel,
+				std::memory_order_acquire)) {
+			break;
+		}
+	}
+	if (s->policy == POLICY_BLOCK) {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (s->producer_waiting.load(std::memory_order_relaxed)) {
+			signalFd(s->space_fd);
+		}
+	}
+	return n;
+}
+
+static void waitForFrames(rx_subscriber *s, jlong timeoutNanos)
+{
+	s->consumer_waiting.store(true, std::memory_order_seq_cst);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (s->tail.load(std::memory_order_seq_cst) ==
+	    s->head.load(std::memory_order_relaxed) &&
+	    s->reader->error.load(std::memory_order_acquire) == 0) {
+		struct pollfd pfd;
+		pfd.fd = s->data_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		struct timespec timeout;
+		timeout.tv_sec = timeoutNanos / 1000000000;
+		timeout.tv_nsec = timeoutNanos % 1000000000;
+		if (ppoll(&pfd, 1, timeoutNanos < 0 ? NULL : &timeout,
+			  NULL) == 1) {
+			drainFd(s->data_fd);
+		}
+	}
+	s->consumer_waiting.store(false, std::memory_order_relaxed);
+}
+
+/* hands n received frames to the subscribers, called with the lock held */
+static void dispatch(rx_reader *r, const struct frame_burst& burst, int n)
+{
+	canid_t ids[RECV_BATCH_MAX];
+	uint8_t keep[RECV_BATCH_MAX];
+	uint8_t claimed[RECV_BATCH_MAX];
+	rx_entry e;
+
+	for (int i = 0; i < n; i++) {
+		ids[i] = burst.frames[i].can_id;
+		claimed[i] = 0;
+	}
+	int64_t deliveries = 0;
+	for (size_t k = 0; k < r->subscribers.size(); k++) {
+		rx_subscriber *const s = r->subscribers[k];
+		if (s->filter == NULL) {
+			memset(keep, 1, n);
+		} else if (filterBatch(s->filter, ids, n, keep) == 0) {
+			continue;
+		}
+		bool queued = false;
+		for (int i = 0; i < n; i++) {
+			if (!keep[i]) {
+				continue;
+			}
+			claimed[i] = 1;
+			e.frame = burst.frames[i];
+			e.if_index = burst.addrs[i].can_ifindex;
+			if (push(r, s, e)) {
+				queued = true;
+				deliveries++;
+			}
+		}
+		if (queued) {
+			wakeConsumer(s);
+		}
+	}
+	int64_t unmatched = 0;
+	for (int i = 0; i < n; i++) {
+		unmatched += !claimed[i];
+	}
+	r->stats[STAT_DELIVERIES].fetch_add(deliveries,
+			std::memory_order_relaxed);
+	r->stats[STAT_UNMATCHED].fetch_add(unmatched,
+			std::memory_order_relaxed);
+}
+
+/* drops the frames of a burst the kernel did not fill completely */
+static int dropMalformed(rx_reader *r, struct frame_burst& burst, int n)
+{
+	int kept = 0;
+	for (int i = 0; i < n; i++) {
+		if (burst.msgs[i].msg_hdr.msg_namelen != sizeof(burst.addrs[i]) ||
+		    burst.msgs[i].msg_len != sizeof(burst.frames[i])) {
+			r->stats[STAT_MALFORMED].fetch_add(1,
+					std::memory_order_relaxed);
+			continue;
+		}
+		if (kept != i) {
+			burst.frames[kept] = burst.frames[i];
+			burst.addrs[kept] = burst.addrs[i];
+		}
+		kept++;
+	}
+	return kept;
+}
+
+static void fail(rx_reader *r, int err)
+{
+	r->stats[STAT_LAST_ERRNO].store(err, std::memory_order_relaxed);
+	r->error.store(err, std::memory_order_release);
+	std::lock_guard<std::mutex> guard(r->lock);
+	for (size_t k = 0; k < r->subscribers.size(); k++) {
+		signalFd(r->subscribers[k]->data_fd);
+	}
+}
+
+/* receives and dispatches what is queued, returns errno on failure */
+static int receiveBursts(rx_reader *r, io_shard& shard,
+			 struct frame_burst& burst)
+{
+	for (int b = 0; b < RECV_BURSTS_MAX; b++) {
+		const int n = recvBurst(r->fd, burst, RECV_BATCH_MAX,
+					MSG_DONTWAIT);
+		ioAdd(shard, IO_RECV_CALLS, 1);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				ioAdd(shard, IO_WOULD_BLOCK, 1);
+				return 0;
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			ioAdd(shard, IO_EXCEPTIONS, 1);
+			return errno;
+		}
+		uint64_t bytes = 0;
+		for (int i = 0; i < n; i++) {
+			bytes += std::min(burst.frames[i].can_dlc,
+				static_cast<__u8>(CAN_MAX_DLEN));
+		}
+		ioAdd(shard, IO_FRAMES_IN, n);
+		ioAdd(shard, IO_BYTES_IN, bytes);
+		r->stats[STAT_FRAMES].fetch_add(n, std::memory_order_relaxed);
+		dispatch(r, burst, dropMalformed(r, burst, n));
+		if (n < RECV_BATCH_MAX) {
+			break;
+		}
+	}
+	return 0;
+}
+
+static void readLoop(rx_reader *r)
+{
+	io_shard& shard = ioShard(r->io);
+	struct frame_burst burst;
+
+	while (!r->stop.load(std::memory_order_acquire)) {
+		struct pollfd pfd[2];
+		pfd[0].fd = r->fd;
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
+		pfd[1].fd = r->wake_fd;
+		pfd[1].events = POLLIN;
+		pfd[1].revents = 0;
+		const int ready = poll(pfd, 2, IDLE_WAIT_MS);
+		if (ready < 0 && errno != EINTR) {
+			fail(r, errno);
+			return;
+		}
+		if (pfd[1].revents != 0) {
+			drainFd(r->wake_fd);
+		}
+		if (ready <= 0 || pfd[0].revents == 0) {
+			continue;
+		}
+		int err = 0;
+		{
+			std::lock_guard<std::mutex> guard(r->lock);
+			err = receiveBursts(r, shard, burst);
+		}
+		if (err != 0) {
+			fail(r, err);
+			return;
+		}
+	}
+}
+
+static void freeSubscriber(rx_subscriber *s)
+{
+	close(s->data_fd);
+	close(s->space_fd);
+	delete s->filter;
+	delete[] s->ring;
+	delete s;
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_SharedReader__1create
+(JNIEnv *env, jclass clazz, jint fd, jlong stats)
+{
+	const int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd == -1) {
+		throwIOExceptionErrno(env, errno);
+		return 0;
+	}
+	rx_reader *const r = new (std::nothrow) rx_reader();
+	if (r == NULL) {
+		close(wake_fd);
+		throwOutOfMemoryError(env, "shared reader");
+		return 0;
+	}
+	r->fd = fd;
+	r->wake_fd = wake_fd;
+	r->io = reinterpret_cast<io_stats *>(stats);
+	r->stop.store(false, std::memory_order_relaxed);
+	r->error.store(0, std::memory_order_relaxed);
+	for (int i = 0; i < STAT_FIELDS; i++) {
+		r->stats[i].store(0, std::memory_order_relaxed);
+	}
+	try {
+		r->thread = std::thread(readLoop, r);
+	} catch (const std::system_error& e) {
+		close(wake_fd);
+		delete r;
+		throwIOExceptionMsg(env, e.what());
+		return 0;
+	}
+	return reinterpret_cast<jlong>(r);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_SharedReader__1destroy
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	rx_reader *const r = reinterpret_cast<rx_reader *>(handle);
+	r->stop.store(true, std::memory_order_seq_cst);
+	signalFd(r->wake_fd);
+	r->thread.join();
+	for (size_t k = 0; k < r->subscribers.size(); k++) {
+		freeSubscriber(r->subscribers[k]);
+	}
+	close(r->wake_fd);
+	delete r;
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_SharedReader__1subscribe
+(JNIEnv *env, jclass clazz, jlong handle, jintArray canIds,
+ jintArray masks, jint capacity, jint policy)
+{
+	rx_reader *const r = reinterpret_cast<rx_reader *>(handle);
+	if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+		throwIllegalArgumentException(env, "capacity must be a power of two");
+		return 0;
+	}
+	if (policy < POLICY_DROP_OLDEST || policy > POLICY_BLOCK) {
+		throwIllegalArgumentException(env, "unknown overflow policy");
+		return 0;
+	}
+	frame_filter *filter = NULL;
+	if (canIds != NULL) {
+		const jsize n = env->GetArrayLength(canIds);
+		if (env->GetArrayLength(masks) != n) {
+			throwIllegalArgumentException(env,
+				"ids and masks differ in length");
+			return 0;
+		}
+		std::vector<jint> ids(n);
+		std::vector<jint> ms(n);
+		env->GetIntArrayRegion(canIds, 0, n, ids.data());
+		env->GetIntArrayRegion(masks, 0, n, ms.data());
+		if (env->ExceptionCheck() == JNI_TRUE) {
+			return 0;
+		}
+		try {
+			filter = compileFilter(
+				reinterpret_cast<const canid_t *>(ids.data()),
+				reinterpret_cast<const canid_t *>(ms.data()), n);
+		} catch (const std::bad_alloc& e) {
+			throwOutOfMemoryError(env, "subscription filter");
+			return 0;
+		}
+		if (filter == NULL) {
+			throwIllegalArgumentException(env,
+				"inverted filters are not supported");
+			return 0;
+		}
+	}
+	const int data_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	const int space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (data_fd == -1 || space_fd == -1) {
+		const int err = errno;
+		if (data_fd != -1) {
+			close(data_fd);
+		}
+		delete filter;
+		throwIOExceptionErrno(env, err);
+		return 0;
+	}
+	rx_subscriber *const s = new (std::nothrow) rx_subscriber();
+	rx_entry *const ring = new (std::nothrow) rx_entry[capacity];
+	if (s == NULL || ring == NULL) {
+		close(data_fd);
+		close(space_fd);
+		delete filter;
+		delete s;
+		delete[] ring;
+		throwOutOfMemoryError(env, "subscription queue");
+		return 0;
+	}
+	s->reader = r;
+	s->filter = filter;
+	s->policy = policy;
+	s->mask = capacity - 1;
+	s->ring = ring;
+	s->data_fd = data_fd;
+	s->space_fd = space_fd;
+	s->head.store(0, std::memory_order_relaxed);
+	s->tail.store(0, std::memory_order_relaxed);
+	s->consumer_waiting.store(false, std::memory_order_relaxed);
+	s->producer_waiting.store(false, std::memory_order_relaxed);
+	s->closed.store(false, std::memory_order_relaxed);
+	for (int i = 0; i < SUB_FIELDS; i++) {
+		s->stats[i].store(0, std::memory_order_relaxed);
+	}
+	std::lock_guard<std::mutex> guard(r->lock);
+	r->subscribers.push_back(s);
+	return reinterpret_cast<jlong>(s);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_SharedReader__1unsubscribe
+(JNIEnv *env, jclass clazz, jlong handle, jlong subscriber)
+{
+	rx_reader *const r = reinterpret_cast<rx_reader *>(handle);
+	rx_subscriber *const s = reinterpret_cast<rx_subscriber *>(subscriber);
+	/* a reader blocked on this subscriber holds the lock */
+	s->closed.store(true, std::memory_order_seq_cst);
+	signalFd(s->space_fd);
+	{
+		std::lock_guard<std::mutex> guard(r->lock);
+		r->subscribers.erase(std::remove(r->subscribers.begin(),
+				r->subscribers.end(), s), r->subscribers.end());
+	}
+	freeSubscriber(s);
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_SharedReader__1poll
+(JNIEnv *env, jclass clazz, jlong subscriber, jlong timeoutNanos,
+ jintArray ifIndices, jintArray canIds, jbyteArray dlcs, jbyteArray data)
+{
+	rx_subscriber *const s = reinterpret_cast<rx_subscriber *>(subscriber);
+	rx_entry entries[RECV_BATCH_MAX];
+	jint ifidx_buf[RECV_BATCH_MAX];
+	jint canid_buf[RECV_BATCH_MAX];
+	jbyte dlc_buf[RECV_BATCH_MAX];
+	jbyte data_buf[RECV_BATCH_MAX * CAN_MAX_DLEN];
+
+	const jsize capacity = env->GetArrayLength(canIds);
+	if (env->GetArrayLength(ifIndices) < capacity ||
+	    env->GetArrayLength(dlcs) < capacity ||
+	    env->GetArrayLength(data) / CAN_MAX_DLEN < capacity) {
+		throwIllegalArgumentException(env, "batch columns too short");
+		return -1;
+	}
+
+	jsize count = 0;
+	for (int attempt = 0; attempt < 2 && count == 0; attempt++) {
+		if (attempt == 1) {
+			if (timeoutNanos == 0) {
+				break;
+			}
+			waitForFrames(s, timeoutNanos);
+		}
+		while (count < capacity) {
+			const int chunk = std::min(capacity - count,
+						   RECV_BATCH_MAX);
+			const int n = take(s, entries, chunk);
+			for (int i = 0; i < n; i++) {
+				const struct can_frame& frame = entries[i].frame;
+				ifidx_buf[i] = entries[i].if_index;
+				canid_buf[i] = frame.can_id;
+				dlc_buf[i] = std::min(frame.can_dlc,
+					static_cast<__u8>(CAN_MAX_DLEN));
+				memcpy(data_buf + i * CAN_MAX_DLEN, frame.data,
+				       CAN_MAX_DLEN);
+			}
+			env->SetIntArrayRegion(ifIndices, count, n, ifidx_buf);
+			env->SetIntArrayRegion(canIds, count, n, canid_buf);
+			env->SetByteArrayRegion(dlcs, count, n, dlc_buf);
+			env->SetByteArrayRegion(data, count * CAN_MAX_DLEN,
+						n * CAN_MAX_DLEN, data_buf);
+			if (env->ExceptionCheck() == JNI_TRUE) {
+				return -1;
+			}
+			count += n;
+			if (n < chunk) {
+				break;
+			}
+		}
+	}
+	if (count == 0) {
+		const int err = s->reader->error.load(std::memory_order_acquire);
+		if (err != 0) {
+			throwIOExceptionErrno(env, err);
+			return -1;
+		}
+	}
+	return count;
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_SharedReader__1stats
+(JNIEnv *env, jclass clazz, jlong handle, jlongArray out)
+{
+	rx_reader *const r = reinterpret_cast<rx_reader *>(handle);
+	jlong values[STAT_FIELDS];
+	for (int i = 0; i < STAT_FIELDS; i++) {
+		values[i] = r->stats[i].load(std::memory_order_relaxed);
+	}
+	env->SetLongArrayRegion(out, 0, STAT_FIELDS, values);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_SharedReader__1subscriptionStats
+(JNIEnv *env, jclass clazz, jlong subscriber, jlongArray out)
+{
+	rx_subscriber *const s = reinterpret_cast<rx_subscriber *>(subscriber);
+	jlong values[SUB_FIELDS];
+	for (int i = 0; i < SUB_FIELDS; i++) {
+		values[i] = s->stats[i].load(std::memory_order_relaxed);
+	}
+	values[SUB_DEPTH] = s->tail.load(std::memory_order_relaxed) -
+		s->head.load(std::memory_order_relaxed);
+	env->SetLongArrayRegion(out, 0, SUB_FIELDS, values);
+}
@@ -0,0 +1,332 @@
+#include<vector>
+#include<limits>
+#include<new>
+
+#include<cstring>
+#include<cstdint>
+
+extern "C" {
+#include <endian.h>
+#include <sys/socket.h>
+
+#include <linux/can.h>
+}
+
+#if defined(ANDROID) || defined(__ANDROID__)
+#include "jni.h"
+#else
+#include "de_entropia_can_SignalDecoder.h"
+#endif
+
+#include "jniutil.h"
+
+/*
+ * Every signal is compiled down to
+ *
+ *	raw = (word >> shift) & mask
+ *
+ * where word is the payload loaded as little endian 64 bit integer for
+ * Intel signals and as big endian one for Motorola signals. Decoding keeps
+ * one word per matching frame in a scratch column and runs a branch free
+ * loop per signal over it, so the compiler can vectorize the extraction.
+ */
+
+enum {
+	LAYOUT_START_BIT,
+	LAYOUT_LENGTH,
+	LAYOUT_LITTLE_ENDIAN,
+	LAYOUT_SIGNED,
+	LAYOUT_MUX_MODE,
+	LAYOUT_MUX_VALUE,
+	LAYOUT_FIELDS
+};
+
+enum {
+	MUX_NONE,
+	MUX_SELECTOR,
+	MUX_SELECTED
+};
+
+struct signal_plan {
+	uint64_t mask;
+	double factor;
+	double offset;
+	int shift;
+	int length;
+	bool big_endian;
+	bool is_signed;
+	int mux_mode;
+	long long mux_value;
+};
+
+struct message_plan {
+	uint32_t can_id;
+	bool has_big_endian;
+	int selector;
+	std::vector<signal_plan> signals;
+};
+
+struct decoder_plan {
+	std::vector<message_plan> messages;
+};
+
+struct decode_scratch {
+	std::vector<uint64_t> le_words;
+	std::vector<uint64_t> be_words;
+	std::vector<jint> frame_index;
+	std::vector<int64_t> raw;
+	std::vector<jdouble> physical;
+	std::vector<int64_t> selector;
+};
+
+static thread_local decode_scratch scratch;
+
+static inline uint32_t normalize_id(uint32_t can_id)
+{
+	return (can_id & CAN_EFF_FLAG) ? can_id & (CAN_EFF_FLAG | CAN_EFF_MASK)
+				       : can_id & CAN_SFF_MASK;
+}
+
+static bool compile_signal(const jint *layout, const jdouble *scaling,
+			   signal_plan& sig)
+{
+	const int start = layout[LAYOUT_START_BIT];
+	const int length = layout[LAYOUT_LENGTH];
+	if (start < 0 || start > 63 || length < 1 || length > 64) {
+		return false;
+	}
+	sig.length = length;
+	sig.big_endian = layout[LAYOUT_LITTLE_ENDIAN] == 0;
+	sig.is_signed = layout[LAYOUT_SIGNED] != 0;
+	sig.mux_mode = layout[LAYOUT_MUX_MODE];
+	sig.mux_value = layout[LAYOUT_MUX_VALUE];
+	sig.factor = scaling[0];
+	sig.offset = scaling[1];
+	sig.mask = length == 64 ? ~UINT64_C(0) : (UINT64_C(1) << length) - 1;
+	if (sig.big_endian) {
+		/* DBC names the msb of a Motorola signal, bit 7 of byte 0 is
+		 * the msb of the big endian word */
+		const int msb = (7 - start / 8) * 8 + start % 8;
+		sig.shift = msb - length + 1;
+		return sig.shift >= 0;
+	} else {
+		sig.shift = start;
+		return start + length <= 64;
+	}
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_SignalDecoder__1compile
+(JNIEnv *env, jclass clazz, jintArray messageIds, jintArray signalCounts,
+ jintArray layout, jdoubleArray scaling)
+{
+	const jsize messages = env->GetArrayLength(messageIds);
+	const jsize layout_len = env->GetArrayLength(layout);
+	const jsize scaling_len = env->GetArrayLength(scaling);
+	if (env->GetArrayLength(signalCounts) != messages ||
+	    layout_len % LAYOUT_FIELDS != 0 ||
+	    scaling_len != layout_len / LAYOUT_FIELDS * 2) {
+		throwIllegalArgumentException(env, "inconsistent decoder layout");
+		return 0;
+	}
+	std::vector<jint> ids(messages), counts(messages), lay(layout_len);
+	std::vector<jdouble> scale(scaling_len);
+	env->GetIntArrayRegion(messageIds, 0, messages, ids.data());
+	env->GetIntArrayRegion(signalCounts, 0, messages, counts.data());
+	env->GetIntArrayRegion(layout, 0, layout_len, lay.data());
+	env->GetDoubleArrayRegion(scaling, 0, scaling_len, scale.data());
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return 0;
+	}
+
+	decoder_plan *const plan = new (std::nothrow) decoder_plan();
+	if (plan == NULL) {
+		throwOutOfMemoryError(env, "could not allocate decoder plan");
+		return 0;
+	}
+	plan->messages.resize(messages);
+	jsize sig_idx = 0;
+	for (jsize m = 0; m < messages; m++) {
+		message_plan& msg = plan->messages[m];
+		msg.can_id = normalize_id(ids[m]);
+		msg.has_big_endian = false;
+		msg.selector = -1;
+		if (counts[m] < 0 ||
+		    sig_idx + counts[m] > layout_len / LAYOUT_FIELDS) {
+			delete plan;
+			throwIllegalArgumentException(env, "inconsistent decoder layout");
+			return 0;
+		}
+		msg.signals.resize(counts[m]);
+		for (jint s = 0; s < counts[m]; s++, sig_idx++) {
+			signal_plan& sig = msg.signals[s];
+			if (!compile_signal(&lay[sig_idx * LAYOUT_FIELDS],
+					    &scale[sig_idx * 2], sig)) {
+				delete plan;
+				throwIllegalArgumentException(env, "signal exceeds payload");
+				return 0;
+			}
+			msg.has_big_endian |= sig.big_endian;
+			if (sig.mux_mode == MUX_SELECTOR && msg.selector == -1) {
+				msg.selector = s;
+			}
+		}
+	}
+	return reinterpret_cast<jlong>(plan);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_SignalDecoder__1free
+(JNIEnv *env, jclass clazz, jlong plan)
+{
+	delete reinterpret_cast<decoder_plan *>(plan);
+}
+
+static void extract_raw(const signal_plan& sig, const uint64_t *words,
+			int64_t *raw, jsize rows)
+{
+	const int shift = sig.shift;
+	const uint64_t mask = sig.mask;
+	if (sig.is_signed && sig.length < 64) {
+		const int ext = 64 - sig.length;
+		for (jsize r = 0; r < rows; r++) {
+			const uint64_t v = ((words[r] >> shift) & mask) << ext;
+			raw[r] = static_cast<int64_t>(v) >> ext;
+		}
+	} else {
+		for (jsize r = 0; r < rows; r++) {
+			raw[r] = static_cast<int64_t>((words[r] >> shift) & mask);
+		}
+	}
+}
+
+static void scale_raw(const signal_plan& sig, const int64_t *raw,
+		      jdouble *physical, jsize rows)
+{
+	const double factor = sig.factor;
+	const double offset = sig.offset;
+	if (sig.is_signed || sig.length < 64) {
+		for (jsize r = 0; r < rows; r++) {
+			physical[r] = static_cast<double>(raw[r]) * factor + offset;
+		}
+	} else {
+		for (jsize r = 0; r < rows; r++) {
+			physical[r] = static_cast<double>(
+				static_cast<uint64_t>(raw[r])) * factor + offset;
+		}
+	}
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_SignalDecoder__1decode
+(JNIEnv *env, jclass clazz, jlong planHandle, jint message, jintArray canIds,
+ jbyteArray data, jint count, jintArray frameIndex, jobjectArray rawColumns,
+ jobjectArray physicalColumns)
+{
+	const decoder_plan *const plan =
+		reinterpret_cast<const decoder_plan *>(planHandle);
+	if (message < 0 ||
+	    static_cast<size_t>(message) >= plan->messages.size()) {
+		throwIllegalArgumentException(env, "illegal message index");
+		return -1;
+	}
+	const message_plan& msg = plan->messages[message];
+	const jsize signals = static_cast<jsize>(msg.signals.size());
+	if (count < 0 || env->GetArrayLength(canIds) < count ||
+	    env->GetArrayLength(data) / CAN_MAX_DLEN < count ||
+	    env->GetArrayLength(rawColumns) != signals ||
+	    env->GetArrayLength(physicalColumns) != signals) {
+		throwIllegalArgumentException(env, "illegal batch or columns");
+		return -1;
+	}
+	decode_scratch& s = scratch;
+	if (s.le_words.size() < static_cast<size_t>(count)) {
+		s.le_words.resize(count);
+		s.be_words.resize(count);
+		s.frame_index.resize(count);
+		s.raw.resize(count);
+		s.physical.resize(count);
+		s.selector.resize(count);
+	}
+
+	/* gather the payload words of all frames of this message */
+	jsize rows = 0;
+	{
+		const jint *const ids = static_cast<const jint *>(
+			env->GetPrimitiveArrayCritical(canIds, NULL));
+		if (ids == NULL) {
+			return -1;
+		}
+		const jbyte *const payload = static_cast<const jbyte *>(
+			env->GetPrimitiveArrayCritical(data, NULL));
+		if (payload == NULL) {
+			env->ReleasePrimitiveArrayCritical(canIds,
+				const_cast<jint *>(ids), JNI_ABORT);
+			return -1;
+		}
+		for (jint i = 0; i < count; i++) {
+			if (normalize_id(ids[i]) != msg.can_id) {
+				continue;
+			}
+			uint64_t word;
+			memcpy(&word, payload + i * CAN_MAX_DLEN, sizeof(word));
+			s.le_words[rows] = le64toh(word);
+			s.frame_index[rows] = i;
+			rows++;
+		}
+		env->ReleasePrimitiveArrayCritical(data,
+			const_cast<jbyte *>(payload), JNI_ABORT);
+		env->ReleasePrimitiveArrayCritical(canIds,
+			const_cast<jint *>(ids), JNI_ABORT);
+	}
+	if (rows > env->GetArrayLength(frameIndex)) {
+		throwIllegalArgumentException(env, "columns too short for batch");
+		return -1;
+	}
+	if (msg.has_big_endian) {
+		for (jsize r = 0; r < rows; r++) {
+			s.be_words[r] = __builtin_bswap64(s.le_words[r]);
+		}
+	}
+	if (msg.selector != -1) {
+		const signal_plan& sel = msg.signals[msg.selector];
+		extract_raw(sel, sel.big_endian ? s.be_words.data()
+			    : s.le_words.data(), s.selector.data(), rows);
+	}
+
+	env->SetIntArrayRegion(frameIndex, 0, rows, s.frame_index.data());
+	for (jsize i = 0; i < signals; i++) {
+		const signal_plan& sig = msg.signals[i];
+		const jlongArray raw_col = static_cast<jlongArray>(
+			env->GetObjectArrayElement(rawColumns, i));
+		const jdoubleArray phys_col = static_cast<jdoubleArray>(
+			env->GetObjectArrayElement(physicalColumns, i));
+		if (raw_col == NULL || phys_col == NULL) {
+			throwIllegalArgumentException(env, "missing signal column");
+			return -1;
+		}
+		if (env->GetArrayLength(raw_col) < rows ||
+		    env->GetArrayLength(phys_col) < rows) {
+			throwIllegalArgumentException(env, "columns too short for batch");
+			return -1;
+		}
+		extract_raw(sig, sig.big_endian ? s.be_words.data()
+			    : s.le_words.data(), s.raw.data(), rows);
+		scale_raw(sig, s.raw.data(), s.physical.data(), rows);
+		if (sig.mux_mode == MUX_SELECTED && msg.selector != -1) {
+			for (jsize r = 0; r < rows; r++) {
+				if (s.selector[r] != sig.mux_value) {
+					s.raw[r] = 0;
+					s.physical[r] =
+						std::numeric_limits<double>::quiet_NaN();
+				}
+			}
+		}
+		env->SetLongArrayRegion(raw_col, 0, rows,
+			reinterpret_cast<const jlong *>(s.raw.data()));
+		env->SetDoubleArrayRegion(phys_col, 0, rows, s.physical.data());
+		env->DeleteLocalRef(raw_col);
+		env->DeleteLocalRef(phys_col);
+		if (env->ExceptionCheck() == JNI_TRUE) {
+			return -1;
+		}
+	}
+	return rows;
+}
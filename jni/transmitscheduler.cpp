@@ -0,0 +1,457 @@
+#include<atomic>
+#include<algorithm>
+#include<new>
+#include<queue>
+#include<thread>
+#include<vector>
+#include<system_error>
+
+#include<cstring>
+#include<cstdint>
+#include<cerrno>
+#include<ctime>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+}
+
+#if defined(ANDROID) || defined(__ANDROID__)
+#include "jni.h"
+#else
+#include "de_entropia_can_TransmitScheduler.h"
+#endif
+
+#include "jniutil.h"
+#include "iostats.h"
+#include "txshaper.h"
+#include "clocks.h"
+
+/*
+ * Frames submitted from Java go through a bounded lock-free MPSC ring
+ * into a priority heap owned by the transmit thread. The thread sends the
+ * frames with the highest bus priority first, up to SEND_BATCH_MAX per
+ * sendmmsg call, and waits for POLLOUT when the kernel reports a full
+ * queue. CAN sockets may report ENOBUFS for a full device queue without
+ * ever signalling POLLOUT, so these waits are capped at POLLOUT_WAIT_MS.
+ *
+ * Frames also pass the shaper of the socket, without waiting in it: a
+ * frame over budget stays pending like one the kernel refused, and the
+ * thread offers it again after SHAPER_WAIT_MS, so close is never held up
+ * by a slow budget.
+ */
+
+static const int SEND_BATCH_MAX = 32;
+static const int POLLOUT_WAIT_MS = 1;
+static const int SHAPER_WAIT_MS = 1;
+static const int IDLE_WAIT_MS = 100;
+
+/* indices of the array filled by _stats */
+enum {
+	STAT_SUBMITTED,
+	STAT_REJECTED,
+	STAT_SENT,
+	STAT_DISCARDED,
+	STAT_SEND_CALLS,
+	STAT_ENOBUFS,
+	STAT_POLLOUT_WAITS,
+	STAT_POLLOUT_WAIT_NANOS,
+	STAT_QUEUE_DEPTH,
+	STAT_MAX_QUEUE_DEPTH,
+	STAT_QUEUE_NANOS,
+	STAT_MAX_QUEUE_NANOS,
+	STAT_ERRORS,
+	STAT_LAST_ERRNO,
+	STAT_FIELDS
+};
+
+struct tx_entry {
+	struct can_frame frame;
+	int if_index;
+	uint32_t priority;
+	uint64_t order;
+	int64_t submitted;
+};
+
+struct tx_cell {
+	std::atomic<size_t> seq;
+	tx_entry entry;
+};
+
+struct tx_later {
+	bool operator()(const tx_entry& a, const tx_entry& b) const
+	{
+		if (a.priority != b.priority) {
+			return a.priority > b.priority;
+		}
+		return a.order > b.order;
+	}
+};
+
+struct tx_scheduler {
+	int fd;
+	/* counters of the socket, the sends count there as well */
+	io_stats *io;
+	int wake_fd;
+	size_t mask;
+	tx_cell *ring;
+	alignas(64) std::atomic<size_t> enqueue_pos;
+	alignas(64) size_t dequeue_pos;
+	std::atomic<bool> sleeping;
+	std::atomic<bool> stop;
+	std::atomic<int64_t> stats[STAT_FIELDS];
+	std::thread thread;
+};
+
+/*
+ * Sort key following CAN arbitration: the 11 bit base id decides first,
+ * then the RTR bit of standard frames against the recessive SRR bit of
+ * extended ones, the IDE bit, the 18 bit id extension and finally RTR.
+ */
+static uint32_t arbitrationKey(uint32_t can_id)
+{
+	const uint32_t rtr = (can_id & CAN_RTR_FLAG) ? 1 : 0;
+	if (can_id & CAN_EFF_FLAG) {
+		const uint32_t id = can_id & CAN_EFF_MASK;
+		return ((id >> 18) << 21) | (1U << 20) | (1U << 19) |
+			((id & 0x3ffff) << 1) | rtr;
+	}
+	return ((can_id & CAN_SFF_MASK) << 21) | (rtr << 20);
+}
+
+static inline void statAdd(tx_scheduler *s, int stat, int64_t v)
+{
+	s->stats[stat].fetch_add(v, std::memory_order_relaxed);
+}
+
+static inline void statMax(tx_scheduler *s, int stat, int64_t v)
+{
+	int64_t cur = s->stats[stat].load(std::memory_order_relaxed);
+	while (v > cur && !s->stats[stat].compare_exchange_weak(cur, v,
+			std::memory_order_relaxed)) {
+	}
+}
+
+static bool ringPush(tx_scheduler *s, const tx_entry& entry)
+{
+	size_t pos = s->enqueue_pos.load(std::memory_order_relaxed);
+	for (;;) {
+		tx_cell& cell = s->ring[pos & s->mask];
+		const size_t seq = cell.seq.load(std::memory_order_acquire);
+		const intptr_t diff = static_cast<intptr_t>(seq) -
+			static_cast<intptr_t>(pos);
+		if (diff == 0) {
+			if (s->enqueue_pos.compare_exchange_weak(pos, pos + 1,
+					std::memory_order_relaxed)) {
+				cell.entry = entry;
+				cell.seq.store(pos + 1, std::memory_order_release);
+				return true;
+			}
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = s->enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+/* single consumer: only called from the transmit thread */
+static bool ringPop(tx_scheduler *s, tx_entry& entry)
+{
+	tx_cell& cell = s->ring[s->dequeue_pos & s->mask];
+	const size_t seq = cell.seq.load(std::memory_order_acquire);
+	if (seq != s->dequeue_pos + 1) {
+		return false;
+	}
+	entry = cell.entry;
+	cell.seq.store(s->dequeue_pos + s->mask + 1, std::memory_order_release);
+	s->dequeue_pos++;
+	return true;
+}
+
+static bool ringEmpty(tx_scheduler *s)
+{
+	const tx_cell& cell = s->ring[s->dequeue_pos & s->mask];
+	return cell.seq.load(std::memory_order_acquire) != s->dequeue_pos + 1;
+}
+
+static void waitForWork(tx_scheduler *s)
+{
+	s->sleeping.store(true, std::memory_order_seq_cst);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (!ringEmpty(s) || s->stop.load(std::memory_order_seq_cst)) {
+		s->sleeping.store(false, std::memory_order_relaxed);
+		return;
+	}
+	struct pollfd pfd;
+	pfd.fd = s->wake_fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, IDLE_WAIT_MS) == 1) {
+		uint64_t v;
+		if (read(s->wake_fd, &v, sizeof(v)) == -1) {
+			/* EAGAIN, another wakeup got there first */
+		}
+	}
+	s->sleeping.store(false, std::memory_order_relaxed);
+}
+
+static void waitForPollout(tx_scheduler *s)
+{
+	struct pollfd pfd;
+	pfd.fd = s->fd;
+	pfd.events = POLLOUT;
+	const int64_t start = monotonicNanos();
+	poll(&pfd, 1, POLLOUT_WAIT_MS);
+	statAdd(s, STAT_POLLOUT_WAITS, 1);
+	statAdd(s, STAT_POLLOUT_WAIT_NANOS, monotonicNanos() - start);
+}
+
+static void waitForShaper()
+{
+	poll(NULL, 0, SHAPER_WAIT_MS);
+}
+
+static void transmitLoop(tx_scheduler *s)
+{
+	std::priority_queue<tx_entry, std::vector<tx_entry>, tx_later> pending;
+	tx_entry batch[SEND_BATCH_MAX];
+	struct sockaddr_can addrs[SEND_BATCH_MAX];
+	struct iovec iovs[SEND_BATCH_MAX];
+	struct mmsghdr msgs[SEND_BATCH_MAX];
+	uint64_t order = 0;
+	tx_entry entry;
+	io_shard& shard = ioShard(s->io);
+
+	while (!s->stop.load(std::memory_order_acquire)) {
+		while (ringPop(s, entry)) {
+			entry.order = order++;
+			pending.push(entry);
+		}
+		if (pending.empty()) {
+			waitForWork(s);
+			continue;
+		}
+		const shaper_ref ref(s->io);
+		bool throttled = false;
+		int n = 0;
+		while (n < SEND_BATCH_MAX && !pending.empty()) {
+			batch[n] = pending.top();
+			pending.pop();
+			if (ref.shaper != NULL) {
+				const shape_verdict verdict =
+					shapeFrame(ref.shaper, batch[n].if_index,
+						   batch[n].frame, false);
+				if (verdict == SHAPE_DROP) {
+					statAdd(s, STAT_DISCARDED, 1);
+					statAdd(s, STAT_QUEUE_DEPTH, -1);
+					continue;
+				} else if (verdict == SHAPE_REJECT) {
+					ioAdd(shard, IO_WOULD_BLOCK, 1);
+					pending.push(batch[n]);
+					throttled = true;
+					break;
+				}
+			}
+			memset(&addrs[n], 0, sizeof(addrs[n]));
+			addrs[n].can_family = AF_CAN;
+			addrs[n].can_ifindex = batch[n].if_index;
+			iovs[n].iov_base = &batch[n].frame;
+			iovs[n].iov_len = sizeof(batch[n].frame);
+			memset(&msgs[n], 0, sizeof(msgs[n]));
+			msgs[n].msg_hdr.msg_name = &addrs[n];
+			msgs[n].msg_hdr.msg_namelen = sizeof(addrs[n]);
+			msgs[n].msg_hdr.msg_iov = &iovs[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+			n++;
+		}
+		if (n == 0) {
+			if (throttled) {
+				waitForShaper();
+			}
+			continue;
+		}
+		int sent;
+		{
+			io_timer timer(shard, IO_SEND_NANOS);
+			sent = sendmmsg(s->fd, msgs, n, MSG_DONTWAIT);
+		}
+		statAdd(s, STAT_SEND_CALLS, 1);
+		ioAdd(shard, IO_SEND_CALLS, 1);
+		int done = sent > 0 ? sent : 0;
+		bool congested = sent >= 0 && sent < n;
+		if (sent == -1) {
+			countSendError(shard, errno);
+			if (errno == ENOBUFS || errno == EAGAIN ||
+			    errno == EWOULDBLOCK) {
+				statAdd(s, STAT_ENOBUFS, 1);
+				congested = true;
+			} else if (errno != EINTR) {
+				/* the first frame is broken or the socket
+				 * unusable, drop it so the rest can proceed */
+				statAdd(s, STAT_ERRORS, 1);
+				ioAdd(shard, IO_EXCEPTIONS, 1);
+				s->stats[STAT_LAST_ERRNO].store(errno,
+						std::memory_order_relaxed);
+				statAdd(s, STAT_DISCARDED, 1);
+				statAdd(s, STAT_QUEUE_DEPTH, -1);
+				done = 1;
+			}
+		}
+		if (sent > 0) {
+			const int64_t now = monotonicNanos();
+			int64_t total = 0;
+			uint64_t bytes = 0;
+			for (int i = 0; i < sent; i++) {
+				const int64_t waited = now - batch[i].submitted;
+				total += waited;
+				bytes += batch[i].frame.can_dlc;
+				statMax(s, STAT_MAX_QUEUE_NANOS, waited);
+			}
+			ioAdd(shard, IO_FRAMES_OUT, sent);
+			ioAdd(shard, IO_BYTES_OUT, bytes);
+			statAdd(s, STAT_SENT, sent);
+			statAdd(s, STAT_QUEUE_NANOS, total);
+			statAdd(s, STAT_QUEUE_DEPTH, -sent);
+		}
+		/* unsent frames go back, newer urgent ones may overtake them */
+		for (int i = done; i < n; i++) {
+			pending.push(batch[i]);
+		}
+		if (congested) {
+			waitForPollout(s);
+		} else if (throttled) {
+			waitForShaper();
+		}
+	}
+	while (ringPop(s, entry)) {
+		pending.push(entry);
+	}
+	statAdd(s, STAT_DISCARDED, pending.size());
+	statAdd(s, STAT_QUEUE_DEPTH, -static_cast<int64_t>(pending.size()));
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_TransmitScheduler__1create
+(JNIEnv *env, jclass clazz, jint fd, jlong stats, jint capacity)
+{
+	if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+		throwIllegalArgumentException(env, "capacity must be a power of two");
+		return 0;
+	}
+	const int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd == -1) {
+		throwIOExceptionErrno(env, errno);
+		return 0;
+	}
+	tx_cell *const ring = new (std::nothrow) tx_cell[capacity];
+	if (ring == NULL) {
+		close(wake_fd);
+		throwOutOfMemoryError(env, "could not allocate transmit ring");
+		return 0;
+	}
+	tx_scheduler *const s = new (std::nothrow) tx_scheduler();
+	if (s == NULL) {
+		close(wake_fd);
+		delete[] ring;
+		throwOutOfMemoryError(env, "could not allocate transmit scheduler");
+		return 0;
+	}
+	s->fd = fd;
+	s->io = reinterpret_cast<io_stats *>(stats);
+	s->wake_fd = wake_fd;
+	s->mask = capacity - 1;
+	s->ring = ring;
+	for (jint i = 0; i < capacity; i++) {
+		s->ring[i].seq.store(i, std::memory_order_relaxed);
+	}
+	s->enqueue_pos.store(0, std::memory_order_relaxed);
+	s->dequeue_pos = 0;
+	s->sleeping.store(false, std::memory_order_relaxed);
+	s->stop.store(false, std::memory_order_relaxed);
+	for (int i = 0; i < STAT_FIELDS; i++) {
+		s->stats[i].store(0, std::memory_order_relaxed);
+	}
+	try {
+		s->thread = std::thread(transmitLoop, s);
+	} catch (const std::system_error& e) {
+		close(wake_fd);
+		delete[] s->ring;
+		delete s;
+		throwIOExceptionMsg(env, e.what());
+		return 0;
+	}
+	return reinterpret_cast<jlong>(s);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_TransmitScheduler__1destroy
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	tx_scheduler *const s = reinterpret_cast<tx_scheduler *>(handle);
+	const uint64_t one = 1;
+	s->stop.store(true, std::memory_order_seq_cst);
+	if (write(s->wake_fd, &one, sizeof(one)) == -1) {
+		/* counter overflow, the thread is awake anyway */
+	}
+	s->thread.join();
+	close(s->wake_fd);
+	delete[] s->ring;
+	delete s;
+}
+
+JNIEXPORT jboolean JNICALL Java_de_entropia_can_TransmitScheduler__1offer
+(JNIEnv *env, jclass clazz, jlong handle, jint ifIndex, jint canId,
+ jbyteArray data)
+{
+	tx_scheduler *const s = reinterpret_cast<tx_scheduler *>(handle);
+	tx_entry entry;
+	memset(&entry, 0, sizeof(entry));
+	const jsize len = env->GetArrayLength(data);
+	if (len > CAN_MAX_DLEN) {
+		throwIllegalArgumentException(env, "payload too long");
+		return JNI_FALSE;
+	}
+	env->GetByteArrayRegion(data, 0, len,
+				reinterpret_cast<jbyte *>(entry.frame.data));
+	if (env->ExceptionCheck() == JNI_TRUE) {
+		return JNI_FALSE;
+	}
+	entry.frame.can_id = canId;
+	entry.frame.can_dlc = static_cast<__u8>(len);
+	entry.if_index = ifIndex;
+	entry.priority = arbitrationKey(canId);
+	entry.submitted = monotonicNanos();
+
+	/* account before publishing so the depth never goes negative */
+	const int64_t depth = s->stats[STAT_QUEUE_DEPTH].fetch_add(1,
+			std::memory_order_relaxed) + 1;
+	if (!ringPush(s, entry)) {
+		statAdd(s, STAT_QUEUE_DEPTH, -1);
+		statAdd(s, STAT_REJECTED, 1);
+		return JNI_FALSE;
+	}
+	statAdd(s, STAT_SUBMITTED, 1);
+	statMax(s, STAT_MAX_QUEUE_DEPTH, depth);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (s->sleeping.load(std::memory_order_relaxed)) {
+		const uint64_t one = 1;
+		if (write(s->wake_fd, &one, sizeof(one)) == -1) {
+			/* counter overflow, the thread is awake anyway */
+		}
+	}
+	return JNI_TRUE;
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_TransmitScheduler__1stats
+(JNIEnv *env, jclass clazz, jlong handle, jlongArray out)
+{
+	tx_scheduler *const s = reinterpret_cast<tx_scheduler *>(handle);
+	jlong values[STAT_FIELDS];
+	for (int i = 0; i < STAT_FIELDS; i++) {
+		values[i] = s->stats[i].load(std::memory_order_relaxed);
+	}
+	env->SetLongArrayRegion(out, 0, STAT_FIELDS, values);
+}
@@ -0,0 +1,376 @@
+#include<algorithm>
+#include<atomic>
+#include<mutex>
+#include<new>
+#include<vector>
+
+#include<cstring>
+#include<cstdint>
+#include<cerrno>
+#include<ctime>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sched.h>
+#include <time.h>
+
+#include <linux/can.h>
+}
+
+#if defined(ANDROID) || defined(__ANDROID__)
+#include "jni.h"
+#else
+#include "de_entropia_can_TxShaper.h"
+#endif
+
+#include "jniutil.h"
+#include "txshaper.h"
+#include "wirebits.h"
+#include "clocks.h"
+
+/*
+ * Token buckets checked on the raw frame send paths of every socket the
+ * shaper is attached to. A frame has to fit into the bucket of the first
+ * id rule matching it, the frame bucket of its interface and the bit
+ * budget of its interface; it takes tokens from all of them or from none.
+ * Buckets are refilled lazily from CLOCK_MONOTONIC when a frame is
+ * checked, so an idle shaper costs nothing. One mutex guards all
+ * buckets: shaped sockets run at bus speed, which is far below what the
+ * lock can sustain.
+ */
+
+/* values of TxShaper.Policy.ordinal() */
+enum {
+	POLICY_DELAY,
+	POLICY_DROP,
+	POLICY_FAIL
+};
+
+/* smallest bit budget burst, one worst case extended frame */
+static const double MIN_BURST_BITS = 160;
+/* default bit budget burst in nanoseconds of the bus load limit */
+static const double BURST_NANOS = 10e6;
+
+struct token_bucket {
+	double tokens;
+	double burst;
+	double per_nano;
+	int64_t last;
+};
+
+struct id_rule {
+	canid_t low;
+	canid_t high;
+	token_bucket bucket;
+	std::atomic<int64_t> shaped;
+};
+
+struct if_limit {
+	int ifindex;
+	bool frames_set;
+	token_bucket frames;
+	bool bits_set;
+	token_bucket bits;
+};
+
+struct tx_shaper {
+	std::atomic<int> refs;
+	int policy;
+	std::mutex lock;
+	/* rules hold atomics and are never removed, so they stay put */
+	std::vector<id_rule *> rules;
+	std::vector<if_limit> limits;
+	std::atomic<int64_t> stats[SHAPER_FIELDS];
+};
+
+static inline void statAdd(tx_shaper *s, int stat, int64_t v)
+{
+	s->stats[stat].fetch_add(v, std::memory_order_relaxed);
+}
+
+static void initBucket(token_bucket& b, double per_second, double burst)
+{
+	b.tokens = burst;
+	b.burst = burst;
+	b.per_nano = per_second / 1e9;
+	b.last = monotonicNanos();
+}
+
+static void refill(token_bucket& b, const int64_t now)
+{
+	if (now > b.last) {
+		b.tokens = std::min(b.burst, b.tokens + (now - b.last) * b.per_nano);
+		b.last = now;
+	}
+}
+
+/*
+ * Nanoseconds until cost tokens are available. A cost above the burst is
+ * capped to it, so oversized frames still pass with a full bucket.
+ */
+static int64_t deficitNanos(const token_bucket& b, double cost)
+{
+	cost = std::min(cost, b.burst);
+	if (b.tokens >= cost) {
+		return 0;
+	}
+	return static_cast<int64_t>((cost - b.tokens) / b.per_nano) + 1;
+}
+
+static void take(token_bucket& b, const double cost)
+{
+	b.tokens -= std::min(cost, b.burst);
+}
+
+static if_limit *findLimit(tx_shaper *s, const int ifindex)
+{
+	for (size_t i = 0; i < s->limits.size(); i++) {
+		if (s->limits[i].ifindex == ifindex) {
+			return &s->limits[i];
+		}
+	}
+	return NULL;
+}
+
+shape_verdict shapeFrame(tx_shaper *s, const int ifindex,
+			 const struct can_frame& frame, const bool may_delay)
+{
+	const canid_t key = frame.can_id & (CAN_EFF_FLAG | CAN_EFF_MASK);
+	const double bits = frameWireBits(frame.can_id, frame.data,
+					 frame.can_dlc);
+	int64_t delayed_since = 0;
+	bool first = true;
+	statAdd(s, SHAPER_FRAMES, 1);
+	for (;;) {
+		int64_t wait = 0;
+		{
+			std::lock_guard<std::mutex> guard(s->lock);
+			const int64_t now = monotonicNanos();
+			id_rule *rule = NULL;
+			for (size_t i = 0; i < s->rules.size(); i++) {
+				if (key >= s->rules[i]->low && key <= s->rules[i]->high) {
+					rule = s->rules[i];
+					break;
+				}
+			}
+			if_limit *const limit = findLimit(s, ifindex);
+			if (rule != NULL) {
+				refill(rule->bucket, now);
+				wait = deficitNanos(rule->bucket, 1);
+				if (wait > 0 && first) {
+					rule->shaped.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+			if (limit != NULL && limit->frames_set) {
+				refill(limit->frames, now);
+				wait = std::max(wait, deficitNanos(limit->frames, 1));
+			}
+			if (limit != NULL && limit->bits_set) {
+				refill(limit->bits, now);
+				wait = std::max(wait, deficitNanos(limit->bits, bits));
+			}
+			if (wait == 0) {
+				if (rule != NULL) {
+					take(rule->bucket, 1);
+				}
+				if (limit != NULL && limit->frames_set) {
+					take(limit->frames, 1);
+				}
+				if (limit != NULL && limit->bits_set) {
+					take(limit->bits, bits);
+				}
+				if (delayed_since != 0) {
+					statAdd(s, SHAPER_DELAYED, 1);
+					statAdd(s, SHAPER_DELAY_NANOS, now - delayed_since);
+				}
+				return SHAPE_PASS;
+			}
+			if (delayed_since == 0) {
+				delayed_since = now;
+			}
+		}
+		first = false;
+		if (s->policy == POLICY_DROP) {
+			statAdd(s, SHAPER_DROPPED, 1);
+			return SHAPE_DROP;
+		} else if (s->policy == POLICY_FAIL || !may_delay) {
+			statAdd(s, SHAPER_REJECTED, 1);
+			return SHAPE_REJECT;
+		}
+		struct timespec ts;
+		ts.tv_sec = wait / 1000000000;
+		ts.tv_nsec = wait % 1000000000;
+		/* an early wakeup just rechecks the buckets */
+		nanosleep(&ts, NULL);
+	}
+}
+
+void retainShaper(tx_shaper *s)
+{
+	s->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void releaseShaper(tx_shaper *s)
+{
+	if (s->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		for (size_t i = 0; i < s->rules.size(); i++) {
+			delete s->rules[i];
+		}
+		delete s;
+	}
+}
+
+/*
+ * A sender announces itself before loading the pointer, so swapShaper,
+ * having swapped in the next shaper, only has to wait for the announced
+ * senders to retain the previous one before dropping its own reference.
+ */
+tx_shaper *acquireShaper(io_stats *stats)
+{
+	if (stats == NULL) {
+		return NULL;
+	}
+	stats->shaper_readers.fetch_add(1, std::memory_order_seq_cst);
+	tx_shaper *const s = stats->shaper.load(std::memory_order_seq_cst);
+	if (s != NULL) {
+		retainShaper(s);
+	}
+	stats->shaper_readers.fetch_sub(1, std::memory_order_release);
+	return s;
+}
+
+void swapShaper(io_stats *stats, tx_shaper *next)
+{
+	if (next != NULL) {
+		retainShaper(next);
+	}
+	tx_shaper *const prev = stats->shaper.exchange(next,
+						       std::memory_order_seq_cst);
+	if (prev == NULL) {
+		return;
+	}
+	while (stats->shaper_readers.load(std::memory_order_seq_cst) != 0) {
+		sched_yield();
+	}
+	releaseShaper(prev);
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_TxShaper__1create
+(JNIEnv *env, jclass clazz, jint policy)
+{
+	if (policy < POLICY_DELAY || policy > POLICY_FAIL) {
+		throwIllegalArgumentException(env, "unknown policy");
+		return 0;
+	}
+	tx_shaper *const s = new (std::nothrow) tx_shaper();
+	if (s == NULL) {
+		throwOutOfMemoryError(env, "could not allocate shaper");
+		return 0;
+	}
+	s->refs.store(1, std::memory_order_relaxed);
+	s->policy = policy;
+	for (int i = 0; i < SHAPER_FIELDS; i++) {
+		s->stats[i].store(0, std::memory_order_relaxed);
+	}
+	return reinterpret_cast<jlong>(s);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_TxShaper__1release
+(JNIEnv *env, jclass clazz, jlong handle)
+{
+	releaseShaper(reinterpret_cast<tx_shaper *>(handle));
+}
+
+JNIEXPORT jint JNICALL Java_de_entropia_can_TxShaper__1addIdRule
+(JNIEnv *env, jclass clazz, jlong handle, jint low, jint high,
+ jdouble perSecond, jdouble burst)
+{
+	tx_shaper *const s = reinterpret_cast<tx_shaper *>(handle);
+	if (!(perSecond > 0) || !(burst >= 1)) {
+		throwIllegalArgumentException(env, "rate must be positive and "
+					      "burst at least one frame");
+		return -1;
+	}
+	id_rule *const rule = new (std::nothrow) id_rule();
+	if (rule == NULL) {
+		throwOutOfMemoryError(env, "could not allocate id rule");
+		return -1;
+	}
+	rule->low = static_cast<canid_t>(low);
+	rule->high = static_cast<canid_t>(high);
+	initBucket(rule->bucket, perSecond, burst);
+	rule->shaped.store(0, std::memory_order_relaxed);
+	std::lock_guard<std::mutex> guard(s->lock);
+	s->rules.push_back(rule);
+	return static_cast<jint>(s->rules.size() - 1);
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_TxShaper__1setInterfaceLimit
+(JNIEnv *env, jclass clazz, jlong handle, jint ifindex, jdouble perSecond,
+ jdouble burst)
+{
+	tx_shaper *const s = reinterpret_cast<tx_shaper *>(handle);
+	if (!(perSecond > 0) || !(burst >= 1)) {
+		throwIllegalArgumentException(env, "rate must be positive and "
+					      "burst at least one frame");
+		return;
+	}
+	std::lock_guard<std::mutex> guard(s->lock);
+	if_limit *limit = findLimit(s, ifindex);
+	if (limit == NULL) {
+		s->limits.push_back(if_limit());
+		limit = &s->limits.back();
+		memset(limit, 0, sizeof(*limit));
+		limit->ifindex = ifindex;
+	}
+	initBucket(limit->frames, perSecond, burst);
+	limit->frames_set = true;
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_TxShaper__1setBusLoadLimit
+(JNIEnv *env, jclass clazz, jlong handle, jint ifindex, jint bitrate,
+ jdouble maxLoad)
+{
+	tx_shaper *const s = reinterpret_cast<tx_shaper *>(handle);
+	if (bitrate <= 0 || !(maxLoad > 0) || maxLoad > 1) {
+		throwIllegalArgumentException(env, "bitrate must be positive and "
+					      "load in (0, 1]");
+		return;
+	}
+	const double bits_per_second = bitrate * maxLoad;
+	std::lock_guard<std::mutex> guard(s->lock);
+	if_limit *limit = findLimit(s, ifindex);
+	if (limit == NULL) {
+		s->limits.push_back(if_limit());
+		limit = &s->limits.back();
+		memset(limit, 0, sizeof(*limit));
+		limit->ifindex = ifindex;
+	}
+	initBucket(limit->bits, bits_per_second,
+		   std::max(MIN_BURST_BITS, bits_per_second * BURST_NANOS / 1e9));
+	limit->bits_set = true;
+}
+
+JNIEXPORT void JNICALL Java_de_entropia_can_TxShaper__1stats
+(JNIEnv *env, jclass clazz, jlong handle, jlongArray out)
+{
+	tx_shaper *const s = reinterpret_cast<tx_shaper *>(handle);
+	jlong values[SHAPER_FIELDS];
+	for (int i = 0; i < SHAPER_FIELDS; i++) {
+		values[i] = s->stats[i].load(std::memory_order_relaxed);
+	}
+	env->SetLongArrayRegion(out, 0, SHAPER_FIELDS, values);
+}
+
+JNIEXPORT jlong JNICALL Java_de_entropia_can_TxShaper__1ruleShaped
+(JNIEnv *env, jclass clazz, jlong handle, jint rule)
+{
+	tx_shaper *const s = reinterpret_cast<tx_shaper *>(handle);
+	std::lock_guard<std::mutex> guard(s->lock);
+	if (rule < 0 || static_cast<size_t>(rule) >= s->rules.size()) {
+		throwIllegalArgumentException(env, "no such rule");
+		return 0;
+	}
+	return s->rules[rule]->shaped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,68 @@
+#ifndef TXSHAPER_H
+#define TXSHAPER_H
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <linux/can.h>
+}
+
+#include<atomic>
+
+#include "iostats.h"
+
+/* indices of the array filled by TxShaper._stats, mirrored in Java */
+enum {
+	SHAPER_FRAMES,
+	SHAPER_DELAYED,
+	SHAPER_DELAY_NANOS,
+	SHAPER_DROPPED,
+	SHAPER_REJECTED,
+	SHAPER_FIELDS
+};
+
+enum shape_verdict {
+	SHAPE_PASS,
+	/* the policy discards frames over budget, report them as sent */
+	SHAPE_DROP,
+	/* over budget and not allowed to wait, the caller fails fast */
+	SHAPE_REJECT
+};
+
+struct tx_shaper;
+
+/*
+ * Takes the tokens for one frame leaving on ifindex. Under the delay
+ * policy the calling thread sleeps until the budget allows the frame if
+ * may_delay is set; non-blocking callers get SHAPE_REJECT instead.
+ */
+shape_verdict shapeFrame(tx_shaper *shaper, int ifindex,
+			 const struct can_frame& frame, bool may_delay);
+
+void retainShaper(tx_shaper *shaper);
+/* frees the shaper once the last socket and the Java owner let go */
+void releaseShaper(tx_shaper *shaper);
+
+/* the shaper attached to stats, retained for the caller; NULL if none */
+tx_shaper *acquireShaper(io_stats *stats);
+/*
+ * Attaches next, NULL to detach, and releases the previous shaper once no
+ * sender is still picking it up.
+ */
+void swapShaper(io_stats *stats, tx_shaper *next);
+
+/* holds the shaper of a socket for the duration of one send */
+class shaper_ref {
+public:
+	explicit shaper_ref(io_stats *stats) : shaper(acquireShaper(stats)) {}
+	~shaper_ref()
+	{
+		if (shaper != NULL) {
+			releaseShaper(shaper);
+		}
+	}
+	tx_shaper *const shaper;
+};
+
+#endif
@@ -0,0 +1,87 @@
+#include<algorithm>
+
+#include<cstdint>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <linux/can.h>
+}
+
+#include "wirebits.h"
+
+/* feeds SOF .. CRC sequence of a classic frame through CRC and stuffing */
+struct bit_stream {
+	int bits;
+	int run;
+	int last;
+	uint16_t crc;
+
+	bit_stream() : bits(0), run(0), last(-1), crc(0) {}
+
+	void put(int bit, bool checked)
+	{
+		if (checked) {
+			const int next = bit ^ ((crc >> 14) & 1);
+			crc = (crc << 1) & 0x7fff;
+			if (next) {
+				crc ^= 0x4599;
+			}
+		}
+		bits++;
+		if (bit == last) {
+			run++;
+		} else {
+			last = bit;
+			run = 1;
+		}
+		if (run == 5) {
+			/* the complement stuff bit starts the next run */
+			bits++;
+			last = !bit;
+			run = 1;
+		}
+	}
+
+	void put(uint32_t value, int count, bool checked)
+	{
+		while (count-- > 0) {
+			put((value >> count) & 1, checked);
+		}
+	}
+};
+
+int frameWireBits(uint32_t can_id, const uint8_t *data, int dlc)
+{
+	bit_stream s;
+	const int rtr = (can_id & CAN_RTR_FLAG) ? 1 : 0;
+	dlc = std::min(std::max(dlc, 0), CAN_MAX_DLEN);
+	s.put(0, true);
+	if (can_id & CAN_EFF_FLAG) {
+		const uint32_t id = can_id & CAN_EFF_MASK;
+		s.put(id >> 18, 11, true);
+		/* SRR, IDE */
+		s.put(1, true);
+		s.put(1, true);
+		s.put(id & 0x3ffff, 18, true);
+		s.put(rtr, true);
+		/* r1, r0 */
+		s.put(0, true);
+		s.put(0, true);
+	} else {
+		s.put(can_id & CAN_SFF_MASK, 11, true);
+		s.put(rtr, true);
+		/* IDE, r0 */
+		s.put(0, true);
+		s.put(0, true);
+	}
+	s.put(dlc, 4, true);
+	if (!rtr) {
+		for (int i = 0; i < dlc; i++) {
+			s.put(data[i], 8, true);
+		}
+	}
+	s.put(s.crc, 15, false);
+	return s.bits + CLASSIC_TRAILER_BITS;
+}
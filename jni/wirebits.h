@@ -0,0 +1,15 @@
+#ifndef WIREBITS_H
+#define WIREBITS_H
+
+#include<cstdint>
+
+/* bit times following the CRC sequence: delimiter, ACK, EOF, IFS */
+static const int CLASSIC_TRAILER_BITS = 1 + 2 + 7 + 3;
+
+/*
+ * Exact on-wire length of a classic frame in bit times, stuff bits and
+ * IFS included, as counted by the bus analyzer and charged by the shaper.
+ */
+int frameWireBits(uint32_t can_id, const uint8_t *data, int dlc);
+
+#endif
@@ -0,0 +1,113 @@
+package de.entropia.can;
+
+import java.io.BufferedOutputStream;
+import java.io.File;
+import java.io.FileOutputStream;
+import java.io.IOException;
+import java.io.OutputStream;
+import java.nio.file.Files;
+import java.nio.file.Path;
+
+/**
+ * Conversion speed of {@link ArrowFrameWriter}, once into a discarding
+ * stream to show the encoder alone and once into a file, and of the per-id
+ * partitioning. Frames are synthetic: a few hundred periodic ids with
+ * changing payloads, 16 bytes each in a plain capture.
+ *
+ * Arguments: [frames] [ids]
+ */
+public class ArrowExportBench {
+
+    private static final class NullOutputStream extends OutputStream {
+        @Override
+        public void write(final int b) {
+        }
+
+        @Override
+        public void write(final byte[] b, final int off, final int len) {
+        }
+    }
+
+    private static CanFrameBatch fill(final CanFrameBatch batch,
+            final long[] timestamps, final long first, final int ids) {
+        batch.clear();
+        final byte[] payload = new byte[8];
+        for (int i = 0; i < batch.capacity(); i++) {
+            final long n = first + i;
+            payload[0] = (byte) n;
+            payload[1] = (byte) (n >>> 8);
+            timestamps[i] = 1500000000000000000L + n * 100000L;
+            batch.add(1, 0x100 + (int) (n % ids), payload);
+        }
+        return batch;
+    }
+
+    private static void report(final String name, final long frames,
+            final long nanos, final long bytes) {
+        System.out.printf("%-12s %6.1f Mframes/s  %7.1f MB/s of 16 byte "
+                + "frames  %7.1f MB written%n", name, frames * 1e3 / nanos,
+                frames * 16 * 1e3 / nanos, bytes / 1e6);
+    }
+
+    private static void single(final String name, final OutputStream out,
+            final File file, final long frames, final int ids)
+            throws IOException {
+        final CanFrameBatch batch = new CanFrameBatch(1024);
+        final long[] timestamps = new long[batch.capacity()];
+        final long start = System.nanoTime();
+        try (final ArrowFrameWriter writer = new ArrowFrameWriter(out)) {
+            for (long n = 0; n < frames; n += batch.capacity()) {
+                writer.write(fill(batch, timestamps, n, ids), timestamps);
+            }
+        }
+        report(name, frames, System.nanoTime() - start,
+                file == null ? 0 : file.length());
+    }
+
+    private static void partitioned(final Path dir, final long frames,
+            final int ids) throws IOException {
+        final CanFrameBatch batch = new CanFrameBatch(1024);
+        final long[] timestamps = new long[batch.capacity()];
+        final long start = System.nanoTime();
+        try (final ArrowFrameWriter.Partitioned writer =
+                new ArrowFrameWriter.Partitioned(dir.toFile())) {
+            for (long n = 0; n < frames; n += batch.capacity()) {
+                writer.write(fill(batch, timestamps, n, ids), timestamps);
+            }
+        }
+        final long nanos = System.nanoTime() - start;
+        long bytes = 0;
+        for (final File f : dir.toFile().listFiles()) {
+            bytes += f.length();
+            Files.delete(f.toPath());
+        }
+        report("per id", frames, nanos, bytes);
+    }
+
+    public static void main(final String[] args) throws Exception {
+        final long frames = args.length > 0 ? Long.parseLong(args[0])
+                : 20000000;
+        final int ids = args.length > 1 ? Integer.parseInt(args[1]) : 300;
+        final Path dir = Files.createTempDirectory("arrow-bench");
+        final File file = new File(dir.toFile(), "frames.arrows");
+        try {
+            for (int pass = 0; pass < 2; pass++) {
+                if (pass == 1) {
+                    System.out.println("-- measured");
+                }
+                final long n = pass == 0 ? frames / 10 : frames;
+                single("encode", new NullOutputStream(), null, n, ids);
+                single("file", new BufferedOutputStream(
+                        new FileOutputStream(file), 1 << 20), file, n, ids);
+                Files.delete(file.toPath());
+                final Path parts = Files.createDirectory(dir.resolve(
+                        "parts" + pass));
+                partitioned(parts, n, ids);
+                Files.delete(parts);
+            }
+        } finally {
+            Files.deleteIfExists(file.toPath());
+            Files.delete(dir);
+        }
+    }
+}
@@ -0,0 +1,135 @@
+package de.entropia.can;
+
+import java.io.IOException;
+import java.util.concurrent.TimeUnit;
+
+import de.entropia.can.CanSocket.CanFrame;
+import de.entropia.can.CanSocket.CanId;
+import de.entropia.can.CanSocket.CanInterface;
+import de.entropia.can.CanSocket.Mode;
+
+/**
+ * Loopback throughput of {@link AsyncCanIo} with io_uring and with poll
+ * against plain {@link CanSocket#send} and {@link CanSocket#recv}. Every
+ * round sends a burst on one socket and receives it on several others, so
+ * the receive side shows how well each path collects frames of many
+ * sockets.
+ *
+ * Arguments: [interface] [rounds] [receiving sockets] [burst]
+ */
+public class AsyncIoBench {
+
+    private static void report(final String name, final long frames,
+            final long nanos, final long syscalls) {
+        System.out.printf("%-10s %9.0f frames/s  %6.3f syscalls/frame%n", name,
+                frames * 1e9 / nanos,
+                syscalls < 0 ? Double.NaN : (double) syscalls / frames);
+    }
+
+    private static void plain(final CanInterface canif, final CanSocket tx,
+            final CanSocket[] rx, final int rounds, final int burst)
+            throws IOException {
+        final CanFrameBatch batch = new CanFrameBatch(64);
+        final CanId id = new CanId(0x123);
+        final byte[] payload = new byte[8];
+        final long start = System.nanoTime();
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < burst; i++) {
+                tx.send(new CanFrame(canif, id, payload));
+            }
+            for (final CanSocket s : rx) {
+                int received = 0;
+                while (received < burst) {
+                    received += s.recv(batch);
+                }
+            }
+        }
+        final long nanos = System.nanoTime() - start;
+        long syscalls = 0;
+        final SocketStats stats = new SocketStats();
+        tx.getStats(stats);
+        syscalls += stats.getSendCalls();
+        for (final CanSocket s : rx) {
+            s.getStats(stats);
+            syscalls += stats.getRecvCalls();
+        }
+        report("plain", (long) rounds * burst * (rx.length + 1), nanos,
+                syscalls);
+    }
+
+    private static void async(final AsyncCanIo io, final CanSocket tx,
+            final CanSocket[] rx, final int rounds, final int burst)
+            throws IOException {
+        final int txTag = io.register(tx);
+        for (final CanSocket s : rx) {
+            io.register(s);
+        }
+        final CanFrameBatch out = new CanFrameBatch(burst);
+        for (int i = 0; i < burst; i++) {
+            out.add(0, 0x123, new byte[8]);
+        }
+        final CanFrameBatch in = new CanFrameBatch(256);
+        final int expected = burst * rx.length;
+        final AsyncCanIo.Stats before = io.getStats(new AsyncCanIo.Stats());
+        final long start = System.nanoTime();
+        for (int r = 0; r < rounds; r++) {
+            if (io.submit(txTag, out) != burst) {
+                throw new IOException("submission queue too small");
+            }
+            int received = 0;
+            while (received < expected) {
+                received += io.poll(in, null, 1, TimeUnit.SECONDS);
+            }
+        }
+        final long nanos = System.nanoTime() - start;
+        final AsyncCanIo.Stats after = io.getStats(new AsyncCanIo.Stats());
+        report(io.getBackend().toString(), (long) rounds * burst
+                * (rx.length + 1), nanos,
+                after.getSystemCalls() - before.getSystemCalls());
+    }
+
+    public static void main(final String[] args) throws Exception {
+        final String ifName = args.length > 0 ? args[0] : "vcan0";
+        final int rounds = args.length > 1 ? Integer.parseInt(args[1]) : 20000;
+        final int sockets = args.length > 2 ? Integer.parseInt(args[2]) : 4;
+        final int burst = args.length > 3 ? Integer.parseInt(args[3]) : 32;
+        System.out.println("io_uring available: "
+                + AsyncCanIo.isIoUringAvailable());
+
+        for (int pass = 0; pass < 2; pass++) {
+            if (pass == 1) {
+                System.out.println("-- measured");
+            }
+            final int n = pass == 0 ? rounds / 10 : rounds;
+            for (int variant = 0; variant < 3; variant++) {
+                final CanSocket tx = new CanSocket(Mode.RAW);
+                final CanSocket[] rx = new CanSocket[sockets];
+                try {
+                    final CanInterface canif = new CanInterface(tx, ifName);
+                    tx.bind(canif);
+                    for (int i = 0; i < sockets; i++) {
+                        rx[i] = new CanSocket(Mode.RAW);
+                        rx[i].bind(canif);
+                    }
+                    if (variant == 0) {
+                        plain(canif, tx, rx, n, burst);
+                    } else {
+                        try (final AsyncCanIo io = new AsyncCanIo(
+                                Math.max(burst, 16), variant == 1
+                                        ? AsyncCanIo.Backend.IO_URING
+                                        : AsyncCanIo.Backend.POLL)) {
+                            async(io, tx, rx, n, burst);
+                        }
+                    }
+                } finally {
+                    tx.close();
+                    for (final CanSocket s : rx) {
+                        if (s != null) {
+                            s.close();
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
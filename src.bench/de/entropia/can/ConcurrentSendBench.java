@@ -0,0 +1,107 @@
+package de.entropia.can;
+
+import java.io.IOException;
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.atomic.AtomicLong;
+
+import de.entropia.can.CanSocket.CanFrame;
+import de.entropia.can.CanSocket.CanId;
+import de.entropia.can.CanSocket.CanInterface;
+import de.entropia.can.CanSocket.Mode;
+
+/**
+ * Send throughput of 1 to 16 threads sharing one {@link CanSocket}, once
+ * calling it directly and once serialized by a lock around every send as
+ * callers had to before the socket was safe for concurrent use. The
+ * difference is the cost of the coarse lock; the remaining per thread
+ * slowdown comes from the kernel send path and the socket reference
+ * count.
+ *
+ * Arguments: [interface] [frames per thread] [max threads]
+ */
+public class ConcurrentSendBench {
+
+    private static long run(final CanSocket socket, final CanFrame frame,
+            final int threads, final long frames, final boolean locked)
+            throws Exception {
+        final CountDownLatch start = new CountDownLatch(1);
+        final CountDownLatch done = new CountDownLatch(threads);
+        final AtomicLong retries = new AtomicLong();
+        final Object lock = new Object();
+        final IOException[] failure = new IOException[1];
+        for (int t = 0; t < threads; t++) {
+            new Thread(new Runnable() {
+                @Override
+                public void run() {
+                    long retried = 0;
+                    try {
+                        start.await();
+                        for (long i = 0; i < frames; i++) {
+                            for (;;) {
+                                final int status;
+                                if (locked) {
+                                    synchronized (lock) {
+                                        status = socket.trySend(frame);
+                                    }
+                                } else {
+                                    status = socket.trySend(frame);
+                                }
+                                if (status > 0) {
+                                    break;
+                                }
+                                retried++;
+                                Thread.yield();
+                            }
+                        }
+                    } catch (final IOException e) {
+                        synchronized (failure) {
+                            failure[0] = e;
+                        }
+                    } catch (final InterruptedException e) {
+                        Thread.currentThread().interrupt();
+                    } finally {
+                        retries.addAndGet(retried);
+                        done.countDown();
+                    }
+                }
+            }, "sender-" + t).start();
+        }
+        final long begin = System.nanoTime();
+        start.countDown();
+        done.await();
+        final long nanos = System.nanoTime() - begin;
+        synchronized (failure) {
+            if (failure[0] != null) {
+                throw failure[0];
+            }
+        }
+        final long total = frames * threads;
+        System.out.printf("%-7s %2d threads  %9.0f frames/s  %7.1f ns/frame"
+                + "  %d retries%n", locked ? "locked" : "shared", threads,
+                total * 1e9 / nanos, (double) nanos / total, retries.get());
+        return nanos;
+    }
+
+    public static void main(final String[] args) throws Exception {
+        final String ifName = args.length > 0 ? args[0] : "vcan0";
+        final long frames = args.length > 1 ? Long.parseLong(args[1])
+                : 200000;
+        final int maxThreads = args.length > 2 ? Integer.parseInt(args[2])
+                : 16;
+
+        try (final CanSocket socket = new CanSocket(Mode.RAW)) {
+            final CanInterface canif = new CanInterface(socket, ifName);
+            socket.bind(canif);
+            socket.setLoopbackMode(false);
+            final CanFrame frame = new CanFrame(canif, new CanId(0x123),
+                    new byte[8]);
+            run(socket, frame, maxThreads, frames / 10, false);
+            run(socket, frame, maxThreads, frames / 10, true);
+            System.out.println("-- measured");
+            for (int threads = 1; threads <= maxThreads; threads *= 2) {
+                run(socket, frame, threads, frames, false);
+                run(socket, frame, threads, frames, true);
+            }
+        }
+    }
+}
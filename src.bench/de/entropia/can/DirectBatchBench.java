@@ -0,0 +1,118 @@
+package de.entropia.can;
+
+import java.io.IOException;
+
+import de.entropia.can.CanSocket.CanFrame;
+import de.entropia.can.CanSocket.CanId;
+import de.entropia.can.CanSocket.CanInterface;
+import de.entropia.can.CanSocket.Mode;
+
+/**
+ * Loopback throughput of the array based JNI paths against
+ * {@link DirectFrameBatch}, once frame by frame and once in bursts. Every
+ * round sends {@code burst} frames on one socket and receives them on
+ * another, so the numbers include one send and one receive per frame.
+ *
+ * Arguments: [interface] [frames] [burst]
+ */
+public class DirectBatchBench {
+
+    private static final int VARIANT_ARRAY_SINGLE = 0;
+    private static final int VARIANT_DIRECT_SINGLE = 1;
+    private static final int VARIANT_ARRAY_BATCH = 2;
+    private static final int VARIANT_DIRECT_BATCH = 3;
+    private static final String[] NAMES = { "array 1", "direct 1",
+            "array N", "direct N" };
+
+    private static void arrayBatch(final CanSocket tx, final CanSocket rx,
+            final CanFrameBatch out, final CanFrameBatch in)
+            throws IOException {
+        int sent = 0;
+        while (sent < out.size()) {
+            final int n = tx.trySend(out, sent);
+            if (n < 0) {
+                Thread.yield();
+            } else {
+                sent += n;
+            }
+        }
+        int received = 0;
+        while (received < sent) {
+            received += rx.recv(in);
+        }
+    }
+
+    private static void directBatch(final CanSocket tx, final CanSocket rx,
+            final DirectFrameBatch out, final DirectFrameBatch in)
+            throws IOException {
+        tx.send(out);
+        int received = 0;
+        while (received < out.size()) {
+            received += rx.recv(in);
+        }
+    }
+
+    private static void run(final CanInterface canif, final CanSocket tx,
+            final CanSocket rx, final int variant, final int frames,
+            final int burst) throws IOException {
+        final CanFrame frame = new CanFrame(canif, new CanId(0x123),
+                new byte[] {1, 2, 3, 4, 5, 6, 7, 8});
+        final int size = variant == VARIANT_ARRAY_BATCH
+                || variant == VARIANT_DIRECT_BATCH ? burst : 1;
+        final CanFrameBatch arrayOut = new CanFrameBatch(size);
+        final CanFrameBatch arrayIn = new CanFrameBatch(size);
+        final DirectFrameBatch directOut = new DirectFrameBatch(size);
+        final DirectFrameBatch directIn = new DirectFrameBatch(size);
+        for (int i = 0; i < size; i++) {
+            arrayOut.add(frame);
+            directOut.add(frame);
+        }
+        final int rounds = frames / size;
+        final long start = System.nanoTime();
+        for (int r = 0; r < rounds; r++) {
+            switch (variant) {
+            case VARIANT_ARRAY_SINGLE:
+                tx.send(frame);
+                rx.recv();
+                break;
+            case VARIANT_DIRECT_SINGLE:
+                tx.send(directOut);
+                rx.recv(directIn);
+                break;
+            case VARIANT_ARRAY_BATCH:
+                arrayBatch(tx, rx, arrayOut, arrayIn);
+                break;
+            case VARIANT_DIRECT_BATCH:
+                directBatch(tx, rx, directOut, directIn);
+                break;
+            }
+        }
+        final long nanos = System.nanoTime() - start;
+        System.out.printf("%-9s %9.0f frames/s  %7.1f ns/frame%n",
+                NAMES[variant], rounds * size * 1e9 / nanos,
+                (double) nanos / (rounds * size));
+    }
+
+    public static void main(final String[] args) throws Exception {
+        final String ifName = args.length > 0 ? args[0] : "vcan0";
+        final int frames = args.length > 1 ? Integer.parseInt(args[1])
+                : 1000000;
+        final int burst = args.length > 2 ? Integer.parseInt(args[2]) : 64;
+
+        for (int pass = 0; pass < 2; pass++) {
+            if (pass == 1) {
+                System.out.println("-- measured");
+            }
+            final int n = pass == 0 ? frames / 10 : frames;
+            for (int variant = 0; variant < NAMES.length; variant++) {
+                try (final CanSocket tx = new CanSocket(Mode.RAW);
+                        final CanSocket rx = new CanSocket(Mode.RAW)) {
+                    final CanInterface canif = new CanInterface(tx, ifName);
+                    tx.bind(canif);
+                    rx.bind(canif);
+                    run(canif, tx, rx, variant, n, burst);
+                }
+            }
+        }
+    }
+}
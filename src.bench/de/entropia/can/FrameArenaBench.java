@@ -0,0 +1,139 @@
+package de.entropia.can;
+
+import java.lang.management.GarbageCollectorMXBean;
+import java.lang.management.ManagementFactory;
+import java.util.concurrent.ArrayBlockingQueue;
+import java.util.concurrent.BlockingQueue;
+
+import de.entropia.can.CanSocket.CanFrame;
+import de.entropia.can.CanSocket.CanId;
+import de.entropia.can.CanSocket.CanInterface;
+import de.entropia.can.CanSocket.Mode;
+
+/**
+ * A receiving thread handing frames to a consumer thread through a queue,
+ * once as a {@link CanFrame} allocated per receive and once as pooled
+ * {@link FrameArena} views the consumer releases. Every round sends
+ * {@code burst} frames on one socket and receives them on another; next
+ * to the throughput it prints the collections the JVM ran meanwhile.
+ *
+ * Arguments: [interface] [frames] [burst]
+ */
+public class FrameArenaBench {
+
+    private static long gcCount() {
+        long count = 0;
+        for (final GarbageCollectorMXBean gc
+                : ManagementFactory.getGarbageCollectorMXBeans()) {
+            count += Math.max(gc.getCollectionCount(), 0);
+        }
+        return count;
+    }
+
+    private static long gcMillis() {
+        long millis = 0;
+        for (final GarbageCollectorMXBean gc
+                : ManagementFactory.getGarbageCollectorMXBeans()) {
+            millis += Math.max(gc.getCollectionTime(), 0);
+        }
+        return millis;
+    }
+
+    private static Thread consumer(final BlockingQueue<Object> queue,
+            final long frames, final long[] checksum) {
+        final Thread thread = new Thread(new Runnable() {
+            @Override
+            public void run() {
+                long sum = 0;
+                try {
+                    for (long i = 0; i < frames; i++) {
+                        final Object item = queue.take();
+                        if (item instanceof FrameArena.Frame) {
+                            final FrameArena.Frame frame =
+                                    (FrameArena.Frame) item;
+                            sum += frame.getCanId() + frame.getData(0);
+                            frame.release();
+                        } else {
+                            final CanFrame frame = (CanFrame) item;
+                            sum += frame.getCanId()._canId
+                                    + frame.getData()[0];
+                        }
+                    }
+                } catch (final InterruptedException e) {
+                    Thread.currentThread().interrupt();
+                }
+                checksum[0] = sum;
+            }
+        }, "consumer");
+        thread.start();
+        return thread;
+    }
+
+    private static void run(final CanSocket tx, final CanSocket rx,
+            final DirectFrameBatch out, final boolean arena,
+            final long frames) throws Exception {
+        final int burst = out.size();
+        final BlockingQueue<Object> queue =
+                new ArrayBlockingQueue<Object>(burst * 4);
+        final FrameArena pool = new FrameArena(burst * 8, 4);
+        final FrameArena.Frame[] received = new FrameArena.Frame[burst];
+        final long rounds = frames / burst;
+        final long[] checksum = new long[1];
+        final long gcBefore = gcCount();
+        final long gcMillisBefore = gcMillis();
+        final long start = System.nanoTime();
+        final Thread thread = consumer(queue, rounds * burst, checksum);
+        long exhausted = 0;
+        for (long r = 0; r < rounds; r++) {
+            tx.send(out);
+            int n = 0;
+            while (n < burst) {
+                if (arena) {
+                    final int got = rx.recv(pool, received);
+                    if (got == 0) {
+                        exhausted++;
+                        Thread.yield();
+                    }
+                    for (int i = 0; i < got; i++) {
+                        queue.put(received[i]);
+                    }
+                    n += got;
+                } else {
+                    queue.put(rx.recv());
+                    n++;
+                }
+            }
+        }
+        thread.join();
+        final long nanos = System.nanoTime() - start;
+        System.out.printf("%-8s %9.0f frames/s  %7.1f ns/frame  %4d GCs "
+                + "%5d ms  %d exhausted%n", arena ? "arena" : "CanFrame",
+                rounds * burst * 1e9 / nanos,
+                (double) nanos / (rounds * burst), gcCount() - gcBefore,
+                gcMillis() - gcMillisBefore, exhausted);
+    }
+
+    public static void main(final String[] args) throws Exception {
+        final String ifName = args.length > 0 ? args[0] : "vcan0";
+        final long frames = args.length > 1 ? Long.parseLong(args[1])
+                : 2000000;
+        final int burst = args.length > 2 ? Integer.parseInt(args[2]) : 64;
+
+        try (final CanSocket tx = new CanSocket(Mode.RAW);
+                final CanSocket rx = new CanSocket(Mode.RAW)) {
+            final CanInterface canif = new CanInterface(tx, ifName);
+            tx.bind(canif);
+            rx.bind(canif);
+            final DirectFrameBatch out = new DirectFrameBatch(burst);
+            for (int i = 0; i < burst; i++) {
+                out.add(new CanFrame(canif, new CanId(0x100 + i),
+                        new byte[] {(byte) i, 2, 3, 4, 5, 6, 7, 8}));
+            }
+            run(tx, rx, out, false, frames / 10);
+            run(tx, rx, out, true, frames / 10);
+            System.out.println("-- measured");
+            run(tx, rx, out, false, frames);
+            run(tx, rx, out, true, frames);
+        }
+    }
+}
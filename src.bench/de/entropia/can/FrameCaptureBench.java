@@ -0,0 +1,95 @@
+package de.entropia.can;
+
+import java.io.ByteArrayInputStream;
+import java.io.ByteArrayOutputStream;
+import java.io.IOException;
+import java.util.Random;
+
+/**
+ * Encoding and decoding speed of {@link FrameCapture} and the size of its
+ * output against the 16 bytes a frame takes in a plain capture. Frames
+ * are synthetic: periodic ids with timestamp jitter, most payloads
+ * repeating, some with an alive counter and a few with random bytes.
+ *
+ * Arguments: [frames] [ids]
+ */
+public class FrameCaptureBench {
+
+    private static void fill(final CanFrameBatch batch,
+            final long[] timestamps, final long first, final int ids,
+            final Random random) {
+        batch.clear();
+        final byte[] payload = new byte[8];
+        for (int i = 0; i < batch.capacity(); i++) {
+            final long n = first + i;
+            final int id = (int) (n % ids);
+            for (int b = 0; b < payload.length; b++) {
+                payload[b] = (byte) (id * b);
+            }
+            if (id % 4 == 0) {
+                payload[1] = (byte) (n / ids);
+            } else if (id % 16 == 1) {
+                random.nextBytes(payload);
+            }
+            timestamps[i] = 1500000000000000000L + n * 10000L
+                    + random.nextInt(200);
+            batch.add(1, 0x100 + id, payload);
+        }
+    }
+
+    private static void report(final String name, final long frames,
+            final long nanos) {
+        System.out.printf("%-8s %6.1f Mframes/s  %7.1f MB/s of 16 byte "
+                + "frames%n", name, frames * 1e3 / nanos,
+                frames * 16 * 1e3 / nanos);
+    }
+
+    private static void run(final long frames, final int ids)
+            throws IOException {
+        final CanFrameBatch batch = new CanFrameBatch(1024);
+        final long[] timestamps = new long[batch.capacity()];
+        final Random random = new Random(1);
+        final ByteArrayOutputStream bytes = new ByteArrayOutputStream();
+        long encodeNanos = 0;
+        try (final FrameCapture.Writer writer =
+                new FrameCapture.Writer(bytes)) {
+            for (long n = 0; n < frames; n += batch.capacity()) {
+                fill(batch, timestamps, n, ids, random);
+                final long start = System.nanoTime();
+                writer.write(batch, timestamps);
+                encodeNanos += System.nanoTime() - start;
+            }
+            final long start = System.nanoTime();
+            writer.flush();
+            encodeNanos += System.nanoTime() - start;
+        }
+        final byte[] capture = bytes.toByteArray();
+
+        long decoded = 0;
+        final long start = System.nanoTime();
+        try (final FrameCapture.Reader reader = new FrameCapture.Reader(
+                new ByteArrayInputStream(capture))) {
+            int n;
+            while ((n = reader.read(batch, timestamps)) >= 0) {
+                decoded += n;
+                batch.clear();
+            }
+        }
+        final long decodeNanos = System.nanoTime() - start;
+
+        report("encode", decoded, encodeNanos);
+        report("decode", decoded, decodeNanos);
+        System.out.printf("%.2f bytes/frame, %.1fx smaller than 16 byte "
+                + "frames%n", (double) capture.length / decoded,
+                decoded * 16.0 / capture.length);
+    }
+
+    public static void main(final String[] args) throws Exception {
+        final long frames = args.length > 0 ? Long.parseLong(args[0])
+                : 20000000;
+        final int ids = args.length > 1 ? Integer.parseInt(args[1]) : 200;
+        run(frames / 10, ids);
+        System.out.println("-- measured");
+        run(frames, ids);
+    }
+}
@@ -0,0 +1,102 @@
+package de.entropia.can;
+
+import java.util.Random;
+
+/**
+ * Cost per frame of {@link FrameFilter} against a linear scan of the
+ * id/mask pairs as done by the kernel for {@code CAN_RAW_FILTER}, at 10,
+ * 1k and 100k pairs. Half of the pairs are exact standard ids, half exact
+ * extended ids, with a few masked ranges; a quarter of the frames are
+ * extended.
+ *
+ * Arguments: [rounds] [batch size]
+ */
+public class FrameFilterBench {
+
+    private static final int EFF_FLAG = 0x80000000;
+    private static final int SFF_EXACT = 0xc00007ff;
+    private static final int EFF_EXACT = 0xdfffffff;
+
+    private static int linear(final int[] ids, final int[] masks,
+            final int[] canIds, final int count) {
+        int kept = 0;
+        for (int i = 0; i < count; i++) {
+            final int id = canIds[i];
+            for (int j = 0; j < ids.length; j++) {
+                if (((id ^ ids[j]) & masks[j]) == 0) {
+                    kept++;
+                    break;
+                }
+            }
+        }
+        return kept;
+    }
+
+    public static void main(final String[] args) {
+        final int rounds = args.length > 0 ? Integer.parseInt(args[0]) : 20000;
+        final int batchSize = args.length > 1 ? Integer.parseInt(args[1]) : 64;
+        final Random rnd = new Random(42);
+
+        for (final int n : new int[] {10, 1000, 100000}) {
+            final int[] ids = new int[n];
+            final int[] masks = new int[n];
+            for (int i = 0; i < n; i++) {
+                if (i % 50 == 49) {
+                    ids[i] = rnd.nextInt(0x800) & 0x7f0;
+                    masks[i] = 0x7f0;
+                } else if ((i & 1) == 0) {
+                    ids[i] = rnd.nextInt(0x800);
+                    masks[i] = SFF_EXACT;
+                } else {
+                    ids[i] = rnd.nextInt(0x20000000) | EFF_FLAG;
+                    masks[i] = EFF_EXACT;
+                }
+            }
+            final CanFrameBatch template = new CanFrameBatch(batchSize);
+            for (int i = 0; i < batchSize; i++) {
+                final int id = (i & 3) == 0
+                        ? (rnd.nextBoolean() ? ids[rnd.nextInt(n) | 1]
+                                : rnd.nextInt(0x20000000) | EFF_FLAG)
+                        : rnd.nextInt(0x800);
+                template.add(0, id, new byte[8]);
+            }
+            final CanFrameBatch batch = new CanFrameBatch(batchSize);
+
+            final long compileStart = System.nanoTime();
+            try (final FrameFilter filter = new FrameFilter(ids, masks)) {
+                final long compileNanos = System.nanoTime() - compileStart;
+                long sink = 0;
+                for (int pass = 0; pass < 2; pass++) {
+                    final int r = pass == 0 ? rounds / 10 : rounds;
+                    long start = System.nanoTime();
+                    for (int i = 0; i < r; i++) {
+                        System.arraycopy(template.canId, 0, batch.canId, 0,
+                                batchSize);
+                        batch.size = batchSize;
+                        sink += filter.filter(batch);
+                    }
+                    final long nativeNanos = System.nanoTime() - start;
+                    /* the kernel way is far slower, fewer rounds suffice */
+                    final int lr = Math.max(1, r / Math.max(1, n / 100));
+                    start = System.nanoTime();
+                    for (int i = 0; i < lr; i++) {
+                        sink += linear(ids, masks, template.canId, batchSize);
+                    }
+                    final long linearNanos = System.nanoTime() - start;
+                    if (pass == 1) {
+                        System.out.printf("%6d pairs  compile %8.2f ms  "
+                                + "native %7.1f ns/frame  linear %10.1f "
+                                + "ns/frame  (%d masks)%n", n,
+                                compileNanos / 1e6,
+                                (double) nativeNanos / ((long) r * batchSize),
+                                (double) linearNanos / ((long) lr * batchSize),
+                                filter.getMaskGroups());
+                    }
+                }
+                if (sink == 42) {
+                    System.out.println();
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,107 @@
+package de.entropia.can;
+
+/**
+ * Cost of protecting outgoing frames with an alive counter, a CRC8 and an
+ * XOR checksum: once computed in Java frame by frame as the callers of
+ * {@link CanSocket#send} used to do it, once per batch with
+ * {@link FrameProtection}, and the batch verification of the result.
+ *
+ * Arguments: [frames] [ids] [batch size]
+ */
+public class FrameProtectionBench {
+
+    private static final byte[] TABLE = FrameProtection.crc8Table(0x1d);
+
+    private static void protectJava(final CanFrameBatch batch,
+            final int[] counters, final int ids) {
+        for (int i = 0; i < batch.size(); i++) {
+            final int off = i * CanFrameBatch.DATA_STRIDE;
+            final int id = batch.canId[i] - 0x100;
+            batch.data[off + 1] = (byte) ((batch.data[off + 1] & 0xf0)
+                    | counters[id]);
+            counters[id] = (counters[id] + 1) & 0x0f;
+            int crc = 0xff;
+            for (int b = 1; b <= 6; b++) {
+                crc = TABLE[(crc ^ batch.data[off + b]) & 0xff] & 0xff;
+            }
+            batch.data[off] = (byte) (crc ^ 0xff);
+            int xor = 0;
+            for (int b = 0; b <= 6; b++) {
+                xor ^= batch.data[off + b];
+            }
+            batch.data[off + 7] = (byte) xor;
+        }
+    }
+
+    private static void fill(final CanFrameBatch batch, final long first,
+            final int ids) {
+        batch.clear();
+        final byte[] payload = new byte[8];
+        for (int i = 0; i < batch.capacity(); i++) {
+            final long n = first + i;
+            payload[2] = (byte) n;
+            payload[3] = (byte) (n >>> 8);
+            batch.add(1, 0x100 + (int) (n % ids), payload);
+        }
+    }
+
+    private static void report(final String name, final long frames,
+            final long nanos) {
+        System.out.printf("%-8s %7.1f Mframes/s  %6.1f ns/frame%n", name,
+                frames * 1e3 / nanos, (double) nanos / frames);
+    }
+
+    private static void run(final long frames, final int ids,
+            final int size) {
+        final CanFrameBatch batch = new CanFrameBatch(size);
+        final byte[] status = new byte[size];
+        final int[] counters = new int[ids];
+        long javaNanos = 0;
+        long nativeNanos = 0;
+        long verifyNanos = 0;
+        long failed = 0;
+        try (final FrameProtection tx = new FrameProtection();
+                final FrameProtection rx = new FrameProtection()) {
+            for (int id = 0x100; id < 0x100 + ids; id++) {
+                for (final FrameProtection p
+                        : new FrameProtection[] {tx, rx}) {
+                    p.setCounter(id, 1, 0x0f, 1);
+                    p.setCrc8(id, 1, 6, 0, 0xff, 0xff, TABLE,
+                            FrameProtection.Crc8Profile.NONE, null);
+                    p.setXor(id, 0, 6, 7, 0);
+                }
+            }
+            for (long n = 0; n < frames; n += size) {
+                fill(batch, n, ids);
+                long start = System.nanoTime();
+                protectJava(batch, counters, ids);
+                javaNanos += System.nanoTime() - start;
+
+                fill(batch, n, ids);
+                start = System.nanoTime();
+                tx.protect(batch);
+                nativeNanos += System.nanoTime() - start;
+
+                start = System.nanoTime();
+                failed += rx.verify(batch, status);
+                verifyNanos += System.nanoTime() - start;
+            }
+        }
+        report("java", frames, javaNanos);
+        report("native", frames, nativeNanos);
+        report("verify", frames, verifyNanos);
+        if (failed != 0) {
+            System.out.println(failed + " frames failed verification");
+        }
+    }
+
+    public static void main(final String[] args) throws Exception {
+        final long frames = args.length > 0 ? Long.parseLong(args[0])
+                : 20000000;
+        final int ids = args.length > 1 ? Integer.parseInt(args[1]) : 200;
+        final int size = args.length > 2 ? Integer.parseInt(args[2]) : 256;
+        run(frames / 10, ids, size);
+        System.out.println("-- measured");
+        run(frames, ids, size);
+    }
+}
@@ -0,0 +1,303 @@
+package de.entropia.can;
+
+import java.io.IOException;
+import java.io.PrintStream;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Files;
+import java.nio.file.Paths;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicLong;
+
+import de.entropia.can.CanSocket.CanFrame;
+import de.entropia.can.CanSocket.CanId;
+import de.entropia.can.CanSocket.CanInterface;
+import de.entropia.can.CanSocket.Mode;
+import de.entropia.can.CanSocket.RecvMode;
+
+/**
+ * End-to-end latency from sending a frame to receiving it through the
+ * loopback of a (virtual) CAN interface, for every send and receive API of
+ * the library. Each frame carries its send time; one frame is in flight at
+ * a time.
+ *
+ * The report is tab separated with one line per variant and latencies in
+ * nanoseconds, so reports of two releases can be compared with diff.
+ *
+ * Arguments: [interface] [samples] [report file, - for stdout]
+ */
+public class LatencyHarness {
+    private static final CanId ID = new CanId(0x7b);
+    private static final double[] PERCENTILES = {50, 90, 99, 99.9, 99.99};
+
+    /** one way of handing a frame to the library */
+    private interface Sender {
+        void send(CanFrame frame) throws IOException;
+    }
+
+    /** one way of getting a frame back, returns its payload */
+    private interface Receiver {
+        byte[] recv() throws IOException;
+    }
+
+    private static abstract class Variant {
+        final String name;
+
+        Variant(final String name) {
+            this.name = name;
+        }
+
+        abstract void run(final String ifName, final int samples,
+                final LatencyHistogram histogram) throws Exception;
+    }
+
+    private static byte[] encode(final long v) {
+        final byte[] b = new byte[8];
+        for (int i = 0; i < 8; i++) {
+            b[i] = (byte) (v >>> (8 * i));
+        }
+        return b;
+    }
+
+    private static long decode(final byte[] b, final int off) {
+        long v = 0;
+        for (int i = 7; i >= 0; i--) {
+            v = (v << 8) | (b[off + i] & 0xff);
+        }
+        return v;
+    }
+
+    /* ping pong on the calling thread: send, then receive the same frame */
+    private static void pingPong(final CanInterface canif, final Sender tx,
+            final Receiver rx, final int samples,
+            final LatencyHistogram histogram) throws IOException {
+        for (int i = 0; i < samples; i++) {
+            tx.send(new CanFrame(canif, ID, encode(System.nanoTime())));
+            final long sent = decode(rx.recv(), 0);
+            histogram.record(System.nanoTime() - sent);
+        }
+    }
+
+    private static Variant socketPair(final String name,
+            final RecvMode mode) {
+        return new Variant(name) {
+            @Override
+            void run(final String ifName, final int samples,
+                    final LatencyHistogram histogram) throws Exception {
+                try (final CanSocket tx = new CanSocket(Mode.RAW);
+                        final CanSocket rx = new CanSocket(Mode.RAW)) {
+                    final CanInterface canif = new CanInterface(tx, ifName);
+                    tx.bind(canif);
+                    rx.bind(canif);
+                    rx.setRecvMode(mode);
+                    pingPong(canif, new Sender() {
+                        @Override
+                        public void send(final CanFrame frame)
+                                throws IOException {
+                            tx.send(frame);
+                        }
+                    }, new Receiver() {
+                        @Override
+                        public byte[] recv() throws IOException {
+                            return rx.recv().getData();
+                        }
+                    }, samples, histogram);
+                }
+            }
+        };
+    }
+
+    private static final Variant BATCH = new Variant("send/recv-batch") {
+        @Override
+        void run(final String ifName, final int samples,
+                final LatencyHistogram histogram) throws Exception {
+            try (final CanSocket tx = new CanSocket(Mode.RAW);
+                    final CanSocket rx = new CanSocket(Mode.RAW)) {
+                final CanInterface canif = new CanInterface(tx, ifName);
+                tx.bind(canif);
+                rx.bind(canif);
+                final CanFrameBatch batch = new CanFrameBatch(64);
+                pingPong(canif, new Sender() {
+                    @Override
+                    public void send(final CanFrame frame)
+                            throws IOException {
+                        tx.send(frame);
+                    }
+                }, new Receiver() {
+                    @Override
+                    public byte[] recv() throws IOException {
+                        rx.recv(batch);
+                        return batch.getData(0);
+                    }
+                }, samples, histogram);
+            }
+        }
+    };
+
+    private static final Variant RECV_OWN = new Variant("send/recv-own") {
+        @Override
+        void run(final String ifName, final int samples,
+                final LatencyHistogram histogram) throws Exception {
+            try (final CanSocket socket = new CanSocket(Mode.RAW)) {
+                final CanInterface canif = new CanInterface(socket, ifName);
+                socket.bind(canif);
+                socket.setLoopbackMode(true);
+                socket.setRecvOwnMsgsMode(true);
+                pingPong(canif, new Sender() {
+                    @Override
+                    public void send(final CanFrame frame)
+                            throws IOException {
+                        socket.send(frame);
+                    }
+                }, new Receiver() {
+                    @Override
+                    public byte[] recv() throws IOException {
+                        return socket.recv().getData();
+                    }
+                }, samples, histogram);
+            }
+        }
+    };
+
+    private static final Variant SCHEDULER =
+            new Variant("scheduler/recv") {
+        @Override
+        void run(final String ifName, final int samples,
+                final LatencyHistogram histogram) throws Exception {
+            try (final CanSocket tx = new CanSocket(Mode.RAW);
+                    final CanSocket rx = new CanSocket(Mode.RAW)) {
+                final CanInterface canif = new CanInterface(tx, ifName);
+                tx.bind(canif);
+                rx.bind(canif);
+                try (final TransmitScheduler scheduler =
+                        new TransmitScheduler(tx)) {
+                    pingPong(canif, new Sender() {
+                        @Override
+                        public void send(final CanFrame frame) {
+                            while (!scheduler.offer(frame)) {
+                                /* cannot happen with one frame in flight */
+                            }
+                        }
+                    }, new Receiver() {
+                        @Override
+                        public byte[] recv() throws IOException {
+                            return rx.recv().getData();
+                        }
+                    }, samples, histogram);
+                }
+            }
+        }
+    };
+
+    private static final Variant READER = new Variant("send/reader") {
+        @Override
+        void run(final String ifName, final int samples,
+                final LatencyHistogram histogram) throws Exception {
+            final AtomicLong received = new AtomicLong();
+            try (final CanSocket tx = new CanSocket(Mode.RAW);
+                    final CanSocket rx = new CanSocket(Mode.RAW)) {
+                final CanInterface canif = new CanInterface(tx, ifName);
+                tx.bind(canif);
+                rx.bind(canif);
+                /* the handler records, the histogram is not shared */
+                final LowLatencyReader.FrameHandler handler =
+                        new LowLatencyReader.FrameHandler() {
+                    @Override
+                    public void onFrame(final CanFrame frame) {
+                        histogram.record(System.nanoTime()
+                                - decode(frame.getData(), 0));
+                        received.incrementAndGet();
+                    }
+                };
+                try (final LowLatencyReader reader =
+                        new LowLatencyReader(rx, handler)) {
+                    reader.start();
+                    for (long i = 0; i < samples; i++) {
+                        tx.send(new CanFrame(canif, ID,
+                                encode(System.nanoTime())));
+                        while (received.get() <= i) {
+                            /* wait for the reader */
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    private static List<Variant> variants() {
+        final List<Variant> variants = new ArrayList<>();
+        variants.add(socketPair("send/recv", RecvMode.BLOCKING));
+        variants.add(socketPair("send/recv-spin", RecvMode.SPIN));
+        variants.add(socketPair("send/recv-spin-native",
+                RecvMode.SPIN_NATIVE));
+        variants.add(BATCH);
+        variants.add(RECV_OWN);
+        variants.add(SCHEDULER);
+        variants.add(READER);
+        return variants;
+    }
+
+    private static void header(final PrintStream out, final String ifName,
+            final int samples) {
+        out.println("# socketcan latency report");
+        out.println("# interface\t" + ifName);
+        out.println("# samples\t" + samples);
+        out.println("# java\t" + System.getProperty("java.version"));
+        out.println("# os\t" + System.getProperty("os.name") + " "
+                + System.getProperty("os.version"));
+        out.print("variant\tcount\tmin");
+        for (final double p : PERCENTILES) {
+            out.print("\tp" + p);
+        }
+        out.println("\tmax\tmean");
+    }
+
+    private static void row(final PrintStream out, final String name,
+            final LatencyHistogram h) {
+        out.print(name + "\t" + h.getTotalCount() + "\t" + h.getMin());
+        for (final double p : PERCENTILES) {
+            out.print("\t" + h.getValueAtPercentile(p));
+        }
+        out.println("\t" + h.getMax() + "\t" + Math.round(h.getMean()));
+    }
+
+    public static void main(String[] args) throws Exception {
+        final String ifName = args.length > 0 ? args[0] : "vcan0";
+        final int samples = args.length > 1
+                ? Integer.parseInt(args[1]) : 100000;
+        final String report = args.length > 2 ? args[2] : "-";
+
+        final List<Variant> variants = variants();
+        final LatencyHistogram histogram = new LatencyHistogram();
+        /* warm up the JIT on all code paths */
+        for (final Variant variant : variants) {
+            variant.run(ifName, Math.min(samples, 10000), histogram);
+            histogram.reset();
+        }
+
+        final PrintStream out = report.equals("-") ? System.out
+                : new PrintStream(Files.newOutputStream(Paths.get(report)),
+                        false, StandardCharsets.UTF_8.name());
+        try {
+            header(out, ifName, samples);
+            for (final Variant variant : variants) {
+                final long start = System.nanoTime();
+                variant.run(ifName, samples, histogram);
+                row(out, variant.name, histogram);
+                System.err.printf("%-22s p50 %7.1f us  p99 %7.1f us"
+                        + "  p99.9 %7.1f us  (%d ms)%n", variant.name,
+                        histogram.getValueAtPercentile(50) / 1e3,
+                        histogram.getValueAtPercentile(99) / 1e3,
+                        histogram.getValueAtPercentile(99.9) / 1e3,
+                        TimeUnit.NANOSECONDS.toMillis(
+                                System.nanoTime() - start));
+                histogram.reset();
+            }
+        } finally {
+            if (out != System.out) {
+                out.close();
+            }
+        }
+    }
+}
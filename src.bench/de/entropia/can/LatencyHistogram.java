@@ -0,0 +1,94 @@
+package de.entropia.can;
+
+import java.util.Arrays;
+
+/**
+ * Histogram of latencies in nanoseconds in the spirit of HdrHistogram:
+ * values are counted in power of two buckets split into 1024 linear sub
+ * buckets, so every recorded value is kept with a relative error below
+ * 0.1% at a fixed memory footprint and recording never allocates.
+ */
+final class LatencyHistogram {
+    private static final int SUB_BUCKET_BITS = 10;
+    private static final int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    /* values above about 73 minutes are clamped */
+    private static final int MAX_EXPONENT = 32;
+
+    private final long[] counts =
+            new long[(MAX_EXPONENT + 2) << SUB_BUCKET_BITS];
+    private long total;
+    private long min = Long.MAX_VALUE;
+    private long max;
+    private double sum;
+
+    private static int index(final long value) {
+        if (value < 2 * SUB_BUCKETS) {
+            return (int) value;
+        }
+        final int exponent = Math.min(MAX_EXPONENT, 63
+                - Long.numberOfLeadingZeros(value) - SUB_BUCKET_BITS);
+        final long subBucket = Math.min(value >>> exponent,
+                2 * SUB_BUCKETS - 1);
+        return (exponent << SUB_BUCKET_BITS) + (int) subBucket;
+    }
+
+    /* largest value counted in the same slot as values at index */
+    private static long highestEquivalent(final int index) {
+        if (index < 2 * SUB_BUCKETS) {
+            return index;
+        }
+        final int exponent = (index >>> SUB_BUCKET_BITS) - 1;
+        final long subBucket = index - ((long) exponent << SUB_BUCKET_BITS);
+        return ((subBucket + 1) << exponent) - 1;
+    }
+
+    public void record(final long nanos) {
+        final long value = Math.max(0, nanos);
+        counts[index(value)]++;
+        total++;
+        sum += value;
+        min = Math.min(min, value);
+        max = Math.max(max, value);
+    }
+
+    public long getTotalCount() {
+        return total;
+    }
+
+    public long getMin() {
+        return total == 0 ? 0 : min;
+    }
+
+    public long getMax() {
+        return max;
+    }
+
+    public double getMean() {
+        return total == 0 ? 0 : sum / total;
+    }
+
+    /** @param percentile 0 to 100 */
+    public long getValueAtPercentile(final double percentile) {
+        if (total == 0) {
+            return 0;
+        }
+        final long rank = Math.max(1,
+                (long) Math.ceil(percentile / 100 * total));
+        long seen = 0;
+        for (int i = 0; i < counts.length; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return Math.min(highestEquivalent(i), max);
+            }
+        }
+        return max;
+    }
+
+    public void reset() {
+        Arrays.fill(counts, 0);
+        total = 0;
+        min = Long.MAX_VALUE;
+        max = 0;
+        sum = 0;
+    }
+}
@@ -0,0 +1,91 @@
+package de.entropia.can;
+
+import java.io.BufferedReader;
+import java.io.File;
+import java.io.IOException;
+import java.io.InputStreamReader;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.List;
+
+/**
+ * Startup cost of loading the native library from the JAR, with and
+ * without the library cache. Every sample is a fresh JVM that initializes
+ * {@link CanSocket}; reported are the medians of the class initialization,
+ * which contains the extraction, and of the whole process. The cache runs
+ * use a private cache directory that the first run fills.
+ *
+ * Arguments: [runs per mode]
+ */
+public class LibraryLoadBench {
+
+    private static final String CHILD = "child";
+
+    private static long median(final long[] samples) {
+        final long[] sorted = samples.clone();
+        Arrays.sort(sorted);
+        return sorted[sorted.length / 2];
+    }
+
+    /** @return nanoseconds of class initialization as printed by the child */
+    private static long runChild(final String cacheDir, final long[] wall,
+            final int i) throws IOException, InterruptedException {
+        final List<String> command = new ArrayList<String>();
+        command.add(System.getProperty("java.home") + File.separator + "bin"
+                + File.separator + "java");
+        command.add("-Dde.entropia.can.libCache=" + cacheDir);
+        command.add("-cp");
+        command.add(System.getProperty("java.class.path"));
+        command.add(LibraryLoadBench.class.getName());
+        command.add(CHILD);
+        final long start = System.nanoTime();
+        final Process p = new ProcessBuilder(command).redirectErrorStream(true)
+                .start();
+        final String line;
+        try (final BufferedReader in = new BufferedReader(
+                new InputStreamReader(p.getInputStream(), "UTF-8"))) {
+            line = in.readLine();
+        }
+        if (p.waitFor() != 0 || line == null) {
+            throw new IOException("child failed: " + line);
+        }
+        wall[i] = System.nanoTime() - start;
+        return Long.parseLong(line.trim());
+    }
+
+    private static void measure(final String name, final String cacheDir,
+            final int runs) throws IOException, InterruptedException {
+        final long[] init = new long[runs];
+        final long[] wall = new long[runs];
+        for (int i = 0; i < runs; i++) {
+            init[i] = runChild(cacheDir, wall, i);
+        }
+        System.out.printf("%-10s load %7.2f ms  process %7.1f ms%n", name,
+                median(init) / 1e6, median(wall) / 1e6);
+    }
+
+    public static void main(final String[] args) throws Exception {
+        if (args.length > 0 && args[0].equals(CHILD)) {
+            final long start = System.nanoTime();
+            Class.forName("de.entropia.can.CanSocket");
+            System.out.println(System.nanoTime() - start);
+            return;
+        }
+        final int runs = args.length > 0 ? Integer.parseInt(args[0]) : 20;
+        final Path cache = Files.createTempDirectory("socketcan-cache");
+        try {
+            measure("no cache", "", runs);
+            final long[] wall = new long[1];
+            System.out.printf("%-10s load %7.2f ms%n", "cold",
+                    runChild(cache.toString(), wall, 0) / 1e6);
+            measure("cached", cache.toString(), runs);
+        } finally {
+            for (final File f : cache.toFile().listFiles()) {
+                Files.delete(f.toPath());
+            }
+            Files.delete(cache);
+        }
+    }
+}
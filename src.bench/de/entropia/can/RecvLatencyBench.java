@@ -0,0 +1,134 @@
+package de.entropia.can;
+
+import java.io.IOException;
+import java.util.Arrays;
+import java.util.concurrent.atomic.AtomicInteger;
+
+import de.entropia.can.CanSocket.CanFrame;
+import de.entropia.can.CanSocket.CanId;
+import de.entropia.can.CanSocket.CanInterface;
+import de.entropia.can.CanSocket.Mode;
+import de.entropia.can.CanSocket.RecvMode;
+
+/**
+ * Loopback latency from {@link CanSocket#send} on one socket to the frame
+ * being returned on another, for each receive mode. One frame is in flight
+ * at a time, so the numbers show wake-up latency rather than throughput.
+ *
+ * Arguments: [interface] [samples] [cpu to pin the reader to]
+ */
+public class RecvLatencyBench {
+
+    private static byte[] encode(final long v) {
+        final byte[] b = new byte[8];
+        for (int i = 0; i < 8; i++) {
+            b[i] = (byte) (v >>> (8 * i));
+        }
+        return b;
+    }
+
+    private static long decode(final byte[] b) {
+        long v = 0;
+        for (int i = 7; i >= 0; i--) {
+            v = (v << 8) | (b[i] & 0xff);
+        }
+        return v;
+    }
+
+    private static long percentile(final long[] sorted, final double p) {
+        final int idx = (int) Math.ceil(p * sorted.length) - 1;
+        return sorted[Math.max(0, Math.min(sorted.length - 1, idx))];
+    }
+
+    private static void report(final String name, final long[] samples) {
+        Arrays.sort(samples);
+        System.out.printf("%-14s p50 %7.1f us  p99 %7.1f us  p99.9 %7.1f us"
+                + "  max %8.1f us%n", name,
+                percentile(samples, 0.5) / 1e3,
+                percentile(samples, 0.99) / 1e3,
+                percentile(samples, 0.999) / 1e3,
+                samples[samples.length - 1] / 1e3);
+    }
+
+    private static void pingPong(final CanSocket tx, final CanInterface canif,
+            final AtomicInteger received, final int samples)
+            throws IOException {
+        final CanId id = new CanId(0x7a);
+        for (int i = 0; i < samples; i++) {
+            tx.send(new CanFrame(canif, id, encode(System.nanoTime())));
+            while (received.get() <= i) {
+                /* wait for the receiver */
+            }
+        }
+    }
+
+    private static long[] measure(final String ifName, final int samples,
+            final RecvMode mode, final int cpu) throws Exception {
+        final long[] latencies = new long[samples];
+        final AtomicInteger received = new AtomicInteger();
+        try (final CanSocket tx = new CanSocket(Mode.RAW);
+                final CanSocket rx = new CanSocket(Mode.RAW)) {
+            final CanInterface canif = new CanInterface(tx, ifName);
+            tx.bind(canif);
+            rx.bind(canif);
+            rx.setRecvMode(mode == null ? RecvMode.SPIN_NATIVE : mode);
+            if (mode == null) {
+                final LowLatencyReader.FrameHandler handler =
+                        new LowLatencyReader.FrameHandler() {
+                    @Override
+                    public void onFrame(final CanFrame frame) {
+                        final int n = received.get();
+                        latencies[n] = System.nanoTime()
+                                - decode(frame.getData());
+                        received.set(n + 1);
+                    }
+                };
+                try (final LowLatencyReader reader = cpu >= 0
+                        ? new LowLatencyReader(rx, handler, cpu)
+                        : new LowLatencyReader(rx, handler)) {
+                    reader.start();
+                    pingPong(tx, canif, received, samples);
+                }
+            } else {
+                final Thread thread = new Thread(new Runnable() {
+                    @Override
+                    public void run() {
+                        try {
+                            for (int i = 0; i < samples; i++) {
+                                final CanFrame frame = rx.recv();
+                                latencies[i] = System.nanoTime()
+                                        - decode(frame.getData());
+                                received.set(i + 1);
+                            }
+                        } catch (final IOException e) {
+                            e.printStackTrace();
+                            System.exit(1);
+                        }
+                    }
+                });
+                thread.start();
+                pingPong(tx, canif, received, samples);
+                thread.join();
+            }
+        }
+        return latencies;
+    }
+
+    public static void main(String[] args) throws Exception {
+        final String ifName = args.length > 0 ? args[0] : "vcan0";
+        final int samples = args.length > 1
+                ? Integer.parseInt(args[1]) : 100000;
+        final int cpu = args.length > 2 ? Integer.parseInt(args[2]) : -1;
+
+        /* warm up the JIT on all code paths */
+        for (final RecvMode mode : RecvMode.values()) {
+            measure(ifName, 10000, mode, -1);
+        }
+        System.out.printf("%s, %d samples%n", ifName, samples);
+        for (final RecvMode mode : RecvMode.values()) {
+            report(mode.toString(), measure(ifName, samples, mode, -1));
+        }
+        report(cpu >= 0 ? "READER cpu " + cpu : "READER",
+                measure(ifName, samples, null, cpu));
+    }
+}
@@ -0,0 +1,130 @@
+package de.entropia.can;
+
+import java.io.IOException;
+import java.util.ArrayList;
+import java.util.HashMap;
+import java.util.List;
+import java.util.Map;
+import java.util.Random;
+
+import de.entropia.can.CanSocket.CanFrame;
+import de.entropia.can.DbcDatabase.Message;
+import de.entropia.can.DbcDatabase.Signal;
+
+/**
+ * Compares batch decoding through {@link SignalDecoder} with a naive
+ * decoder that walks the bits of {@link CanFrame#getData()} frame by frame.
+ *
+ * Arguments: [messages] [signals per message] [batch size] [rounds]
+ */
+public class SignalDecoderBench {
+
+    private static String syntheticDbc(final int messages,
+            final int signals) {
+        final StringBuilder sb = new StringBuilder();
+        final int bits = 64 / signals;
+        for (int m = 0; m < messages; m++) {
+            sb.append("BO_ ").append(0x100 + m).append(" Msg").append(m)
+                    .append(": 8 ECU\n");
+            for (int s = 0; s < signals; s++) {
+                final boolean intel = (s & 1) == 0;
+                /* Motorola signals are addressed by their msb */
+                final int start = intel ? s * bits
+                        : (s * bits / 8) * 8 + 7 - (s * bits % 8);
+                sb.append(" SG_ S").append(s).append(" : ").append(start)
+                        .append('|').append(bits).append('@')
+                        .append(intel ? '1' : '0')
+                        .append((s & 2) == 0 ? '+' : '-')
+                        .append(" (0.5,-3) [0|0] \"\" ECU\n");
+            }
+            sb.append('\n');
+        }
+        return sb.toString();
+    }
+
+    /* straightforward per frame decoder as found in typical user code */
+    private static double naiveDecode(final byte[] data, final Signal sig) {
+        long raw = 0;
+        if (sig.isLittleEndian()) {
+            for (int i = sig.getLength() - 1; i >= 0; i--) {
+                final int bit = sig.getStartBit() + i;
+                raw = (raw << 1) | ((data[bit / 8] >> (bit % 8)) & 1);
+            }
+        } else {
+            int bit = sig.getStartBit();
+            for (int i = 0; i < sig.getLength(); i++) {
+                raw = (raw << 1) | ((data[bit / 8] >> (bit % 8)) & 1);
+                bit = bit % 8 == 0 ? bit + 15 : bit - 1;
+            }
+        }
+        if (sig.isSigned() && sig.getLength() < 64) {
+            raw = (raw << (64 - sig.getLength())) >> (64 - sig.getLength());
+        }
+        return raw * sig.getFactor() + sig.getOffset();
+    }
+
+    public static void main(String[] args) throws IOException {
+        final int messages = args.length > 0 ? Integer.parseInt(args[0]) : 16;
+        final int signals = args.length > 1 ? Integer.parseInt(args[1]) : 8;
+        final int batchSize = args.length > 2
+                ? Integer.parseInt(args[2]) : 4096;
+        final int rounds = args.length > 3 ? Integer.parseInt(args[3]) : 2000;
+
+        final DbcDatabase db = DbcDatabase.parse(
+                syntheticDbc(messages, signals));
+        final Random rnd = new Random(42);
+        final CanFrameBatch batch = new CanFrameBatch(batchSize);
+        final byte[] payload = new byte[8];
+        while (batch.size() < batchSize) {
+            rnd.nextBytes(payload);
+            batch.add(1, 0x100 + rnd.nextInt(messages), payload);
+        }
+        final List<CanFrame> frames = new ArrayList<>(batchSize);
+        for (int i = 0; i < batchSize; i++) {
+            frames.add(batch.getFrame(i));
+        }
+        final Map<Integer, Message> byId = new HashMap<>();
+        for (final Message m : db.getMessages()) {
+            byId.put(m.getCanId(), m);
+        }
+
+        double sink = 0;
+        long naiveNs = Long.MAX_VALUE;
+        for (int r = 0; r < rounds; r++) {
+            final long t0 = System.nanoTime();
+            for (final CanFrame f : frames) {
+                final Message m = byId.get(f.getCanId().getCanId_SFF());
+                for (final Signal sig : m.getSignals()) {
+                    sink += naiveDecode(f.getData(), sig);
+                }
+            }
+            naiveNs = Math.min(naiveNs, System.nanoTime() - t0);
+        }
+
+        long batchNs = Long.MAX_VALUE;
+        try (final SignalDecoder decoder = new SignalDecoder(db)) {
+            final List<SignalDecoder.Columns> columns = new ArrayList<>();
+            for (final Message m : db.getMessages()) {
+                columns.add(decoder.newColumns(m.getCanId(), batchSize));
+            }
+            for (int r = 0; r < rounds; r++) {
+                final long t0 = System.nanoTime();
+                for (final SignalDecoder.Columns c : columns) {
+                    decoder.decode(batch, c);
+                }
+                batchNs = Math.min(batchNs, System.nanoTime() - t0);
+                sink += columns.get(0).getPhysical(0)[0];
+            }
+        }
+
+        System.out.printf("%d messages x %d signals, batch %d, best of %d%n",
+                messages, signals, batchSize, rounds);
+        System.out.printf("naive per frame: %8.1f ns/frame%n",
+                (double) naiveNs / batchSize);
+        System.out.printf("native batch:    %8.1f ns/frame (%.1fx)%n",
+                (double) batchNs / batchSize, (double) naiveNs / batchNs);
+        if (sink == 42) {
+            System.out.println();
+        }
+    }
+}
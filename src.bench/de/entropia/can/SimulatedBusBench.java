@@ -0,0 +1,82 @@
+package de.entropia.can;
+
+import java.io.IOException;
+
+import de.entropia.can.CanSocket.CanFrame;
+import de.entropia.can.CanSocket.CanId;
+import de.entropia.can.CanSocket.CanInterface;
+
+/**
+ * Drives {@link LatestValueTable} from a {@link SimulatedCanBus} instead of
+ * vcan: periodic senders on several nodes, one receiving node that updates
+ * the table in batches. The bus is stepped from the benchmark thread, so
+ * every run sees the same frame order and bus time; reported are the host
+ * throughput and the simulated bus load.
+ *
+ * Arguments: [frames] [sending nodes] [ids per node] [bitrate] [error rate]
+ */
+public class SimulatedBusBench {
+
+    private static void run(final long frames, final int senders,
+            final int ids, final int bitrate, final double errorRate)
+            throws IOException {
+        try (final SimulatedCanBus bus = new SimulatedCanBus(bitrate, 42);
+                final LatestValueTable table = new LatestValueTable()) {
+            bus.setErrorRate(errorRate);
+            final CanInterface canif = bus.getInterface();
+            final SimulatedCanBus.Node[] nodes =
+                    new SimulatedCanBus.Node[senders];
+            final CanFrame[][] messages = new CanFrame[senders][ids];
+            for (int n = 0; n < senders; n++) {
+                nodes[n] = bus.attach(ids, 16);
+                for (int i = 0; i < ids; i++) {
+                    messages[n][i] = new CanFrame(canif,
+                            new CanId(0x100 + n * ids + i),
+                            new byte[] {(byte) n, (byte) i, 0, 0, 0, 0, 0, 0});
+                }
+            }
+            final SimulatedCanBus.Node receiver = bus.attach(1, 4096);
+            final CanFrameBatch batch = new CanFrameBatch(256);
+            long received = 0;
+            final long start = System.nanoTime();
+            while (received < frames) {
+                /* one period: every node queues all its messages */
+                for (int n = 0; n < senders; n++) {
+                    if (nodes[n].isBusOff()) {
+                        nodes[n].restart();
+                    }
+                    for (int i = 0; i < ids; i++) {
+                        nodes[n].trySend(messages[n][i]);
+                    }
+                }
+                bus.runUntilIdle();
+                int got;
+                while ((got = receiver.tryRecv(batch)) > 0) {
+                    table.update(batch);
+                    received += got;
+                }
+            }
+            final long nanos = System.nanoTime() - start;
+            System.out.printf("%d nodes x %d ids  %9.0f frames/s host  "
+                    + "%8.1f ms bus time  %6.2f x real time  %d errors  "
+                    + "%d arbitration losses%n", senders, ids,
+                    received * 1e9 / nanos, bus.getTimeNanos() / 1e6,
+                    (double) bus.getTimeNanos() / nanos, bus.getErrorFrames(),
+                    bus.getArbitrationLosses());
+        }
+    }
+
+    public static void main(final String[] args) throws Exception {
+        final long frames = args.length > 0 ? Long.parseLong(args[0])
+                : 2000000;
+        final int senders = args.length > 1 ? Integer.parseInt(args[1]) : 8;
+        final int ids = args.length > 2 ? Integer.parseInt(args[2]) : 16;
+        final int bitrate = args.length > 3 ? Integer.parseInt(args[3])
+                : 500000;
+        final double errorRate = args.length > 4
+                ? Double.parseDouble(args[4]) : 0.001;
+        run(frames / 10, senders, ids, bitrate, errorRate);
+        System.out.println("-- measured");
+        run(frames, senders, ids, bitrate, errorRate);
+    }
+}
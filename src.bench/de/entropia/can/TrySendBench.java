@@ -0,0 +1,98 @@
+package de.entropia.can;
+
+import java.io.IOException;
+
+import de.entropia.can.CanSocket.CanFrame;
+import de.entropia.can.CanSocket.CanId;
+import de.entropia.can.CanSocket.CanInterface;
+import de.entropia.can.CanSocket.Mode;
+
+/**
+ * Retry loops against a saturated TX queue: {@link CanSocket#send} with a
+ * caught exception per rejected frame, against the status codes of
+ * {@link CanSocket#trySend(CanFrame)} and the batch variant. Every variant
+ * pushes frames for the same time and reports accepted frames, rejected
+ * attempts and the cost of one attempt.
+ *
+ * vcan has no queue of its own; throttle it first so that the kernel
+ * rejects frames, e.g.
+ * {@code tc qdisc replace dev vcan0 root tbf rate 1mbit burst 2k latency 1ms}
+ *
+ * Arguments: [interface] [seconds per variant]
+ */
+public class TrySendBench {
+
+    private static final int VARIANT_SEND = 0;
+    private static final int VARIANT_TRY_SEND = 1;
+    private static final int VARIANT_TRY_SEND_BATCH = 2;
+    private static final String[] NAMES = { "send", "trySend", "batch" };
+
+    private static void run(final CanInterface canif, final CanSocket tx,
+            final int variant, final long nanos) throws IOException {
+        final CanFrame frame = new CanFrame(canif, new CanId(0x123),
+                new byte[8]);
+        final CanFrameBatch batch = new CanFrameBatch(64);
+        for (int i = 0; i < batch.capacity(); i++) {
+            batch.add(frame);
+        }
+        long sent = 0;
+        long rejected = 0;
+        long attempts = 0;
+        int from = 0;
+        final long start = System.nanoTime();
+        final long end = start + nanos;
+        while ((attempts & 0xff) != 0 || System.nanoTime() < end) {
+            attempts++;
+            switch (variant) {
+            case VARIANT_SEND:
+                try {
+                    tx.send(frame);
+                    sent++;
+                } catch (final IOException e) {
+                    rejected++;
+                }
+                break;
+            case VARIANT_TRY_SEND:
+                if (tx.trySend(frame) > 0) {
+                    sent++;
+                } else {
+                    rejected++;
+                }
+                break;
+            case VARIANT_TRY_SEND_BATCH:
+                final int n = tx.trySend(batch, from);
+                if (n > 0) {
+                    sent += n;
+                    from = (from + n) % batch.size();
+                } else {
+                    rejected++;
+                }
+                break;
+            }
+        }
+        final long elapsed = System.nanoTime() - start;
+        System.out.printf(
+                "%-8s %9.0f frames/s  %9.0f rejected/s  %7.1f ns/attempt%n",
+                NAMES[variant], sent * 1e9 / elapsed, rejected * 1e9 / elapsed,
+                (double) elapsed / attempts);
+    }
+
+    public static void main(final String[] args) throws Exception {
+        final String ifName = args.length > 0 ? args[0] : "vcan0";
+        final long seconds = args.length > 1 ? Long.parseLong(args[1]) : 3;
+
+        for (int pass = 0; pass < 2; pass++) {
+            if (pass == 1) {
+                System.out.println("-- measured");
+            }
+            final long nanos = (pass == 0 ? 1 : seconds) * 1000000000L;
+            for (int variant = 0; variant < NAMES.length; variant++) {
+                try (final CanSocket tx = new CanSocket(Mode.RAW)) {
+                    final CanInterface canif = new CanInterface(tx, ifName);
+                    tx.bind(canif);
+                    run(canif, tx, variant, nanos);
+                }
+            }
+        }
+    }
+}
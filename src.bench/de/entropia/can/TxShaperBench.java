@@ -0,0 +1,104 @@
+package de.entropia.can;
+
+import java.io.IOException;
+
+import de.entropia.can.CanSocket.CanFrame;
+import de.entropia.can.CanSocket.CanId;
+import de.entropia.can.CanSocket.CanInterface;
+import de.entropia.can.CanSocket.Mode;
+
+/**
+ * Cost and accuracy of {@link TxShaper}. The first runs send as fast as
+ * possible without a shaper and with one whose budgets are never reached,
+ * which shows the per frame overhead of the bucket checks. The last run
+ * caps the bus load under the delay policy and reports the load the sent
+ * frames would put on a bus of the given bitrate.
+ *
+ * Arguments: [interface] [frames] [bitrate] [max load]
+ */
+public class TxShaperBench {
+
+    private static CanFrame[] frames(final CanInterface canif) {
+        final CanFrame[] frames = new CanFrame[64];
+        for (int i = 0; i < frames.length; i++) {
+            final byte[] data = new byte[1 + i % 8];
+            data[0] = (byte) i;
+            frames[i] = new CanFrame(canif, new CanId(0x100 + i), data);
+        }
+        return frames;
+    }
+
+    private static void run(final String name, final CanSocket socket,
+            final CanFrame[] frames, final long n, final int bitrate)
+            throws IOException {
+        long bits = 0;
+        final long start = System.nanoTime();
+        for (long i = 0; i < n; i++) {
+            final CanFrame frame = frames[(int) (i % frames.length)];
+            while (socket.trySend(frame) < 0) {
+                Thread.yield();
+            }
+        }
+        final long nanos = System.nanoTime() - start;
+        for (long i = 0; i < n; i++) {
+            bits += SimulatedCanBus.wireBits(
+                    frames[(int) (i % frames.length)]);
+        }
+        System.out.printf("%-10s %9.0f frames/s  %7.1f ns/frame  "
+                + "%6.1f %% load at %d bit/s%n", name, n * 1e9 / nanos,
+                (double) nanos / n, bits * 1e11 / nanos / bitrate, bitrate);
+    }
+
+    public static void main(final String[] args) throws Exception {
+        final String ifName = args.length > 0 ? args[0] : "vcan0";
+        final long frames = args.length > 1 ? Long.parseLong(args[1])
+                : 1000000;
+        final int bitrate = args.length > 2 ? Integer.parseInt(args[2])
+                : 500000;
+        final double maxLoad = args.length > 3
+                ? Double.parseDouble(args[3]) : 0.3;
+
+        for (int pass = 0; pass < 2; pass++) {
+            if (pass == 1) {
+                System.out.println("-- measured");
+            }
+            final long n = pass == 0 ? frames / 10 : frames;
+            try (final CanSocket socket = new CanSocket(Mode.RAW);
+                    final TxShaper open = new TxShaper(TxShaper.Policy.DELAY);
+                    final TxShaper capped =
+                            new TxShaper(TxShaper.Policy.DELAY)) {
+                final CanInterface canif = new CanInterface(socket, ifName);
+                socket.bind(canif);
+                final CanFrame[] messages = frames(canif);
+                run("unshaped", socket, messages, n, bitrate);
+
+                open.addIdRule(0x100, 0x13f, 1e12, 1e6);
+                open.setInterfaceLimit(canif, 1e12, 1e6);
+                socket.setShaper(open);
+                run("unlimited", socket, messages, n, bitrate);
+
+                /* a few seconds worth of frames at the capped load */
+                capped.setBusLoadLimit(canif, bitrate, maxLoad);
+                socket.setShaper(capped);
+                final long bounded = Math.min(n, (long) (bitrate * maxLoad
+                        / 100 * (pass == 0 ? 1 : 5)));
+                final long start = System.nanoTime();
+                for (long i = 0; i < bounded; i++) {
+                    socket.send(messages[(int) (i % messages.length)]);
+                }
+                final long nanos = System.nanoTime() - start;
+                long bits = 0;
+                for (long i = 0; i < bounded; i++) {
+                    bits += SimulatedCanBus.wireBits(
+                            messages[(int) (i % messages.length)]);
+                }
+                System.out.printf("%-10s %9.0f frames/s  %6.1f %% load at "
+                        + "%d bit/s, limit %.1f %%  %d delayed%n", "capped",
+                        bounded * 1e9 / nanos, bits * 1e11 / nanos / bitrate,
+                        bitrate, maxLoad * 100,
+                        capped.getStats().getDelayed());
+                socket.setShaper(null);
+            }
+        }
+    }
+}
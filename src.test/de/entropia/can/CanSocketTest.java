@@ -1,11 +1,32 @@
 package de.entropia.can;
 
+import java.io.ByteArrayInputStream;
+import java.io.ByteArrayOutputStream;
+import java.io.File;
 import java.io.IOException;
 import java.lang.annotation.ElementType;
 import java.lang.annotation.Retention;
 import java.lang.annotation.RetentionPolicy;
 import java.lang.annotation.Target;
+import java.lang.management.ManagementFactory;
 import java.lang.reflect.Method;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.channels.AsynchronousCloseException;
+import java.nio.channels.ClosedChannelException;
+import java.nio.file.Files;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.EnumSet;
+import java.util.List;
+import java.util.Random;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.TimeoutException;
+
+import javax.management.MBeanServer;
+import javax.management.ObjectName;
 
 import de.entropia.can.CanSocket.CanFrame;
 import de.entropia.can.CanSocket.CanId;
@@ -167,4 +188,1371 @@ public class CanSocketTest {
             assert !socket.getLoopbackMode();
         }
     }
+
+    private static final String TEST_DBC =
+            "VERSION \"\"\n"
+            + "\n"
+            + "BO_ 256 Engine: 8 ECU\n"
+            + " SG_ Speed : 0|16@1+ (0.01,0) [0|655.35] \"km/h\" Dash\n"
+            + " SG_ Temp : 16|8@1- (1,-40) [-40|215] \"C\" Dash\n"
+            + " SG_ Rpm : 39|16@0+ (0.25,0) [0|16383.75] \"rpm\" Dash\n"
+            + "\n"
+            + "BO_ 2147484160 Mux: 8 ECU\n"
+            + " SG_ Sel M : 0|8@1+ (1,0) [0|255] \"\" Dash\n"
+            + " SG_ A m1 : 8|8@1+ (1,0) [0|255] \"\" Dash\n"
+            + " SG_ B m2 : 8|8@1+ (2,0) [0|510] \"\" Dash\n";
+
+    private static boolean near(final double a, final double b) {
+        return Math.abs(a - b) < 1e-9;
+    }
+
+    @Test
+    public void testDbcParse() throws IOException {
+        final DbcDatabase db = DbcDatabase.parse(TEST_DBC);
+        assert db.getMessages().size() == 2;
+        final DbcDatabase.Message engine = db.getMessage(0x100);
+        assert engine.getName().equals("Engine");
+        assert engine.getSignals().size() == 3;
+        assert !engine.getSignals().get(2).isLittleEndian();
+        assert engine.getSignals().get(1).isSigned();
+        final DbcDatabase.Message mux =
+                db.getMessage(new CanId(0x200).setEFFSFF()._canId);
+        assert mux != null && mux.getName().equals("Mux");
+        assert mux.getSignals().get(0).isMultiplexor();
+        assert mux.getSignals().get(2).getMultiplexValue() == 2;
+        assert db.getMessage(0x200) == null;
+    }
+
+    @Test
+    public void testSignalDecode() throws IOException {
+        final int muxId = new CanId(0x200).setEFFSFF()._canId;
+        final CanFrameBatch batch = new CanFrameBatch(4);
+        batch.add(1, 0x100, new byte[] {0x10, 0x27, (byte) 0xf6, 0,
+                0x0f, (byte) 0xa0, 0, 0});
+        batch.add(1, muxId, new byte[] {1, 7});
+        batch.add(1, 0x300, new byte[] {1, 2, 3});
+        batch.add(1, muxId, new byte[] {2, 7});
+        try (final SignalDecoder decoder =
+                new SignalDecoder(DbcDatabase.parse(TEST_DBC))) {
+            final SignalDecoder.Columns engine =
+                    decoder.newColumns(0x100, batch.capacity());
+            assert decoder.decode(batch, engine) == 1;
+            assert engine.getFrameIndex(0) == 0;
+            assert near(engine.getPhysical("Speed")[0], 100.0);
+            assert engine.getRaw(1)[0] == -10;
+            assert near(engine.getPhysical("Temp")[0], -50.0);
+            assert near(engine.getPhysical("Rpm")[0], 1000.0);
+
+            final SignalDecoder.Columns mux =
+                    decoder.newColumns("Mux", batch.capacity());
+            assert decoder.decode(batch, mux) == 2;
+            assert mux.getFrameIndex(0) == 1 && mux.getFrameIndex(1) == 3;
+            assert near(mux.getPhysical("A")[0], 7.0);
+            assert Double.isNaN(mux.getPhysical("B")[0]);
+            assert Double.isNaN(mux.getPhysical("A")[1]);
+            assert near(mux.getPhysical("B")[1], 14.0);
+        }
+    }
+
+    @Test
+    public void testLatestValueTable() {
+        final int effId = new CanId(0x123456).setEFFSFF()._canId;
+        final CanFrameBatch batch = new CanFrameBatch(4);
+        batch.add(1, 0x123, new byte[] {1});
+        batch.add(1, effId, new byte[] {4, 5, 6});
+        batch.add(2, 0x123, new byte[] {2, 3});
+        try (final LatestValueTable table = new LatestValueTable(16)) {
+            final LatestValueTable.Value value = new LatestValueTable.Value();
+            assert !table.read(0x124, value);
+            assert !table.read(new CanId(0x124).setEFFSFF()._canId, value);
+            table.update(batch);
+            assert table.read(0x123, value);
+            assert value.getInterfaceIndex() == 2;
+            assert value.getDlc() == 2 && value.getData(1) == 3;
+            assert value.getUpdateCount() == 2;
+            assert table.getUpdateCount(effId) == 1;
+            assert table.read(effId, value);
+            assert value.getCanId() == effId && value.getData(2) == 6;
+            assert table.getOverflowCount() == 0;
+
+            /* remote and error frames leave the data frame alone */
+            final CanFrameBatch other = new CanFrameBatch(2);
+            other.add(1, new CanId(0x123).setRTR()._canId, new byte[0]);
+            other.add(1, new CanId(0x123).setERR()._canId, new byte[8]);
+            table.update(other);
+            assert table.read(0x123, value);
+            assert value.getUpdateCount() == 2 && value.getData(1) == 3;
+        }
+    }
+
+    @Test
+    public void testLatestValueTableReceive() throws Exception {
+        try (final CanSocket sender = new CanSocket(Mode.RAW);
+                final CanSocket receiver = new CanSocket(Mode.RAW);
+                final LatestValueTable table = new LatestValueTable()) {
+            final CanInterface canif = new CanInterface(sender, CAN_INTERFACE);
+            sender.bind(canif);
+            receiver.bind(canif);
+            sender.send(new CanFrame(canif, new CanId(0x42),
+                    new byte[] {7, 8}));
+            assert table.receive(receiver) >= 1;
+            final LatestValueTable.Value value = new LatestValueTable.Value();
+            assert table.read(0x42, value);
+            assert value.getData(1) == 8;
+            assert value.getTimestampNanos() > 0;
+
+            /* close wakes a receive blocked on an idle socket */
+            final CompletableFuture<Throwable> reader =
+                    new CompletableFuture<Throwable>();
+            new Thread(new Runnable() {
+                @Override
+                public void run() {
+                    try {
+                        table.receive(receiver);
+                        reader.complete(null);
+                    } catch (final Throwable t) {
+                        reader.complete(t);
+                    }
+                }
+            }).start();
+            Thread.sleep(100);
+            receiver.close();
+            assert reader.get(5, TimeUnit.SECONDS)
+                    instanceof AsynchronousCloseException;
+        }
+    }
+
+    @Test
+    public void testSpinRecv() throws Exception {
+        try (final CanSocket sender = new CanSocket(Mode.RAW);
+                final CanSocket receiver = new CanSocket(Mode.RAW)) {
+            final CanInterface canif = new CanInterface(sender, CAN_INTERFACE);
+            sender.bind(canif);
+            receiver.bind(canif);
+            receiver.setBusyPoll(50);
+            assert receiver.recvSpin(0) == null;
+            for (final CanSocket.RecvMode mode : CanSocket.RecvMode.values()) {
+                receiver.setRecvMode(mode);
+                sender.send(new CanFrame(canif, new CanId(0x43),
+                        new byte[] {(byte) mode.ordinal()}));
+                final CanFrame frame = receiver.recv();
+                assert frame.getCanId().getCanId_SFF() == 0x43;
+                assert frame.getData()[0] == mode.ordinal();
+            }
+        }
+        /* spinning receivers never sleep in poll, close must still stop them */
+        for (final CanSocket.RecvMode mode : new CanSocket.RecvMode[] {
+                CanSocket.RecvMode.SPIN, CanSocket.RecvMode.SPIN_NATIVE}) {
+            final CanSocket spinning = new CanSocket(Mode.RAW);
+            spinning.bind(new CanInterface(spinning, CAN_INTERFACE));
+            spinning.setRecvMode(mode);
+            final CompletableFuture<Throwable> reader =
+                    new CompletableFuture<Throwable>();
+            new Thread(new Runnable() {
+                @Override
+                public void run() {
+                    try {
+                        spinning.recv();
+                        reader.complete(null);
+                    } catch (final Throwable t) {
+                        reader.complete(t);
+                    }
+                }
+            }).start();
+            Thread.sleep(100);
+            spinning.close();
+            assert reader.get(5, TimeUnit.SECONDS)
+                    instanceof AsynchronousCloseException;
+        }
+    }
+
+    @Test
+    public void testTransmitScheduler() throws Exception {
+        final int frames = 100;
+        try (final CanSocket sender = new CanSocket(Mode.RAW);
+                final CanSocket receiver = new CanSocket(Mode.RAW)) {
+            final CanInterface canif = new CanInterface(sender, CAN_INTERFACE);
+            sender.bind(canif);
+            receiver.bind(canif);
+            final TransmitScheduler.Stats stats;
+            try (final TransmitScheduler scheduler =
+                    new TransmitScheduler(sender, 128)) {
+                for (int i = 0; i < frames; i++) {
+                    assert scheduler.offer(new CanFrame(canif,
+                            new CanId(0x100 + i % 7), new byte[] {(byte) i}));
+                }
+                assert scheduler.flush(5, TimeUnit.SECONDS);
+                stats = scheduler.getStats();
+            }
+            assert stats.getSubmitted() == frames;
+            assert stats.getSent() == frames;
+            assert stats.getQueueDepth() == 0;
+            assert stats.getMaxQueueDepth() >= 1;
+            final CanFrameBatch batch = new CanFrameBatch(frames);
+            int received = 0;
+            while (received < frames) {
+                received += receiver.recv(batch);
+            }
+            assert received == frames;
+        }
+    }
+
+    private static final int CAN_ERR_FLAG = 0x20000000;
+
+    @Test
+    public void testErrorEvent() {
+        /* controller rx passive, stuff error in data field, counters */
+        final int id = CAN_ERR_FLAG | 0x04 | 0x08 | 0x200;
+        final CanFrameBatch batch = new CanFrameBatch(2);
+        batch.add(0, id, new byte[] {0, 0x10, 0x04, 0x0a, 0, 0, (byte) 130, 5});
+        batch.add(0, 0x123, new byte[] {1});
+        final CanErrorEvent event = new CanErrorEvent();
+        assert event.decode(batch, 0);
+        assert event.has(CanErrorEvent.ErrorClass.CONTROLLER);
+        assert event.has(CanErrorEvent.ErrorClass.PROTOCOL);
+        assert !event.has(CanErrorEvent.ErrorClass.BUS_OFF);
+        assert event.getControllerState()
+                == CanErrorEvent.ControllerState.ERROR_PASSIVE;
+        assert event.has(CanErrorEvent.ProtocolViolation.STUFF);
+        assert event.getProtocolLocation()
+                == CanErrorEvent.ProtocolLocation.DATA;
+        assert event.getTxErrorCount() == 130;
+        assert event.getRxErrorCount() == 5;
+        assert !event.decode(batch, 1);
+    }
+
+    @Test
+    public void testErrorMonitor() throws IOException {
+        final CanFrameBatch batch = new CanFrameBatch(8);
+        batch.add(0, CAN_ERR_FLAG | 0x08, new byte[] {0, 0, 0x04, 0x0a, 0,
+                0, 0, 0});
+        batch.add(0, CAN_ERR_FLAG | 0x08, new byte[] {0, 0, 0x01, 0x08, 0,
+                0, 0, 0});
+        batch.add(0, 0x123, new byte[] {1});
+        batch.add(0, CAN_ERR_FLAG | 0x40, new byte[8]);
+        try (final ErrorMonitor monitor = new ErrorMonitor()) {
+            monitor.aggregate(batch);
+            final ErrorMonitor.Summary summary =
+                    monitor.snapshotAndReset(new ErrorMonitor.Summary());
+            assert summary.getErrorFrames() == 3;
+            assert summary.getOtherFrames() == 1;
+            assert summary.getBursts() == 1;
+            assert summary.getMaxBurstLength() == 3;
+            assert summary.getCount(CanErrorEvent.ErrorClass.PROTOCOL) == 2;
+            assert summary.getCount(CanErrorEvent.ProtocolViolation.STUFF)
+                    == 1;
+            assert summary.getCount(CanErrorEvent.ProtocolLocation.DATA) == 1;
+            assert summary.getControllerState()
+                    == CanErrorEvent.ControllerState.BUS_OFF;
+            monitor.snapshot(summary);
+            assert summary.getErrorFrames() == 0;
+            assert summary.getControllerState()
+                    == CanErrorEvent.ControllerState.BUS_OFF;
+
+            /* counters count like in CanErrorEvent, without CAN_ERR_CNT */
+            batch.clear();
+            batch.add(0, CAN_ERR_FLAG | 0x04, new byte[] {0, 0x10, 0, 0, 0,
+                    0, (byte) 130, 5});
+            monitor.aggregate(batch);
+            monitor.snapshot(summary);
+            assert summary.getTxErrorCount() == 130;
+            assert summary.getRxErrorCount() == 5;
+            assert summary.getMaxTxErrorCount() == 130;
+        }
+        try (final CanSocket socket = new CanSocket(Mode.RAW)) {
+            socket.setErrorFilter(EnumSet.of(CanErrorEvent.ErrorClass.BUS_OFF,
+                    CanErrorEvent.ErrorClass.CONTROLLER));
+            assert socket.getErrorFilter().equals(EnumSet.of(
+                    CanErrorEvent.ErrorClass.BUS_OFF,
+                    CanErrorEvent.ErrorClass.CONTROLLER));
+        }
+    }
+
+    @Test
+    public void testErrorMonitorClose() throws Exception {
+        try (final CanSocket socket = new CanSocket(Mode.RAW)) {
+            socket.bind(new CanInterface(socket, CAN_INTERFACE));
+            /* close wakes a receive waiting for frames */
+            final ErrorMonitor monitor = new ErrorMonitor();
+            final CompletableFuture<Throwable> blocked =
+                    new CompletableFuture<Throwable>();
+            new Thread(new Runnable() {
+                @Override
+                public void run() {
+                    try {
+                        monitor.receive(socket);
+                        blocked.complete(null);
+                    } catch (final Throwable t) {
+                        blocked.complete(t);
+                    }
+                }
+            }).start();
+            Thread.sleep(100);
+            monitor.close();
+            assert blocked.get(5, TimeUnit.SECONDS)
+                    instanceof AsynchronousCloseException;
+            try {
+                monitor.snapshot(new ErrorMonitor.Summary());
+                assert false;
+            } catch (final IllegalStateException e) {
+                /* expected */
+            }
+            monitor.close();
+        }
+    }
+
+    @Test
+    public void testBusAnalyzer() {
+        /* 34 stuffable zero bits need 6 stuff bits, plus 13 trailing bits */
+        assert BusAnalyzer.frameBits(new CanFrame(
+                CanSocket.CAN_ALL_INTERFACES, new CanId(0), new byte[0]))
+                == 53;
+        assert BusAnalyzer.worstCaseBits(false, false, 8) == 135;
+        assert BusAnalyzer.worstCaseBits(true, false, 8) == 160;
+        assert BusAnalyzer.worstCaseFdNanos(false, true, 64, 500000, 2000000)
+                < BusAnalyzer.worstCaseFdNanos(false, false, 64, 500000,
+                        2000000);
+
+        final long ms = TimeUnit.MILLISECONDS.toNanos(1);
+        final CanFrameBatch batch = new CanFrameBatch(20);
+        final long[] timestamps = new long[20];
+        for (int i = 0; i < 10; i++) {
+            batch.add(1, 0x100, new byte[8]);
+            timestamps[2 * i] = (i + 1) * 10 * ms;
+            batch.add(1, 0x200, new byte[] {1});
+            timestamps[2 * i + 1] = (i + 1) * 10 * ms + (i % 2) * ms;
+        }
+        try (final BusAnalyzer analyzer = new BusAnalyzer(500000,
+                100 * ms, 64)) {
+            analyzer.aggregate(batch, timestamps);
+            final BusAnalyzer.IdTable table = analyzer.snapshot(
+                    new BusAnalyzer.IdTable(analyzer.getIdCapacity()));
+            assert table.size() == 2;
+            final int fixed = table.indexOf(1, 0x100);
+            assert table.getFrames(fixed) == 10;
+            assert table.getMinPeriodNanos(fixed) == 10 * ms;
+            assert table.getMaxPeriodNanos(fixed) == 10 * ms;
+            assert table.getJitterNanos(fixed) == 0;
+            final int jittery = table.indexOf(1, 0x200);
+            assert table.getMinPeriodNanos(jittery) == 9 * ms;
+            assert table.getMaxPeriodNanos(jittery) == 11 * ms;
+            assert table.getMeanPeriodNanos(jittery) > 9 * ms;
+            assert table.getJitterNanos(jittery) > 0;
+
+            final BusAnalyzer.BusStats stats = new BusAnalyzer.BusStats();
+            assert analyzer.getBusStats(1, 101 * ms, stats);
+            assert stats.getFrames() == 20;
+            assert stats.getBusLoad() > 0 && stats.getBusLoad() < 1;
+            assert !analyzer.getBusStats(2, 101 * ms, stats);
+
+            /* id 0 on interface 0 is counted like any other id */
+            batch.clear();
+            batch.add(0, 0, new byte[0]);
+            batch.add(0, 0, new byte[0]);
+            analyzer.aggregate(batch, new long[] {200 * ms, 210 * ms});
+            final BusAnalyzer.IdTable zero = analyzer.snapshot(
+                    new BusAnalyzer.IdTable(analyzer.getIdCapacity()));
+            assert zero.size() == 3;
+            assert zero.getFrames(zero.indexOf(0, 0)) == 2;
+
+            /* a negative timestamp would index before the load buckets */
+            try {
+                analyzer.aggregate(batch, new long[] {220 * ms, -1});
+                assert false;
+            } catch (final IllegalArgumentException e) {
+                /* expected */
+            }
+            assert analyzer.snapshot(zero).getFrames(zero.indexOf(0, 0))
+                    == 2;
+        }
+    }
+
+    @Test
+    public void testBusAnalyzerClose() throws Exception {
+        try (final CanSocket socket = new CanSocket(Mode.RAW)) {
+            socket.bind(new CanInterface(socket, CAN_INTERFACE));
+            /* close wakes a receive waiting for frames */
+            final BusAnalyzer analyzer = new BusAnalyzer(500000);
+            final CompletableFuture<Throwable> blocked =
+                    new CompletableFuture<Throwable>();
+            new Thread(new Runnable() {
+                @Override
+                public void run() {
+                    try {
+                        analyzer.receive(socket);
+                        blocked.complete(null);
+                    } catch (final Throwable t) {
+                        blocked.complete(t);
+                    }
+                }
+            }).start();
+            Thread.sleep(100);
+            analyzer.close();
+            assert blocked.get(5, TimeUnit.SECONDS)
+                    instanceof AsynchronousCloseException;
+            try {
+                analyzer.getOverflows();
+                assert false;
+            } catch (final IllegalStateException e) {
+                /* expected */
+            }
+            analyzer.close();
+        }
+    }
+
+    @Test
+    public void testSocketStats() throws Exception {
+        try (final CanSocket sender = new CanSocket(Mode.RAW);
+                final CanSocket receiver = new CanSocket(Mode.RAW)) {
+            final CanInterface canif = new CanInterface(sender, CAN_INTERFACE);
+            sender.bind(canif);
+            receiver.bind(canif);
+            for (int i = 0; i < 3; i++) {
+                sender.send(new CanFrame(canif, new CanId(0x44),
+                        new byte[] {1, 2}));
+            }
+            final CanFrameBatch batch = new CanFrameBatch(8);
+            int received = 0;
+            while (received < 3) {
+                received += receiver.recv(batch);
+            }
+            assert receiver.recvSpin(0) == null;
+
+            final SocketStats stats = new SocketStats();
+            assert sender.getStats(stats);
+            assert stats.getFramesOut() == 3;
+            assert stats.getBytesOut() == 6;
+            assert stats.getSendCalls() == 3;
+            assert receiver.getStats(stats);
+            assert stats.getFramesIn() == 3;
+            assert stats.getBytesIn() == 6;
+            assert stats.getFramesPerRecvCall() > 0;
+            assert stats.getWouldBlockCount() >= 1;
+            assert stats.getExceptions() == 0;
+
+            final MBeanServer server =
+                    ManagementFactory.getPlatformMBeanServer();
+            final ObjectName name = receiver.registerMBean();
+            assert server.getAttribute(name, "FramesIn")
+                    .equals(Long.valueOf(3));
+
+            /* native consumers of the socket count there as well */
+            try (final LatestValueTable table = new LatestValueTable()) {
+                sender.send(new CanFrame(canif, new CanId(0x45),
+                        new byte[] {3}));
+                received = 0;
+                while (received < 1) {
+                    received += table.receive(receiver);
+                }
+            }
+            assert receiver.getStats(stats);
+            assert stats.getFramesIn() == 4 && stats.getBytesIn() == 7;
+        }
+
+        final CanSocket socket = new CanSocket(Mode.RAW);
+        final ObjectName name = socket.registerMBean();
+        socket.close();
+        assert !socket.getStats(new SocketStats());
+        assert !ManagementFactory.getPlatformMBeanServer().isRegistered(name);
+    }
+
+    @Test
+    public void testAsyncCanIo() throws IOException {
+        for (final AsyncCanIo.Backend preferred : AsyncCanIo.Backend.values()) {
+            try (final CanSocket sender = new CanSocket(Mode.RAW);
+                    final CanSocket receiver = new CanSocket(Mode.RAW);
+                    final AsyncCanIo io = new AsyncCanIo(16, preferred)) {
+                assert preferred == AsyncCanIo.Backend.POLL
+                        || (io.getBackend() == AsyncCanIo.Backend.IO_URING)
+                        == AsyncCanIo.isIoUringAvailable();
+                final CanInterface canif =
+                        new CanInterface(sender, CAN_INTERFACE);
+                sender.bind(canif);
+                receiver.bind(canif);
+                final int txTag = io.register(sender);
+                final int rxTag = io.register(receiver);
+                assert txTag != rxTag;
+
+                int queued = 0;
+                while (queued < 40) {
+                    final CanFrameBatch rest = new CanFrameBatch(40 - queued);
+                    for (int i = queued; i < 40; i++) {
+                        rest.add(0, i, new byte[] {(byte) i});
+                    }
+                    queued += io.submit(txTag, rest);
+                }
+
+                final CanFrameBatch in = new CanFrameBatch(8);
+                final int[] tags = new int[8];
+                int received = 0;
+                while (received < 40) {
+                    final int n = io.poll(in, tags, 1, TimeUnit.SECONDS);
+                    assert n > 0;
+                    for (int i = 0; i < n; i++) {
+                        assert tags[i] == rxTag;
+                        assert in.getCanId(i) == received;
+                        assert in.getInterfaceIndex(i)
+                                == canif.getInterfaceIndex();
+                        assert in.getData(i)[0] == (byte) received;
+                        received++;
+                    }
+                }
+                assert io.poll(in, null, 0, TimeUnit.SECONDS) == 0;
+
+                final AsyncCanIo.Stats stats =
+                        io.getStats(new AsyncCanIo.Stats());
+                assert stats.getSentFrames() == 40;
+                assert stats.getReceivedFrames() == 40;
+                assert stats.getMalformed() == 0;
+
+                /* a full receive backlog must not hold back send slots */
+                final CanFrameBatch burst = new CanFrameBatch(16);
+                for (int i = 0; i < 16; i++) {
+                    burst.add(0, 0x60, new byte[] {(byte) i});
+                }
+                int sent = 0;
+                for (int attempt = 0; sent < 400; attempt++) {
+                    assert attempt < 100000;
+                    sent += io.submit(txTag, burst);
+                }
+                while (io.poll(in, null, 10, TimeUnit.MILLISECONDS) > 0) {
+                    /* drain */
+                }
+
+                io.unregister(rxTag);
+                sender.send(new CanFrame(canif, new CanId(0x55),
+                        new byte[0]));
+                assert io.poll(in, null, 10, TimeUnit.MILLISECONDS) == 0;
+                io.unregister(txTag);
+            }
+        }
+    }
+
+    @Test
+    public void testRequestClient() throws Exception {
+        try (final CanSocket client = new CanSocket(Mode.RAW);
+                final CanSocket ecu = new CanSocket(Mode.RAW)) {
+            final CanInterface canif = new CanInterface(client, CAN_INTERFACE);
+            client.bind(canif);
+            ecu.bind(canif);
+            try (final RequestClient requests = new RequestClient(client)) {
+                final CompletableFuture<CanFrame> answered = requests.request(
+                        new CanFrame(canif, new CanId(0x7df),
+                                new byte[] {2, 1, 0x0c}),
+                        new CanId(0x7e8), 1, TimeUnit.SECONDS);
+                final CompletableFuture<CanFrame> masked = requests.request(
+                        new CanFrame(canif, new CanId(0x7df),
+                                new byte[] {2, 1, 0x0d}),
+                        0x7e8, 0x7f8, 1, TimeUnit.SECONDS);
+                final CompletableFuture<CanFrame> lost = requests.request(
+                        new CanFrame(canif, new CanId(0x7df),
+                                new byte[] {2, 1, 0x0f}),
+                        new CanId(0x7ea), 20, TimeUnit.MILLISECONDS);
+                assert ecu.recv().getCanId().getCanId_SFF() == 0x7df;
+                ecu.send(new CanFrame(canif, new CanId(0x7e8),
+                        new byte[] {4, 0x41, 0x0c, 0x1a, (byte) 0xf8}));
+                ecu.send(new CanFrame(canif, new CanId(0x7e9),
+                        new byte[] {3, 0x41, 0x0d, 0x32}));
+                ecu.send(new CanFrame(canif, new CanId(0x7eb),
+                        new byte[] {3, 0x41, 0x0f, 0x50}));
+
+                assert answered.get(1, TimeUnit.SECONDS).getData()[2] == 0x0c;
+                assert masked.get(1, TimeUnit.SECONDS).getCanId()
+                        .getCanId_SFF() == 0x7e9;
+                try {
+                    lost.get(1, TimeUnit.SECONDS);
+                    assert false;
+                } catch (final ExecutionException e) {
+                    assert e.getCause() instanceof TimeoutException;
+                }
+                assert requests.getPendingCount() == 0;
+                assert requests.getUnmatchedFrames() >= 1;
+
+                final CompletableFuture<CanFrame> open = requests.request(
+                        new CanFrame(canif, new CanId(0x7df), new byte[0]),
+                        new CanId(0x7e8), 1, TimeUnit.MINUTES);
+                requests.close();
+                assert open.isCompletedExceptionally();
+            }
+        }
+
+        final TimerWheel<String> wheel = new TimerWheel<String>(10, 4, 0);
+        final List<String> fired = new ArrayList<String>();
+        final TimerWheel.Handler<String> collect =
+                new TimerWheel.Handler<String>() {
+            @Override
+            public void onTimeout(final String item) {
+                fired.add(item);
+            }
+        };
+        wheel.schedule("a", 25);
+        wheel.schedule("b", 95);
+        wheel.expire(29, collect);
+        assert fired.isEmpty();
+        wheel.expire(30, collect);
+        assert fired.equals(Arrays.asList("a"));
+        wheel.expire(99, collect);
+        assert fired.size() == 1;
+        wheel.expire(100, collect);
+        assert fired.equals(Arrays.asList("a", "b"));
+    }
+
+    @Test
+    public void testFrameFilter() throws IOException {
+        final int eff = 0x80000000;
+        final int rtr = 0x40000000;
+        final int[] ids = new int[1000];
+        final int[] masks = new int[1000];
+        for (int i = 0; i < 1000; i++) {
+            ids[i] = (i & 1) == 0 ? 0x100 + i : (0x10000 + i) | eff;
+            masks[i] = 0xdfffffff;
+        }
+        ids[999] = 0x700;
+        masks[999] = 0x7f0;
+        try (final FrameFilter filter = new FrameFilter(ids, masks)) {
+            assert filter.size() == 1000;
+            assert filter.matches(0x100);
+            assert !filter.matches(0x101);
+            assert !filter.matches(0x100 | rtr);
+            assert filter.matches(0x10001 | eff);
+            assert !filter.matches(0x10001);
+            assert filter.matches(0x70f) && filter.matches(0x70f | rtr);
+            assert filter.matches(0x70f | eff);
+            assert !filter.matches(0x20000000);
+
+            final CanFrameBatch batch = new CanFrameBatch(200);
+            for (int i = 0; i < 200; i++) {
+                batch.add(i, i % 3 == 0 ? 0x100 + 2 * i : 0x101 + 2 * i,
+                        new byte[] {(byte) i});
+            }
+            assert filter.filter(batch) == 67;
+            for (int i = 0; i < batch.size(); i++) {
+                assert batch.getCanId(i) == 0x100 + 6 * i;
+                assert batch.getInterfaceIndex(i) == 3 * i;
+                assert batch.getData(i, 0) == (byte) (3 * i);
+            }
+        }
+
+        try (final CanSocket sender = new CanSocket(Mode.RAW);
+                final CanSocket receiver = new CanSocket(Mode.RAW);
+                final FrameFilter filter = new FrameFilter(
+                        new int[] {0x123}, new int[] {0x7ff})) {
+            final CanInterface canif = new CanInterface(sender, CAN_INTERFACE);
+            sender.bind(canif);
+            receiver.bind(canif);
+            receiver.setFilters(new int[] {0x100}, new int[] {0x700});
+            sender.send(new CanFrame(canif, new CanId(0x200), new byte[0]));
+            sender.send(new CanFrame(canif, new CanId(0x122), new byte[0]));
+            sender.send(new CanFrame(canif, new CanId(0x123), new byte[0]));
+            final CanFrameBatch batch = new CanFrameBatch(8);
+            assert filter.recv(receiver, batch) == 1;
+            assert batch.getCanId(0) == 0x123;
+            final SocketStats stats = new SocketStats();
+            assert receiver.getStats(stats);
+            assert stats.getFramesIn() == 2;
+        }
+    }
+
+    @Test
+    public void testSharedReader() throws IOException {
+        try (final CanSocket sender = new CanSocket(Mode.RAW);
+                final CanSocket receiver = new CanSocket(Mode.RAW);
+                final SharedReader reader = new SharedReader(receiver)) {
+            final CanInterface canif = new CanInterface(sender, CAN_INTERFACE);
+            sender.bind(canif);
+            receiver.bind(canif);
+            final SharedReader.Subscription low = reader.subscribe(
+                    new int[] {0x100}, new int[] {0x700}, 4,
+                    SharedReader.OverflowPolicy.DROP_OLDEST);
+            final SharedReader.Subscription newest = reader.subscribe(
+                    new int[] {0x100}, new int[] {0x700}, 4,
+                    SharedReader.OverflowPolicy.DROP_NEWEST);
+            final SharedReader.Subscription all = reader.subscribeAll(64,
+                    SharedReader.OverflowPolicy.BLOCK);
+            for (int i = 0; i < 10; i++) {
+                sender.send(new CanFrame(canif, new CanId(0x100 + i),
+                        new byte[] {(byte) i}));
+            }
+            sender.send(new CanFrame(canif, new CanId(0x200), new byte[0]));
+
+            final CanFrameBatch batch = new CanFrameBatch(16);
+            int received = 0;
+            while (received < 11) {
+                assert all.poll(batch, 1, TimeUnit.SECONDS) > 0;
+                for (int i = 0; i < batch.size(); i++) {
+                    assert batch.getCanId(i) == (received < 10
+                            ? 0x100 + received : 0x200);
+                    received++;
+                }
+            }
+            assert low.poll(batch, 1, TimeUnit.SECONDS) == 4;
+            assert batch.getCanId(0) == 0x106 && batch.getCanId(3) == 0x109;
+            assert low.getDropped() == 6;
+            assert newest.poll(batch, 1, TimeUnit.SECONDS) == 4;
+            assert batch.getCanId(0) == 0x100 && batch.getCanId(3) == 0x103;
+            assert newest.getDropped() == 6;
+            assert low.poll(batch, 10, TimeUnit.MILLISECONDS) == 0;
+            assert reader.getStats().getFrames() == 11;
+            assert reader.getStats().getDeliveries() == 25;
+
+            newest.close();
+            sender.send(new CanFrame(canif, new CanId(0x101), new byte[0]));
+            assert low.poll(batch, 1, TimeUnit.SECONDS) == 1;
+        }
+    }
+
+    @Test
+    public void testMergedReader() throws Exception {
+        try (final CanSocket sender = new CanSocket(Mode.RAW);
+                final CanSocket first = new CanSocket(Mode.RAW);
+                final CanSocket second = new CanSocket(Mode.RAW)) {
+            final CanInterface canif = new CanInterface(sender, CAN_INTERFACE);
+            sender.bind(canif);
+            first.bind(canif);
+            second.bind(canif);
+            try (final MergedReader reader = new MergedReader(
+                    new CanSocket[] {first, second}, 50,
+                    TimeUnit.MILLISECONDS)) {
+                assert first.getKernelTimestamps();
+                for (int i = 0; i < 10; i++) {
+                    sender.send(new CanFrame(canif, new CanId(0x100 + i),
+                            new byte[] {(byte) i}));
+                }
+                final CanFrameBatch batch = new CanFrameBatch(32);
+                final long[] timestamps = new long[32];
+                final int[] seen = new int[10];
+                long last = 0;
+                int received = 0;
+                while (received < 20) {
+                    assert reader.receive(batch, timestamps, 1,
+                            TimeUnit.SECONDS) > 0;
+                    for (int i = 0; i < batch.size(); i++) {
+                        assert timestamps[i] >= last;
+                        last = timestamps[i];
+                        seen[batch.getCanId(i) - 0x100]++;
+                        received++;
+                    }
+                }
+                for (int i = 0; i < 10; i++) {
+                    assert seen[i] == 2;
+                }
+                assert reader.receive(batch, timestamps, 10,
+                        TimeUnit.MILLISECONDS) == 0;
+                final MergedReader.Stats stats = reader.getStats();
+                assert stats.getFrames() == 20;
+                assert stats.getLate() == 0 && stats.getBuffered() == 0;
+            }
+
+            /* close wakes a receive waiting without timeout */
+            final MergedReader reader = new MergedReader(
+                    new CanSocket[] {first}, 50, TimeUnit.MILLISECONDS);
+            final CompletableFuture<Throwable> blocked =
+                    new CompletableFuture<Throwable>();
+            new Thread(new Runnable() {
+                @Override
+                public void run() {
+                    try {
+                        reader.receive(new CanFrameBatch(8), new long[8], -1,
+                                TimeUnit.SECONDS);
+                        blocked.complete(null);
+                    } catch (final Throwable t) {
+                        blocked.complete(t);
+                    }
+                }
+            }).start();
+            Thread.sleep(100);
+            reader.close();
+            assert blocked.get(5, TimeUnit.SECONDS)
+                    instanceof AsynchronousCloseException;
+            try {
+                reader.getStats();
+                assert false;
+            } catch (final IllegalStateException e) {
+                /* expected */
+            }
+        }
+    }
+
+    @Test
+    public void testLibraryArch() {
+        final String arch = CanSocket.libraryArch();
+        assert !arch.isEmpty();
+        assert !arch.equals("amd64") && !arch.equals("i686");
+    }
+
+    @Test
+    public void testTrySendTryRecv() throws IOException {
+        try (final CanSocket socket = new CanSocket(Mode.RAW)) {
+            final CanInterface canif = new CanInterface(socket,
+                    CAN_INTERFACE);
+            socket.bind(canif);
+            socket.setRecvOwnMsgsMode(true);
+            final CanFrameBatch batch = new CanFrameBatch(16);
+            assert socket.tryRecv(batch) == -CanSocket.EAGAIN;
+            assert batch.size() == 0;
+            assert socket.trySend(new CanFrame(canif, new CanId(0x11),
+                    new byte[] {1})) == 1;
+            for (int i = 0; i < 4; i++) {
+                batch.add(canif.getInterfaceIndex(), 0x20 + i,
+                        new byte[] {(byte) i});
+            }
+            assert socket.trySend(batch, 1) == 3;
+            int received = 0;
+            final long deadline = System.currentTimeMillis() + 1000;
+            while (received < 4 && System.currentTimeMillis() < deadline) {
+                final int n = socket.tryRecv(batch);
+                if (n > 0) {
+                    assert batch.getCanId(0) == (received == 0 ? 0x11
+                            : 0x20 + received);
+                    received += n;
+                } else {
+                    assert n == -CanSocket.EAGAIN;
+                }
+            }
+            assert received == 4;
+        }
+    }
+
+    @Test
+    public void testDirectFrameBatch() throws IOException {
+        try (final CanSocket socket = new CanSocket(Mode.RAW)) {
+            final CanInterface canif = new CanInterface(socket,
+                    CAN_INTERFACE);
+            socket.bind(canif);
+            socket.setRecvOwnMsgsMode(true);
+            final DirectFrameBatch out = new DirectFrameBatch(4);
+            for (int i = 0; i < 4; i++) {
+                assert out.add(canif.getInterfaceIndex(), 0x30 + i,
+                        Arrays.copyOf(new byte[] {(byte) i, 2, 3}, i + 1));
+            }
+            assert !out.add(canif.getInterfaceIndex(), 0x40, new byte[0]);
+            assert out.getCanId(3) == 0x33 && out.getDlc(3) == 4;
+            socket.send(out);
+            final DirectFrameBatch in = new DirectFrameBatch(8);
+            int received = 0;
+            while (received < 4) {
+                final int n = socket.recv(in);
+                for (int i = 0; i < n; i++, received++) {
+                    assert in.getCanId(i) == 0x30 + received;
+                    assert in.getInterfaceIndex(i) == canif
+                            .getInterfaceIndex();
+                    assert Arrays.equals(in.getData(i),
+                            out.getData(received));
+                }
+            }
+            assert socket.tryRecv(in) == -CanSocket.EAGAIN;
+            assert in.isEmpty();
+        }
+    }
+
+    /** walks an Arrow IPC stream up to its end, returns the messages */
+    private static int arrowMessages(final byte[] bytes) {
+        final ByteBuffer stream = ByteBuffer.wrap(bytes)
+                .order(ByteOrder.LITTLE_ENDIAN);
+        /* each message is continuation, size, metadata and body */
+        int messages = 0;
+        int pos = 0;
+        for (;;) {
+            assert stream.getInt(pos) == 0xffffffff;
+            final int metadata = stream.getInt(pos + 4);
+            assert metadata % 8 == 0;
+            pos += 8;
+            if (metadata == 0) {
+                break;
+            }
+            /* bodyLength is the last field added, see recordBatchMessage */
+            final int root = pos + stream.getInt(pos);
+            final int vtable = root - stream.getInt(root);
+            final long body = stream.getLong(root + stream.getShort(
+                    vtable + 4 + 2 * 3));
+            assert body % 8 == 0;
+            pos += metadata + (int) body;
+            messages++;
+        }
+        assert pos == stream.capacity();
+        return messages;
+    }
+
+    @Test
+    public void testArrowFrameWriter() throws IOException {
+        final CanFrameBatch batch = new CanFrameBatch(100);
+        for (int i = 0; i < 100; i++) {
+            batch.add(1, i % 2 == 0 ? 0x100 + i : 0x80000000 | i,
+                    new byte[] {(byte) i});
+        }
+        final long[] timestamps = new long[100];
+        final ByteArrayOutputStream bytes = new ByteArrayOutputStream();
+        try (final ArrowFrameWriter writer = new ArrowFrameWriter(bytes, 64)) {
+            writer.write(batch, timestamps);
+            assert writer.getRowsWritten() == 64;
+        }
+        /* schema and two record batches */
+        assert arrowMessages(bytes.toByteArray()) == 3;
+
+        final File dir = Files.createTempDirectory("arrow").toFile();
+        try (final ArrowFrameWriter.Partitioned partitioned =
+                new ArrowFrameWriter.Partitioned(dir, 16, 32)) {
+            partitioned.write(batch, null);
+            assert partitioned.getPartitions() == 100;
+        }
+        final File[] files = dir.listFiles();
+        assert files.length == 100;
+        assert new File(dir, "80000001.arrows").length() > 0;
+        for (final File f : files) {
+            Files.delete(f.toPath());
+        }
+
+        /* past maxOpen partitions are suspended and appended to later */
+        try (final ArrowFrameWriter.Partitioned partitioned =
+                new ArrowFrameWriter.Partitioned(dir, 16, 1024, 8)) {
+            partitioned.write(batch, null);
+            partitioned.write(batch, null);
+            assert partitioned.getPartitions() == 100;
+            assert partitioned.getOpenPartitions() == 8;
+        }
+        for (final File f : dir.listFiles()) {
+            /* one schema, a record batch per stretch the file was open */
+            assert arrowMessages(Files.readAllBytes(f.toPath())) == 3;
+            Files.delete(f.toPath());
+        }
+        Files.delete(dir.toPath());
+    }
+
+    @Test
+    public void testSimulatedCanBus() throws IOException {
+        try (final SimulatedCanBus bus = new SimulatedCanBus(500000, 1)) {
+            final SimulatedCanBus.Node a = bus.attach();
+            final SimulatedCanBus.Node b = bus.attach();
+            final SimulatedCanBus.Node c = bus.attach();
+            final CanInterface canif = bus.getInterface();
+            c.setFilters(new int[] {0x100}, new int[] {0x700});
+            assert a.trySend(new CanFrame(canif, new CanId(0x300),
+                    new byte[8])) == 1;
+            b.send(new CanFrame(canif, new CanId(0x120), new byte[2]));
+            a.send(new CanFrame(canif, new CanId(0x80000050), new byte[0]));
+            /* a's queue is FIFO, so 0x300 blocks the extended frame */
+            assert bus.runUntilIdle() == 3;
+            assert bus.getArbitrationLosses() == 1;
+            final CanFrameBatch batch = new CanFrameBatch(8);
+            assert b.tryRecv(batch) == 2;
+            assert batch.getCanId(0) == 0x300;
+            assert batch.getCanId(1) == 0x80000050;
+            assert batch.getInterfaceIndex(0) == canif.getInterfaceIndex();
+            assert c.tryRecv(batch) == 1 && batch.getCanId(0) == 0x120;
+            assert c.tryRecv(batch) == -CanSocket.EAGAIN;
+            assert a.recv().getCanId().getCanId_SFF() == 0x120;
+            long bits = 0;
+            for (final int id : new int[] {0x300, 0x120}) {
+                final int dlc = id == 0x300 ? 8 : 2;
+                final int wire = SimulatedCanBus.wireBits(new CanFrame(canif,
+                        new CanId(id), new byte[dlc]));
+                assert wire >= 47 + 8 * dlc && wire <= 47 + 8 * dlc
+                        + (34 + 8 * dlc - 1) / 4;
+                bits += wire;
+            }
+            bits += SimulatedCanBus.wireBits(new CanFrame(canif,
+                    new CanId(0x80000050), new byte[0]));
+            assert bus.getBits() == bits;
+            assert bus.getTimeNanos() == bits * 2000;
+
+            bus.setErrorRate(1);
+            a.setReceiveErrors(true);
+            a.send(new CanFrame(canif, new CanId(0x10), new byte[1]));
+            assert bus.runUntilIdle() == 32;
+            assert a.isBusOff() && bus.getErrorFrames() == 32;
+            assert a.trySend(new CanFrame(canif, new CanId(0x10),
+                    new byte[1])) == -CanSocket.ENETDOWN;
+            assert a.tryRecv(batch) == 8;
+            assert b.tryRecv(batch) == -CanSocket.EAGAIN;
+        }
+    }
+
+    @Test
+    public void testSimulatedWireBits() {
+        /* the simulation times frames like the native analyzer counts them */
+        final Random random = new Random(1);
+        for (int i = 0; i < 10000; i++) {
+            final boolean eff = random.nextBoolean();
+            int id = eff ? random.nextInt(0x20000000) : random.nextInt(0x800);
+            if (i % 4 == 0) {
+                /* long runs of equal bits need the most stuffing */
+                id = i % 8 == 0 ? 0 : eff ? 0x1fffffff : 0x7ff;
+            }
+            if (eff) {
+                id |= 0x80000000;
+            }
+            if (random.nextInt(5) == 0) {
+                id |= 0x40000000;
+            }
+            final byte[] data = new byte[random.nextInt(9)];
+            random.nextBytes(data);
+            if (i % 3 == 0) {
+                Arrays.fill(data, (byte) (i % 2 == 0 ? 0 : 0xff));
+            }
+            final CanFrame frame = new CanFrame(CanSocket.CAN_ALL_INTERFACES,
+                    new CanId(id), data);
+            assert SimulatedCanBus.wireBits(frame)
+                    == BusAnalyzer.frameBits(frame) : frame;
+        }
+    }
+
+    @Test
+    public void testTxShaper() throws IOException {
+        try (final CanSocket socket = new CanSocket(Mode.RAW);
+                final TxShaper drop = new TxShaper(TxShaper.Policy.DROP);
+                final TxShaper fail = new TxShaper(TxShaper.Policy.FAIL)) {
+            final CanInterface canif = new CanInterface(socket,
+                    CAN_INTERFACE);
+            socket.bind(canif);
+            final int rule = drop.addIdRule(0x100, 0x1ff, 1, 4);
+            socket.setShaper(drop);
+            assert socket.getShaper() == drop;
+            final CanFrame shaped = new CanFrame(canif, new CanId(0x123),
+                    new byte[] {1, 2});
+            final CanFrame free = new CanFrame(canif, new CanId(0x223),
+                    new byte[] {1, 2});
+            for (int i = 0; i < 10; i++) {
+                assert socket.trySend(shaped) == 1;
+                socket.send(free);
+            }
+            assert drop.getStats().getFrames() == 20;
+            assert drop.getStats().getDropped() == 6;
+            assert drop.getShapedFrames(rule) == 6;
+
+            fail.addIdRule(0x100, 0x1ff, 1, 4);
+            socket.setShaper(fail);
+            final CanFrameBatch batch = new CanFrameBatch(8);
+            for (int i = 0; i < 8; i++) {
+                batch.add(shaped);
+            }
+            assert socket.trySend(batch, 0) == 4;
+            assert socket.trySend(batch, 4) == -CanSocket.EAGAIN;
+            try {
+                socket.send(shaped);
+                assert false;
+            } catch (final IOException e) {
+                /* budget exhausted */
+            }
+            assert fail.getStats().getRejected() == 3;
+            try (final AsyncCanIo io = new AsyncCanIo(16,
+                    AsyncCanIo.Backend.POLL)) {
+                /* the budget is used up, the submission ends at once */
+                assert io.submit(io.register(socket), batch) == 0;
+            }
+            fail.close();
+            /* the socket keeps its reference */
+            assert socket.trySend(shaped) == -CanSocket.EAGAIN;
+            socket.setShaper(null);
+            assert socket.trySend(shaped) == 1;
+        }
+    }
+
+    @Test
+    public void testFrameProtection() {
+        final byte[] j1850 = FrameProtection.crc8Table(0x1d);
+        final byte[] dataIds = new byte[16];
+        for (int i = 0; i < dataIds.length; i++) {
+            dataIds[i] = (byte) (0x40 + i);
+        }
+        try (final FrameProtection tx = new FrameProtection();
+                final FrameProtection rx = new FrameProtection()) {
+            for (final FrameProtection p : new FrameProtection[] {tx, rx}) {
+                p.setCrc8(0x10, 1, 4, 0, 0xff, 0xff, j1850,
+                        FrameProtection.Crc8Profile.NONE, null);
+                p.setCounter(0x80001234, 1, 0x0f, 2);
+                p.setCrc8(0x80001234, 1, -2, 0, 0x00, 0x00, j1850,
+                        FrameProtection.Crc8Profile.COUNTER_DATA_ID,
+                        dataIds);
+                p.setXor(0x80001234, 0, -2, -1, 0x5a);
+            }
+            final CanFrame single = new CanFrame(new CanInterface(1),
+                    new CanId(0x10), new byte[5]);
+            assert tx.protect(single);
+            /* SAE J1850 check value of four zero bytes */
+            assert single.getData()[0] == 0x59;
+
+            final CanFrameBatch batch = new CanFrameBatch(40);
+            for (int i = 0; i < 20; i++) {
+                batch.add(1, 0x80001234, new byte[] {0, 0x30, (byte) i, 7,
+                        0});
+            }
+            batch.add(1, 0x300, new byte[] {1});
+            assert tx.protect(batch) == 20;
+            final byte[] status = new byte[batch.capacity()];
+            assert rx.verify(batch, status) == 0;
+            for (int i = 0; i < 20; i++) {
+                assert status[i] == 0;
+                assert (batch.getData(i)[1] & 0x0f) == i % 16;
+            }
+            assert status[20] == FrameProtection.UNPROTECTED;
+
+            batch.clear();
+            final byte[] p1 = new byte[] {0, 0x30, 1, 2, 0};
+            final byte[] p2 = new byte[] {0, 0x30, 3, 4, 0};
+            final byte[] p3 = new byte[] {0, 0x30, 5, 6, 0};
+            final CanFrameBatch sent = new CanFrameBatch(4);
+            sent.add(1, 0x80001234, p1);
+            sent.add(1, 0x80001234, p2);
+            sent.add(1, 0x80001234, p3);
+            sent.add(1, 0x80001234, p3);
+            tx.protect(sent);
+            /* lose one frame, corrupt one, repeat one */
+            batch.add(1, 0x80001234, sent.getData(1));
+            final byte[] corrupt = sent.getData(2);
+            corrupt[3] ^= 1;
+            batch.add(1, 0x80001234, corrupt);
+            batch.add(1, 0x80001234, sent.getData(2));
+            assert rx.verify(batch, status) == 2;
+            assert status[0] == 0;
+            assert status[1] == (FrameProtection.BAD_CRC8
+                    | FrameProtection.BAD_XOR);
+            assert status[2] == FrameProtection.BAD_COUNTER;
+            assert rx.getStats().getVerified() == 23;
+            assert rx.getStats().getBadCrc8() == 1;
+            assert rx.getStats().getUnprotected() == 1;
+        }
+    }
+
+    @Test
+    public void testJ1939() throws IOException {
+        try (final CanSocket tx = new CanSocket(Mode.J1939);
+                final CanSocket rx = new CanSocket(Mode.J1939);
+                final CanSocket monitor = new CanSocket(Mode.J1939)) {
+            final CanInterface canif = new CanInterface(tx, CAN_INTERFACE);
+            tx.bind(canif, CanSocket.J1939_NO_NAME, CanSocket.J1939_NO_PGN,
+                    0x10);
+            rx.bind(canif, CanSocket.J1939_NO_NAME, CanSocket.J1939_NO_PGN,
+                    0x20);
+            monitor.bind(canif);
+            monitor.setJ1939Promiscuous(true);
+            assert monitor.getJ1939Promiscuous();
+            tx.setJ1939SendPriority(3);
+            assert tx.getJ1939SendPriority() == 3;
+
+            /* 1785 bytes go out as a TP session of 255 frames */
+            final byte[] large = new byte[CanSocket.J1939_MAX_TP_SIZE];
+            for (int i = 0; i < large.length; i++) {
+                large[i] = (byte) i;
+            }
+            tx.send(J1939Message.toAddress(0x0c000, 0x20, large));
+            final J1939Message in = rx.recvJ1939();
+            assert in.getPgn() == 0x0c000;
+            assert in.getSourceAddress() == 0x10;
+            assert in.getDestinationAddress() == 0x20;
+            assert in.getPriority() == 3;
+            assert Arrays.equals(in.getData(), large);
+            assert Arrays.equals(monitor.recvJ1939().getData(), large);
+
+            tx.setJ1939Broadcast(true);
+            tx.send(J1939Message.broadcast(0x0feca, new byte[20]));
+            final J1939Message bam = rx.recvJ1939();
+            assert bam.getPgn() == 0x0feca;
+            assert bam.getDestinationAddress() == CanSocket.J1939_NO_ADDR;
+            assert bam.getData().length == 20;
+        }
+    }
+
+    @Test
+    public void testFrameCapture() throws IOException {
+        final CanFrameBatch batch = new CanFrameBatch(5000);
+        final long[] timestamps = new long[5000];
+        for (int i = 0; i < 5000; i++) {
+            final int id = i % 50;
+            final byte[] payload = new byte[id == 7 ? i % 9 : 8];
+            if (payload.length > 1) {
+                payload[1] = (byte) (id % 3 == 0 ? i / 50 : id);
+            }
+            batch.add(1 + id % 2, id == 9 ? 0x80000000 | id : 0x100 + id,
+                    payload);
+            timestamps[i] = 1500000000000000000L + i * 100000L + i % 7;
+        }
+        final ByteArrayOutputStream bytes = new ByteArrayOutputStream();
+        try (final FrameCapture.Writer writer =
+                new FrameCapture.Writer(bytes, 4000)) {
+            writer.write(batch, timestamps);
+            assert writer.getFramesWritten() == 4000;
+        }
+        /* far below the 16 bytes of a raw frame for periodic traffic */
+        assert bytes.size() < 5000 * 4;
+
+        final CanFrameBatch read = new CanFrameBatch(3000);
+        final long[] readTimestamps = new long[3000];
+        int total = 0;
+        try (final FrameCapture.Reader reader = new FrameCapture.Reader(
+                new ByteArrayInputStream(bytes.toByteArray()))) {
+            int n;
+            while ((n = reader.read(read, readTimestamps)) >= 0) {
+                for (int i = 0; i < n; i++) {
+                    assert read.getInterfaceIndex(i)
+                            == batch.getInterfaceIndex(total + i);
+                    assert read.getCanId(i) == batch.getCanId(total + i);
+                    assert Arrays.equals(read.getData(i),
+                            batch.getData(total + i));
+                    assert readTimestamps[i] == timestamps[total + i];
+                }
+                total += n;
+                read.clear();
+            }
+        }
+        assert total == 5000;
+
+        /* a flipped bit may still decode, but must never crash */
+        final byte[] corrupt = bytes.toByteArray();
+        corrupt[30] ^= 0x55;
+        try (final FrameCapture.Reader reader = new FrameCapture.Reader(
+                new ByteArrayInputStream(corrupt))) {
+            while (reader.read(read, null) >= 0) {
+                read.clear();
+            }
+        } catch (final IOException e) {
+            /* expected */
+        }
+    }
+
+    @Test
+    public void testConcurrentClose() throws Exception {
+        final CanSocket socket = new CanSocket(Mode.RAW);
+        final CanInterface canif = new CanInterface(socket, CAN_INTERFACE);
+        socket.bind(canif);
+        /* receive nothing, so the reader blocks until the close */
+        socket.setFilters(new int[0], new int[0]);
+        final CanFrame frame = new CanFrame(canif, new CanId(0x7ff),
+                new byte[] {1});
+        final CompletableFuture<Throwable> reader =
+                new CompletableFuture<Throwable>();
+        final List<CompletableFuture<Throwable>> senders =
+                new ArrayList<CompletableFuture<Throwable>>();
+        new Thread(new Runnable() {
+            @Override
+            public void run() {
+                try {
+                    socket.recv(new CanFrameBatch(8));
+                    reader.complete(null);
+                } catch (final Throwable t) {
+                    reader.complete(t);
+                }
+            }
+        }).start();
+        for (int i = 0; i < 4; i++) {
+            final CompletableFuture<Throwable> sender =
+                    new CompletableFuture<Throwable>();
+            senders.add(sender);
+            new Thread(new Runnable() {
+                @Override
+                public void run() {
+                    try {
+                        for (;;) {
+                            socket.trySend(frame);
+                        }
+                    } catch (final Throwable t) {
+                        sender.complete(t);
+                    }
+                }
+            }).start();
+        }
+        Thread.sleep(100);
+        socket.close();
+        assert reader.get(5, TimeUnit.SECONDS)
+                instanceof AsynchronousCloseException;
+        /* senders stop at the close, never on a stale descriptor */
+        for (final CompletableFuture<Throwable> sender : senders) {
+            assert sender.get(5, TimeUnit.SECONDS)
+                    instanceof ClosedChannelException;
+        }
+        socket.close();
+        try {
+            socket.send(frame);
+            assert false;
+        } catch (final ClosedChannelException e) {
+            /* expected */
+        }
+        assert !socket.getStats(new SocketStats());
+
+        /* a reader pins the descriptor until it is closed */
+        final CanSocket pinned = new CanSocket(Mode.RAW);
+        pinned.bind(canif);
+        final SharedReader shared = new SharedReader(pinned);
+        pinned.close();
+        assert pinned.getStats(new SocketStats());
+        shared.close();
+        assert !pinned.getStats(new SocketStats());
+    }
+
+    @Test
+    public void testFrameArena() throws Exception {
+        final FrameArena arena = new FrameArena(2, 2);
+        assert arena.capacity() == 4;
+        try (final CanSocket socket = new CanSocket(Mode.RAW)) {
+            final CanInterface canif = new CanInterface(socket,
+                    CAN_INTERFACE);
+            socket.bind(canif);
+            socket.setRecvOwnMsgsMode(true);
+            for (int i = 0; i < 6; i++) {
+                socket.send(new CanFrame(canif, new CanId(0x50 + i),
+                        new byte[] {(byte) i, 7}));
+            }
+            final FrameArena.Frame[] frames = new FrameArena.Frame[8];
+            final List<FrameArena.Frame> held =
+                    new ArrayList<FrameArena.Frame>();
+            while (held.size() < 4) {
+                final int n = socket.recv(arena, frames);
+                assert n > 0;
+                held.addAll(Arrays.asList(frames).subList(0, n));
+            }
+            for (int i = 0; i < 4; i++) {
+                final FrameArena.Frame frame = held.get(i);
+                assert frame.getCanId() == 0x50 + i;
+                assert frame.getInterfaceIndex() == canif.getInterfaceIndex();
+                assert frame.getDlc() == 2 && frame.getData(1) == 7;
+                assert Arrays.equals(frame.toCanFrame().getData(),
+                        new byte[] {(byte) i, 7});
+            }
+            FrameArena.Stats stats = arena.getStats();
+            assert stats.getSlabs() == 2 && stats.getInUse() == 4;
+
+            /* every slot in use: nothing is taken from the socket */
+            assert socket.tryRecv(arena, frames) == 0;
+            assert arena.getStats().getExhausted() == 1;
+
+            /* a retained frame survives the first release */
+            final FrameArena.Frame shared = held.get(0).retain();
+            shared.release();
+            assert shared.getCanId() == 0x50;
+            assert socket.tryRecv(arena, frames) == 0;
+
+            /* the last release, on another thread, recycles the slot */
+            final CompletableFuture<Void> released =
+                    new CompletableFuture<Void>();
+            new Thread(new Runnable() {
+                @Override
+                public void run() {
+                    shared.release();
+                    released.complete(null);
+                }
+            }).start();
+            released.get(5, TimeUnit.SECONDS);
+            try {
+                shared.getCanId();
+                assert false;
+            } catch (final IllegalStateException e) {
+                /* expected */
+            }
+            assert socket.recv(arena, frames) == 1;
+            assert frames[0] == shared && frames[0].getCanId() == 0x54;
+            for (final FrameArena.Frame frame : held) {
+                frame.release();
+            }
+            try {
+                shared.release();
+                assert false;
+            } catch (final IllegalStateException e) {
+                /* expected */
+            }
+            assert socket.recv(arena, frames) == 1;
+            assert frames[0].getCanId() == 0x55;
+            frames[0].release();
+            stats = arena.getStats();
+            assert stats.getInUse() == 0 && stats.getSlots() == 4;
+        }
+    }
 }
@@ -0,0 +1,723 @@
+package de.entropia.can;
+
+import java.io.BufferedOutputStream;
+import java.io.Closeable;
+import java.io.File;
+import java.io.FileOutputStream;
+import java.io.IOException;
+import java.io.OutputStream;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.HashSet;
+import java.util.Iterator;
+import java.util.LinkedHashMap;
+import java.util.Map;
+import java.util.Set;
+
+import de.entropia.can.CanSocket.CanFrame;
+
+/**
+ * Streams frames as Apache Arrow IPC record batches for columnar tools.
+ *
+ * The output is the Arrow IPC streaming format: a schema message, one
+ * record batch per chunk and the end-of-stream marker, as read by e.g.
+ * {@code pyarrow.ipc.open_stream}. Columns, none of them nullable:
+ * <ul>
+ * <li>{@code timestamp}: timestamp[ns, UTC]
+ * <li>{@code ifindex}: int32
+ * <li>{@code id}: uint32, the identifier without flag bits
+ * <li>{@code flags}: uint8, the top three bits of can_id, see
+ * {@link #FLAG_EFF}
+ * <li>{@code dlc}: uint8
+ * <li>{@code payload}: fixed_size_binary[8], zero padded
+ * </ul>
+ * Frames are buffered column-wise until a chunk is full and then written
+ * as one record batch, so memory stays bounded however long the trace is.
+ * Not thread safe.
+ */
+public final class ArrowFrameWriter implements Closeable {
+    public static final int DEFAULT_CHUNK_ROWS = 65536;
+
+    /** bits of the {@code flags} column */
+    public static final int FLAG_ERR = 1;
+    public static final int FLAG_RTR = 2;
+    public static final int FLAG_EFF = 4;
+
+    private static final int ID_MASK = 0x1fffffff;
+    private static final int PAYLOAD_WIDTH = CanFrameBatch.DATA_STRIDE;
+    private static final int INITIAL_ROWS = 256;
+
+    /* Arrow format constants, see Message.fbs and Schema.fbs */
+    private static final short METADATA_V5 = 4;
+    private static final byte HEADER_SCHEMA = 1;
+    private static final byte HEADER_RECORD_BATCH = 3;
+    private static final byte TYPE_INT = 2;
+    private static final byte TYPE_TIMESTAMP = 10;
+    private static final byte TYPE_FIXED_SIZE_BINARY = 15;
+    private static final short UNIT_NANOSECOND = 3;
+    private static final short ENDIANNESS_LITTLE = 0;
+    private static final int CONTINUATION = 0xffffffff;
+    private static final int COLUMNS = 6;
+
+    private final OutputStream out;
+    private final int chunkRows;
+    private final ByteBuffer header = ByteBuffer.allocate(8)
+            .order(ByteOrder.LITTLE_ENDIAN);
+    private ByteBuffer body = ByteBuffer.allocate(0);
+    private long[] timestamps;
+    private int[] ifIndices;
+    private int[] ids;
+    private byte[] flags;
+    private byte[] dlcs;
+    private byte[] payloads;
+    private int rows;
+    private long rowsWritten;
+    private boolean closed;
+
+    public ArrowFrameWriter(final OutputStream out) throws IOException {
+        this(out, DEFAULT_CHUNK_ROWS);
+    }
+
+    /**
+     * Writes the schema to {@code out} right away.
+     *
+     * @param chunkRows frames per record batch
+     */
+    public ArrowFrameWriter(final OutputStream out, final int chunkRows)
+            throws IOException {
+        this(out, chunkRows, true);
+    }
+
+    /** @param schema false to continue a stream left by {@link #suspend} */
+    private ArrowFrameWriter(final OutputStream out, final int chunkRows,
+            final boolean schema) throws IOException {
+        if (chunkRows <= 0) {
+            throw new IllegalArgumentException("chunkRows must be positive");
+        }
+        this.out = out;
+        this.chunkRows = chunkRows;
+        allocate(Math.min(chunkRows, INITIAL_ROWS));
+        if (schema) {
+            writeMessage(schemaMessage());
+        }
+    }
+
+    private void allocate(final int capacity) {
+        timestamps = Arrays.copyOf(timestamps == null ? new long[0]
+                : timestamps, capacity);
+        ifIndices = Arrays.copyOf(ifIndices == null ? new int[0] : ifIndices,
+                capacity);
+        ids = Arrays.copyOf(ids == null ? new int[0] : ids, capacity);
+        flags = Arrays.copyOf(flags == null ? new byte[0] : flags, capacity);
+        dlcs = Arrays.copyOf(dlcs == null ? new byte[0] : dlcs, capacity);
+        payloads = Arrays.copyOf(payloads == null ? new byte[0] : payloads,
+                capacity * PAYLOAD_WIDTH);
+    }
+
+    /** @return the row for the next frame, flushing a full chunk first */
+    private int reserve() throws IOException {
+        if (closed) {
+            throw new IllegalStateException("writer closed");
+        }
+        if (rows == chunkRows) {
+            flushChunk();
+        }
+        if (rows == timestamps.length) {
+            allocate((int) Math.min(chunkRows, 2L * rows));
+        }
+        return rows++;
+    }
+
+    private void put(final int row, final long timestampNanos,
+            final int ifIndex, final int canId, final int dlc) {
+        timestamps[row] = timestampNanos;
+        ifIndices[row] = ifIndex;
+        ids[row] = canId & ID_MASK;
+        flags[row] = (byte) (canId >>> 29);
+        dlcs[row] = (byte) dlc;
+    }
+
+    private static long now() {
+        return System.currentTimeMillis() * 1000000L;
+    }
+
+    public void write(final long timestampNanos, final CanFrame frame)
+            throws IOException {
+        final byte[] data = frame.getData();
+        final int row = reserve();
+        put(row, timestampNanos, frame.getCanInterfacae().getInterfaceIndex(),
+                frame.getCanId()._canId, data.length);
+        final int off = row * PAYLOAD_WIDTH;
+        System.arraycopy(data, 0, payloads, off, data.length);
+        Arrays.fill(payloads, off + data.length, off + PAYLOAD_WIDTH,
+                (byte) 0);
+    }
+
+    /**
+     * @param timestampNanos receive time of every frame in CLOCK_REALTIME
+     *            nanoseconds, as filled by {@link MergedReader#receive}, or
+     *            null to stamp the whole batch with the current time
+     */
+    public void write(final CanFrameBatch batch, final long[] timestampNanos)
+            throws IOException {
+        final long now = timestampNanos == null ? now() : 0;
+        for (int i = 0; i < batch.size; i++) {
+            final int row = reserve();
+            put(row, timestampNanos == null ? now : timestampNanos[i],
+                    batch.ifIndex[i], batch.canId[i], batch.dlc[i]);
+            System.arraycopy(batch.data, i * PAYLOAD_WIDTH, payloads,
+                    row * PAYLOAD_WIDTH, PAYLOAD_WIDTH);
+        }
+    }
+
+    /** @see #write(CanFrameBatch, long[]) */
+    public void write(final DirectFrameBatch batch,
+            final long[] timestampNanos) throws IOException {
+        final long now = timestampNanos == null ? now() : 0;
+        for (int i = 0; i < batch.size; i++) {
+            final int row = reserve();
+            put(row, timestampNanos == null ? now : timestampNanos[i],
+                    batch.getInterfaceIndex(i), batch.getCanId(i),
+                    batch.getDlc(i));
+            for (int j = 0; j < PAYLOAD_WIDTH; j++) {
+                payloads[row * PAYLOAD_WIDTH + j] = batch.getData(i, j);
+            }
+        }
+    }
+
+    /** frames written as record batches so far, buffered ones excluded */
+    public long getRowsWritten() {
+        return rowsWritten;
+    }
+
+    private static int padded(final long length) {
+        return (int) ((length + 7) & ~7L);
+    }
+
+    private void flushChunk() throws IOException {
+        if (rows == 0) {
+            return;
+        }
+        final int n = rows;
+        final int[] lengths = { n * 8, n * 4, n * 4, n, n, n * PAYLOAD_WIDTH };
+        int bodyLength = 0;
+        for (final int length : lengths) {
+            bodyLength += padded(length);
+        }
+        if (body.capacity() < bodyLength) {
+            body = ByteBuffer.allocate(bodyLength)
+                    .order(ByteOrder.LITTLE_ENDIAN);
+        }
+        Arrays.fill(body.array(), 0, bodyLength, (byte) 0);
+        int off = 0;
+        body.position(off);
+        body.asLongBuffer().put(timestamps, 0, n);
+        off += padded(lengths[0]);
+        body.position(off);
+        body.asIntBuffer().put(ifIndices, 0, n);
+        off += padded(lengths[1]);
+        body.position(off);
+        body.asIntBuffer().put(ids, 0, n);
+        off += padded(lengths[2]);
+        System.arraycopy(flags, 0, body.array(), off, n);
+        off += padded(lengths[3]);
+        System.arraycopy(dlcs, 0, body.array(), off, n);
+        off += padded(lengths[4]);
+        System.arraycopy(payloads, 0, body.array(), off, lengths[5]);
+
+        writeMessage(recordBatchMessage(n, lengths, bodyLength));
+        out.write(body.array(), 0, bodyLength);
+        rowsWritten += n;
+        rows = 0;
+    }
+
+    /** Writes the buffered frames as a record batch and flushes the stream. */
+    public void flush() throws IOException {
+        flushChunk();
+        out.flush();
+    }
+
+    /** Releases column buffers grown beyond the initial size. */
+    void trim() {
+        if (rows == 0 && timestamps.length > INITIAL_ROWS) {
+            timestamps = null;
+            ifIndices = null;
+            ids = null;
+            flags = null;
+            dlcs = null;
+            payloads = null;
+            allocate(Math.min(chunkRows, INITIAL_ROWS));
+        }
+    }
+
+    /**
+     * Writes the buffered frames and closes the stream without the
+     * end-of-stream marker, so another writer may append to it.
+     */
+    private void suspend() throws IOException {
+        if (closed) {
+            return;
+        }
+        try {
+            flushChunk();
+        } finally {
+            closed = true;
+            out.close();
+        }
+    }
+
+    /** Writes the buffered frames and the end-of-stream marker. */
+    @Override
+    public void close() throws IOException {
+        if (closed) {
+            return;
+        }
+        try {
+            flushChunk();
+            header.clear();
+            header.putInt(CONTINUATION).putInt(0);
+            out.write(header.array(), 0, 8);
+        } finally {
+            closed = true;
+            out.close();
+        }
+    }
+
+    /* encapsulated message: continuation, metadata size, metadata, body */
+    private void writeMessage(final FlatBuilder metadata) throws IOException {
+        final int size = metadata.offset();
+        header.clear();
+        header.putInt(CONTINUATION).putInt(padded(size));
+        out.write(header.array(), 0, 8);
+        metadata.writeTo(out);
+        for (int i = size; i < padded(size); i++) {
+            out.write(0);
+        }
+    }
+
+    private static int intType(final FlatBuilder b, final int bitWidth,
+            final boolean signed) {
+        b.startTable(2);
+        b.addInt(0, bitWidth);
+        b.addBoolean(1, signed);
+        return b.endTable();
+    }
+
+    private static int field(final FlatBuilder b, final String name,
+            final byte typeType, final int type) {
+        final int nameOffset = b.createString(name);
+        final int children = b.createOffsetVector(new int[0]);
+        b.startTable(7);
+        b.addOffset(0, nameOffset);
+        b.addBoolean(1, false);
+        b.addByte(2, typeType);
+        b.addOffset(3, type);
+        b.addOffset(5, children);
+        return b.endTable();
+    }
+
+    private static FlatBuilder schemaMessage() {
+        final FlatBuilder b = new FlatBuilder(1024);
+        final int[] fields = new int[COLUMNS];
+        final int timezone = b.createString("UTC");
+        b.startTable(2);
+        b.addShort(0, UNIT_NANOSECOND);
+        b.addOffset(1, timezone);
+        fields[0] = field(b, "timestamp", TYPE_TIMESTAMP, b.endTable());
+        fields[1] = field(b, "ifindex", TYPE_INT, intType(b, 32, true));
+        fields[2] = field(b, "id", TYPE_INT, intType(b, 32, false));
+        fields[3] = field(b, "flags", TYPE_INT, intType(b, 8, false));
+        fields[4] = field(b, "dlc", TYPE_INT, intType(b, 8, false));
+        b.startTable(1);
+        b.addInt(0, PAYLOAD_WIDTH);
+        fields[5] = field(b, "payload", TYPE_FIXED_SIZE_BINARY,
+                b.endTable());
+        final int fieldVector = b.createOffsetVector(fields);
+        b.startTable(4);
+        b.addShort(0, ENDIANNESS_LITTLE);
+        b.addOffset(1, fieldVector);
+        return message(b, HEADER_SCHEMA, b.endTable(), 0);
+    }
+
+    private static FlatBuilder recordBatchMessage(final int n,
+            final int[] lengths, final int bodyLength) {
+        final FlatBuilder b = new FlatBuilder(512);
+        /* per column an empty validity buffer and the values */
+        final long[] offsets = new long[COLUMNS];
+        long off = 0;
+        for (int i = 0; i < COLUMNS; i++) {
+            offsets[i] = off;
+            off += padded(lengths[i]);
+        }
+        b.startVector(16, 2 * COLUMNS, 8);
+        for (int i = COLUMNS - 1; i >= 0; i--) {
+            b.addStruct(offsets[i], lengths[i]);
+            b.addStruct(offsets[i], 0);
+        }
+        final int buffers = b.endVector();
+        b.startVector(16, COLUMNS, 8);
+        for (int i = 0; i < COLUMNS; i++) {
+            /* FieldNode: length, null count */
+            b.addStruct(n, 0);
+        }
+        final int nodes = b.endVector();
+        b.startTable(5);
+        b.addLong(0, n);
+        b.addOffset(1, nodes);
+        b.addOffset(2, buffers);
+        return message(b, HEADER_RECORD_BATCH, b.endTable(), bodyLength);
+    }
+
+    private static FlatBuilder message(final FlatBuilder b,
+            final byte headerType, final int header, final long bodyLength) {
+        b.startTable(5);
+        b.addLong(3, bodyLength);
+        b.addOffset(2, header);
+        b.addShort(0, METADATA_V5);
+        b.addByte(1, headerType);
+        b.finish(b.endTable());
+        return b;
+    }
+
+    /**
+     * The little of FlatBuffers the Arrow metadata needs, filled back to
+     * front like the reference builder so that every offset points forward.
+     */
+    private static final class FlatBuilder {
+        private ByteBuffer bb;
+        private int space;
+        private int minAlign = 1;
+        private final int[] vtable = new int[8];
+        private int vtableSize;
+        private int objectStart;
+        private int vectorElements;
+
+        FlatBuilder(final int size) {
+            this.bb = ByteBuffer.allocate(size).order(ByteOrder.LITTLE_ENDIAN);
+            this.space = size;
+        }
+
+        int offset() {
+            return bb.capacity() - space;
+        }
+
+        void writeTo(final OutputStream out) throws IOException {
+            out.write(bb.array(), space, offset());
+        }
+
+        private void prep(final int size, final int additional) {
+            minAlign = Math.max(minAlign, size);
+            final int alignSize = (-(offset() + additional)) & (size - 1);
+            while (space < alignSize + size + additional) {
+                final int old = bb.capacity();
+                final ByteBuffer grown = ByteBuffer.allocate(old * 2)
+                        .order(ByteOrder.LITTLE_ENDIAN);
+                System.arraycopy(bb.array(), 0, grown.array(), old, old);
+                bb = grown;
+                space += old;
+            }
+            for (int i = 0; i < alignSize; i++) {
+                bb.put(--space, (byte) 0);
+            }
+        }
+
+        private void putByte(final byte v) {
+            bb.put(--space, v);
+        }
+
+        private void putShort(final short v) {
+            bb.putShort(space -= 2, v);
+        }
+
+        private void putInt(final int v) {
+            bb.putInt(space -= 4, v);
+        }
+
+        private void putLong(final long v) {
+            bb.putLong(space -= 8, v);
+        }
+
+        private void addShort(final short v) {
+            prep(2, 0);
+            putShort(v);
+        }
+
+        private void addInt(final int v) {
+            prep(4, 0);
+            putInt(v);
+        }
+
+        private void addOffset(final int target) {
+            prep(4, 0);
+            putInt(offset() - target + 4);
+        }
+
+        void startTable(final int fields) {
+            Arrays.fill(vtable, 0, fields, 0);
+            vtableSize = fields;
+            objectStart = offset();
+        }
+
+        void addByte(final int slot, final byte v) {
+            prep(1, 0);
+            putByte(v);
+            vtable[slot] = offset();
+        }
+
+        void addBoolean(final int slot, final boolean v) {
+            addByte(slot, (byte) (v ? 1 : 0));
+        }
+
+        void addShort(final int slot, final short v) {
+            addShort(v);
+            vtable[slot] = offset();
+        }
+
+        void addInt(final int slot, final int v) {
+            addInt(v);
+            vtable[slot] = offset();
+        }
+
+        void addLong(final int slot, final long v) {
+            prep(8, 0);
+            putLong(v);
+            vtable[slot] = offset();
+        }
+
+        void addOffset(final int slot, final int target) {
+            addOffset(target);
+            vtable[slot] = offset();
+        }
+
+        int endTable() {
+            addInt(0);
+            final int table = offset();
+            int last = vtableSize - 1;
+            while (last >= 0 && vtable[last] == 0) {
+                last--;
+            }
+            for (int i = last; i >= 0; i--) {
+                addShort((short) (vtable[i] != 0 ? table - vtable[i] : 0));
+            }
+            addShort((short) (table - objectStart));
+            addShort((short) ((last + 3) * 2));
+            bb.putInt(bb.capacity() - table, offset() - table);
+            return table;
+        }
+
+        void startVector(final int elementSize, final int elements,
+                final int alignment) {
+            vectorElements = elements;
+            prep(4, elementSize * elements);
+            prep(alignment, elementSize * elements);
+        }
+
+        /* a struct of two longs, the first one at the lower address */
+        void addStruct(final long first, final long second) {
+            prep(8, 16);
+            putLong(second);
+            putLong(first);
+        }
+
+        int endVector() {
+            putInt(vectorElements);
+            return offset();
+        }
+
+        int createOffsetVector(final int[] targets) {
+            startVector(4, targets.length, 4);
+            for (int i = targets.length - 1; i >= 0; i--) {
+                addOffset(targets[i]);
+            }
+            return endVector();
+        }
+
+        int createString(final String s) {
+            final byte[] utf8 = s.getBytes(StandardCharsets.UTF_8);
+            prep(1, 0);
+            putByte((byte) 0);
+            startVector(1, utf8.length, 1);
+            space -= utf8.length;
+            System.arraycopy(utf8, 0, bb.array(), space, utf8.length);
+            return endVector();
+        }
+
+        void finish(final int root) {
+            prep(minAlign, 4);
+            addOffset(root);
+        }
+    }
+
+    /**
+     * One Arrow stream per CAN id in a directory, for tools that load a
+     * single signal source at a time.
+     *
+     * Files are named after the can_id in eight hex digits, EFF and ERR
+     * flags included and RTR excluded, with the extension {@code .arrows}.
+     * Once the frames buffered over all ids reach the row budget, every
+     * partition writes its pending chunk, which bounds memory regardless
+     * of the number of ids. At most {@code maxOpen} files are kept open;
+     * beyond that the least recently written partition writes its chunk
+     * and closes its file, which is appended to when its id shows up
+     * again. Every stream gets its end-of-stream marker on {@link #close}.
+     */
+    public static final class Partitioned implements Closeable {
+        public static final int DEFAULT_BUDGET_ROWS = 1 << 20;
+        public static final int DEFAULT_MAX_OPEN = 256;
+
+        private static final int RTR_FLAG = 0x40000000;
+
+        private final File directory;
+        private final int chunkRows;
+        private final int budgetRows;
+        private final int maxOpen;
+        /* open partitions, least recently written first */
+        private final Map<Integer, ArrowFrameWriter> writers =
+                new LinkedHashMap<Integer, ArrowFrameWriter>(16, 0.75f, true);
+        /* partitions whose file was closed without end-of-stream marker */
+        private final Set<Integer> suspended = new HashSet<Integer>();
+        private int buffered;
+
+        public Partitioned(final File directory) throws IOException {
+            this(directory, DEFAULT_CHUNK_ROWS, DEFAULT_BUDGET_ROWS);
+        }
+
+        public Partitioned(final File directory, final int chunkRows,
+                final int budgetRows) throws IOException {
+            this(directory, chunkRows, budgetRows, DEFAULT_MAX_OPEN);
+        }
+
+        /**
+         * @param chunkRows frames per record batch and id at most
+         * @param budgetRows frames buffered over all ids at most
+         * @param maxOpen files open at the same time at most
+         */
+        public Partitioned(final File directory, final int chunkRows,
+                final int budgetRows, final int maxOpen) throws IOException {
+            if (chunkRows <= 0 || budgetRows <= 0 || maxOpen <= 0) {
+                throw new IllegalArgumentException("sizes must be positive");
+            }
+            if (!directory.isDirectory() && !directory.mkdirs()) {
+                throw new IOException("cannot create " + directory);
+            }
+            this.directory = directory;
+            this.chunkRows = chunkRows;
+            this.budgetRows = budgetRows;
+            this.maxOpen = maxOpen;
+        }
+
+        /** opens the stream of key, appending to a suspended one */
+        private ArrowFrameWriter open(final int key) throws IOException {
+            final boolean resume = suspended.remove(key);
+            final File file = new File(directory, String.format(
+                    "%08x.arrows", key));
+            return new ArrowFrameWriter(new BufferedOutputStream(
+                    new FileOutputStream(file, resume), 1 << 16), chunkRows,
+                    !resume);
+        }
+
+        private ArrowFrameWriter writer(final int canId) throws IOException {
+            final int key = canId & ~RTR_FLAG;
+            ArrowFrameWriter w = writers.get(key);
+            if (w == null) {
+                if (writers.size() >= maxOpen) {
+                    final Iterator<Map.Entry<Integer, ArrowFrameWriter>> it =
+                            writers.entrySet().iterator();
+                    final Map.Entry<Integer, ArrowFrameWriter> eldest =
+                            it.next();
+                    it.remove();
+                    suspended.add(eldest.getKey());
+                    eldest.getValue().suspend();
+                }
+                w = open(key);
+                writers.put(key, w);
+            }
+            return w;
+        }
+
+        private void account(final int frames) throws IOException {
+            buffered += frames;
+            if (buffered >= budgetRows) {
+                for (final ArrowFrameWriter w : writers.values()) {
+                    w.flushChunk();
+                    w.trim();
+                }
+                buffered = 0;
+            }
+        }
+
+        public void write(final long timestampNanos, final CanFrame frame)
+                throws IOException {
+            writer(frame.getCanId()._canId).write(timestampNanos, frame);
+            account(1);
+        }
+
+        /** @see ArrowFrameWriter#write(CanFrameBatch, long[]) */
+        public void write(final CanFrameBatch batch,
+                final long[] timestampNanos) throws IOException {
+            final long now = timestampNanos == null ? now() : 0;
+            for (int i = 0; i < batch.size; i++) {
+                final ArrowFrameWriter w = writer(batch.canId[i]);
+                final int row = w.reserve();
+                w.put(row, timestampNanos == null ? now : timestampNanos[i],
+                        batch.ifIndex[i], batch.canId[i], batch.dlc[i]);
+                System.arraycopy(batch.data, i * PAYLOAD_WIDTH, w.payloads,
+                        row * PAYLOAD_WIDTH, PAYLOAD_WIDTH);
+                account(1);
+            }
+        }
+
+        public File getDirectory() {
+            return directory;
+        }
+
+        /** number of ids seen, i.e. files written */
+        public int getPartitions() {
+            return writers.size() + suspended.size();
+        }
+
+        /** number of files currently open */
+        public int getOpenPartitions() {
+            return writers.size();
+        }
+
+        public void flush() throws IOException {
+            for (final ArrowFrameWriter w : writers.values()) {
+                w.flush();
+            }
+            buffered = 0;
+        }
+
+        @Override
+        public void close() throws IOException {
+            IOException failure = null;
+            for (final ArrowFrameWriter w : writers.values()) {
+                try {
+                    w.close();
+                } catch (final IOException e) {
+                    if (failure == null) {
+                        failure = e;
+                    }
+                }
+            }
+            writers.clear();
+            /* suspended streams only lack their end-of-stream marker */
+            for (final Integer key : new ArrayList<Integer>(suspended)) {
+                try {
+                    open(key).close();
+                } catch (final IOException e) {
+                    if (failure == null) {
+                        failure = e;
+                    }
+                }
+            }
+            suspended.clear();
+            if (failure != null) {
+                throw failure;
+            }
+        }
+    }
+}
@@ -0,0 +1,213 @@
+package de.entropia.can;
+
+import java.io.Closeable;
+import java.io.IOException;
+import java.util.Map;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.TimeUnit;
+
+/**
+ * Event driven send and receive over many CAN sockets.
+ *
+ * On Linux 6.0 and later an io_uring keeps a multishot receive posted on
+ * every registered socket, frames of all sockets are collected without a
+ * system call per frame and a batch of sends is submitted with one system
+ * call. Where io_uring is unavailable or disabled the sockets are polled
+ * and drained with recvmmsg and sendmmsg instead; both backends behave the
+ * same.
+ *
+ * An instance must be driven by one thread at a time. The registered
+ * sockets stay owned by the caller; closing one keeps its descriptor open
+ * until it is unregistered or this instance is closed.
+ */
+public final class AsyncCanIo implements Closeable {
+    static {
+        CanSocket.loadNativeLibrary();
+    }
+
+    public static final int DEFAULT_ENTRIES = 256;
+
+    public enum Backend {
+        IO_URING,
+        POLL
+    }
+
+    private static native long _create(final int entries,
+            final boolean allowIoUring);
+    private static native void _free(final long io);
+    private static native int _backend(final long io);
+    private static native int _register(final long io, final int fd,
+            final long stats) throws IOException;
+    private static native void _unregister(final long io, final int tag)
+            throws IOException;
+    private static native int _submit(final long io, final int tag,
+            final int[] ifIndices, final int[] canIds, final byte[] dlcs,
+            final byte[] data, final int count) throws IOException;
+    private static native int _poll(final long io, final int[] tags,
+            final int[] ifIndices, final int[] canIds, final byte[] dlcs,
+            final byte[] data, final long timeoutNanos) throws IOException;
+    private static native void _stats(final long io, final long[] stats);
+    private static native boolean _isIoUringAvailable();
+
+    private static final int ST_RECV_FRAMES = 0;
+    private static final int ST_SENT_FRAMES = 1;
+    private static final int ST_SEND_ERRORS = 2;
+    private static final int ST_SYSCALLS = 3;
+    private static final int ST_REARMS = 4;
+    private static final int ST_MALFORMED = 5;
+    private static final int ST_FIELDS = 6;
+
+    /** Reusable snapshot of the counters of an instance. */
+    public final static class Stats {
+        private final long[] v = new long[ST_FIELDS];
+
+        public long getReceivedFrames() {
+            return v[ST_RECV_FRAMES];
+        }
+
+        public long getSentFrames() {
+            return v[ST_SENT_FRAMES];
+        }
+
+        /** sends the kernel completed with an error */
+        public long getSendErrors() {
+            return v[ST_SEND_ERRORS];
+        }
+
+        /** poll, recvmmsg, sendmmsg or io_uring_enter calls made */
+        public long getSystemCalls() {
+            return v[ST_SYSCALLS];
+        }
+
+        /** receives posted again, e.g. after running out of buffers */
+        public long getRearms() {
+            return v[ST_REARMS];
+        }
+
+        /** datagrams dropped because they were no classic CAN frame */
+        public long getMalformed() {
+            return v[ST_MALFORMED];
+        }
+
+        @Override
+        public String toString() {
+            return "Stats [received=" + getReceivedFrames() + ", sent="
+                    + getSentFrames() + ", syscalls=" + getSystemCalls()
+                    + "]";
+        }
+    }
+
+    private final Backend backend;
+    private volatile long _io;
+    /* registered sockets by tag, pinned until unregistered */
+    private final Map<Integer, CanSocket> registered =
+            new ConcurrentHashMap<Integer, CanSocket>();
+
+    public AsyncCanIo() {
+        this(DEFAULT_ENTRIES, Backend.IO_URING);
+    }
+
+    /**
+     * @param entries submission queue size, bounds the sends in flight
+     * @param preferred {@link Backend#POLL} to never use io_uring
+     */
+    public AsyncCanIo(final int entries, final Backend preferred) {
+        this._io = _create(entries, preferred == Backend.IO_URING);
+        this.backend = Backend.values()[_backend(_io)];
+    }
+
+    /** Whether this kernel and process may use the io_uring backend. */
+    public static boolean isIoUringAvailable() {
+        return _isIoUringAvailable();
+    }
+
+    private long handle() {
+        final long io = _io;
+        if (io == 0) {
+            throw new IllegalStateException("async io closed");
+        }
+        return io;
+    }
+
+    public Backend getBackend() {
+        return backend;
+    }
+
+    /**
+     * Starts receiving on {@code socket}.
+     *
+     * @return tag identifying the socket in {@link #poll} and
+     *         {@link #submit}
+     */
+    public int register(final CanSocket socket) throws IOException {
+        socket.acquire();
+        try {
+            final int tag = _register(handle(), socket._fd, socket._stats);
+            registered.put(tag, socket);
+            return tag;
+        } catch (final IOException | RuntimeException | Error e) {
+            socket.release();
+            throw e;
+        }
+    }
+
+    /** Stops receiving on the socket, tags are not reused. */
+    public void unregister(final int tag) throws IOException {
+        _unregister(handle(), tag);
+        final CanSocket socket = registered.remove(tag);
+        if (socket != null) {
+            socket.release();
+        }
+    }
+
+    /**
+     * Sends the frames of {@code batch} on the socket of {@code tag}. Frames
+     * with an interface index are sent to that interface, the others to
+     * the interface the socket is bound to. A {@link TxShaper} attached to
+     * the socket never makes this wait: frames it drops count as queued,
+     * and the first one it holds back ends the submission.
+     *
+     * @return number of frames queued, less than the batch size if the
+     *         submission queue is full or the shaper holds frames back
+     */
+    public int submit(final int tag, final CanFrameBatch batch)
+            throws IOException {
+        return _submit(handle(), tag, batch.ifIndex, batch.canId, batch.dlc,
+                batch.data, batch.size);
+    }
+
+    /**
+     * Fills {@code batch} with frames received on any registered socket,
+     * waiting up to {@code timeout} if none are pending.
+     *
+     * @param tags receives the tag of every frame, may be null
+     * @param timeout negative to wait without limit, zero to not wait
+     * @return number of frames received, zero on timeout
+     */
+    public int poll(final CanFrameBatch batch, final int[] tags,
+            final long timeout, final TimeUnit unit) throws IOException {
+        batch.size = 0;
+        batch.size = _poll(handle(), tags, batch.ifIndex, batch.canId,
+                batch.dlc, batch.data,
+                timeout < 0 ? -1 : unit.toNanos(timeout));
+        return batch.size;
+    }
+
+    public Stats getStats(final Stats stats) {
+        _stats(handle(), stats.v);
+        return stats;
+    }
+
+    @Override
+    public synchronized void close() {
+        if (_io != 0) {
+            final long io = _io;
+            _io = 0;
+            _free(io);
+            for (final CanSocket socket : registered.values()) {
+                socket.release();
+            }
+            registered.clear();
+        }
+    }
+}
@@ -0,0 +1,425 @@
+package de.entropia.can;
+
+import java.io.Closeable;
+import java.io.IOException;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicIntegerFieldUpdater;
+
+import de.entropia.can.CanSocket.CanFrame;
+import de.entropia.can.CanSocket.CanInterface;
+
+/**
+ * Native bus load and cycle time analyzer.
+ *
+ * Frames are read straight from a socket with {@link #receive} or fed from
+ * a {@link CanFrameBatch} with their timestamps; no Java object is created
+ * per frame. For every frame the exact on-wire length including stuff bits
+ * is computed and accounted in a sliding window per interface, and the
+ * period of every CAN id is tracked with its minimum, maximum, mean and
+ * jitter. Snapshots may be polled from another thread, and
+ * {@link #close()} may be called while a receive is blocked.
+ *
+ * Receive times are taken from the kernel when
+ * {@link CanSocket#setKernelTimestamps} is enabled on the socket, otherwise
+ * all frames of one receive burst share the time they were read, which
+ * blurs the cycle times of ids sent back to back. Only classic CAN frames
+ * are received; {@link #worstCaseFdNanos} bounds the length of CAN FD
+ * frames.
+ */
+public final class BusAnalyzer implements Closeable {
+    static {
+        CanSocket.loadNativeLibrary();
+    }
+
+    public static final long DEFAULT_WINDOW_NANOS =
+            TimeUnit.SECONDS.toNanos(1);
+    public static final int DEFAULT_ID_CAPACITY = 4096;
+
+    private static native long _create(final int bitrate,
+            final long windowNanos, final int idCapacity);
+    private static native void _free(final long analyzer);
+    private static native void _wake(final long analyzer);
+    private static native boolean _setBitrate(final long analyzer,
+            final int ifIndex, final int bitrate);
+    private static native int _receive(final long analyzer, final int fd,
+            final long stats) throws IOException;
+    private static native void _aggregate(final long analyzer,
+            final int[] ifIndices, final int[] canIds, final byte[] dlcs,
+            final byte[] data, final long[] timestamps, final int count);
+    private static native boolean _busStats(final long analyzer,
+            final int ifIndex, final long nowNanos, final long[] stats);
+    private static native int _snapshot(final long analyzer,
+            final int[] ifIndices, final int[] canIds, final long[] stats,
+            final boolean reset);
+    private static native long _overflows(final long analyzer);
+    private static native int _frameBits(final int canId, final byte[] data);
+    private static native int _worstCaseBits(final int flags,
+            final int length, final int[] phases);
+
+    private static final int WC_EFF = 1;
+    private static final int WC_RTR = 2;
+    private static final int WC_FD = 4;
+
+    private static final int BUS_IF_INDEX = 0;
+    private static final int BUS_BITRATE = 1;
+    private static final int BUS_FRAMES = 2;
+    private static final int BUS_BITS = 3;
+    private static final int BUS_WINDOW_BITS = 4;
+    private static final int BUS_WINDOW_NANOS = 5;
+    private static final int BUS_FIELDS = 6;
+
+    private static final int ID_FRAMES = 0;
+    private static final int ID_BITS = 1;
+    private static final int ID_LAST_NANOS = 2;
+    private static final int ID_MIN_PERIOD = 3;
+    private static final int ID_MAX_PERIOD = 4;
+    private static final int ID_MEAN_PERIOD = 5;
+    private static final int ID_JITTER = 6;
+    private static final int ID_FIELDS = 7;
+
+    /** Reusable load snapshot of one interface. */
+    public final static class BusStats {
+        private final long[] v = new long[BUS_FIELDS];
+
+        public int getInterfaceIndex() {
+            return (int) v[BUS_IF_INDEX];
+        }
+
+        public int getBitrate() {
+            return (int) v[BUS_BITRATE];
+        }
+
+        public long getFrames() {
+            return v[BUS_FRAMES];
+        }
+
+        /** bit times of all frames seen */
+        public long getBits() {
+            return v[BUS_BITS];
+        }
+
+        public long getWindowBits() {
+            return v[BUS_WINDOW_BITS];
+        }
+
+        /** covered time, shorter than the window right after start */
+        public long getWindowNanos() {
+            return v[BUS_WINDOW_NANOS];
+        }
+
+        /** share of the bit time in the window used by frames, 0 to 1 */
+        public double getBusLoad() {
+            if (v[BUS_WINDOW_NANOS] == 0) {
+                return 0;
+            }
+            return v[BUS_WINDOW_BITS] * 1e9
+                    / ((double) v[BUS_BITRATE] * v[BUS_WINDOW_NANOS]);
+        }
+
+        @Override
+        public String toString() {
+            return "BusStats [ifIndex=" + getInterfaceIndex() + ", frames="
+                    + getFrames() + ", busLoad=" + getBusLoad() + "]";
+        }
+    }
+
+    /**
+     * Reusable snapshot of the per id table, one row per CAN id and
+     * interface. Periods are in nanoseconds.
+     */
+    public final static class IdTable {
+        private final int[] ifIndex;
+        private final int[] canId;
+        private final long[] v;
+        private int size;
+
+        /** @param capacity at least the id capacity of the analyzer */
+        public IdTable(final int capacity) {
+            this.ifIndex = new int[capacity];
+            this.canId = new int[capacity];
+            this.v = new long[capacity * ID_FIELDS];
+        }
+
+        public int size() {
+            return size;
+        }
+
+        private int row(final int i, final int field) {
+            if (i < 0 || i >= size) {
+                throw new IndexOutOfBoundsException("index " + i + ", size "
+                        + size);
+            }
+            return i * ID_FIELDS + field;
+        }
+
+        public int getInterfaceIndex(final int i) {
+            row(i, 0);
+            return ifIndex[i];
+        }
+
+        /** raw can_id including the EFF and RTR flags */
+        public int getCanId(final int i) {
+            row(i, 0);
+            return canId[i];
+        }
+
+        public long getFrames(final int i) {
+            return v[row(i, ID_FRAMES)];
+        }
+
+        /** on-wire length of the latest frame in bit times */
+        public int getFrameBits(final int i) {
+            return (int) v[row(i, ID_BITS)];
+        }
+
+        public long getLastNanos(final int i) {
+            return v[row(i, ID_LAST_NANOS)];
+        }
+
+        public long getMinPeriodNanos(final int i) {
+            return v[row(i, ID_MIN_PERIOD)];
+        }
+
+        public long getMaxPeriodNanos(final int i) {
+            return v[row(i, ID_MAX_PERIOD)];
+        }
+
+        public long getMeanPeriodNanos(final int i) {
+            return v[row(i, ID_MEAN_PERIOD)];
+        }
+
+        /** standard deviation of the period */
+        public long getJitterNanos(final int i) {
+            return v[row(i, ID_JITTER)];
+        }
+
+        /** row of the given interface and raw can_id, -1 if absent */
+        public int indexOf(final int ifIdx, final int id) {
+            for (int i = 0; i < size; i++) {
+                if (ifIndex[i] == ifIdx && canId[i] == id) {
+                    return i;
+                }
+            }
+            return -1;
+        }
+    }
+
+    private final int idCapacity;
+    private volatile long _analyzer;
+    /* native calls in flight in the low bits, CLOSED once close() ran */
+    private volatile int _users;
+
+    private static final AtomicIntegerFieldUpdater<BusAnalyzer> USERS =
+            AtomicIntegerFieldUpdater.newUpdater(BusAnalyzer.class,
+                    "_users");
+    private static final int CLOSED = 0x80000000;
+
+    public BusAnalyzer(final int bitrate) {
+        this(bitrate, DEFAULT_WINDOW_NANOS, DEFAULT_ID_CAPACITY);
+    }
+
+    /**
+     * @param bitrate default nominal bit rate of the interfaces
+     * @param windowNanos length of the bus load window
+     * @param idCapacity number of ids tracked over all interfaces, a power
+     *        of two
+     */
+    public BusAnalyzer(final int bitrate, final long windowNanos,
+            final int idCapacity) {
+        this._analyzer = _create(bitrate, windowNanos, idCapacity);
+        this.idCapacity = idCapacity;
+    }
+
+    /**
+     * Pins the analyzer for a native call, like {@link CanSocket#acquire()};
+     * the last {@link #release()} after {@link #close()} frees it.
+     *
+     * @return the analyzer handle
+     */
+    private long acquire() {
+        for (;;) {
+            final int users = _users;
+            if ((users & CLOSED) != 0) {
+                throw new IllegalStateException("analyzer closed");
+            }
+            if (USERS.compareAndSet(this, users, users + 1)) {
+                return _analyzer;
+            }
+        }
+    }
+
+    private void release() {
+        if (USERS.decrementAndGet(this) == CLOSED) {
+            destroy();
+        }
+    }
+
+    public int getIdCapacity() {
+        return idCapacity;
+    }
+
+    /**
+     * Overrides the bit rate of one interface.
+     *
+     * @return false if too many interfaces are tracked already
+     */
+    public boolean setBitrate(final CanInterface canif, final int bitrate) {
+        final long analyzer = acquire();
+        try {
+            return _setBitrate(analyzer, canif.getInterfaceIndex(), bitrate);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Blocks until frames are available on {@code socket} and analyzes one
+     * burst of them.
+     *
+     * @return number of frames consumed
+     * @throws java.nio.channels.AsynchronousCloseException if the socket
+     *         or the analyzer is closed meanwhile
+     */
+    public int receive(final CanSocket socket) throws IOException {
+        final long analyzer = acquire();
+        try {
+            socket.acquire();
+            try {
+                return _receive(analyzer, socket._fd, socket._stats);
+            } finally {
+                socket.release();
+            }
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Analyzes the frames of {@code batch}, e.g. from a capture.
+     *
+     * @param timestampNanos receive time of every frame, ascending per id
+     * @throws IllegalArgumentException if a timestamp is negative; no
+     *         frame of the batch is analyzed then
+     */
+    public void aggregate(final CanFrameBatch batch,
+            final long[] timestampNanos) {
+        for (int i = 0; i < batch.size && i < timestampNanos.length; i++) {
+            if (timestampNanos[i] < 0) {
+                throw new IllegalArgumentException("negative timestamp "
+                        + timestampNanos[i]);
+            }
+        }
+        final long analyzer = acquire();
+        try {
+            _aggregate(analyzer, batch.ifIndex, batch.canId, batch.dlc,
+                    batch.data, timestampNanos, batch.size);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Fills {@code stats} with the load of {@code canif} up to now.
+     *
+     * @return false if no frame was seen on the interface yet
+     */
+    public boolean getBusStats(final CanInterface canif,
+            final BusStats stats) {
+        return getBusStats(canif.getInterfaceIndex(), 0, stats);
+    }
+
+    /**
+     * Like {@link #getBusStats(CanInterface, BusStats)} with the window
+     * ending at {@code nowNanos}, for replayed timestamps.
+     */
+    public boolean getBusStats(final int ifIndex, final long nowNanos,
+            final BusStats stats) {
+        final long analyzer = acquire();
+        try {
+            return _busStats(analyzer, ifIndex, nowNanos, stats.v);
+        } finally {
+            release();
+        }
+    }
+
+    public IdTable snapshot(final IdTable table) {
+        return snapshot(table, false);
+    }
+
+    /** Takes a snapshot and restarts the period statistics. */
+    public IdTable snapshotAndReset(final IdTable table) {
+        return snapshot(table, true);
+    }
+
+    private IdTable snapshot(final IdTable table, final boolean reset) {
+        final long analyzer = acquire();
+        try {
+            table.size = _snapshot(analyzer, table.ifIndex, table.canId,
+                    table.v, reset);
+        } finally {
+            release();
+        }
+        return table;
+    }
+
+    /** frames not tracked because the interface or id table was full */
+    public long getOverflows() {
+        final long analyzer = acquire();
+        try {
+            return _overflows(analyzer);
+        } finally {
+            release();
+        }
+    }
+
+    /** exact on-wire length of a classic frame in bit times */
+    public static int frameBits(final CanFrame frame) {
+        return _frameBits(frame.getCanId()._canId, frame.getData());
+    }
+
+    /** longest possible classic frame in bit times, IFS included */
+    public static int worstCaseBits(final boolean eff, final boolean rtr,
+            final int length) {
+        return _worstCaseBits((eff ? WC_EFF : 0) | (rtr ? WC_RTR : 0), length,
+                new int[2]);
+    }
+
+    /**
+     * Longest possible transmission time of a CAN FD frame.
+     *
+     * @param brs whether the data phase uses {@code dataBitrate}
+     */
+    public static long worstCaseFdNanos(final boolean eff, final boolean brs,
+            final int length, final int bitrate, final int dataBitrate) {
+        final int[] phases = new int[2];
+        _worstCaseBits(WC_FD | (eff ? WC_EFF : 0), length, phases);
+        final double data = phases[1] * 1e9 / (brs ? dataBitrate : bitrate);
+        return (long) Math.ceil(phases[0] * 1e9 / bitrate + data);
+    }
+
+    /**
+     * Wakes a blocked {@link #receive} and frees the analyzer once no call
+     * runs any more.
+     */
+    @Override
+    public void close() {
+        int users;
+        do {
+            users = _users;
+            if ((users & CLOSED) != 0) {
+                return;
+            }
+        } while (!USERS.compareAndSet(this, users, (users + 1) | CLOSED));
+        try {
+            _wake(_analyzer);
+        } finally {
+            release();
+        }
+    }
+
+    private void destroy() {
+        final long analyzer = _analyzer;
+        _analyzer = 0;
+        _free(analyzer);
+    }
+}
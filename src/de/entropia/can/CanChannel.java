@@ -0,0 +1,37 @@
+package de.entropia.can;
+
+import java.io.Closeable;
+import java.io.IOException;
+
+import de.entropia.can.CanSocket.CanFrame;
+
+/**
+ * Frame I/O of {@link CanSocket} and of the nodes of a
+ * {@link SimulatedCanBus}, for code that should run against either.
+ */
+public interface CanChannel extends Closeable {
+
+    void send(CanFrame frame) throws IOException;
+
+    /**
+     * @return 1 if the frame was sent, or a negative errno, see
+     *         {@link CanSocket#trySend(CanFrame)}
+     */
+    int trySend(CanFrame frame) throws IOException;
+
+    CanFrame recv() throws IOException;
+
+    /**
+     * Blocks for the first frame, then drains what is queued up to the
+     * batch capacity.
+     *
+     * @return the number of frames received
+     */
+    int recv(CanFrameBatch batch) throws IOException;
+
+    /**
+     * @return the number of frames received, or a negative errno, see
+     *         {@link CanSocket#tryRecv(CanFrameBatch)}
+     */
+    int tryRecv(CanFrameBatch batch) throws IOException;
+}
@@ -0,0 +1,170 @@
+package de.entropia.can;
+
+import java.util.Collections;
+import java.util.EnumSet;
+import java.util.Set;
+
+import de.entropia.can.CanSocket.CanFrame;
+
+/**
+ * Decoded content of a CAN error frame as described in
+ * {@code linux/can/error.h}.
+ *
+ * Instances are meant to be reused: {@link #decode} overwrites the event in
+ * place, so a receive loop can inspect any number of error frames without
+ * allocating. Error frames are only delivered after enabling them with
+ * {@link CanSocket#setErrorFilter}.
+ */
+public final class CanErrorEvent {
+    static {
+        CanSocket.loadNativeLibrary();
+    }
+
+    /** error classes in the bit order of the can_id error flags */
+    public static enum ErrorClass {
+        TX_TIMEOUT, LOST_ARBITRATION, CONTROLLER, PROTOCOL, TRANSCEIVER,
+        NO_ACK, BUS_OFF, BUS_ERROR, RESTARTED, ERROR_COUNTERS;
+
+        int mask() {
+            return 1 << ordinal();
+        }
+
+        static int mask(final Set<ErrorClass> classes) {
+            int mask = 0;
+            for (final ErrorClass c : classes) {
+                mask |= c.mask();
+            }
+            return mask;
+        }
+
+        static Set<ErrorClass> fromMask(final int mask) {
+            final EnumSet<ErrorClass> classes =
+                    EnumSet.noneOf(ErrorClass.class);
+            for (final ErrorClass c : values()) {
+                if ((mask & c.mask()) != 0) {
+                    classes.add(c);
+                }
+            }
+            return Collections.unmodifiableSet(classes);
+        }
+    }
+
+    public static enum ControllerState {
+        /** the frame carries no state information */
+        UNKNOWN,
+        ERROR_ACTIVE, ERROR_WARNING, ERROR_PASSIVE, BUS_OFF
+    }
+
+    /** protocol violation types in the bit order of data[2] */
+    public static enum ProtocolViolation {
+        BIT, FORM, STUFF, BIT0, BIT1, OVERLOAD, ACTIVE_ANNOUNCEMENT, TX
+    }
+
+    /** where in the frame a protocol violation was detected */
+    public static enum ProtocolLocation {
+        UNSPECIFIED, SOF, ID28_21, ID20_18, SRTR, IDE, ID17_13, ID12_05,
+        ID04_00, RTR, RES1, RES0, DLC, DATA, CRC_SEQUENCE, CRC_DELIMITER, ACK,
+        ACK_DELIMITER, EOF, INTERMISSION
+    }
+
+    /* controller problem bits of data[1] */
+    private static final int CRTL_RX_OVERFLOW = 0x01;
+    private static final int CRTL_TX_OVERFLOW = 0x02;
+
+    private static final int EV_CLASSES = 0;
+    private static final int EV_STATE = 1;
+    private static final int EV_CONTROLLER_FLAGS = 2;
+    private static final int EV_VIOLATIONS = 3;
+    private static final int EV_LOCATION = 4;
+    private static final int EV_TRANSCEIVER = 5;
+    private static final int EV_LOST_ARBITRATION_BIT = 6;
+    private static final int EV_TX_ERRORS = 7;
+    private static final int EV_RX_ERRORS = 8;
+    private static final int EV_FIELDS = 9;
+
+    private static native boolean _decode(final int canId, final byte[] data,
+            final int offset, final int length, final int[] fields);
+
+    private final int[] fields = new int[EV_FIELDS];
+
+    /**
+     * Decodes {@code frame} into this event.
+     *
+     * @return false if the frame is no error frame; the event is unchanged
+     */
+    public boolean decode(final CanFrame frame) {
+        final byte[] data = frame.getData();
+        return _decode(frame.getCanId()._canId, data, 0, data.length, fields);
+    }
+
+    /**
+     * Decodes frame {@code i} of {@code batch} into this event.
+     *
+     * @return false if the frame is no error frame; the event is unchanged
+     */
+    public boolean decode(final CanFrameBatch batch, final int i) {
+        batch.checkIndex(i);
+        return _decode(batch.canId[i], batch.data, i * CanFrameBatch.DATA_STRIDE,
+                batch.dlc[i], fields);
+    }
+
+    public boolean has(final ErrorClass errorClass) {
+        return (fields[EV_CLASSES] & errorClass.mask()) != 0;
+    }
+
+    /** allocates, prefer {@link #has} in hot loops */
+    public Set<ErrorClass> getErrorClasses() {
+        return ErrorClass.fromMask(fields[EV_CLASSES]);
+    }
+
+    public ControllerState getControllerState() {
+        return ControllerState.values()[fields[EV_STATE]];
+    }
+
+    /** raw CAN_ERR_CRTL_* bits */
+    public int getControllerFlags() {
+        return fields[EV_CONTROLLER_FLAGS];
+    }
+
+    public boolean isRxOverflow() {
+        return (fields[EV_CONTROLLER_FLAGS] & CRTL_RX_OVERFLOW) != 0;
+    }
+
+    public boolean isTxOverflow() {
+        return (fields[EV_CONTROLLER_FLAGS] & CRTL_TX_OVERFLOW) != 0;
+    }
+
+    public boolean has(final ProtocolViolation violation) {
+        return (fields[EV_VIOLATIONS] & (1 << violation.ordinal())) != 0;
+    }
+
+    public ProtocolLocation getProtocolLocation() {
+        return ProtocolLocation.values()[fields[EV_LOCATION]];
+    }
+
+    /** raw CAN_ERR_TRX_* value */
+    public int getTransceiverStatus() {
+        return fields[EV_TRANSCEIVER];
+    }
+
+    /** bit position arbitration was lost at, 0 if unspecified */
+    public int getLostArbitrationBit() {
+        return fields[EV_LOST_ARBITRATION_BIT];
+    }
+
+    public int getTxErrorCount() {
+        return fields[EV_TX_ERRORS];
+    }
+
+    public int getRxErrorCount() {
+        return fields[EV_RX_ERRORS];
+    }
+
+    @Override
+    public String toString() {
+        return "CanErrorEvent [classes=" + getErrorClasses() + ", state="
+                + getControllerState() + ", location="
+                + getProtocolLocation() + ", txErrors=" + getTxErrorCount()
+                + ", rxErrors=" + getRxErrorCount() + "]";
+    }
+}
@@ -0,0 +1,127 @@
+package de.entropia.can;
+
+import java.util.Arrays;
+
+import de.entropia.can.CanSocket.CanFrame;
+import de.entropia.can.CanSocket.CanId;
+import de.entropia.can.CanSocket.CanInterface;
+
+/**
+ * Columnar storage for a batch of classic CAN frames.
+ *
+ * The batch is filled by {@link CanSocket#recv(CanFrameBatch)} with as many
+ * frames as one burst of receive system calls delivers and can be handed to
+ * batch consumers like {@link SignalDecoder} without creating a
+ * {@link CanFrame} per received frame. Payloads are stored back to back with
+ * a fixed stride of {@link #DATA_STRIDE} bytes, unused bytes are zero.
+ */
+public final class CanFrameBatch {
+    public static final int DATA_STRIDE = 8;
+
+    final int[] ifIndex;
+    final int[] canId;
+    final byte[] dlc;
+    final byte[] data;
+    int size;
+
+    public CanFrameBatch(final int capacity) {
+        if (capacity <= 0) {
+            throw new IllegalArgumentException("capacity must be positive");
+        }
+        this.ifIndex = new int[capacity];
+        this.canId = new int[capacity];
+        this.dlc = new byte[capacity];
+        this.data = new byte[capacity * DATA_STRIDE];
+    }
+
+    public int capacity() {
+        return canId.length;
+    }
+
+    public int size() {
+        return size;
+    }
+
+    public boolean isEmpty() {
+        return size == 0;
+    }
+
+    public void clear() {
+        size = 0;
+    }
+
+    /**
+     * Appends a frame, e.g. when replaying a capture.
+     *
+     * @return false if the batch is full
+     */
+    public boolean add(final int ifIdx, final int id, final byte[] payload) {
+        if (payload.length > DATA_STRIDE) {
+            throw new IllegalArgumentException("payload too long");
+        }
+        if (size == canId.length) {
+            return false;
+        }
+        ifIndex[size] = ifIdx;
+        canId[size] = id;
+        dlc[size] = (byte) payload.length;
+        final int off = size * DATA_STRIDE;
+        System.arraycopy(payload, 0, data, off, payload.length);
+        Arrays.fill(data, off + payload.length, off + DATA_STRIDE, (byte) 0);
+        size++;
+        return true;
+    }
+
+    public boolean add(final CanFrame frame) {
+        return add(frame.getCanInterfacae().getInterfaceIndex(),
+                frame.getCanId()._canId, frame.getData());
+    }
+
+    void checkIndex(final int i) {
+        if (i < 0 || i >= size) {
+            throw new IndexOutOfBoundsException("index " + i + ", size "
+                    + size);
+        }
+    }
+
+    public int getInterfaceIndex(final int i) {
+        checkIndex(i);
+        return ifIndex[i];
+    }
+
+    public int getCanId(final int i) {
+        checkIndex(i);
+        return canId[i];
+    }
+
+    public int getDlc(final int i) {
+        checkIndex(i);
+        return dlc[i];
+    }
+
+    public byte getData(final int i, final int byteIdx) {
+        checkIndex(i);
+        if (byteIdx < 0 || byteIdx >= DATA_STRIDE) {
+            throw new IndexOutOfBoundsException("byte " + byteIdx);
+        }
+        return data[i * DATA_STRIDE + byteIdx];
+    }
+
+    public byte[] getData(final int i) {
+        checkIndex(i);
+        final int off = i * DATA_STRIDE;
+        return Arrays.copyOfRange(data, off, off + dlc[i]);
+    }
+
+    public CanFrame getFrame(final int i) {
+        checkIndex(i);
+        return new CanFrame(new CanInterface(ifIndex[i]),
+                new CanId(canId[i]), getData(i));
+    }
+
+    @Override
+    public String toString() {
+        return "CanFrameBatch [size=" + size + ", capacity=" + capacity()
+                + "]";
+    }
+}
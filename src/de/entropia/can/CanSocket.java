@@ -1,12 +1,21 @@
 package de.entropia.can;
 
-import java.io.Closeable;
 import java.io.FileNotFoundException;
 import java.io.IOException;
 import java.io.InputStream;
 import java.io.OutputStream;
+import java.lang.management.ManagementFactory;
+import java.net.JarURLConnection;
+import java.net.URL;
+import java.net.URLConnection;
+import java.nio.ByteBuffer;
+import java.nio.channels.AsynchronousCloseException;
+import java.nio.channels.ClosedChannelException;
 import java.nio.file.Files;
+import java.nio.file.LinkOption;
 import java.nio.file.Path;
+import java.nio.file.Paths;
+import java.nio.file.StandardCopyOption;
 import java.nio.file.StandardOpenOption;
 import java.nio.file.attribute.FileAttribute;
 import java.nio.file.attribute.PosixFilePermission;
@@ -16,8 +25,15 @@ import java.util.Collections;
 import java.util.EnumSet;
 import java.util.Objects;
 import java.util.Set;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.atomic.AtomicIntegerFieldUpdater;
+import java.util.jar.JarEntry;
+import java.util.zip.CRC32;
 
-public final class CanSocket implements Closeable {
+import javax.management.JMException;
+import javax.management.ObjectName;
+
+public final class CanSocket implements CanChannel {
     static {
         final String LIB_JNI_SOCKETCAN = "jni_socketcan";
         try {
@@ -31,35 +47,155 @@ public final class CanSocket implements Closeable {
         }
     }
 
+    /* referencing this forces the static initializer to load the library */
+    static void loadNativeLibrary() { /* EMPTY */ }
+
+    /* sockets not closed yet, reported by SocketStatsEvent */
+    private static final Set<CanSocket> OPEN_SOCKETS =
+            Collections.newSetFromMap(
+                    new ConcurrentHashMap<CanSocket, Boolean>());
+
+    static {
+        try {
+            SocketStatsEvent.register();
+        } catch (final LinkageError e) {
+            /* runtime without flight recorder */
+        }
+    }
+
+    static Set<CanSocket> openSockets() {
+        return OPEN_SOCKETS;
+    }
+
     private static void copyStream(final InputStream in,
             final OutputStream out) throws IOException {
-        final int BYTE_BUFFER_SIZE = 0x1000;
+        final int BYTE_BUFFER_SIZE = 0x10000;
         final byte[] buffer = new byte[BYTE_BUFFER_SIZE];
         for (int len; (len = in.read(buffer)) != -1;) {
             out.write(buffer, 0, len);
         }
     }
 
-    private static void loadLibFromJar(final String libName)
-            throws IOException {
-        Objects.requireNonNull(libName);
-        final String fileName = "/lib/lib" + libName + ".so";
+    /** directory name of the libraries for this CPU inside the JAR */
+    static String libraryArch() {
+        final String arch = System.getProperty("os.arch", "").toLowerCase();
+        if (arch.equals("amd64") || arch.equals("x86_64")) {
+            return "x86_64";
+        }
+        if (arch.equals("x86") || arch.matches("i[3-6]86")) {
+            return "x86";
+        }
+        if (arch.equals("aarch64") || arch.equals("arm64")) {
+            return "aarch64";
+        }
+        if (arch.startsWith("arm")) {
+            return "arm";
+        }
+        return arch;
+    }
+
+    /**
+     * Directory the library is extracted to and reused from by later runs,
+     * null if caching is disabled with {@code -Dde.entropia.can.libCache=}.
+     */
+    private static Path libraryCacheDir() {
+        final String dir = System.getProperty("de.entropia.can.libCache");
+        if (dir != null) {
+            return dir.isEmpty() ? null : Paths.get(dir);
+        }
+        final String xdg = System.getenv("XDG_CACHE_HOME");
+        if (xdg != null && !xdg.isEmpty()) {
+            return Paths.get(xdg, "socketcan-java");
+        }
+        return Paths.get(System.getProperty("user.home"), ".cache",
+                "socketcan-java");
+    }
+
+    /**
+     * Cache key of a library resource, its CRC-32 and size. Inside a JAR
+     * both are read from the entry without inflating it.
+     */
+    private static String libraryKey(final URL url) throws IOException {
+        final URLConnection connection = url.openConnection();
+        if (connection instanceof JarURLConnection) {
+            connection.setUseCaches(false);
+            final JarEntry entry =
+                    ((JarURLConnection) connection).getJarEntry();
+            try {
+                if (entry != null && entry.getCrc() != -1
+                        && entry.getSize() != -1) {
+                    return Long.toHexString(entry.getCrc()) + "-"
+                            + entry.getSize();
+                }
+            } finally {
+                ((JarURLConnection) connection).getJarFile().close();
+            }
+        }
+        final CRC32 crc = new CRC32();
+        long size = 0;
+        try (final InputStream in = url.openStream()) {
+            final byte[] buffer = new byte[0x10000];
+            for (int len; (len = in.read(buffer)) != -1; size += len) {
+                crc.update(buffer, 0, len);
+            }
+        }
+        return Long.toHexString(crc.getValue()) + "-" + size;
+    }
+
+    /**
+     * Returns the cached copy of the library resource, extracting it first
+     * if this version is not cached yet. Concurrent JVMs each write a
+     * private temporary file and rename it into place, so a cached file is
+     * always complete. Only a directory that belongs to the user and is
+     * not writable by others is used.
+     */
+    private static Path cachedLibrary(final Path dir, final URL url,
+            final String libName) throws IOException {
+        final Set<PosixFilePermission> owner =
+                PosixFilePermissions.fromString("rwx------");
+        Files.createDirectories(dir,
+                PosixFilePermissions.asFileAttribute(owner));
+        final String user = System.getProperty("user.name");
+        if (!Files.getOwner(dir).getName().equals(user)
+                || !owner.containsAll(Files.getPosixFilePermissions(dir))) {
+            throw new IOException("unsafe library cache " + dir);
+        }
+        final Path cached = dir.resolve("lib" + libName + "-"
+                + libraryKey(url) + ".so");
+        if (Files.isRegularFile(cached, LinkOption.NOFOLLOW_LINKS)) {
+            return cached;
+        }
+        final Path temp = Files.createTempFile(dir, "lib" + libName, ".tmp",
+                PosixFilePermissions.asFileAttribute(
+                        PosixFilePermissions.fromString("rw-------")));
+        try {
+            try (final InputStream in = url.openStream();
+                    final OutputStream out = Files.newOutputStream(temp,
+                            StandardOpenOption.WRITE,
+                            StandardOpenOption.TRUNCATE_EXISTING)) {
+                copyStream(in, out);
+            }
+            Files.move(temp, cached, StandardCopyOption.ATOMIC_MOVE,
+                    StandardCopyOption.REPLACE_EXISTING);
+        } finally {
+            Files.deleteIfExists(temp);
+        }
+        return cached;
+    }
+
+    /* extracts to a temporary file that is deleted once loaded */
+    private static void loadLibFromTemp(final URL url) throws IOException {
         final FileAttribute<Set<PosixFilePermission>> permissions =
                 PosixFilePermissions.asFileAttribute(
                         PosixFilePermissions.fromString("rw-------"));
         final Path tempSo = Files.createTempFile(CanSocket.class.getName(),
                 ".so", permissions);
         try {
-            try (final InputStream libstream =
-                    CanSocket.class.getResourceAsStream(fileName)) {
-                if (libstream == null) {
-                    throw new FileNotFoundException("jar:*!" + fileName);
-                }
-                try (final OutputStream fout = Files.newOutputStream(tempSo,
-                        StandardOpenOption.WRITE,
-                        StandardOpenOption.TRUNCATE_EXISTING)) {
-                    copyStream(libstream, fout);
-                }
+            try (final InputStream libstream = url.openStream();
+                    final OutputStream fout = Files.newOutputStream(tempSo,
+                            StandardOpenOption.WRITE,
+                            StandardOpenOption.TRUNCATE_EXISTING)) {
+                copyStream(libstream, fout);
             }
             System.load(tempSo.toString());
         } finally {
@@ -67,6 +203,45 @@ public final class CanSocket implements Closeable {
         }
     }
 
+    /**
+     * Loads the library packaged in the JAR, preferring the build for this
+     * CPU under {@code /lib/<arch>/}. The extracted file is kept in the
+     * library cache, so later JVMs load it without extracting it again.
+     */
+    private static void loadLibFromJar(final String libName)
+            throws IOException {
+        Objects.requireNonNull(libName);
+        final String fileName = "lib" + libName + ".so";
+        URL url = CanSocket.class.getResource("/lib/" + libraryArch() + "/"
+                + fileName);
+        if (url == null) {
+            url = CanSocket.class.getResource("/lib/" + fileName);
+        }
+        if (url == null) {
+            throw new FileNotFoundException("jar:*!/lib/" + fileName);
+        }
+        final Path dir = libraryCacheDir();
+        if (dir != null) {
+            final Path cached;
+            try {
+                cached = cachedLibrary(dir, url, libName);
+            } catch (final IOException | SecurityException
+                    | UnsupportedOperationException e) {
+                /* read-only home, no POSIX attributes: extract per run */
+                loadLibFromTemp(url);
+                return;
+            }
+            try {
+                System.load(cached.toString());
+                return;
+            } catch (final UnsatisfiedLinkError e) {
+                /* damaged outside of our control, extract it again */
+                Files.deleteIfExists(cached);
+            }
+        }
+        loadLibFromTemp(url);
+    }
+
     public static final CanInterface CAN_ALL_INTERFACES = new CanInterface(0);
     
     private static native int _getCANID_SFF(final int canid);
@@ -87,7 +262,10 @@ public final class CanSocket implements Closeable {
     
     private static native int _openSocketRAW() throws IOException;
     private static native int _openSocketBCM() throws IOException;
+    private static native int _openSocketJ1939() throws IOException;
     private static native void _close(final int fd) throws IOException;
+    private static native void _wakeReaders(final long stats)
+            throws IOException;
     
     private static native int _fetchInterfaceMtu(final int fd,
 	    final String ifName) throws IOException;
@@ -101,14 +279,101 @@ public final class CanSocket implements Closeable {
     
     private static native void _bindToSocket(final int fd,
             final int ifId) throws IOException;
+    private static native void _bindJ1939(final int fd, final int ifIndex,
+            final long name, final int pgn, final int addr)
+            throws IOException;
+    private static native void _connectJ1939(final int fd,
+            final int ifIndex, final long name, final int pgn,
+            final int addr) throws IOException;
+    private static native void _sendJ1939(final int fd, final long stats,
+            final boolean toAddress, final int ifIndex, final long name,
+            final int pgn, final int addr, final byte[] data, final int off,
+            final int len) throws IOException;
+    private static native J1939Message _recvJ1939(final int fd,
+            final long stats, final int capacity) throws IOException;
+    private static native void _setsockoptJ1939(final int fd, final int op,
+            final int value) throws IOException;
+    private static native int _getsockoptJ1939(final int fd, final int op)
+            throws IOException;
     
-    private static native CanFrame _recvFrame(final int fd) throws IOException;
-    private static native void _sendFrame(final int fd, final int canif,
-            final int canid, final byte[] data) throws IOException;
+    private static native CanFrame _recvFrame(final int fd, final long stats)
+            throws IOException;
+    private static native CanFrame _recvFrameSpin(final int fd,
+            final long stats, final long spinNanos) throws IOException;
+    private static native int _recvFrames(final int fd, final long stats,
+            final int[] ifIndex, final int[] canId, final byte[] dlc,
+            final byte[] data) throws IOException;
+    private static native void _sendFrame(final int fd, final long stats,
+            final int canif, final int canid, final byte[] data)
+            throws IOException;
+    private static native int _trySendFrame(final int fd, final long stats,
+            final int canif, final int canid, final byte[] data)
+            throws IOException;
+    private static native int _trySendFrames(final int fd, final long stats,
+            final int[] ifIndex, final int[] canId, final byte[] dlc,
+            final byte[] data, final int from, final int to)
+            throws IOException;
+    private static native int _tryRecvFrames(final int fd, final long stats,
+            final int[] ifIndex, final int[] canId, final byte[] dlc,
+            final byte[] data) throws IOException;
+    static native long _directAddress(final ByteBuffer buffer);
+    private static native int _recvDirect(final int fd, final long stats,
+            final ByteBuffer buffer, final int capacity, final boolean wait)
+            throws IOException;
+    private static native int _sendDirect(final int fd, final long stats,
+            final ByteBuffer buffer, final int capacity, final int from,
+            final int to, final boolean wait) throws IOException;
+
+    private static native long _createStats() throws IOException;
+    private static native void _freeStats(final long stats);
+    private static native void _setShaper(final long stats,
+            final long shaper);
+    private static native void _readStats(final long stats,
+            final long[] out);
 
     public static final int CAN_MTU = _fetch_CAN_MTU();
     public static final int CAN_FD_MTU = _fetch_CAN_FD_MTU();
+
+    private static native int _fetch_EAGAIN();
+    private static native int _fetch_EINTR();
+    private static native int _fetch_ENOBUFS();
+    private static native int _fetch_ENETDOWN();
+
+    /**
+     * Errno values returned negated by {@link #trySend} and
+     * {@link #tryRecv}: the socket queue is full or empty, the call was
+     * interrupted, or the device TX queue is full.
+     */
+    public static final int EAGAIN = _fetch_EAGAIN();
+    public static final int EINTR = _fetch_EINTR();
+    public static final int ENOBUFS = _fetch_ENOBUFS();
+    /** returned negated by a {@link SimulatedCanBus} node in bus-off */
+    public static final int ENETDOWN = _fetch_ENETDOWN();
     
+    private static native int _fetch_SO_J1939_PROMISC();
+    private static native int _fetch_SO_J1939_SEND_PRIO();
+    private static native int _fetch_SO_BROADCAST();
+
+    private static final int SO_J1939_PROMISC = _fetch_SO_J1939_PROMISC();
+    private static final int SO_J1939_SEND_PRIO =
+            _fetch_SO_J1939_SEND_PRIO();
+    private static final int SO_BROADCAST = _fetch_SO_BROADCAST();
+
+    /** J1939 address of no node, also the global destination */
+    public static final int J1939_NO_ADDR = 0xff;
+    /** source address of a node that has not claimed an address yet */
+    public static final int J1939_IDLE_ADDR = 0xfe;
+    public static final int J1939_MAX_UNICAST_ADDR = 0xfd;
+    public static final long J1939_NO_NAME = 0;
+    /** matches every PGN when binding or connecting */
+    public static final int J1939_NO_PGN = 0x40000;
+    public static final int J1939_PGN_REQUEST = 0x0ea00;
+    public static final int J1939_PGN_ADDRESS_CLAIMED = 0x0ee00;
+    /** largest message of the transport protocol, TP.CM/TP.DT and BAM */
+    public static final int J1939_MAX_TP_SIZE = 1785;
+    /** largest message of the extended transport protocol */
+    public static final int J1939_MAX_ETP_SIZE = 7 * 0xffffff;
+
     private static native int _fetch_CAN_RAW_FILTER();
     private static native int _fetch_CAN_RAW_ERR_FILTER();
     private static native int _fetch_CAN_RAW_LOOPBACK();
@@ -121,13 +386,24 @@ public final class CanSocket implements Closeable {
     private static final int CAN_RAW_RECV_OWN_MSGS = _fetch_CAN_RAW_RECV_OWN_MSGS();
     private static final int CAN_RAW_FD_FRAMES = _fetch_CAN_RAW_FD_FRAMES();
     
+    private static native boolean _setBusyPoll(final int fd,
+            final int usecs) throws IOException;
+    private static native void _setCurrentThreadAffinity(final int[] cpus)
+            throws IOException;
+    private static native void _setKernelTimestamps(final int fd,
+            final boolean on) throws IOException;
+    private static native boolean _getKernelTimestamps(final int fd)
+            throws IOException;
+    private static native void _setFilters(final int fd, final int[] canIds,
+            final int[] masks) throws IOException;
+
     private static native void _setsockopt(final int fd, final int op,
 	    final int stat) throws IOException;
     private static native int _getsockopt(final int fd, final int op)
 	    throws IOException;
     
     public final static class CanId implements Cloneable {
-        private int _canId = 0;
+        int _canId = 0;
         
         public static enum StatusBits {
             ERR, EFFSFF, RTR
@@ -246,7 +522,12 @@ public final class CanSocket implements Closeable {
         
         public CanInterface(final CanSocket socket, final String ifName)
                 throws IOException {
-            this._ifIndex = _discoverInterfaceIndex(socket._fd, ifName);
+            socket.acquire();
+            try {
+                this._ifIndex = _discoverInterfaceIndex(socket._fd, ifName);
+            } finally {
+                socket.release();
+            }
             this._ifName = ifName;
         }
         
@@ -255,7 +536,7 @@ public final class CanSocket implements Closeable {
             this._ifName = ifName;
         }
         
-        private CanInterface(int ifIndex) {
+        CanInterface(int ifIndex) {
             this(ifIndex, null);
         }
         
@@ -276,7 +557,13 @@ public final class CanSocket implements Closeable {
         public String resolveIfName(final CanSocket socket) {
             if (_ifName == null) {
                 try {
-                    _ifName = _discoverInterfaceName(socket._fd, _ifIndex);
+                    socket.acquire();
+                    try {
+                        _ifName = _discoverInterfaceName(socket._fd,
+                                _ifIndex);
+                    } finally {
+                        socket.release();
+                    }
                 } catch (IOException e) { /* EMPTY */ }
             }
             return _ifName;
@@ -366,12 +653,41 @@ public final class CanSocket implements Closeable {
     }
     
     public static enum Mode {
-        RAW, BCM
+        RAW, BCM,
+        /** SAE J1939 messages with kernel transport protocol, see
+         * {@link CanSocket#bind(CanInterface, long, int, int)} */
+        J1939
     }
+
+    /**
+     * How {@link CanSocket#recv()} waits for frames.
+     */
+    public static enum RecvMode {
+        /** sleep in the kernel until a frame arrives */
+        BLOCKING,
+        /** poll the socket without blocking, one JNI call per attempt */
+        SPIN,
+        /** poll the socket without blocking inside native code, returning
+         * to Java only when a frame arrived */
+        SPIN_NATIVE
+    }
+
+    /* longest time spent spinning in native code without a safepoint */
+    static final long SPIN_SLICE_NANOS = 100000000L;
     
-    private final int _fd;
+    final int _fd;
     private final Mode _mode;
     private CanInterface _boundTo;
+    private volatile RecvMode _recvMode = RecvMode.BLOCKING;
+    volatile long _stats;
+    private ObjectName _mbeanName;
+    private TxShaper _shaper;
+    /* native calls in flight in the low bits, CLOSED once close() ran */
+    private volatile int _users;
+
+    private static final AtomicIntegerFieldUpdater<CanSocket> USERS =
+            AtomicIntegerFieldUpdater.newUpdater(CanSocket.class, "_users");
+    private static final int CLOSED = 0x80000000;
     
     public CanSocket(Mode mode) throws IOException {
         switch (mode) {
@@ -381,47 +697,813 @@ public final class CanSocket implements Closeable {
         case RAW:
             _fd = _openSocketRAW();
             break;
+        case J1939:
+            _fd = _openSocketJ1939();
+            break;
         default:
             throw new IllegalStateException("unkown mode " + mode);
         }
         this._mode = mode;
+        try {
+            this._stats = _createStats();
+        } catch (final IOException | RuntimeException | Error e) {
+            _close(_fd);
+            throw e;
+        }
+        OPEN_SOCKETS.add(this);
+    }
+
+    /**
+     * Pins the descriptor and the native state of this socket for a native
+     * call. Until the matching {@link #release()}, {@link #close()} only
+     * marks the socket closed, so the descriptor number cannot be handed to
+     * a socket opened meanwhile; the last release closes it. Lock-free, so
+     * threads sending and receiving on one socket do not serialize.
+     *
+     * @throws ClosedChannelException if the socket is closed
+     */
+    void acquire() throws ClosedChannelException {
+        for (;;) {
+            final int users = _users;
+            if ((users & CLOSED) != 0) {
+                throw new ClosedChannelException();
+            }
+            if (USERS.compareAndSet(this, users, users + 1)) {
+                return;
+            }
+        }
+    }
+
+    void release() {
+        if (USERS.decrementAndGet(this) == CLOSED) {
+            try {
+                destroy();
+            } catch (final IOException e) {
+                /* the descriptor is released either way */
+            }
+        }
     }
     
     public void bind(CanInterface canInterface) throws IOException {
-        _bindToSocket(_fd, canInterface._ifIndex);
-        this._boundTo = canInterface;
+        if (_mode == Mode.J1939) {
+            bind(canInterface, J1939_NO_NAME, J1939_NO_PGN, J1939_NO_ADDR);
+            return;
+        }
+        acquire();
+        try {
+            _bindToSocket(_fd, canInterface._ifIndex);
+            this._boundTo = canInterface;
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Binds a J1939 socket to its local end on {@code canInterface}: the
+     * source address {@code addr}, or the address the kernel resolved for
+     * {@code name} by address claiming. A {@code pgn} other than
+     * {@link #J1939_NO_PGN} restricts reception to that PGN. Address
+     * claiming itself is the task of the application or of a separate
+     * daemon such as j1939acd; the kernel tracks the claims on the bus.
+     */
+    public void bind(final CanInterface canInterface, final long name,
+            final int pgn, final int addr) throws IOException {
+        checkJ1939();
+        acquire();
+        try {
+            _bindJ1939(_fd, canInterface._ifIndex, name, pgn, addr);
+            this._boundTo = canInterface;
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Sets the default destination of a bound J1939 socket and restricts
+     * reception to messages from it. {@link #sendJ1939(byte[])} then
+     * sends to this peer.
+     */
+    public void connect(final CanInterface canInterface, final long name,
+            final int pgn, final int addr) throws IOException {
+        checkJ1939();
+        acquire();
+        try {
+            _connectJ1939(_fd, canInterface._ifIndex, name, pgn, addr);
+        } finally {
+            release();
+        }
+    }
+
+    private void checkJ1939() {
+        if (_mode != Mode.J1939) {
+            throw new IllegalStateException("not a J1939 socket");
+        }
+    }
+
+    /**
+     * Sends one J1939 message, segmented by the kernel into a TP, ETP or
+     * BAM session if it exceeds 8 bytes. Blocks until the kernel accepted
+     * the message; a failing transfer is reported by the kernel error
+     * queue, not here.
+     */
+    public void send(final J1939Message message) throws IOException {
+        checkJ1939();
+        final byte[] data = message.getData();
+        acquire();
+        try {
+            _sendJ1939(_fd, _stats, true, 0, message.getDestinationName(),
+                    message.getPgn(), message.getDestinationAddress(), data, 0,
+                    data.length);
+        } finally {
+            release();
+        }
+    }
+
+    /** Sends {@code data} as one message to the connected peer. */
+    public void sendJ1939(final byte[] data) throws IOException {
+        checkJ1939();
+        acquire();
+        try {
+            _sendJ1939(_fd, _stats, false, 0, J1939_NO_NAME, J1939_NO_PGN,
+                    J1939_NO_ADDR, data, 0, data.length);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Receives one reassembled J1939 message of up to
+     * {@link #J1939_MAX_TP_SIZE} bytes.
+     */
+    public J1939Message recvJ1939() throws IOException {
+        return recvJ1939(J1939_MAX_TP_SIZE);
+    }
+
+    /**
+     * Receives one reassembled J1939 message of up to {@code maxSize}
+     * bytes, e.g. {@link #J1939_MAX_ETP_SIZE} when ETP transfers are
+     * expected.
+     *
+     * @throws IOException also if the message was longer than maxSize
+     */
+    public J1939Message recvJ1939(final int maxSize) throws IOException {
+        checkJ1939();
+        acquire();
+        try {
+            return _recvJ1939(_fd, _stats, maxSize);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Makes a J1939 socket receive all messages on the bus regardless of
+     * its bound address and PGN, as a bus monitor would.
+     */
+    public void setJ1939Promiscuous(final boolean on) throws IOException {
+        checkJ1939();
+        acquire();
+        try {
+            _setsockoptJ1939(_fd, SO_J1939_PROMISC, on ? 1 : 0);
+        } finally {
+            release();
+        }
+    }
+
+    public boolean getJ1939Promiscuous() throws IOException {
+        checkJ1939();
+        acquire();
+        try {
+            return _getsockoptJ1939(_fd, SO_J1939_PROMISC) != 0;
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Priority of the messages this J1939 socket sends, 0 (highest) to 7;
+     * the kernel defaults to 6. Priorities below 2 need CAP_NET_ADMIN.
+     */
+    public void setJ1939SendPriority(final int priority)
+            throws IOException {
+        checkJ1939();
+        if (priority < 0 || priority > 7) {
+            throw new IllegalArgumentException("priority " + priority);
+        }
+        acquire();
+        try {
+            _setsockoptJ1939(_fd, SO_J1939_SEND_PRIO, priority);
+        } finally {
+            release();
+        }
+    }
+
+    public int getJ1939SendPriority() throws IOException {
+        checkJ1939();
+        acquire();
+        try {
+            return _getsockoptJ1939(_fd, SO_J1939_SEND_PRIO);
+        } finally {
+            release();
+        }
+    }
+
+    /** Allows sending to {@link #J1939_NO_ADDR}, required for BAM. */
+    public void setJ1939Broadcast(final boolean on) throws IOException {
+        checkJ1939();
+        acquire();
+        try {
+            _setsockoptJ1939(_fd, SO_BROADCAST, on ? 1 : 0);
+        } finally {
+            release();
+        }
     }
 
     public void send(CanFrame frame) throws IOException {
-        _sendFrame(_fd, frame.canIf._ifIndex, frame.canId._canId, frame.data);
+        acquire();
+        try {
+            _sendFrame(_fd, _stats, frame.canIf._ifIndex, frame.canId._canId,
+                    frame.data);
+        } finally {
+            release();
+        }
     }
     
+    /**
+     * Sends {@code frame} without blocking. Unlike {@link #send}, congestion
+     * is reported as a status instead of an exception, which keeps retry
+     * loops cheap when the TX queue is saturated.
+     *
+     * @return 1 if the frame was sent, or {@code -EAGAIN}, {@code -ENOBUFS}
+     *         or {@code -EINTR} if it should be retried later
+     * @throws IOException on any other error
+     */
+    public int trySend(final CanFrame frame) throws IOException {
+        acquire();
+        try {
+            return _trySendFrame(_fd, _stats, frame.canIf._ifIndex,
+                    frame.canId._canId, frame.data);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Sends the frames of {@code batch} starting at index {@code from}
+     * without blocking, stopping at the first frame the kernel does not
+     * accept.
+     *
+     * @return the number of frames sent, or a negative errno as for
+     *         {@link #trySend(CanFrame)} if not even the first one was
+     * @throws IOException on any other error
+     */
+    public int trySend(final CanFrameBatch batch, final int from)
+            throws IOException {
+        acquire();
+        try {
+            return _trySendFrames(_fd, _stats, batch.ifIndex, batch.canId,
+                    batch.dlc, batch.data, from, batch.size);
+        } finally {
+            release();
+        }
+    }
+
     public CanFrame recv() throws IOException {
-	return _recvFrame(_fd);
+        acquire();
+        try {
+            switch (_recvMode) {
+            case SPIN:
+                for (;;) {
+                    final CanFrame frame = _recvFrameSpin(_fd, _stats, 0);
+                    if (frame != null) {
+                        return frame;
+                    }
+                }
+            case SPIN_NATIVE:
+                for (;;) {
+                    final CanFrame frame = _recvFrameSpin(_fd, _stats,
+                            SPIN_SLICE_NANOS);
+                    if (frame != null) {
+                        return frame;
+                    }
+                }
+            default:
+                return _recvFrame(_fd, _stats);
+            }
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Spins for at most {@code spinNanos} waiting for a frame, regardless
+     * of the configured {@link RecvMode}.
+     *
+     * @return the frame or null if none arrived in time
+     * @throws AsynchronousCloseException if the socket is closed meanwhile
+     */
+    public CanFrame recvSpin(final long spinNanos) throws IOException {
+        acquire();
+        try {
+            return _recvFrameSpin(_fd, _stats, spinNanos);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Receives a burst of frames into {@code batch}, replacing its content.
+     * Blocks until at least one frame is available and then drains
+     * whatever is queued on the socket up to the batch capacity.
+     *
+     * @return the number of frames received
+     */
+    public int recv(final CanFrameBatch batch) throws IOException {
+        batch.size = 0;
+        acquire();
+        try {
+            batch.size = _recvFrames(_fd, _stats, batch.ifIndex, batch.canId,
+                    batch.dlc, batch.data);
+            return batch.size;
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Drains whatever is queued on the socket into {@code batch} without
+     * blocking, replacing its content.
+     *
+     * @return the number of frames received, or {@code -EAGAIN} if none
+     *         were queued or {@code -EINTR}
+     * @throws IOException on any other error
+     */
+    public int tryRecv(final CanFrameBatch batch) throws IOException {
+        batch.size = 0;
+        acquire();
+        try {
+            final int n = _tryRecvFrames(_fd, _stats, batch.ifIndex,
+                    batch.canId, batch.dlc, batch.data);
+            batch.size = Math.max(n, 0);
+            return n;
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Receives a burst of frames straight into the native memory of
+     * {@code batch}, replacing its content; otherwise like
+     * {@link #recv(CanFrameBatch)}.
+     *
+     * @return the number of frames received
+     */
+    public int recv(final DirectFrameBatch batch) throws IOException {
+        batch.size = 0;
+        acquire();
+        try {
+            batch.size = _recvDirect(_fd, _stats, batch.buffer,
+                    batch.capacity(), true);
+            return batch.size;
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Non-blocking {@link #recv(DirectFrameBatch)} with the status codes of
+     * {@link #tryRecv(CanFrameBatch)}.
+     */
+    public int tryRecv(final DirectFrameBatch batch) throws IOException {
+        batch.size = 0;
+        acquire();
+        try {
+            final int n = _recvDirect(_fd, _stats, batch.buffer,
+                    batch.capacity(), false);
+            batch.size = Math.max(n, 0);
+            return n;
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Receives a burst of up to {@code frames.length} frames into free
+     * slots of {@code arena}, blocking for the first one. Each frame placed
+     * in {@code frames} holds one reference the caller must
+     * {@link FrameArena.Frame#release release}.
+     *
+     * @return the number of frames received, 0 if every slot of the arena
+     *         is in use
+     */
+    public int recv(final FrameArena arena, final FrameArena.Frame[] frames)
+            throws IOException {
+        acquire();
+        try {
+            return arena.receive(_fd, _stats, frames, true);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Non-blocking {@link #recv(FrameArena, FrameArena.Frame[])} with the
+     * status codes of {@link #tryRecv(CanFrameBatch)}.
+     */
+    public int tryRecv(final FrameArena arena,
+            final FrameArena.Frame[] frames) throws IOException {
+        acquire();
+        try {
+            return arena.receive(_fd, _stats, frames, false);
+        } finally {
+            release();
+        }
+    }
+
+    /** Sends all frames of {@code batch}, blocking as needed. */
+    public void send(final DirectFrameBatch batch) throws IOException {
+        acquire();
+        try {
+            _sendDirect(_fd, _stats, batch.buffer, batch.capacity(), 0,
+                    batch.size, true);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Non-blocking {@link #send(DirectFrameBatch)} from index {@code from}
+     * with the status codes of {@link #trySend(CanFrameBatch, int)}.
+     */
+    public int trySend(final DirectFrameBatch batch, final int from)
+            throws IOException {
+        if (from < 0 || from > batch.size) {
+            throw new IndexOutOfBoundsException("from " + from + ", size "
+                    + batch.size);
+        }
+        acquire();
+        try {
+            return _sendDirect(_fd, _stats, batch.buffer, batch.capacity(),
+                    from, batch.size, false);
+        } finally {
+            release();
+        }
     }
     
+    /**
+     * Shapes all frames this socket sends from now on with {@code shaper},
+     * replacing any shaper attached before, or stops shaping if it is
+     * null. Frames dropped by the shaper count as sent; frames it refuses
+     * make {@link #trySend} return {@code -EAGAIN} and blocking sends
+     * throw. J1939 messages bypass the shaper.
+     */
+    public void setShaper(final TxShaper shaper) {
+        synchronized (OPEN_SOCKETS) {
+            if (_stats == 0) {
+                throw new IllegalStateException("socket closed");
+            }
+            _setShaper(_stats, shaper == null ? 0 : shaper.handle());
+            _shaper = shaper;
+        }
+    }
+
+    public TxShaper getShaper() {
+        synchronized (OPEN_SOCKETS) {
+            return _shaper;
+        }
+    }
+
+    /**
+     * Copies the I/O counters of this socket into {@code stats}.
+     *
+     * @return false if the socket is closed
+     */
+    public boolean getStats(final SocketStats stats) {
+        synchronized (OPEN_SOCKETS) {
+            if (_stats == 0) {
+                return false;
+            }
+            _readStats(_stats, stats.v);
+            return true;
+        }
+    }
+
+    String getBoundInterfaceName() {
+        final CanInterface boundTo = _boundTo;
+        if (boundTo == null) {
+            return "";
+        }
+        final String name = boundTo.resolveIfName(this);
+        return name == null ? "" : name;
+    }
+
+    /**
+     * Registers a {@link CanSocketMXBean} for this socket with the platform
+     * MBean server. It is unregistered when the socket is closed.
+     */
+    public synchronized ObjectName registerMBean() throws JMException {
+        if (_mbeanName == null) {
+            final ObjectName name = new ObjectName(
+                    "de.entropia.can:type=CanSocket,fd=" + _fd);
+            ManagementFactory.getPlatformMBeanServer().registerMBean(
+                    new SocketMXBean(this), name);
+            _mbeanName = name;
+        }
+        return _mbeanName;
+    }
+
+    private static final class SocketMXBean implements CanSocketMXBean {
+        private final CanSocket socket;
+
+        SocketMXBean(final CanSocket socket) {
+            this.socket = socket;
+        }
+
+        private SocketStats stats() {
+            final SocketStats stats = new SocketStats();
+            socket.getStats(stats);
+            return stats;
+        }
+
+        @Override
+        public String getMode() {
+            return socket._mode.toString();
+        }
+
+        @Override
+        public String getInterfaceName() {
+            return socket.getBoundInterfaceName();
+        }
+
+        @Override
+        public long getFramesIn() {
+            return stats().getFramesIn();
+        }
+
+        @Override
+        public long getBytesIn() {
+            return stats().getBytesIn();
+        }
+
+        @Override
+        public long getFramesOut() {
+            return stats().getFramesOut();
+        }
+
+        @Override
+        public long getBytesOut() {
+            return stats().getBytesOut();
+        }
+
+        @Override
+        public long getRecvCalls() {
+            return stats().getRecvCalls();
+        }
+
+        @Override
+        public long getSendCalls() {
+            return stats().getSendCalls();
+        }
+
+        @Override
+        public double getFramesPerRecvCall() {
+            return stats().getFramesPerRecvCall();
+        }
+
+        @Override
+        public double getFramesPerSendCall() {
+            return stats().getFramesPerSendCall();
+        }
+
+        @Override
+        public long getWouldBlockCount() {
+            return stats().getWouldBlockCount();
+        }
+
+        @Override
+        public long getNoBufferCount() {
+            return stats().getNoBufferCount();
+        }
+
+        @Override
+        public long getMeanRecvNanos() {
+            return stats().getMeanRecvNanos();
+        }
+
+        @Override
+        public long getMeanSendNanos() {
+            return stats().getMeanSendNanos();
+        }
+
+        @Override
+        public long getExceptions() {
+            return stats().getExceptions();
+        }
+    }
+
+    /**
+     * Closes the socket. Receives blocked on it fail with
+     * {@link AsynchronousCloseException}, later calls with
+     * {@link ClosedChannelException}. The descriptor itself is closed as
+     * soon as no call uses it any more; readers and schedulers created on
+     * the socket keep it open until they are closed themselves.
+     */
     @Override
     public void close() throws IOException {
-        _close(_fd);
+        int users;
+        do {
+            users = _users;
+            if ((users & CLOSED) != 0) {
+                return;
+            }
+        } while (!USERS.compareAndSet(this, users, (users + 1) | CLOSED));
+        OPEN_SOCKETS.remove(this);
+        synchronized (this) {
+            if (_mbeanName != null) {
+                try {
+                    ManagementFactory.getPlatformMBeanServer()
+                            .unregisterMBean(_mbeanName);
+                } catch (final JMException e) {
+                    /* already gone */
+                }
+                _mbeanName = null;
+            }
+        }
+        try {
+            _wakeReaders(_stats);
+        } finally {
+            if (USERS.decrementAndGet(this) == CLOSED) {
+                destroy();
+            }
+        }
+    }
+
+    private void destroy() throws IOException {
+        try {
+            _close(_fd);
+        } finally {
+            synchronized (OPEN_SOCKETS) {
+                if (_stats != 0) {
+                    final long stats = _stats;
+                    _stats = 0;
+                    _shaper = null;
+                    _freeStats(stats);
+                }
+            }
+        }
     }
     
     public int getMtu(final String canif) throws IOException {
-	return _fetchInterfaceMtu(_fd, canif);
+        acquire();
+        try {
+            return _fetchInterfaceMtu(_fd, canif);
+        } finally {
+            release();
+        }
     }
 
     public void setLoopbackMode(final boolean on) throws IOException {
-        _setsockopt(_fd, CAN_RAW_LOOPBACK, on ? 1 : 0);
+        acquire();
+        try {
+            _setsockopt(_fd, CAN_RAW_LOOPBACK, on ? 1 : 0);
+        } finally {
+            release();
+        }
     }
     
     public boolean getLoopbackMode() throws IOException {
-	return _getsockopt(_fd, CAN_RAW_LOOPBACK) == 1;
+        acquire();
+        try {
+            return _getsockopt(_fd, CAN_RAW_LOOPBACK) == 1;
+        } finally {
+            release();
+        }
     }
 
     public void setRecvOwnMsgsMode(final boolean on) throws IOException {
-        _setsockopt(_fd, CAN_RAW_RECV_OWN_MSGS, on ? 1 : 0);
+        acquire();
+        try {
+            _setsockopt(_fd, CAN_RAW_RECV_OWN_MSGS, on ? 1 : 0);
+        } finally {
+            release();
+        }
     }
 
     public boolean getRecvOwnMsgsMode() throws IOException {
-	return _getsockopt(_fd, CAN_RAW_RECV_OWN_MSGS) == 1;
+        acquire();
+        try {
+            return _getsockopt(_fd, CAN_RAW_RECV_OWN_MSGS) == 1;
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Selects the error classes delivered as error frames, none by default.
+     * Received error frames can be decoded with {@link CanErrorEvent} or
+     * summarized with {@link ErrorMonitor}.
+     */
+    public void setErrorFilter(final Set<CanErrorEvent.ErrorClass> classes)
+            throws IOException {
+        acquire();
+        try {
+            _setsockopt(_fd, CAN_RAW_ERR_FILTER,
+                    CanErrorEvent.ErrorClass.mask(classes));
+        } finally {
+            release();
+        }
+    }
+
+    public Set<CanErrorEvent.ErrorClass> getErrorFilter() throws IOException {
+        acquire();
+        try {
+            return CanErrorEvent.ErrorClass.fromMask(
+                    _getsockopt(_fd, CAN_RAW_ERR_FILTER));
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Installs kernel receive filters: a frame is received if
+     * {@code (frameId & masks[i]) == (canIds[i] & masks[i])} for any i,
+     * with raw can_ids including the EFF and RTR flags. No filters receive
+     * nothing, a single pair of zeros receives everything. The kernel
+     * checks the pairs one by one, so for large sets use a
+     * {@link FrameFilter} instead.
+     */
+    public void setFilters(final int[] canIds, final int[] masks)
+            throws IOException {
+        acquire();
+        try {
+            _setFilters(_fd, canIds, masks);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Selects how {@link #recv()} waits for frames. The spinning modes trade
+     * a fully busy CPU for the wake-up latency of a blocking read; batch
+     * receive always blocks.
+     */
+    public void setRecvMode(final RecvMode mode) {
+        _recvMode = Objects.requireNonNull(mode);
+    }
+
+    public RecvMode getRecvMode() {
+        return _recvMode;
+    }
+
+    /**
+     * Sets SO_BUSY_POLL, letting the kernel poll the device queue for up to
+     * {@code usecs} microseconds before sleeping. Only drivers with NAPI
+     * support honour it and raising it above net.core.busy_poll needs
+     * CAP_NET_ADMIN.
+     *
+     * @return false if the option is not supported or not permitted
+     */
+    public boolean setBusyPoll(final int usecs) throws IOException {
+        acquire();
+        try {
+            return _setBusyPoll(_fd, usecs);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Enables SO_TIMESTAMPNS, making the kernel record the receive time of
+     * every frame. Native consumers like {@link BusAnalyzer} use it instead
+     * of the time the frames were read.
+     */
+    public void setKernelTimestamps(final boolean on) throws IOException {
+        acquire();
+        try {
+            _setKernelTimestamps(_fd, on);
+        } finally {
+            release();
+        }
+    }
+
+    public boolean getKernelTimestamps() throws IOException {
+        acquire();
+        try {
+            return _getKernelTimestamps(_fd);
+        } finally {
+            release();
+        }
+    }
+
+    /**
+     * Restricts the calling thread to the given CPUs, e.g. to pin a
+     * spinning reader to an isolated core.
+     */
+    public static void setCurrentThreadAffinity(final int... cpus)
+            throws IOException {
+        if (cpus.length == 0) {
+            throw new IllegalArgumentException("no cpu given");
+        }
+        _setCurrentThreadAffinity(cpus);
     }
 }
@@ -0,0 +1,25 @@
+package de.entropia.can;
+
+/**
+ * Management interface of a {@link CanSocket} registered with
+ * {@link CanSocket#registerMBean()}. See {@link SocketStats} for the
+ * meaning of the attributes.
+ */
+public interface CanSocketMXBean {
+    public String getMode();
+    /** name of the bound interface, empty if the socket is unbound */
+    public String getInterfaceName();
+    public long getFramesIn();
+    public long getBytesIn();
+    public long getFramesOut();
+    public long getBytesOut();
+    public long getRecvCalls();
+    public long getSendCalls();
+    public double getFramesPerRecvCall();
+    public double getFramesPerSendCall();
+    public long getWouldBlockCount();
+    public long getNoBufferCount();
+    public long getMeanRecvNanos();
+    public long getMeanSendNanos();
+    public long getExceptions();
+}
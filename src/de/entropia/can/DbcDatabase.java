@@ -0,0 +1,318 @@
+package de.entropia.can;
+
+import java.io.BufferedReader;
+import java.io.IOException;
+import java.io.Reader;
+import java.io.StringReader;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.util.ArrayList;
+import java.util.Collections;
+import java.util.HashMap;
+import java.util.List;
+import java.util.Map;
+import java.util.regex.Matcher;
+import java.util.regex.Pattern;
+
+/**
+ * Message and signal definitions read from a DBC file.
+ *
+ * Only the parts needed for decoding are understood ({@code BO_} and
+ * {@code SG_} lines, including simple multiplexing); everything else in the
+ * file is skipped. Message ids use the DBC convention of marking extended
+ * frames with the most significant bit, which is the same bit as
+ * {@code CAN_EFF_FLAG}, so they compare directly against received ids.
+ */
+public final class DbcDatabase {
+    private static final Pattern MESSAGE = Pattern.compile(
+            "^BO_\\s+(\\d+)\\s+(\\w+)\\s*:\\s*(\\d+)\\s+(\\w+)");
+    private static final Pattern SIGNAL = Pattern.compile(
+            "^SG_\\s+(\\w+)\\s*(M|m\\d+)?\\s*:\\s*(\\d+)\\|(\\d+)@([01])([+-])"
+            + "\\s*\\(([^,]+),([^)]+)\\)\\s*\\[([^|]*)\\|([^\\]]*)\\]"
+            + "\\s*\"([^\"]*)\"\\s*(.*)$");
+
+    private static final int CAN_EFF_FLAG = 0x80000000;
+    private static final int CAN_SFF_MASK = 0x000007ff;
+    private static final int CAN_EFF_MASK = 0x1fffffff;
+
+    public final static class Signal {
+        public static final int NOT_MULTIPLEXED = -1;
+
+        private final String name;
+        private final int startBit;
+        private final int length;
+        private final boolean littleEndian;
+        private final boolean signed;
+        private final double factor;
+        private final double offset;
+        private final double minimum;
+        private final double maximum;
+        private final String unit;
+        private final boolean multiplexor;
+        private final int multiplexValue;
+
+        public Signal(final String name, final int startBit, final int length,
+                final boolean littleEndian, final boolean signed,
+                final double factor, final double offset,
+                final double minimum, final double maximum,
+                final String unit, final boolean multiplexor,
+                final int multiplexValue) {
+            if (length < 1 || length > 64) {
+                throw new IllegalArgumentException("signal " + name
+                        + ": illegal length " + length);
+            }
+            if (startBit < 0 || startBit > 63) {
+                throw new IllegalArgumentException("signal " + name
+                        + ": illegal start bit " + startBit);
+            }
+            this.name = name;
+            this.startBit = startBit;
+            this.length = length;
+            this.littleEndian = littleEndian;
+            this.signed = signed;
+            this.factor = factor;
+            this.offset = offset;
+            this.minimum = minimum;
+            this.maximum = maximum;
+            this.unit = unit;
+            this.multiplexor = multiplexor;
+            this.multiplexValue = multiplexValue;
+        }
+
+        public String getName() {
+            return name;
+        }
+
+        public int getStartBit() {
+            return startBit;
+        }
+
+        public int getLength() {
+            return length;
+        }
+
+        /** true for Intel (@1), false for Motorola (@0) byte order */
+        public boolean isLittleEndian() {
+            return littleEndian;
+        }
+
+        public boolean isSigned() {
+            return signed;
+        }
+
+        public double getFactor() {
+            return factor;
+        }
+
+        public double getOffset() {
+            return offset;
+        }
+
+        public double getMinimum() {
+            return minimum;
+        }
+
+        public double getMaximum() {
+            return maximum;
+        }
+
+        public String getUnit() {
+            return unit;
+        }
+
+        public boolean isMultiplexor() {
+            return multiplexor;
+        }
+
+        /** @return the selecting multiplexor value or NOT_MULTIPLEXED */
+        public int getMultiplexValue() {
+            return multiplexValue;
+        }
+
+        @Override
+        public String toString() {
+            return "Signal [name=" + name + ", startBit=" + startBit
+                    + ", length=" + length + ", littleEndian=" + littleEndian
+                    + ", signed=" + signed + ", factor=" + factor
+                    + ", offset=" + offset + "]";
+        }
+    }
+
+    public final static class Message {
+        private final int canId;
+        private final String name;
+        private final int dlc;
+        private final String transmitter;
+        private final List<Signal> signals;
+
+        public Message(final int canId, final String name, final int dlc,
+                final String transmitter, final List<Signal> signals) {
+            this.canId = canId;
+            this.name = name;
+            this.dlc = dlc;
+            this.transmitter = transmitter;
+            this.signals = Collections.unmodifiableList(
+                    new ArrayList<Signal>(signals));
+        }
+
+        /** the id including CAN_EFF_FLAG for extended frames */
+        public int getCanId() {
+            return canId;
+        }
+
+        public String getName() {
+            return name;
+        }
+
+        public int getDlc() {
+            return dlc;
+        }
+
+        public String getTransmitter() {
+            return transmitter;
+        }
+
+        public List<Signal> getSignals() {
+            return signals;
+        }
+
+        public int indexOf(final String signalName) {
+            for (int i = 0; i < signals.size(); i++) {
+                if (signals.get(i).name.equals(signalName)) {
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        @Override
+        public String toString() {
+            return "Message [canId=0x" + Integer.toHexString(canId)
+                    + ", name=" + name + ", dlc=" + dlc + ", signals="
+                    + signals.size() + "]";
+        }
+    }
+
+    private final List<Message> messages;
+    private final Map<Integer, Message> byId;
+
+    public DbcDatabase(final List<Message> messages) {
+        this.messages = Collections.unmodifiableList(
+                new ArrayList<Message>(messages));
+        this.byId = new HashMap<>();
+        for (final Message m : messages) {
+            if (byId.put(m.canId, m) != null) {
+                throw new IllegalArgumentException("duplicate message id 0x"
+                        + Integer.toHexString(m.canId));
+            }
+        }
+    }
+
+    public List<Message> getMessages() {
+        return messages;
+    }
+
+    /**
+     * Looks up the message for a received can_id; RTR and ERR flags are
+     * ignored.
+     */
+    public Message getMessage(final int canId) {
+        return byId.get(normalizeId(canId));
+    }
+
+    public Message getMessage(final String name) {
+        for (final Message m : messages) {
+            if (m.name.equals(name)) {
+                return m;
+            }
+        }
+        return null;
+    }
+
+    static int normalizeId(final int canId) {
+        return (canId & CAN_EFF_FLAG) != 0
+                ? canId & (CAN_EFF_FLAG | CAN_EFF_MASK)
+                : canId & CAN_SFF_MASK;
+    }
+
+    public static DbcDatabase load(final Path path) throws IOException {
+        try (final Reader reader = Files.newBufferedReader(path,
+                StandardCharsets.ISO_8859_1)) {
+            return parse(reader);
+        }
+    }
+
+    public static DbcDatabase parse(final String dbc) throws IOException {
+        return parse(new StringReader(dbc));
+    }
+
+    public static DbcDatabase parse(final Reader in) throws IOException {
+        final BufferedReader reader = new BufferedReader(in);
+        final List<Message> messages = new ArrayList<>();
+        int canId = 0;
+        String name = null;
+        int dlc = 0;
+        String transmitter = null;
+        List<Signal> signals = null;
+        int lineNo = 0;
+        for (String line; (line = reader.readLine()) != null;) {
+            lineNo++;
+            line = line.trim();
+            if (line.startsWith("BO_ ")) {
+                if (name != null) {
+                    messages.add(new Message(canId, name, dlc, transmitter,
+                            signals));
+                }
+                final Matcher m = MESSAGE.matcher(line);
+                if (!m.find()) {
+                    throw new IOException("line " + lineNo
+                            + ": malformed message");
+                }
+                canId = normalizeId((int) Long.parseLong(m.group(1)));
+                name = m.group(2);
+                dlc = Integer.parseInt(m.group(3));
+                transmitter = m.group(4);
+                signals = new ArrayList<>();
+            } else if (line.startsWith("SG_ ")) {
+                if (name == null) {
+                    throw new IOException("line " + lineNo
+                            + ": signal outside of message");
+                }
+                final Matcher m = SIGNAL.matcher(line);
+                if (!m.find()) {
+                    throw new IOException("line " + lineNo
+                            + ": malformed signal");
+                }
+                final String mux = m.group(2);
+                try {
+                    signals.add(new Signal(m.group(1),
+                            Integer.parseInt(m.group(3)),
+                            Integer.parseInt(m.group(4)),
+                            "1".equals(m.group(5)),
+                            "-".equals(m.group(6)),
+                            Double.parseDouble(m.group(7).trim()),
+                            Double.parseDouble(m.group(8).trim()),
+                            Double.parseDouble(m.group(9).trim()),
+                            Double.parseDouble(m.group(10).trim()),
+                            m.group(11),
+                            "M".equals(mux),
+                            mux != null && mux.startsWith("m")
+                                    ? Integer.parseInt(mux.substring(1))
+                                    : Signal.NOT_MULTIPLEXED));
+                } catch (final IllegalArgumentException e) {
+                    throw new IOException("line " + lineNo + ": "
+                            + e.getMessage(), e);
+                }
+            } else if (!line.isEmpty() && name != null) {
+                messages.add(new Message(canId, name, dlc, transmitter,
+                        signals));
+                name = null;
+            }
+        }
+        if (name != null) {
+            messages.add(new Message(canId, name, dlc, transmitter, signals));
+        }
+        return new DbcDatabase(messages);
+    }
+}
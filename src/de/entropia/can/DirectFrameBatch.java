@@ -0,0 +1,159 @@
+package de.entropia.can;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+import de.entropia.can.CanSocket.CanFrame;
+import de.entropia.can.CanSocket.CanId;
+import de.entropia.can.CanSocket.CanInterface;
+
+/**
+ * Batch of classic CAN frames in native memory, laid out as the kernel's
+ * {@code struct can_frame}.
+ *
+ * {@link CanSocket#recv(DirectFrameBatch)} and
+ * {@link CanSocket#send(DirectFrameBatch)} pass the memory to recvmmsg and
+ * sendmmsg as is, so a burst crosses JNI as one address and the kernel
+ * copies straight into or out of it, without the per-column array copies
+ * of {@link CanFrameBatch}. The buffer holds {@link #FRAME_SIZE} bytes per
+ * frame in native byte order, followed by the interface index of every
+ * frame.
+ */
+public final class DirectFrameBatch {
+    /** sizeof(struct can_frame) */
+    public static final int FRAME_SIZE = 16;
+    public static final int DATA_LENGTH = 8;
+
+    private static final int ID_OFFSET = 0;
+    private static final int DLC_OFFSET = 4;
+    private static final int DATA_OFFSET = 8;
+
+    /* handed to the natives as is, so it stays reachable while they run */
+    final ByteBuffer buffer;
+    private final int capacity;
+    private final int ifIndexOffset;
+    int size;
+
+    public DirectFrameBatch(final int capacity) {
+        if (capacity <= 0 || capacity > Integer.MAX_VALUE / (FRAME_SIZE + 4)) {
+            throw new IllegalArgumentException("illegal capacity");
+        }
+        this.capacity = capacity;
+        this.ifIndexOffset = capacity * FRAME_SIZE;
+        this.buffer = ByteBuffer.allocateDirect(capacity * (FRAME_SIZE + 4))
+                .order(ByteOrder.nativeOrder());
+    }
+
+    public int capacity() {
+        return capacity;
+    }
+
+    public int size() {
+        return size;
+    }
+
+    public boolean isEmpty() {
+        return size == 0;
+    }
+
+    public void clear() {
+        size = 0;
+    }
+
+    /**
+     * Appends a frame.
+     *
+     * @return false if the batch is full
+     */
+    public boolean add(final int ifIdx, final int id, final byte[] payload) {
+        if (payload.length > DATA_LENGTH) {
+            throw new IllegalArgumentException("payload too long");
+        }
+        if (size == capacity) {
+            return false;
+        }
+        final int off = size * FRAME_SIZE;
+        buffer.putInt(off + ID_OFFSET, id);
+        /* clears the padding and reserved bytes after the dlc as well */
+        buffer.putInt(off + DLC_OFFSET, 0);
+        buffer.put(off + DLC_OFFSET, (byte) payload.length);
+        buffer.putLong(off + DATA_OFFSET, 0);
+        for (int j = 0; j < payload.length; j++) {
+            buffer.put(off + DATA_OFFSET + j, payload[j]);
+        }
+        buffer.putInt(ifIndexOffset + size * 4, ifIdx);
+        size++;
+        return true;
+    }
+
+    public boolean add(final CanFrame frame) {
+        return add(frame.getCanInterfacae().getInterfaceIndex(),
+                frame.getCanId()._canId, frame.getData());
+    }
+
+    private int frameOffset(final int i) {
+        if (i < 0 || i >= size) {
+            throw new IndexOutOfBoundsException("index " + i + ", size "
+                    + size);
+        }
+        return i * FRAME_SIZE;
+    }
+
+    public int getInterfaceIndex(final int i) {
+        frameOffset(i);
+        return buffer.getInt(ifIndexOffset + i * 4);
+    }
+
+    public int getCanId(final int i) {
+        return buffer.getInt(frameOffset(i) + ID_OFFSET);
+    }
+
+    public int getDlc(final int i) {
+        return Math.min(buffer.get(frameOffset(i) + DLC_OFFSET) & 0xff,
+                DATA_LENGTH);
+    }
+
+    public byte getData(final int i, final int byteIdx) {
+        final int off = frameOffset(i);
+        if (byteIdx < 0 || byteIdx >= DATA_LENGTH) {
+            throw new IndexOutOfBoundsException("byte " + byteIdx);
+        }
+        return buffer.get(off + DATA_OFFSET + byteIdx);
+    }
+
+    /** the 8 payload bytes of frame {@code i} as one native order long */
+    public long getDataLong(final int i) {
+        return buffer.getLong(frameOffset(i) + DATA_OFFSET);
+    }
+
+    public byte[] getData(final int i) {
+        final int off = frameOffset(i) + DATA_OFFSET;
+        final byte[] data = new byte[getDlc(i)];
+        for (int j = 0; j < data.length; j++) {
+            data[j] = buffer.get(off + j);
+        }
+        return data;
+    }
+
+    public CanFrame getFrame(final int i) {
+        return new CanFrame(new CanInterface(getInterfaceIndex(i)),
+                new CanId(getCanId(i)), getData(i));
+    }
+
+    /**
+     * Read-only view of the frames, {@link #FRAME_SIZE} bytes each in
+     * native byte order, limited to the current size.
+     */
+    public ByteBuffer frames() {
+        final ByteBuffer view = buffer.asReadOnlyBuffer()
+                .order(ByteOrder.nativeOrder());
+        view.limit(size * FRAME_SIZE);
+        return view;
+    }
+
+    @Override
+    public String toString() {
+        return "DirectFrameBatch [size=" + size + ", capacity=" + capacity
+                + "]";
+    }
+}
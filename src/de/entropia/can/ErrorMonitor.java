@@ -0,0 +1,276 @@
+package de.entropia.can;
+
+import java.io.Closeable;
+import java.io.IOException;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicIntegerFieldUpdater;
+
+import de.entropia.can.CanErrorEvent.ControllerState;
+import de.entropia.can.CanErrorEvent.ErrorClass;
+import de.entropia.can.CanErrorEvent.ProtocolLocation;
+import de.entropia.can.CanErrorEvent.ProtocolViolation;
+
+/**
+ * Native aggregation of CAN error frames into counters.
+ *
+ * Frames are either read straight from a socket with {@link #receive} or
+ * fed from an already received {@link CanFrameBatch}; in both cases no Java
+ * object is created per frame. Error frames closer together than the burst
+ * gap are counted as one burst. The monitor may be fed and read from
+ * different threads, and {@link #close()} may be called while a receive is
+ * blocked.
+ */
+public final class ErrorMonitor implements Closeable {
+    static {
+        CanSocket.loadNativeLibrary();
+    }
+
+    public static final long DEFAULT_BURST_GAP_NANOS =
+            TimeUnit.MILLISECONDS.toNanos(100);
+
+    private static native long _create(final long burstGapNanos);
+    private static native void _free(final long monitor);
+    private static native void _wake(final long monitor);
+    private static native int _receive(final long monitor, final int fd,
+            final long stats) throws IOException;
+    private static native void _aggregate(final long monitor,
+            final int[] canIds, final byte[] dlcs, final byte[] data,
+            final int count);
+    private static native void _snapshot(final long monitor,
+            final long[] summary, final boolean reset);
+
+    private static final int SUM_ERROR_FRAMES = 0;
+    private static final int SUM_OTHER_FRAMES = 1;
+    private static final int SUM_STATE = 2;
+    private static final int SUM_STATE_CHANGES = 3;
+    private static final int SUM_TX_ERRORS = 4;
+    private static final int SUM_RX_ERRORS = 5;
+    private static final int SUM_MAX_TX_ERRORS = 6;
+    private static final int SUM_MAX_RX_ERRORS = 7;
+    private static final int SUM_BURSTS = 8;
+    private static final int SUM_BURST_LENGTH = 9;
+    private static final int SUM_MAX_BURST_LENGTH = 10;
+    private static final int SUM_FIRST_NANOS = 11;
+    private static final int SUM_LAST_NANOS = 12;
+    private static final int SUM_CLASS_BASE = 13;
+    private static final int SUM_VIOLATION_BASE =
+            SUM_CLASS_BASE + ErrorClass.values().length;
+    private static final int SUM_LOCATION_BASE =
+            SUM_VIOLATION_BASE + ProtocolViolation.values().length;
+    private static final int SUM_FIELDS =
+            SUM_LOCATION_BASE + ProtocolLocation.values().length;
+
+    /**
+     * Reusable snapshot of the monitor counters. Timestamps are
+     * {@link System#nanoTime()} compatible monotonic clock values.
+     */
+    public final static class Summary {
+        private final long[] v = new long[SUM_FIELDS];
+
+        public long getErrorFrames() {
+            return v[SUM_ERROR_FRAMES];
+        }
+
+        /** frames seen that were no error frames */
+        public long getOtherFrames() {
+            return v[SUM_OTHER_FRAMES];
+        }
+
+        /** last controller state reported by an error frame */
+        public ControllerState getControllerState() {
+            return ControllerState.values()[(int) v[SUM_STATE]];
+        }
+
+        public long getStateChanges() {
+            return v[SUM_STATE_CHANGES];
+        }
+
+        /** transmit error counter of the latest error frame */
+        public int getTxErrorCount() {
+            return (int) v[SUM_TX_ERRORS];
+        }
+
+        /** receive error counter of the latest error frame */
+        public int getRxErrorCount() {
+            return (int) v[SUM_RX_ERRORS];
+        }
+
+        public int getMaxTxErrorCount() {
+            return (int) v[SUM_MAX_TX_ERRORS];
+        }
+
+        public int getMaxRxErrorCount() {
+            return (int) v[SUM_MAX_RX_ERRORS];
+        }
+
+        public long getBursts() {
+            return v[SUM_BURSTS];
+        }
+
+        /** error frames in the latest burst */
+        public long getBurstLength() {
+            return v[SUM_BURST_LENGTH];
+        }
+
+        public long getMaxBurstLength() {
+            return v[SUM_MAX_BURST_LENGTH];
+        }
+
+        public long getFirstErrorNanos() {
+            return v[SUM_FIRST_NANOS];
+        }
+
+        public long getLastErrorNanos() {
+            return v[SUM_LAST_NANOS];
+        }
+
+        public long getCount(final ErrorClass errorClass) {
+            return v[SUM_CLASS_BASE + errorClass.ordinal()];
+        }
+
+        public long getCount(final ProtocolViolation violation) {
+            return v[SUM_VIOLATION_BASE + violation.ordinal()];
+        }
+
+        public long getCount(final ProtocolLocation location) {
+            return v[SUM_LOCATION_BASE + location.ordinal()];
+        }
+
+        @Override
+        public String toString() {
+            return "Summary [errorFrames=" + getErrorFrames()
+                    + ", otherFrames=" + getOtherFrames() + ", state="
+                    + getControllerState() + ", txErrors="
+                    + getTxErrorCount() + ", rxErrors=" + getRxErrorCount()
+                    + ", bursts=" + getBursts() + ", maxBurstLength="
+                    + getMaxBurstLength() + "]";
+        }
+    }
+
+    private volatile long _monitor;
+    /* native calls in flight in the low bits, CLOSED once close() ran */
+    private volatile int _users;
+
+    private static final AtomicIntegerFieldUpdater<ErrorMonitor> USERS =
+            AtomicIntegerFieldUpdater.newUpdater(ErrorMonitor.class,
+                    "_users");
+    private static final int CLOSED = 0x80000000;
+
+    public ErrorMonitor() {
+        this(DEFAULT_BURST_GAP_NANOS);
+    }
+
+    /**
+     * @param burstGapNanos minimum quiet time that separates two bursts
+     */
+    public ErrorMonitor(final long burstGapNanos) {
+        if (burstGapNanos < 0) {
+            throw new IllegalArgumentException("negative burst gap");
+        }
+        this._monitor = _create(burstGapNanos);
+    }
+
+    /**
+     * Pins the monitor for a native call, like {@link CanSocket#acquire()};
+     * the last {@link #release()} after {@link #close()} frees it.
+     *
+     * @return the monitor handle
+     */
+    private long acquire() {
+        for (;;) {
+            final int users = _users;
+            if ((users & CLOSED) != 0) {
+                throw new IllegalStateException("monitor closed");
+            }
+            if (USERS.compareAndSet(this, users, users + 1)) {
+                return _monitor;
+            }
+        }
+    }
+
+    private void release() {
+        if (USERS.decrementAndGet(this) == CLOSED) {
+            destroy();
+        }
+    }
+
+    /**
+     * Blocks until frames are available on {@code socket} and aggregates
+     * one burst of them.
+     *
+     * @return number of frames consumed
+     * @throws java.nio.channels.AsynchronousCloseException if the socket
+     *         or the monitor is closed meanwhile
+     */
+    public int receive(final CanSocket socket) throws IOException {
+        final long monitor = acquire();
+        try {
+            socket.acquire();
+            try {
+                return _receive(monitor, socket._fd, socket._stats);
+            } finally {
+                socket.release();
+            }
+        } finally {
+            release();
+        }
+    }
+
+    public void aggregate(final CanFrameBatch batch) {
+        final long monitor = acquire();
+        try {
+            _aggregate(monitor, batch.canId, batch.dlc, batch.data,
+                    batch.size);
+        } finally {
+            release();
+        }
+    }
+
+    public Summary snapshot(final Summary summary) {
+        return snapshot(summary, false);
+    }
+
+    /**
+     * Takes a snapshot and restarts counting. The controller state and the
+     * current error counters are levels and survive the reset.
+     */
+    public Summary snapshotAndReset(final Summary summary) {
+        return snapshot(summary, true);
+    }
+
+    private Summary snapshot(final Summary summary, final boolean reset) {
+        final long monitor = acquire();
+        try {
+            _snapshot(monitor, summary.v, reset);
+        } finally {
+            release();
+        }
+        return summary;
+    }
+
+    /**
+     * Wakes a blocked {@link #receive} and frees the monitor once no call
+     * runs any more.
+     */
+    @Override
+    public void close() {
+        int users;
+        do {
+            users = _users;
+            if ((users & CLOSED) != 0) {
+                return;
+            }
+        } while (!USERS.compareAndSet(this, users, (users + 1) | CLOSED));
+        try {
+            _wake(_monitor);
+        } finally {
+            release();
+        }
+    }
+
+    private void destroy() {
+        final long monitor = _monitor;
+        _monitor = 0;
+        _free(monitor);
+    }
+}
@@ -0,0 +1,357 @@
+package de.entropia.can;
+
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.concurrent.atomic.AtomicIntegerArray;
+import java.util.concurrent.atomic.AtomicLong;
+
+import de.entropia.can.CanSocket.CanFrame;
+import de.entropia.can.CanSocket.CanId;
+import de.entropia.can.CanSocket.CanInterface;
+
+/**
+ * Pool of received frames in native memory, for pipelines that hand frames
+ * from the receiving thread to others without allocating a
+ * {@link CanFrame} per frame.
+ *
+ * The arena grows by slabs of fixed size slots, {@link #SLOT_SIZE} bytes
+ * each, up to a maximum. {@link CanSocket#recv(FrameArena, Frame[])}
+ * takes free slots and lets recvmmsg copy the frames straight into them;
+ * the caller gets one {@link Frame} view per frame, holding a single
+ * reference. Views are created once per slot and recycled: whoever holds
+ * the last reference calls {@link Frame#release}, from any thread, and the
+ * slot goes back on a lock-free free list. A view must not be used after
+ * its last release, the slot may already hold another frame.
+ *
+ * Slabs are never freed before the arena itself is garbage collected.
+ */
+public final class FrameArena {
+    static {
+        CanSocket.loadNativeLibrary();
+    }
+
+    /** bytes per slot: struct can_frame, timestamp and interface index */
+    public static final int SLOT_SIZE = 32;
+
+    private static final int ID_OFFSET = 0;
+    private static final int DLC_OFFSET = 4;
+    private static final int DATA_OFFSET = 8;
+    private static final int TIMESTAMP_OFFSET = 16;
+    private static final int IFINDEX_OFFSET = 24;
+    private static final int DATA_LENGTH = 8;
+
+    private static final long LINK_MASK = 0xffffffffL;
+
+    private static native int _recv(final int fd, final long stats,
+            final long[] addresses, final int count, final boolean wait)
+            throws IOException;
+
+    /** slot numbers and addresses of one receive, reused per thread */
+    private static final class Scratch {
+        int[] slots = new int[0];
+        long[] addresses = new long[0];
+    }
+
+    private static final ThreadLocal<Scratch> SCRATCH =
+            new ThreadLocal<Scratch>() {
+                @Override
+                protected Scratch initialValue() {
+                    return new Scratch();
+                }
+            };
+
+    private final int slabSlots;
+    private final int maxSlabs;
+    private final ByteBuffer[] slabs;
+    private final long[] slabAddresses;
+    private final Frame[] views;
+    private final AtomicIntegerArray refs;
+    /* free list link of every free slot, slot + 1 of the next, 0 at the end */
+    private final int[] next;
+    /* top of the free list, the slot + 1 in the low and a tag in the high half */
+    private final AtomicLong head = new AtomicLong();
+    private final AtomicLong exhausted = new AtomicLong();
+    private volatile int slabCount;
+
+    /**
+     * @param slabSlots slots allocated at a time
+     * @param maxSlabs limit of slabs, so the arena holds at most
+     *            {@code slabSlots * maxSlabs} frames
+     */
+    public FrameArena(final int slabSlots, final int maxSlabs) {
+        if (slabSlots <= 0 || maxSlabs <= 0
+                || slabSlots > Integer.MAX_VALUE / SLOT_SIZE
+                || slabSlots > (1 << 30) / maxSlabs) {
+            throw new IllegalArgumentException("illegal arena size");
+        }
+        this.slabSlots = slabSlots;
+        this.maxSlabs = maxSlabs;
+        this.slabs = new ByteBuffer[maxSlabs];
+        this.slabAddresses = new long[maxSlabs];
+        this.views = new Frame[slabSlots * maxSlabs];
+        this.refs = new AtomicIntegerArray(views.length);
+        this.next = new int[views.length];
+        grow();
+    }
+
+    /** maximum number of frames the arena holds */
+    public int capacity() {
+        return views.length;
+    }
+
+    /**
+     * Allocates the next slab and puts its slots on the free list.
+     *
+     * @return false if the arena is at its maximum size
+     */
+    private synchronized boolean grow() {
+        final int slab = slabCount;
+        if (slab == maxSlabs) {
+            return false;
+        }
+        final ByteBuffer buffer = ByteBuffer
+                .allocateDirect(slabSlots * SLOT_SIZE)
+                .order(ByteOrder.nativeOrder());
+        slabs[slab] = buffer;
+        slabAddresses[slab] = CanSocket._directAddress(buffer);
+        final int first = slab * slabSlots;
+        for (int i = 0; i < slabSlots; i++) {
+            views[first + i] = new Frame(first + i, buffer, i * SLOT_SIZE);
+        }
+        slabCount = slab + 1;
+        for (int i = slabSlots - 1; i >= 0; i--) {
+            push(first + i);
+        }
+        return true;
+    }
+
+    private void push(final int slot) {
+        long top;
+        do {
+            top = head.get();
+            next[slot] = (int) top;
+        } while (!head.compareAndSet(top, ((top >>> 32) + 1) << 32
+                | (slot + 1)));
+    }
+
+    /** @return a free slot, -1 if there is none */
+    private int pop() {
+        long top;
+        int link;
+        do {
+            top = head.get();
+            link = (int) top;
+            if (link == 0) {
+                return -1;
+            }
+        } while (!head.compareAndSet(top, ((top >>> 32) + 1) << 32
+                | (next[link - 1] & LINK_MASK)));
+        return link - 1;
+    }
+
+    private long address(final int slot) {
+        return slabAddresses[slot / slabSlots]
+                + (long) (slot % slabSlots) * SLOT_SIZE;
+    }
+
+    /**
+     * Receives up to {@code frames.length} frames into free slots; called
+     * by {@link CanSocket} with the socket held.
+     *
+     * @return the number of frames, 0 if every slot is in use, or a
+     *         negative errno as by {@link CanSocket#tryRecv}
+     */
+    int receive(final int fd, final long stats, final Frame[] frames,
+            final boolean wait) throws IOException {
+        final Scratch scratch = SCRATCH.get();
+        if (scratch.slots.length < frames.length) {
+            scratch.slots = new int[frames.length];
+            scratch.addresses = new long[frames.length];
+        }
+        final int[] slots = scratch.slots;
+        final long[] addresses = scratch.addresses;
+        int taken = 0;
+        while (taken < frames.length) {
+            final int slot = pop();
+            if (slot < 0) {
+                if (grow()) {
+                    continue;
+                }
+                break;
+            }
+            slots[taken] = slot;
+            addresses[taken] = address(slot);
+            taken++;
+        }
+        if (taken == 0 && frames.length > 0) {
+            exhausted.incrementAndGet();
+            return 0;
+        }
+        int n = 0;
+        try {
+            n = _recv(fd, stats, addresses, taken, wait);
+            for (int i = 0; i < n; i++) {
+                refs.set(slots[i], 1);
+                frames[i] = views[slots[i]];
+            }
+            return n;
+        } finally {
+            for (int i = Math.max(n, 0); i < taken; i++) {
+                push(slots[i]);
+            }
+        }
+    }
+
+    /**
+     * View of one received frame in its slot. Holders share it by
+     * reference counting: every {@link #retain} needs a matching
+     * {@link #release}.
+     */
+    public final class Frame {
+        private final int slot;
+        private final ByteBuffer slab;
+        private final int offset;
+
+        private Frame(final int slot, final ByteBuffer slab, final int offset) {
+            this.slot = slot;
+            this.slab = slab;
+            this.offset = offset;
+        }
+
+        private int at(final int field) {
+            if (refs.get(slot) <= 0) {
+                throw new IllegalStateException("frame released");
+            }
+            return offset + field;
+        }
+
+        /** Adds a reference, for handing the frame to another holder. */
+        public Frame retain() {
+            int n;
+            do {
+                n = refs.get(slot);
+                if (n <= 0) {
+                    throw new IllegalStateException("frame released");
+                }
+            } while (!refs.compareAndSet(slot, n, n + 1));
+            return this;
+        }
+
+        /**
+         * Drops a reference; the last one returns the slot to the arena.
+         */
+        public void release() {
+            int n;
+            do {
+                n = refs.get(slot);
+                if (n <= 0) {
+                    throw new IllegalStateException("frame released");
+                }
+            } while (!refs.compareAndSet(slot, n, n - 1));
+            if (n == 1) {
+                push(slot);
+            }
+        }
+
+        public int getInterfaceIndex() {
+            return slab.getInt(at(IFINDEX_OFFSET));
+        }
+
+        /** raw can_id including the EFF, RTR and ERR flags */
+        public int getCanId() {
+            return slab.getInt(at(ID_OFFSET));
+        }
+
+        public int getDlc() {
+            return Math.min(slab.get(at(DLC_OFFSET)) & 0xff, DATA_LENGTH);
+        }
+
+        public byte getData(final int byteIdx) {
+            if (byteIdx < 0 || byteIdx >= DATA_LENGTH) {
+                throw new IndexOutOfBoundsException("byte " + byteIdx);
+            }
+            return slab.get(at(DATA_OFFSET) + byteIdx);
+        }
+
+        /** the 8 payload bytes as one native order long */
+        public long getDataLong() {
+            return slab.getLong(at(DATA_OFFSET));
+        }
+
+        public byte[] getData() {
+            final byte[] data = new byte[getDlc()];
+            final int off = at(DATA_OFFSET);
+            for (int j = 0; j < data.length; j++) {
+                data[j] = slab.get(off + j);
+            }
+            return data;
+        }
+
+        /**
+         * Kernel receive time in CLOCK_REALTIME nanoseconds, 0 unless
+         * {@link CanSocket#setKernelTimestamps} is on.
+         */
+        public long getTimestampNanos() {
+            return slab.getLong(at(TIMESTAMP_OFFSET));
+        }
+
+        /** Copies the frame out of the arena. */
+        public CanFrame toCanFrame() {
+            return new CanFrame(new CanInterface(getInterfaceIndex()),
+                    new CanId(getCanId()), getData());
+        }
+
+        @Override
+        public String toString() {
+            return "FrameArena.Frame [slot=" + slot + ", refs="
+                    + refs.get(slot) + "]";
+        }
+    }
+
+    public Stats getStats() {
+        int inUse = 0;
+        for (int i = 0; i < refs.length(); i++) {
+            if (refs.get(i) > 0) {
+                inUse++;
+            }
+        }
+        final int slabsNow = slabCount;
+        return new Stats(new long[] {slabsNow, (long) slabsNow * slabSlots,
+                inUse, exhausted.get()});
+    }
+
+    public final static class Stats {
+        private final long[] v;
+
+        private Stats(final long[] v) {
+            this.v = v;
+        }
+
+        public long getSlabs() {
+            return v[0];
+        }
+
+        /** slots allocated so far */
+        public long getSlots() {
+            return v[1];
+        }
+
+        /** frames received and not yet released by all holders */
+        public long getInUse() {
+            return v[2];
+        }
+
+        /** receives that found every slot in use */
+        public long getExhausted() {
+            return v[3];
+        }
+
+        @Override
+        public String toString() {
+            return "FrameArena.Stats [slabs=" + getSlabs() + ", slots="
+                    + getSlots() + ", inUse=" + getInUse() + ", exhausted="
+                    + getExhausted() + "]";
+        }
+    }
+}
@@ -0,0 +1,327 @@
+package de.entropia.can;
+
+import java.io.Closeable;
+import java.io.EOFException;
+import java.io.IOException;
+import java.io.InputStream;
+import java.io.OutputStream;
+import java.util.Arrays;
+
+import de.entropia.can.CanSocket.CanFrame;
+
+/**
+ * Compact capture format for long traces: frames with their interface,
+ * CAN id, DLC, payload and timestamp, at a fraction of the 16 bytes a
+ * frame takes in a raw dump.
+ *
+ * After an eight byte magic the stream consists of self-contained blocks
+ * of up to {@link #BLOCK_FRAMES} frames. Within a block every id is
+ * written in full once; later frames of the id refer to it by a short slot
+ * number, carry their timestamp as the jitter against the previous
+ * interval of the id, and their payload as a flag when it repeated or as
+ * the bytes that changed. The block is then compressed with a fast LZ77
+ * coder. Encoding and decoding run in native code, a block per call.
+ *
+ * Timestamps are arbitrary longs, typically CLOCK_REALTIME nanoseconds as
+ * filled by {@link MergedReader#receive}; they need not be monotonic but
+ * compress best when every id is roughly periodic.
+ */
+public final class FrameCapture {
+    static {
+        CanSocket.loadNativeLibrary();
+    }
+
+    /** frames per block, the unit of compression and of random access */
+    public static final int BLOCK_FRAMES = 4096;
+
+    private static final byte[] MAGIC = {'C', 'A', 'N', 'C', 'A', 'P', 1, 0};
+    private static final int BLOCK_HEADER = 21;
+    private static final int DATA_STRIDE = CanFrameBatch.DATA_STRIDE;
+
+    private static native int _maxBlockSize(final int frames);
+    private static native int _encode(final int[] ifIndices,
+            final int[] canIds, final byte[] dlcs, final byte[] data,
+            final long[] timestamps, final int count, final byte[] block);
+    private static native int _decode(final byte[] header,
+            final byte[] payload, final int[] ifIndices, final int[] canIds,
+            final byte[] dlcs, final byte[] data, final long[] timestamps);
+
+    private FrameCapture() {
+    }
+
+    private static long now() {
+        return System.currentTimeMillis() * 1000000L;
+    }
+
+    /**
+     * Writes frames to an {@link OutputStream}, a block at a time. Not
+     * thread safe.
+     */
+    public static final class Writer implements Closeable {
+        private final OutputStream out;
+        private final int blockFrames;
+        private final int[] ifIndices;
+        private final int[] canIds;
+        private final byte[] dlcs;
+        private final byte[] data;
+        private final long[] timestamps;
+        private final byte[] block;
+        private int count;
+        private long framesWritten;
+        private long bytesWritten;
+        private boolean closed;
+
+        public Writer(final OutputStream out) throws IOException {
+            this(out, BLOCK_FRAMES);
+        }
+
+        /**
+         * Writes the magic to {@code out} right away.
+         *
+         * @param blockFrames frames per block, at most
+         *            {@link FrameCapture#BLOCK_FRAMES};
+         *            smaller blocks lose less on a crash but compress worse
+         */
+        public Writer(final OutputStream out, final int blockFrames)
+                throws IOException {
+            if (blockFrames <= 0 || blockFrames > BLOCK_FRAMES) {
+                throw new IllegalArgumentException("illegal block size");
+            }
+            this.out = out;
+            this.blockFrames = blockFrames;
+            this.ifIndices = new int[blockFrames];
+            this.canIds = new int[blockFrames];
+            this.dlcs = new byte[blockFrames];
+            this.data = new byte[blockFrames * DATA_STRIDE];
+            this.timestamps = new long[blockFrames];
+            this.block = new byte[_maxBlockSize(blockFrames)];
+            out.write(MAGIC);
+            bytesWritten = MAGIC.length;
+        }
+
+        /** Writes the buffered block if it is full. */
+        private void makeRoom() throws IOException {
+            if (closed) {
+                throw new IllegalStateException("writer closed");
+            }
+            if (count == blockFrames) {
+                flushBlock();
+            }
+        }
+
+        /** @return the index for the next frame */
+        private int reserve() throws IOException {
+            makeRoom();
+            return count++;
+        }
+
+        public void write(final long timestampNanos, final CanFrame frame)
+                throws IOException {
+            final byte[] payload = frame.getData();
+            final int i = reserve();
+            timestamps[i] = timestampNanos;
+            ifIndices[i] = frame.getCanInterfacae().getInterfaceIndex();
+            canIds[i] = frame.getCanId()._canId;
+            dlcs[i] = (byte) payload.length;
+            System.arraycopy(payload, 0, data, i * DATA_STRIDE,
+                    payload.length);
+            Arrays.fill(data, i * DATA_STRIDE + payload.length,
+                    (i + 1) * DATA_STRIDE, (byte) 0);
+        }
+
+        /**
+         * @param timestampNanos timestamp of every frame, or null to stamp
+         *            the whole batch with the current time
+         */
+        public void write(final CanFrameBatch batch,
+                final long[] timestampNanos) throws IOException {
+            final long now = timestampNanos == null ? now() : 0;
+            int done = 0;
+            while (done < batch.size) {
+                makeRoom();
+                final int n = Math.min(batch.size - done, blockFrames - count);
+                System.arraycopy(batch.ifIndex, done, ifIndices, count, n);
+                System.arraycopy(batch.canId, done, canIds, count, n);
+                System.arraycopy(batch.dlc, done, dlcs, count, n);
+                System.arraycopy(batch.data, done * DATA_STRIDE, data,
+                        count * DATA_STRIDE, n * DATA_STRIDE);
+                if (timestampNanos == null) {
+                    Arrays.fill(timestamps, count, count + n, now);
+                } else {
+                    System.arraycopy(timestampNanos, done, timestamps, count,
+                            n);
+                }
+                count += n;
+                done += n;
+            }
+        }
+
+        /** @see #write(CanFrameBatch, long[]) */
+        public void write(final DirectFrameBatch batch,
+                final long[] timestampNanos) throws IOException {
+            final long now = timestampNanos == null ? now() : 0;
+            for (int f = 0; f < batch.size; f++) {
+                final int i = reserve();
+                timestamps[i] = timestampNanos == null ? now
+                        : timestampNanos[f];
+                ifIndices[i] = batch.getInterfaceIndex(f);
+                canIds[i] = batch.getCanId(f);
+                dlcs[i] = (byte) batch.getDlc(f);
+                for (int j = 0; j < DATA_STRIDE; j++) {
+                    data[i * DATA_STRIDE + j] = batch.getData(f, j);
+                }
+            }
+        }
+
+        /** frames written as blocks so far, buffered ones excluded */
+        public long getFramesWritten() {
+            return framesWritten;
+        }
+
+        /** bytes written to the stream so far, magic included */
+        public long getBytesWritten() {
+            return bytesWritten;
+        }
+
+        private void flushBlock() throws IOException {
+            if (count == 0) {
+                return;
+            }
+            final int length = _encode(ifIndices, canIds, dlcs, data,
+                    timestamps, count, block);
+            out.write(block, 0, length);
+            framesWritten += count;
+            bytesWritten += length;
+            count = 0;
+        }
+
+        /** Writes the buffered frames as a block and flushes the stream. */
+        public void flush() throws IOException {
+            flushBlock();
+            out.flush();
+        }
+
+        /** Writes the buffered frames and closes the stream. */
+        @Override
+        public void close() throws IOException {
+            if (closed) {
+                return;
+            }
+            try {
+                flushBlock();
+            } finally {
+                closed = true;
+                out.close();
+            }
+        }
+    }
+
+    /** Reads frames written by a {@link Writer}. Not thread safe. */
+    public static final class Reader implements Closeable {
+        private final InputStream in;
+        private final byte[] header = new byte[BLOCK_HEADER];
+        private final int[] ifIndices = new int[BLOCK_FRAMES];
+        private final int[] canIds = new int[BLOCK_FRAMES];
+        private final byte[] dlcs = new byte[BLOCK_FRAMES];
+        private final byte[] data = new byte[BLOCK_FRAMES * DATA_STRIDE];
+        private final long[] timestamps = new long[BLOCK_FRAMES];
+        private byte[] payload = new byte[0];
+        private int count;
+        private int next;
+        private long framesRead;
+
+        /** Reads and checks the magic right away. */
+        public Reader(final InputStream in) throws IOException {
+            this.in = in;
+            final byte[] magic = new byte[MAGIC.length];
+            if (fill(magic, magic.length) != magic.length
+                    || !Arrays.equals(magic, MAGIC)) {
+                throw new IOException("not a frame capture");
+            }
+        }
+
+        /** @return bytes read, less than {@code length} only at the end */
+        private int fill(final byte[] buffer, final int length)
+                throws IOException {
+            int off = 0;
+            while (off < length) {
+                final int n = in.read(buffer, off, length - off);
+                if (n < 0) {
+                    break;
+                }
+                off += n;
+            }
+            return off;
+        }
+
+        /** @return false at the end of the stream */
+        private boolean nextBlock() throws IOException {
+            final int n = fill(header, BLOCK_HEADER);
+            if (n == 0) {
+                return false;
+            } else if (n != BLOCK_HEADER) {
+                throw new EOFException("truncated capture block");
+            }
+            final int length = (header[0] & 0xff) | (header[1] & 0xff) << 8
+                    | (header[2] & 0xff) << 16 | (header[3] & 0xff) << 24;
+            if (length < 0 || length > _maxBlockSize(BLOCK_FRAMES)) {
+                throw new IOException("corrupt capture block header");
+            }
+            if (payload.length < length) {
+                payload = new byte[length];
+            }
+            if (fill(payload, length) != length) {
+                throw new EOFException("truncated capture block");
+            }
+            count = _decode(header, payload, ifIndices, canIds, dlcs, data,
+                    timestamps);
+            next = 0;
+            return true;
+        }
+
+        /**
+         * Appends frames to {@code batch} until it is full or the stream
+         * ends, and their timestamps to {@code timestampNanos} at the same
+         * indices.
+         *
+         * @param timestampNanos at least as long as the batch, or null
+         * @return the number of frames appended, -1 at the end of the stream
+         */
+        public int read(final CanFrameBatch batch, final long[] timestampNanos)
+                throws IOException {
+            final int start = batch.size;
+            while (batch.size < batch.capacity()) {
+                while (next == count) {
+                    if (!nextBlock()) {
+                        return batch.size == start ? -1 : batch.size - start;
+                    }
+                }
+                final int n = Math.min(count - next,
+                        batch.capacity() - batch.size);
+                System.arraycopy(ifIndices, next, batch.ifIndex, batch.size,
+                        n);
+                System.arraycopy(canIds, next, batch.canId, batch.size, n);
+                System.arraycopy(dlcs, next, batch.dlc, batch.size, n);
+                System.arraycopy(data, next * DATA_STRIDE, batch.data,
+                        batch.size * DATA_STRIDE, n * DATA_STRIDE);
+                if (timestampNanos != null) {
+                    System.arraycopy(timestamps, next, timestampNanos,
+                            batch.size, n);
+                }
+                next += n;
+                batch.size += n;
+                framesRead += n;
+            }
+            return batch.size - start;
+        }
+
+        public long getFramesRead() {
+            return framesRead;
+        }
+
+        @Override
+        public void close() throws IOException {
+            in.close();
+        }
+    }
+}
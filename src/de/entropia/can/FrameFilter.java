@@ -0,0 +1,106 @@
+package de.entropia.can;
+
+import java.io.Closeable;
+import java.io.IOException;
+
+/**
+ * Native filter for large sets of id/mask pairs.
+ *
+ * The pairs have the semantics of {@link CanSocket#setFilters}: a frame
+ * passes if {@code (frameId & mask) == (id & mask)} for any pair, with raw
+ * can_ids including the EFF and RTR flags; error frames never pass and
+ * inverted filters are not supported. Unlike the kernel, which checks the
+ * pairs one by one for every frame, the set is compiled into a bitmap of
+ * all standard ids and sorted tables per distinct mask for extended ids,
+ * so thousands of pairs cost about as much as a few. Standard ids are
+ * checked eight at a time on CPUs with AVX2.
+ *
+ * {@link #recv} filters frames in native code before they reach Java;
+ * {@link #filter} thins out a batch received or replayed otherwise. The
+ * filter is immutable and may be used by several threads.
+ */
+public final class FrameFilter implements Closeable {
+    static {
+        CanSocket.loadNativeLibrary();
+    }
+
+    private static native long _compile(final int[] canIds,
+            final int[] masks);
+    private static native void _free(final long filter);
+    private static native int _maskGroups(final long filter);
+    private static native boolean _matches(final long filter,
+            final int canId);
+    private static native int _filter(final long filter,
+            final int[] ifIndices, final int[] canIds, final byte[] dlcs,
+            final byte[] data, final int count);
+    private static native int _recv(final long filter, final int fd,
+            final long stats, final int[] ifIndices, final int[] canIds,
+            final byte[] dlcs, final byte[] data) throws IOException;
+
+    private final int size;
+    private volatile long _filter;
+
+    public FrameFilter(final int[] canIds, final int[] masks) {
+        this._filter = _compile(canIds, masks);
+        this.size = canIds.length;
+    }
+
+    private long handle() {
+        final long filter = _filter;
+        if (filter == 0) {
+            throw new IllegalStateException("filter closed");
+        }
+        return filter;
+    }
+
+    /** number of id/mask pairs */
+    public int size() {
+        return size;
+    }
+
+    /** distinct masks among the pairs that can match extended frames */
+    public int getMaskGroups() {
+        return _maskGroups(handle());
+    }
+
+    public boolean matches(final int canId) {
+        return _matches(handle(), canId);
+    }
+
+    /**
+     * Removes the frames that do not pass, keeping the order of the others.
+     *
+     * @return the new size of the batch
+     */
+    public int filter(final CanFrameBatch batch) {
+        batch.size = _filter(handle(), batch.ifIndex, batch.canId, batch.dlc,
+                batch.data, batch.size);
+        return batch.size;
+    }
+
+    /**
+     * Like {@link CanSocket#recv(CanFrameBatch)}, but only frames that pass
+     * are copied into the batch. Blocks until at least one frame passes.
+     */
+    public int recv(final CanSocket socket, final CanFrameBatch batch)
+            throws IOException {
+        batch.size = 0;
+        socket.acquire();
+        try {
+            batch.size = _recv(handle(), socket._fd, socket._stats,
+                    batch.ifIndex, batch.canId, batch.dlc, batch.data);
+        } finally {
+            socket.release();
+        }
+        return batch.size;
+    }
+
+    @Override
+    public synchronized void close() {
+        if (_filter != 0) {
+            final long filter = _filter;
+            _filter = 0;
+            _free(filter);
+        }
+    }
+}
@@ -0,0 +1,255 @@
+package de.entropia.can;
+
+import java.io.Closeable;
+import java.nio.ByteBuffer;
+
+import de.entropia.can.CanSocket.CanFrame;
+
+/**
+ * End-to-end protection of outgoing payloads and its verification on
+ * received ones, per CAN id: an alive counter, a CRC8 and an XOR checksum.
+ *
+ * The checksums follow the CGW_CS_CRC8 and CGW_CS_XOR operations of the
+ * kernel CAN gateway (linux/can/gw.h) exactly: the same parameters, byte
+ * ranges that may run downwards and negative indices counting from the end
+ * of the payload, the same CRC8 profiles, and CRC8 before XOR. A frame
+ * protected here therefore carries the bytes a can-gw job with the same
+ * parameters would have written. The counter is written first, so profile
+ * {@link Crc8Profile#COUNTER_DATA_ID} sees the new counter value.
+ *
+ * Batches are protected and verified in a single native call. An instance
+ * keeps the counter state of every id and must not be used from several
+ * threads at once; {@link #close()} must not race with the other methods.
+ */
+public final class FrameProtection implements Closeable {
+    static {
+        CanSocket.loadNativeLibrary();
+    }
+
+    /** CRC8 profiles of can-gw, the ordinals are the CGW_CRC8PRF values. */
+    public static enum Crc8Profile {
+        /** CRC over the byte range only */
+        NONE,
+        /** one more byte, {@code profileData[0]} */
+        DATA_ID,
+        /** one more byte, {@code profileData[data[1] & 0xf]}, the data id
+         * list of AUTOSAR E2E profile 1 selected by the counter */
+        COUNTER_DATA_ID,
+        /** one more byte, the XOR of the two low bytes of the CAN id */
+        SFF_ID_XOR
+    }
+
+    /** set in the verification status of a frame whose counter did not
+     * advance or advanced too far */
+    public static final int BAD_COUNTER = 1;
+    public static final int BAD_XOR = 2;
+    public static final int BAD_CRC8 = 4;
+    /** set for frames of ids without protection rules */
+    public static final int UNPROTECTED = 8;
+
+    private static native long _create();
+    private static native void _free(final long protection);
+    private static native void _setCounter(final long protection,
+            final int canId, final int index, final int mask,
+            final int maxDelta);
+    private static native void _setXor(final long protection,
+            final int canId, final int from, final int to, final int result,
+            final int init);
+    private static native void _setCrc8(final long protection,
+            final int canId, final int from, final int to, final int result,
+            final int init, final int finalXor, final byte[] table,
+            final int profile, final byte[] profileData);
+    private static native int _protectFrame(final long protection,
+            final int canId, final byte[] data);
+    private static native int _protect(final long protection,
+            final int[] canIds, final byte[] dlcs, final byte[] data,
+            final int count);
+    private static native int _protectDirect(final long protection,
+            final ByteBuffer buffer, final int count);
+    private static native int _verify(final long protection,
+            final int[] canIds, final byte[] dlcs, final byte[] data,
+            final int count, final byte[] status);
+    private static native int _verifyDirect(final long protection,
+            final ByteBuffer buffer, final int count, final byte[] status);
+    private static native void _stats(final long protection,
+            final long[] stats);
+
+    private static final int STAT_PROTECTED = 0;
+    private static final int STAT_VERIFIED = 1;
+    private static final int STAT_BAD_COUNTER = 2;
+    private static final int STAT_BAD_XOR = 3;
+    private static final int STAT_BAD_CRC8 = 4;
+    private static final int STAT_UNPROTECTED = 5;
+    private static final int STAT_FIELDS = 6;
+
+    /** Snapshot of the protection counters. */
+    public final static class Stats {
+        private final long[] v;
+
+        private Stats(final long[] v) {
+            this.v = v;
+        }
+
+        /** outgoing frames that matched a rule */
+        public long getProtected() {
+            return v[STAT_PROTECTED];
+        }
+
+        /** received frames that matched a rule */
+        public long getVerified() {
+            return v[STAT_VERIFIED];
+        }
+
+        public long getBadCounter() {
+            return v[STAT_BAD_COUNTER];
+        }
+
+        public long getBadXor() {
+            return v[STAT_BAD_XOR];
+        }
+
+        public long getBadCrc8() {
+            return v[STAT_BAD_CRC8];
+        }
+
+        /** received frames of ids without rules */
+        public long getUnprotected() {
+            return v[STAT_UNPROTECTED];
+        }
+
+        @Override
+        public String toString() {
+            return "Stats [protected=" + getProtected() + ", verified="
+                    + getVerified() + ", badCounter=" + getBadCounter()
+                    + ", badXor=" + getBadXor() + ", badCrc8="
+                    + getBadCrc8() + ", unprotected=" + getUnprotected()
+                    + "]";
+        }
+    }
+
+    private long _protection;
+
+    public FrameProtection() {
+        this._protection = _create();
+    }
+
+    private long handle() {
+        final long protection = _protection;
+        if (protection == 0) {
+            throw new IllegalStateException("protection closed");
+        }
+        return protection;
+    }
+
+    /**
+     * Lookup table of the MSB first CRC8 with generator polynomial
+     * {@code poly}, e.g. 0x1d for SAE J1850 or 0x2f for AUTOSAR CRC8H2F,
+     * in the form can-gw expects.
+     */
+    public static byte[] crc8Table(final int poly) {
+        final byte[] table = new byte[256];
+        for (int i = 0; i < 256; i++) {
+            int crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x80) != 0 ? (crc << 1) ^ poly : crc << 1;
+            }
+            table[i] = (byte) crc;
+        }
+        return table;
+    }
+
+    /**
+     * Places an alive counter into the bits {@code mask} of payload byte
+     * {@code index} of the frames of {@code canId}, counting up by one per
+     * protected frame. A received frame fails verification unless its
+     * counter advanced by 1 to {@code maxDelta} since the previous one.
+     *
+     * @param index payload index, negative to count from the end
+     * @param mask contiguous bits, e.g. 0x0f for AUTOSAR profile 1
+     */
+    public void setCounter(final int canId, final int index, final int mask,
+            final int maxDelta) {
+        _setCounter(handle(), canId, index, mask, maxDelta);
+    }
+
+    /**
+     * CGW_CS_XOR: {@code data[result]} becomes {@code init} XOR
+     * {@code data[from]} .. {@code data[to]}.
+     */
+    public void setXor(final int canId, final int from, final int to,
+            final int result, final int init) {
+        _setXor(handle(), canId, from, to, result, init);
+    }
+
+    /**
+     * CGW_CS_CRC8: {@code data[result]} becomes the CRC8 over
+     * {@code data[from]} .. {@code data[to]} and the profile byte, starting
+     * at {@code init}, XORed with {@code finalXor}.
+     *
+     * @param table 256 entry lookup table, see {@link #crc8Table}
+     * @param profileData up to 20 bytes for the profile
+     */
+    public void setCrc8(final int canId, final int from, final int to,
+            final int result, final int init, final int finalXor,
+            final byte[] table, final Crc8Profile profile,
+            final byte[] profileData) {
+        _setCrc8(handle(), canId, from, to, result, init, finalXor, table,
+                profile.ordinal(), profileData == null ? new byte[0]
+                        : profileData);
+    }
+
+    /**
+     * Protects the payload of {@code frame} in place.
+     *
+     * @return false if there is no rule for its id
+     */
+    public boolean protect(final CanFrame frame) {
+        return _protectFrame(handle(), frame.getCanId()._canId,
+                frame.getData()) == 1;
+    }
+
+    /**
+     * Protects all frames of {@code batch} in place.
+     *
+     * @return the number of frames that matched a rule
+     */
+    public int protect(final CanFrameBatch batch) {
+        return _protect(handle(), batch.canId, batch.dlc, batch.data,
+                batch.size);
+    }
+
+    public int protect(final DirectFrameBatch batch) {
+        return _protectDirect(handle(), batch.buffer, batch.size);
+    }
+
+    /**
+     * Verifies all frames of {@code batch} and stores a combination of
+     * {@link #BAD_COUNTER}, {@link #BAD_XOR}, {@link #BAD_CRC8} and
+     * {@link #UNPROTECTED} per frame in {@code status}, 0 for intact frames.
+     *
+     * @return the number of protected frames that failed a check
+     */
+    public int verify(final CanFrameBatch batch, final byte[] status) {
+        return _verify(handle(), batch.canId, batch.dlc, batch.data,
+                batch.size, status);
+    }
+
+    public int verify(final DirectFrameBatch batch, final byte[] status) {
+        return _verifyDirect(handle(), batch.buffer, batch.size, status);
+    }
+
+    public Stats getStats() {
+        final long[] stats = new long[STAT_FIELDS];
+        _stats(handle(), stats);
+        return new Stats(stats);
+    }
+
+    @Override
+    public synchronized void close() {
+        if (_protection != 0) {
+            final long protection = _protection;
+            _protection = 0;
+            _free(protection);
+        }
+    }
+}
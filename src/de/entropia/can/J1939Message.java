@@ -0,0 +1,113 @@
+package de.entropia.can;
+
+import java.util.Arrays;
+
+/**
+ * One SAE J1939 message as sent and received by a {@link CanSocket} in
+ * {@link CanSocket.Mode#J1939}. The payload may be up to
+ * {@link CanSocket#J1939_MAX_TP_SIZE} bytes for the transport protocol or
+ * up to {@link CanSocket#J1939_MAX_ETP_SIZE} bytes for the extended one;
+ * the kernel segments and reassembles it.
+ *
+ * Messages to send name their destination either by address or by NAME;
+ * received messages additionally carry their source, the priority they
+ * were sent with and the interface they arrived on.
+ */
+public final class J1939Message {
+    private final int ifIndex;
+    private final long sourceName;
+    private final int pgn;
+    private final int sourceAddress;
+    private final long destinationName;
+    private final int destinationAddress;
+    private final int priority;
+    private final byte[] data;
+
+    /* this constructor is used in native code */
+    private J1939Message(final int ifIndex, final long sourceName,
+            final int pgn, final int sourceAddress,
+            final long destinationName, final int destinationAddress,
+            final int priority, final byte[] data) {
+        this.ifIndex = ifIndex;
+        this.sourceName = sourceName;
+        this.pgn = pgn;
+        this.sourceAddress = sourceAddress;
+        this.destinationName = destinationName;
+        this.destinationAddress = destinationAddress;
+        this.priority = priority;
+        this.data = data;
+    }
+
+    /**
+     * Message for {@code pgn} to the node at {@code address}, or to all
+     * nodes for {@link CanSocket#J1939_NO_ADDR}, which needs
+     * {@link CanSocket#setJ1939Broadcast}.
+     */
+    public static J1939Message toAddress(final int pgn, final int address,
+            final byte[] data) {
+        return new J1939Message(0, CanSocket.J1939_NO_NAME, pgn,
+                CanSocket.J1939_NO_ADDR, CanSocket.J1939_NO_NAME, address,
+                -1, data);
+    }
+
+    /**
+     * Message for {@code pgn} to the node that claimed an address with
+     * {@code name}; the kernel resolves the address when sending.
+     */
+    public static J1939Message toName(final int pgn, final long name,
+            final byte[] data) {
+        return new J1939Message(0, CanSocket.J1939_NO_NAME, pgn,
+                CanSocket.J1939_NO_ADDR, name, CanSocket.J1939_NO_ADDR, -1,
+                data);
+    }
+
+    /** broadcast to all nodes, sent as BAM if it needs several frames */
+    public static J1939Message broadcast(final int pgn, final byte[] data) {
+        return toAddress(pgn, CanSocket.J1939_NO_ADDR, data);
+    }
+
+    /** interface the message arrived on, 0 for messages to send */
+    public int getInterfaceIndex() {
+        return ifIndex;
+    }
+
+    public int getPgn() {
+        return pgn;
+    }
+
+    /** NAME of the sender, {@link CanSocket#J1939_NO_NAME} if unknown */
+    public long getSourceName() {
+        return sourceName;
+    }
+
+    public int getSourceAddress() {
+        return sourceAddress;
+    }
+
+    public long getDestinationName() {
+        return destinationName;
+    }
+
+    /** {@link CanSocket#J1939_NO_ADDR} for broadcasts */
+    public int getDestinationAddress() {
+        return destinationAddress;
+    }
+
+    /** priority 0 (highest) to 7 of a received message, -1 if unknown */
+    public int getPriority() {
+        return priority;
+    }
+
+    public byte[] getData() {
+        return data;
+    }
+
+    @Override
+    public String toString() {
+        return "J1939Message [pgn=0x" + Integer.toHexString(pgn) + ", sa="
+                + sourceAddress + ", da=" + destinationAddress
+                + ", priority=" + priority + ", length=" + data.length
+                + ", data=" + (data.length <= 16 ? Arrays.toString(data)
+                        : "...") + "]";
+    }
+}
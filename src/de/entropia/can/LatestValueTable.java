@@ -0,0 +1,184 @@
+package de.entropia.can;
+
+import java.io.Closeable;
+import java.io.IOException;
+import java.util.Arrays;
+
+/**
+ * Off-heap table holding the most recent frame of every CAN id.
+ *
+ * The table is fed by {@link #receive(CanSocket)}, which reads a burst of
+ * frames and stores them without creating Java objects, or from batches
+ * received elsewhere via {@link #update(CanFrameBatch)}. Standard ids have a
+ * slot each, extended ids share a fixed size hash table; frames of extended
+ * ids that no longer fit are counted by {@link #getOverflowCount()}.
+ * Remote and error frames are skipped, they carry no payload for the id.
+ *
+ * Every slot is protected by a seqlock, so any number of threads may
+ * {@link #read} concurrently with the writers without locking or allocating.
+ * Each slot carries an update counter: a reader that sees it advance by
+ * more than one since its last read has missed updates.
+ *
+ * {@link #close()} must only be called once no other thread uses the table.
+ */
+public final class LatestValueTable implements Closeable {
+    static {
+        CanSocket.loadNativeLibrary();
+    }
+
+    public static final int DEFAULT_EXTENDED_CAPACITY = 4096;
+
+    private static final int META_CAN_ID = 0;
+    private static final int META_IF_INDEX = 1;
+    private static final int META_DLC = 2;
+    private static final int META_TIMESTAMP = 3;
+    private static final int META_UPDATES = 4;
+    private static final int META_FIELDS = 5;
+
+    private static native long _create(final int extendedCapacity);
+    private static native void _free(final long table);
+    private static native int _receive(final long table, final int fd,
+            final long stats) throws IOException;
+    private static native void _update(final long table, final int[] ifIndex,
+            final int[] canId, final byte[] dlc, final byte[] data,
+            final int count);
+    private static native long _read(final long table, final int canId,
+            final long[] meta, final byte[] data);
+    private static native long _updateCount(final long table,
+            final int canId);
+    private static native long _overflows(final long table);
+
+    /**
+     * Reusable holder for the content of one slot, to be owned by a single
+     * reading thread.
+     */
+    public final static class Value {
+        private final long[] meta = new long[META_FIELDS];
+        private final byte[] data = new byte[CanFrameBatch.DATA_STRIDE];
+
+        public int getCanId() {
+            return (int) meta[META_CAN_ID];
+        }
+
+        public int getInterfaceIndex() {
+            return (int) meta[META_IF_INDEX];
+        }
+
+        public int getDlc() {
+            return (int) meta[META_DLC];
+        }
+
+        /**
+         * wall clock time the frame was received, in nanoseconds; the
+         * kernel timestamp if {@link CanSocket#setKernelTimestamps} is on
+         */
+        public long getTimestampNanos() {
+            return meta[META_TIMESTAMP];
+        }
+
+        /** number of frames stored to the slot so far */
+        public long getUpdateCount() {
+            return meta[META_UPDATES];
+        }
+
+        public byte getData(final int i) {
+            if (i < 0 || i >= getDlc()) {
+                throw new IndexOutOfBoundsException("byte " + i);
+            }
+            return data[i];
+        }
+
+        /** copies the payload into {@code dst} and returns its length */
+        public int getData(final byte[] dst) {
+            final int len = Math.min(getDlc(), CanFrameBatch.DATA_STRIDE);
+            System.arraycopy(data, 0, dst, 0, len);
+            return len;
+        }
+
+        public byte[] getData() {
+            return Arrays.copyOf(data, Math.min(getDlc(),
+                    CanFrameBatch.DATA_STRIDE));
+        }
+
+        @Override
+        public String toString() {
+            return "Value [canId=0x" + Integer.toHexString(getCanId())
+                    + ", ifIndex=" + getInterfaceIndex() + ", data="
+                    + Arrays.toString(getData()) + ", timestamp="
+                    + getTimestampNanos() + ", updates=" + getUpdateCount()
+                    + "]";
+        }
+    }
+
+    private long _table;
+
+    public LatestValueTable() {
+        this(DEFAULT_EXTENDED_CAPACITY);
+    }
+
+    /**
+     * @param extendedCapacity number of distinct extended ids the table can
+     *        hold, a power of two
+     */
+    public LatestValueTable(final int extendedCapacity) {
+        _table = _create(extendedCapacity);
+    }
+
+    private long handle() {
+        final long table = _table;
+        if (table == 0) {
+            throw new IllegalStateException("table closed");
+        }
+        return table;
+    }
+
+    /**
+     * Blocks until frames are available on {@code socket} and stores the
+     * burst that was read.
+     *
+     * @return the number of frames stored, which may be 0 if the burst
+     *         held only remote or error frames
+     * @throws java.nio.channels.AsynchronousCloseException if the socket
+     *         is closed meanwhile
+     */
+    public int receive(final CanSocket socket) throws IOException {
+        socket.acquire();
+        try {
+            return _receive(handle(), socket._fd, socket._stats);
+        } finally {
+            socket.release();
+        }
+    }
+
+    public void update(final CanFrameBatch batch) {
+        _update(handle(), batch.ifIndex, batch.canId, batch.dlc, batch.data,
+                batch.size);
+    }
+
+    /**
+     * Copies the latest frame of {@code canId} into {@code value}.
+     *
+     * @return false if no frame with this id was stored yet
+     */
+    public boolean read(final int canId, final Value value) {
+        return _read(handle(), canId, value.meta, value.data) != 0;
+    }
+
+    /** @return the number of frames stored for {@code canId} so far */
+    public long getUpdateCount(final int canId) {
+        return _updateCount(handle(), canId);
+    }
+
+    /** @return the number of frames dropped because the table was full */
+    public long getOverflowCount() {
+        return _overflows(handle());
+    }
+
+    @Override
+    public void close() {
+        if (_table != 0) {
+            _free(_table);
+            _table = 0;
+        }
+    }
+}
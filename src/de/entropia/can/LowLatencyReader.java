@@ -0,0 +1,95 @@
+package de.entropia.can;
+
+import java.io.Closeable;
+import java.io.IOException;
+import java.util.Objects;
+
+import de.entropia.can.CanSocket.CanFrame;
+
+/**
+ * Dedicated thread that spins on a socket and hands every frame to a
+ * handler as soon as it arrives.
+ *
+ * The thread polls the socket from native code and only returns to Java
+ * when a frame was read (or every {@link CanSocket#SPIN_SLICE_NANOS} to
+ * check for {@link #close()}). It can be pinned to a set of CPUs, ideally
+ * isolated ones, since it keeps its CPU fully busy.
+ */
+public final class LowLatencyReader implements Closeable {
+
+    public interface FrameHandler {
+        void onFrame(CanFrame frame);
+    }
+
+    private final CanSocket socket;
+    private final FrameHandler handler;
+    private final int[] cpus;
+    private final Thread thread;
+    private volatile boolean running = true;
+    private volatile IOException failure;
+
+    /**
+     * @param cpus CPUs to pin the reader thread to, none to leave it
+     *        unpinned
+     */
+    public LowLatencyReader(final CanSocket socket,
+            final FrameHandler handler, final int... cpus) {
+        this.socket = Objects.requireNonNull(socket);
+        this.handler = Objects.requireNonNull(handler);
+        this.cpus = cpus.clone();
+        this.thread = new Thread(new Runnable() {
+            @Override
+            public void run() {
+                readLoop();
+            }
+        }, "can-low-latency-reader");
+        this.thread.setDaemon(true);
+    }
+
+    public void start() {
+        thread.start();
+    }
+
+    private void readLoop() {
+        try {
+            if (cpus.length > 0) {
+                CanSocket.setCurrentThreadAffinity(cpus);
+            }
+            while (running) {
+                final CanFrame frame =
+                        socket.recvSpin(CanSocket.SPIN_SLICE_NANOS);
+                if (frame != null) {
+                    handler.onFrame(frame);
+                }
+            }
+        } catch (final IOException e) {
+            if (running) {
+                failure = e;
+            }
+        }
+    }
+
+    /** @return the error that terminated the reader, if any */
+    public IOException getFailure() {
+        return failure;
+    }
+
+    public boolean isAlive() {
+        return thread.isAlive();
+    }
+
+    /**
+     * Stops the reader and waits for it to exit, which takes at most one
+     * spin slice. The socket stays open.
+     */
+    @Override
+    public void close() throws IOException {
+        running = false;
+        try {
+            thread.join();
+        } catch (final InterruptedException e) {
+            Thread.currentThread().interrupt();
+            throw new IOException("interrupted while stopping reader", e);
+        }
+    }
+}
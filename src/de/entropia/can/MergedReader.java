@@ -0,0 +1,244 @@
+package de.entropia.can;
+
+import java.io.Closeable;
+import java.io.IOException;
+import java.nio.channels.AsynchronousCloseException;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicIntegerFieldUpdater;
+
+/**
+ * Frames of several sockets, e.g. one per bus, as one stream in kernel
+ * receive time order.
+ *
+ * Separate receive threads per socket lose the order between buses. The
+ * reader instead enables {@link CanSocket#setKernelTimestamps} on every
+ * socket and merges their frames by timestamp in native code. A frame is
+ * held back until it is older than the reorder window, or until every
+ * socket has delivered a newer frame, which on busy buses happens long
+ * before the window ends; the window therefore bounds the added latency.
+ * With a single socket, for instance one bound to
+ * {@link CanSocket#CAN_ALL_INTERFACES}, only the window applies.
+ *
+ * Frames that arrive later than the window allows are delivered as soon
+ * as possible and counted in {@link Stats#getLate()}. The sockets stay
+ * open until the reader is closed and should not be read otherwise; one
+ * thread at a time may call {@link #receive}. {@link #close()} may be
+ * called from any thread, a receive waiting meanwhile fails with
+ * {@link AsynchronousCloseException}.
+ */
+public final class MergedReader implements Closeable {
+    static {
+        CanSocket.loadNativeLibrary();
+    }
+
+    /** frames held back at most, older ones are released early when full */
+    public static final int DEFAULT_CAPACITY = 4096;
+
+    private static native long _create(final int[] fds, final long[] stats,
+            final long windowNanos, final int capacity);
+    private static native void _free(final long merger);
+    private static native void _wake(final long merger);
+    private static native int _receive(final long merger,
+            final long timeoutNanos, final int[] ifIndices,
+            final int[] canIds, final byte[] dlcs, final byte[] data,
+            final long[] timestamps) throws IOException;
+    private static native void _stats(final long merger, final long[] stats);
+
+    private static final int STAT_FRAMES = 0;
+    private static final int STAT_WINDOW_RELEASES = 1;
+    private static final int STAT_EARLY_RELEASES = 2;
+    private static final int STAT_FORCED_RELEASES = 3;
+    private static final int STAT_LATE = 4;
+    private static final int STAT_BUFFERED = 5;
+    private static final int STAT_MAX_BUFFERED = 6;
+    private static final int STAT_FIELDS = 7;
+
+    /** Snapshot of the merge counters. */
+    public final static class Stats {
+        private final long[] v;
+
+        private Stats(final long[] v) {
+            this.v = v;
+        }
+
+        /** frames received from all sockets */
+        public long getFrames() {
+            return v[STAT_FRAMES];
+        }
+
+        /** frames released because they were older than the window */
+        public long getWindowReleases() {
+            return v[STAT_WINDOW_RELEASES];
+        }
+
+        /** frames released because every socket had delivered newer ones */
+        public long getEarlyReleases() {
+            return v[STAT_EARLY_RELEASES];
+        }
+
+        /** frames released before their time because the buffer was full */
+        public long getForcedReleases() {
+            return v[STAT_FORCED_RELEASES];
+        }
+
+        /** frames older than one already delivered, i.e. out of order */
+        public long getLate() {
+            return v[STAT_LATE];
+        }
+
+        /** frames waiting to be released */
+        public long getBuffered() {
+            return v[STAT_BUFFERED];
+        }
+
+        public long getMaxBuffered() {
+            return v[STAT_MAX_BUFFERED];
+        }
+
+        @Override
+        public String toString() {
+            return "Stats [frames=" + getFrames() + ", windowReleases="
+                    + getWindowReleases() + ", earlyReleases="
+                    + getEarlyReleases() + ", forcedReleases="
+                    + getForcedReleases() + ", late=" + getLate()
+                    + ", buffered=" + getBuffered() + ", maxBuffered="
+                    + getMaxBuffered() + "]";
+        }
+    }
+
+    private final CanSocket[] sockets;
+    private volatile long _merger;
+    /* native calls in flight in the low bits, CLOSED once close() ran */
+    private volatile int _users;
+
+    private static final AtomicIntegerFieldUpdater<MergedReader> USERS =
+            AtomicIntegerFieldUpdater.newUpdater(MergedReader.class,
+                    "_users");
+    private static final int CLOSED = 0x80000000;
+
+    public MergedReader(final CanSocket[] sockets, final long window,
+            final TimeUnit unit) throws IOException {
+        this(sockets, window, unit, DEFAULT_CAPACITY);
+    }
+
+    /**
+     * @param window how long frames are held back for reordering at most
+     * @param capacity number of frames that may be held back
+     */
+    public MergedReader(final CanSocket[] sockets, final long window,
+            final TimeUnit unit, final int capacity) throws IOException {
+        this.sockets = sockets.clone();
+        final int[] fds = new int[sockets.length];
+        final long[] stats = new long[sockets.length];
+        /* the descriptors stay pinned until the reader is closed */
+        int acquired = 0;
+        try {
+            for (int i = 0; i < sockets.length; i++) {
+                this.sockets[i].setKernelTimestamps(true);
+                this.sockets[i].acquire();
+                acquired++;
+                fds[i] = this.sockets[i]._fd;
+                stats[i] = this.sockets[i]._stats;
+            }
+            this._merger = _create(fds, stats, unit.toNanos(window),
+                    capacity);
+        } catch (final IOException | RuntimeException | Error e) {
+            for (int i = 0; i < acquired; i++) {
+                this.sockets[i].release();
+            }
+            throw e;
+        }
+    }
+
+    public CanSocket[] getSockets() {
+        return sockets.clone();
+    }
+
+    /**
+     * Pins the merger for a native call, like {@link CanSocket#acquire()};
+     * the last {@link #release()} after {@link #close()} frees it.
+     *
+     * @return the merger handle
+     */
+    private long acquire() {
+        for (;;) {
+            final int users = _users;
+            if ((users & CLOSED) != 0) {
+                throw new IllegalStateException("reader closed");
+            }
+            if (USERS.compareAndSet(this, users, users + 1)) {
+                return _merger;
+            }
+        }
+    }
+
+    private void release() {
+        if (USERS.decrementAndGet(this) == CLOSED) {
+            destroy();
+        }
+    }
+
+    /**
+     * Fills {@code batch} with the next frames in timestamp order, waiting
+     * up to {@code timeout} for the first one; a negative timeout waits
+     * indefinitely.
+     *
+     * @param timestampNanos receives the kernel receive time of every frame
+     *            in CLOCK_REALTIME nanoseconds, at least as long as the
+     *            batch capacity
+     * @return the number of frames, 0 on timeout
+     */
+    public int receive(final CanFrameBatch batch, final long[] timestampNanos,
+            final long timeout, final TimeUnit unit) throws IOException {
+        batch.size = 0;
+        final long merger = acquire();
+        try {
+            batch.size = _receive(merger, unit.toNanos(timeout),
+                    batch.ifIndex, batch.canId, batch.dlc, batch.data,
+                    timestampNanos);
+            return batch.size;
+        } finally {
+            release();
+        }
+    }
+
+    public Stats getStats() {
+        final long[] stats = new long[STAT_FIELDS];
+        final long merger = acquire();
+        try {
+            _stats(merger, stats);
+        } finally {
+            release();
+        }
+        return new Stats(stats);
+    }
+
+    /**
+     * Frees the merge buffer and releases the sockets once no receive runs
+     * any more; frames still held back are lost.
+     */
+    @Override
+    public void close() {
+        int users;
+        do {
+            users = _users;
+            if ((users & CLOSED) != 0) {
+                return;
+            }
+        } while (!USERS.compareAndSet(this, users, (users + 1) | CLOSED));
+        try {
+            _wake(_merger);
+        } finally {
+            release();
+        }
+    }
+
+    private void destroy() {
+        final long merger = _merger;
+        _merger = 0;
+        _free(merger);
+        for (final CanSocket socket : sockets) {
+            socket.release();
+        }
+    }
+}
@@ -0,0 +1,234 @@
+package de.entropia.can;
+
+import java.io.Closeable;
+import java.io.IOException;
+import java.util.Map;
+import java.util.Objects;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.TimeoutException;
+import java.util.concurrent.atomic.AtomicInteger;
+
+import de.entropia.can.CanSocket.CanFrame;
+import de.entropia.can.CanSocket.CanId;
+
+/**
+ * Asynchronous request/response on a CAN socket, e.g. for diagnostic
+ * polling where a request to 0x7DF is answered on 0x7E8.
+ *
+ * {@link #request} sends a frame and returns a future that is completed
+ * with the first frame matching the expected id and mask, or fails with a
+ * {@link TimeoutException}. One thread receives for all outstanding
+ * requests: frames are matched against the pending requests in native
+ * code, only matching frames reach Java, and timeouts are kept in a
+ * shared timer wheel. Thousands of concurrent requests therefore need no
+ * thread of their own.
+ *
+ * The client consumes every frame received on the socket, so the socket
+ * should be dedicated to it, ideally with a kernel filter for the
+ * response ids. Futures are completed on the receive thread; dependent
+ * actions that block should use the async variants of
+ * {@link CompletableFuture}. {@link #close()} must not race with
+ * {@link #request}.
+ */
+public final class RequestClient implements Closeable {
+    static {
+        CanSocket.loadNativeLibrary();
+    }
+
+    /** mask comparing the whole id including the EFF and RTR flags */
+    public static final int EXACT_MASK = 0xdfffffff;
+    public static final long DEFAULT_TICK_NANOS =
+            TimeUnit.MILLISECONDS.toNanos(1);
+    public static final int DEFAULT_WHEEL_SLOTS = 512;
+
+    private static final int BATCH_SIZE = 64;
+
+    private static native long _create();
+    private static native void _free(final long matcher);
+    private static native void _expect(final long matcher, final int request,
+            final int ifIndex, final int canId, final int mask);
+    private static native boolean _cancel(final long matcher,
+            final int request);
+    private static native long _unmatched(final long matcher);
+    private static native int _receive(final long matcher, final int fd,
+            final long stats, final long timeoutNanos, final int[] requests,
+            final int[] ifIndices, final int[] canIds, final byte[] dlcs,
+            final byte[] data) throws IOException;
+
+    private static final class Request {
+        final int id;
+        final long timeoutNanos;
+        final CompletableFuture<CanFrame> future =
+                new CompletableFuture<CanFrame>();
+
+        Request(final int id, final long timeoutNanos) {
+            this.id = id;
+            this.timeoutNanos = timeoutNanos;
+        }
+    }
+
+    private final CanSocket socket;
+    private final TimerWheel<Request> wheel;
+    private final Map<Integer, Request> pending =
+            new ConcurrentHashMap<Integer, Request>();
+    private final AtomicInteger nextId = new AtomicInteger();
+    private final Thread thread;
+    private volatile long _matcher;
+    private volatile boolean running = true;
+    private volatile IOException failure;
+
+    public RequestClient(final CanSocket socket) {
+        this(socket, DEFAULT_TICK_NANOS, DEFAULT_WHEEL_SLOTS);
+    }
+
+    /**
+     * @param tickNanos resolution of the timeouts
+     * @param wheelSlots timer wheel size, a power of two
+     */
+    public RequestClient(final CanSocket socket, final long tickNanos,
+            final int wheelSlots) {
+        this.socket = Objects.requireNonNull(socket);
+        this.wheel = new TimerWheel<Request>(tickNanos, wheelSlots,
+                System.nanoTime());
+        this._matcher = _create();
+        this.thread = new Thread(new Runnable() {
+            @Override
+            public void run() {
+                receiveLoop();
+            }
+        }, "can-request-client");
+        this.thread.setDaemon(true);
+        this.thread.start();
+    }
+
+    private long handle() {
+        final long matcher = _matcher;
+        if (matcher == 0) {
+            throw new IllegalStateException("request client closed");
+        }
+        return matcher;
+    }
+
+    /**
+     * Sends {@code request} and waits for a frame whose raw can_id matches
+     * {@code responseId} in the bits set in {@code responseMask}, on the
+     * interface the request was sent to unless that is 0.
+     */
+    public CompletableFuture<CanFrame> request(final CanFrame request,
+            final int responseId, final int responseMask, final long timeout,
+            final TimeUnit unit) {
+        final long matcher = handle();
+        final Request r = new Request(nextId.getAndIncrement() & 0x7fffffff,
+                unit.toNanos(timeout));
+        pending.put(r.id, r);
+        /* expect before sending, the response may beat send() back */
+        _expect(matcher, r.id,
+                request.getCanInterfacae().getInterfaceIndex(), responseId,
+                responseMask);
+        wheel.schedule(r, System.nanoTime() + r.timeoutNanos);
+        try {
+            socket.send(request);
+        } catch (final IOException e) {
+            if (pending.remove(r.id) != null) {
+                _cancel(matcher, r.id);
+            }
+            r.future.completeExceptionally(e);
+        }
+        return r.future;
+    }
+
+    /** Like {@link #request(CanFrame, int, int, long, TimeUnit)} for one id. */
+    public CompletableFuture<CanFrame> request(final CanFrame request,
+            final CanId responseId, final long timeout, final TimeUnit unit) {
+        return request(request, responseId._canId, EXACT_MASK, timeout, unit);
+    }
+
+    /** number of requests waiting for a response */
+    public int getPendingCount() {
+        return pending.size();
+    }
+
+    /** frames received that no request was waiting for */
+    public long getUnmatchedFrames() {
+        return _unmatched(handle());
+    }
+
+    /** @return the error that stopped the receive thread, if any */
+    public IOException getFailure() {
+        return failure;
+    }
+
+    private void receiveLoop() {
+        final int[] requests = new int[BATCH_SIZE];
+        final CanFrameBatch batch = new CanFrameBatch(BATCH_SIZE);
+        final TimerWheel.Handler<Request> onTimeout =
+                new TimerWheel.Handler<Request>() {
+            @Override
+            public void onTimeout(final Request r) {
+                if (pending.remove(r.id, r)) {
+                    _cancel(_matcher, r.id);
+                    r.future.completeExceptionally(new TimeoutException(
+                            "no response within " + r.timeoutNanos + " ns"));
+                }
+            }
+        };
+        try {
+            while (running) {
+                socket.acquire();
+                try {
+                    batch.size = _receive(_matcher, socket._fd,
+                            socket._stats,
+                            wheel.nanosToNextTick(System.nanoTime()),
+                            requests, batch.ifIndex, batch.canId, batch.dlc,
+                            batch.data);
+                } finally {
+                    socket.release();
+                }
+                for (int i = 0; i < batch.size; i++) {
+                    final Request r = pending.remove(requests[i]);
+                    if (r != null) {
+                        r.future.complete(batch.getFrame(i));
+                    }
+                }
+                wheel.expire(System.nanoTime(), onTimeout);
+            }
+        } catch (final IOException e) {
+            if (running) {
+                failure = e;
+                failAll(e);
+            }
+        }
+    }
+
+    private void failAll(final Throwable cause) {
+        for (final Request r : pending.values()) {
+            if (pending.remove(r.id, r)) {
+                r.future.completeExceptionally(cause);
+            }
+        }
+    }
+
+    /**
+     * Stops the receive thread, which takes at most one tick, and fails all
+     * outstanding requests. The socket stays open.
+     */
+    @Override
+    public synchronized void close() throws IOException {
+        if (_matcher == 0) {
+            return;
+        }
+        running = false;
+        try {
+            thread.join();
+        } catch (final InterruptedException e) {
+            Thread.currentThread().interrupt();
+            throw new IOException("interrupted while stopping client", e);
+        }
+        failAll(new IOException("request client closed"));
+        final long matcher = _matcher;
+        _matcher = 0;
+        _free(matcher);
+    }
+}
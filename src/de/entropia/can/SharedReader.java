@@ -0,0 +1,285 @@
+package de.entropia.can;
+
+import java.io.Closeable;
+import java.io.IOException;
+import java.util.ArrayList;
+import java.util.Collections;
+import java.util.Objects;
+import java.util.Set;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.TimeUnit;
+
+/**
+ * Fans the frames of one {@link CanSocket} out to many in-process
+ * subscribers.
+ *
+ * A native reader thread receives from the socket in bursts and hands
+ * every frame to the subscriptions whose id/mask filter it passes, so any
+ * number of consumers cost one kernel socket and one stream of receive
+ * calls. Filters have the semantics of {@link CanSocket#setFilters} and
+ * are compiled like {@link FrameFilter}. Each subscription has a bounded
+ * lock-free queue drained by {@link Subscription#poll}; what happens when
+ * it is full is chosen per subscription by its {@link OverflowPolicy}.
+ *
+ * The socket must stay open until the reader is closed and should not be
+ * read by anyone else. Each subscription must be polled by one thread at
+ * a time, and closing it must not race with {@link Subscription#poll}.
+ */
+public final class SharedReader implements Closeable {
+    static {
+        CanSocket.loadNativeLibrary();
+    }
+
+    public static final int DEFAULT_CAPACITY = 1024;
+
+    /** what the reader does with a frame for a full subscription queue */
+    public enum OverflowPolicy {
+        /** queue the frame and drop the oldest queued one */
+        DROP_OLDEST,
+        /** drop the frame */
+        DROP_NEWEST,
+        /**
+         * wait until the subscriber makes room; a subscriber that stops
+         * polling stalls every subscription of the reader
+         */
+        BLOCK
+    }
+
+    private static native long _create(final int fd, final long stats)
+            throws IOException;
+    private static native void _destroy(final long reader);
+    private static native long _subscribe(final long reader,
+            final int[] canIds, final int[] masks, final int capacity,
+            final int policy) throws IOException;
+    private static native void _unsubscribe(final long reader,
+            final long subscriber);
+    private static native int _poll(final long subscriber,
+            final long timeoutNanos, final int[] ifIndices,
+            final int[] canIds, final byte[] dlcs, final byte[] data)
+            throws IOException;
+    private static native void _stats(final long reader, final long[] stats);
+    private static native void _subscriptionStats(final long subscriber,
+            final long[] stats);
+
+    private static final int STAT_FRAMES = 0;
+    private static final int STAT_UNMATCHED = 1;
+    private static final int STAT_DELIVERIES = 2;
+    private static final int STAT_MALFORMED = 3;
+    private static final int STAT_LAST_ERRNO = 4;
+    private static final int STAT_FIELDS = 5;
+
+    private static final int SUB_QUEUED = 0;
+    private static final int SUB_DROPPED = 1;
+    private static final int SUB_BLOCKED = 2;
+    private static final int SUB_DEPTH = 3;
+    private static final int SUB_FIELDS = 4;
+
+    /** Snapshot of the reader counters. */
+    public final static class Stats {
+        private final long[] v;
+
+        private Stats(final long[] v) {
+            this.v = v;
+        }
+
+        /** frames received from the socket */
+        public long getFrames() {
+            return v[STAT_FRAMES];
+        }
+
+        /** frames no subscription was interested in */
+        public long getUnmatched() {
+            return v[STAT_UNMATCHED];
+        }
+
+        /** frames queued to subscriptions, counting each one */
+        public long getDeliveries() {
+            return v[STAT_DELIVERIES];
+        }
+
+        public long getMalformed() {
+            return v[STAT_MALFORMED];
+        }
+
+        /** errno that stopped the reader, 0 while it runs */
+        public int getLastErrno() {
+            return (int) v[STAT_LAST_ERRNO];
+        }
+
+        @Override
+        public String toString() {
+            return "Stats [frames=" + getFrames() + ", unmatched="
+                    + getUnmatched() + ", deliveries=" + getDeliveries()
+                    + ", malformed=" + getMalformed() + ", lastErrno="
+                    + getLastErrno() + "]";
+        }
+    }
+
+    /** Frames of one subscriber, see {@link SharedReader#subscribe}. */
+    public final class Subscription implements Closeable {
+        private final OverflowPolicy policy;
+        private volatile long _subscriber;
+
+        private Subscription(final long subscriber,
+                final OverflowPolicy policy) {
+            this._subscriber = subscriber;
+            this.policy = policy;
+        }
+
+        private long handle() {
+            final long subscriber = _subscriber;
+            if (subscriber == 0) {
+                throw new IllegalStateException("subscription closed");
+            }
+            return subscriber;
+        }
+
+        public OverflowPolicy getPolicy() {
+            return policy;
+        }
+
+        /**
+         * Moves queued frames into {@code batch}, waiting up to
+         * {@code timeout} for the first one; a negative timeout waits
+         * indefinitely.
+         *
+         * @return the number of frames, 0 on timeout
+         * @throws IOException if the reader failed and the queue is empty
+         */
+        public int poll(final CanFrameBatch batch, final long timeout,
+                final TimeUnit unit) throws IOException {
+            final long subscriber = handle();
+            final long timeoutNanos = unit.toNanos(timeout);
+            final long deadline = System.nanoTime() + timeoutNanos;
+            long remaining = timeoutNanos;
+            for (;;) {
+                batch.size = _poll(subscriber, remaining, batch.ifIndex,
+                        batch.canId, batch.dlc, batch.data);
+                if (batch.size > 0 || remaining == 0) {
+                    return batch.size;
+                }
+                if (timeoutNanos > 0) {
+                    remaining = Math.max(0, deadline - System.nanoTime());
+                }
+            }
+        }
+
+        /** frames queued for this subscription since it was created */
+        public long getQueued() {
+            return subscriptionStats()[SUB_QUEUED];
+        }
+
+        /** frames lost to a full queue */
+        public long getDropped() {
+            return subscriptionStats()[SUB_DROPPED];
+        }
+
+        /** times the reader waited for room, {@link OverflowPolicy#BLOCK} */
+        public long getBlocked() {
+            return subscriptionStats()[SUB_BLOCKED];
+        }
+
+        /** frames waiting to be polled */
+        public long getDepth() {
+            return subscriptionStats()[SUB_DEPTH];
+        }
+
+        private long[] subscriptionStats() {
+            final long[] stats = new long[SUB_FIELDS];
+            _subscriptionStats(handle(), stats);
+            return stats;
+        }
+
+        /** Stops delivery to this subscription, queued frames are lost. */
+        @Override
+        public void close() {
+            synchronized (SharedReader.this) {
+                if (_subscriber != 0) {
+                    final long subscriber = _subscriber;
+                    _subscriber = 0;
+                    subscriptions.remove(this);
+                    _unsubscribe(_reader, subscriber);
+                }
+            }
+        }
+    }
+
+    private final CanSocket socket;
+    private final Set<Subscription> subscriptions = Collections
+            .newSetFromMap(new ConcurrentHashMap<Subscription, Boolean>());
+    private volatile long _reader;
+
+    /** Starts the reader thread on {@code socket}. */
+    public SharedReader(final CanSocket socket) throws IOException {
+        this.socket = socket;
+        /* the descriptor stays pinned until the reader is closed */
+        socket.acquire();
+        try {
+            this._reader = _create(socket._fd, socket._stats);
+        } catch (final IOException | RuntimeException | Error e) {
+            socket.release();
+            throw e;
+        }
+    }
+
+    public CanSocket getSocket() {
+        return socket;
+    }
+
+    private long handle() {
+        final long reader = _reader;
+        if (reader == 0) {
+            throw new IllegalStateException("reader closed");
+        }
+        return reader;
+    }
+
+    /**
+     * Subscribes to the frames passing any of the id/mask pairs.
+     *
+     * @param capacity queue size in frames, a power of two
+     */
+    public Subscription subscribe(final int[] canIds, final int[] masks,
+            final int capacity, final OverflowPolicy policy)
+            throws IOException {
+        return register(Objects.requireNonNull(canIds),
+                Objects.requireNonNull(masks), capacity, policy);
+    }
+
+    /** Subscribes to every frame received, error frames included. */
+    public Subscription subscribeAll(final int capacity,
+            final OverflowPolicy policy) throws IOException {
+        return register(null, null, capacity, policy);
+    }
+
+    private synchronized Subscription register(final int[] canIds,
+            final int[] masks, final int capacity,
+            final OverflowPolicy policy) throws IOException {
+        final Subscription s = new Subscription(_subscribe(handle(), canIds,
+                masks, capacity, policy.ordinal()), policy);
+        subscriptions.add(s);
+        return s;
+    }
+
+    public Stats getStats() {
+        final long[] stats = new long[STAT_FIELDS];
+        _stats(handle(), stats);
+        return new Stats(stats);
+    }
+
+    /** Closes all subscriptions and stops the reader thread. */
+    @Override
+    public synchronized void close() {
+        if (_reader == 0) {
+            return;
+        }
+        for (final Subscription s : new ArrayList<Subscription>(
+                subscriptions)) {
+            s.close();
+        }
+        final long reader = _reader;
+        _reader = 0;
+        _destroy(reader);
+        socket.release();
+    }
+}
@@ -0,0 +1,197 @@
+package de.entropia.can;
+
+import java.io.Closeable;
+import java.util.HashMap;
+import java.util.List;
+import java.util.Map;
+import java.util.Objects;
+
+import de.entropia.can.DbcDatabase.Message;
+import de.entropia.can.DbcDatabase.Signal;
+
+/**
+ * Decodes the signals of a {@link DbcDatabase} from whole
+ * {@link CanFrameBatch}es into one primitive column per signal.
+ *
+ * On construction every message is compiled into a native plan that reduces
+ * each signal to a single shift and mask of the payload read as 64 bit word
+ * (byte swapped for Motorola signals), followed by sign extension and
+ * scaling. Decoding a batch first gathers the payload words of the matching
+ * frames and then runs one tight loop per signal over them, which the
+ * compiler turns into vector code.
+ *
+ * Decoding from several threads is fine as long as each thread uses its own
+ * {@link Columns}; {@link #close()} must not race with {@link #decode}.
+ */
+public final class SignalDecoder implements Closeable {
+    static {
+        CanSocket.loadNativeLibrary();
+    }
+
+    /* per signal entries of the layout array passed to _compile */
+    private static final int LAYOUT_FIELDS = 6;
+    private static final int MUX_NONE = 0;
+    private static final int MUX_SELECTOR = 1;
+    private static final int MUX_SELECTED = 2;
+
+    private static native long _compile(final int[] messageIds,
+            final int[] signalCounts, final int[] layout,
+            final double[] scaling);
+    private static native void _free(final long plan);
+    private static native int _decode(final long plan, final int message,
+            final int[] canIds, final byte[] data, final int count,
+            final int[] frameIndex, final long[][] raw,
+            final double[][] physical);
+
+    public final static class Columns {
+        private final Message message;
+        private final int messageIndex;
+        private final int[] frameIndex;
+        private final long[][] raw;
+        private final double[][] physical;
+        private int rows;
+
+        private Columns(final Message message, final int messageIndex,
+                final int capacity) {
+            final int signals = message.getSignals().size();
+            this.message = message;
+            this.messageIndex = messageIndex;
+            this.frameIndex = new int[capacity];
+            this.raw = new long[signals][capacity];
+            this.physical = new double[signals][capacity];
+        }
+
+        public Message getMessage() {
+            return message;
+        }
+
+        public int getCapacity() {
+            return frameIndex.length;
+        }
+
+        /** number of decoded frames, valid entries in every column */
+        public int getRows() {
+            return rows;
+        }
+
+        /** position of the frame of {@code row} in the decoded batch */
+        public int getFrameIndex(final int row) {
+            return frameIndex[row];
+        }
+
+        /**
+         * Raw signal values, sign extended for signed signals. The array
+         * is reused by the next decode call.
+         */
+        public long[] getRaw(final int signal) {
+            return raw[signal];
+        }
+
+        /**
+         * Scaled signal values; NaN for multiplexed signals that are not
+         * selected in the frame. The array is reused by the next decode call.
+         */
+        public double[] getPhysical(final int signal) {
+            return physical[signal];
+        }
+
+        public double[] getPhysical(final String signalName) {
+            final int i = message.indexOf(signalName);
+            if (i == -1) {
+                throw new IllegalArgumentException("no signal " + signalName
+                        + " in " + message.getName());
+            }
+            return physical[i];
+        }
+    }
+
+    private final DbcDatabase database;
+    private final Map<Integer, Integer> messageIndex = new HashMap<>();
+    private long _plan;
+
+    public SignalDecoder(final DbcDatabase database) {
+        this.database = Objects.requireNonNull(database);
+        final List<Message> messages = database.getMessages();
+        int totalSignals = 0;
+        for (final Message m : messages) {
+            totalSignals += m.getSignals().size();
+        }
+        final int[] ids = new int[messages.size()];
+        final int[] counts = new int[messages.size()];
+        final int[] layout = new int[totalSignals * LAYOUT_FIELDS];
+        final double[] scaling = new double[totalSignals * 2];
+        int s = 0;
+        for (int i = 0; i < messages.size(); i++) {
+            final Message m = messages.get(i);
+            ids[i] = m.getCanId();
+            counts[i] = m.getSignals().size();
+            messageIndex.put(m.getCanId(), i);
+            for (final Signal sig : m.getSignals()) {
+                final int l = s * LAYOUT_FIELDS;
+                layout[l] = sig.getStartBit();
+                layout[l + 1] = sig.getLength();
+                layout[l + 2] = sig.isLittleEndian() ? 1 : 0;
+                layout[l + 3] = sig.isSigned() ? 1 : 0;
+                layout[l + 4] = sig.isMultiplexor() ? MUX_SELECTOR
+                        : sig.getMultiplexValue() != Signal.NOT_MULTIPLEXED
+                                ? MUX_SELECTED : MUX_NONE;
+                layout[l + 5] = sig.getMultiplexValue();
+                scaling[s * 2] = sig.getFactor();
+                scaling[s * 2 + 1] = sig.getOffset();
+                s++;
+            }
+        }
+        this._plan = _compile(ids, counts, layout, scaling);
+    }
+
+    public DbcDatabase getDatabase() {
+        return database;
+    }
+
+    /**
+     * Allocates output columns for the message with id {@code canId}, able
+     * to hold {@code capacity} decoded frames.
+     */
+    public Columns newColumns(final int canId, final int capacity) {
+        final Integer idx = messageIndex.get(DbcDatabase.normalizeId(canId));
+        if (idx == null) {
+            throw new IllegalArgumentException("unknown message id 0x"
+                    + Integer.toHexString(canId));
+        }
+        return new Columns(database.getMessages().get(idx), idx, capacity);
+    }
+
+    public Columns newColumns(final String messageName, final int capacity) {
+        final Message m = database.getMessage(messageName);
+        if (m == null) {
+            throw new IllegalArgumentException("unknown message "
+                    + messageName);
+        }
+        return newColumns(m.getCanId(), capacity);
+    }
+
+    /**
+     * Decodes all frames of {@code batch} that belong to the message of
+     * {@code columns}.
+     *
+     * @return the number of decoded frames
+     */
+    public int decode(final CanFrameBatch batch, final Columns columns) {
+        if (_plan == 0) {
+            throw new IllegalStateException("decoder closed");
+        }
+        columns.rows = 0;
+        columns.rows = _decode(_plan, columns.messageIndex, batch.canId,
+                batch.data, batch.size, columns.frameIndex, columns.raw,
+                columns.physical);
+        return columns.rows;
+    }
+
+    @Override
+    public void close() {
+        if (_plan != 0) {
+            _free(_plan);
+            _plan = 0;
+        }
+    }
+}
@@ -0,0 +1,613 @@
+package de.entropia.can;
+
+import java.io.Closeable;
+import java.io.IOException;
+import java.io.InterruptedIOException;
+import java.util.ArrayDeque;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.Random;
+import java.util.concurrent.atomic.AtomicInteger;
+import java.util.concurrent.locks.LockSupport;
+
+import de.entropia.can.CanErrorEvent.ErrorClass;
+import de.entropia.can.CanSocket.CanFrame;
+import de.entropia.can.CanSocket.CanId;
+import de.entropia.can.CanSocket.CanInterface;
+
+/**
+ * In-process CAN bus with virtual nodes, for tests and benchmarks that
+ * should not depend on a kernel interface or its scheduling noise.
+ *
+ * Every {@link Node} is a {@link CanChannel} like a {@link CanSocket}
+ * bound to the bus. Each bus step arbitrates between the oldest pending
+ * frames of all nodes the way the wire does, lowest identifier bits first,
+ * and delivers the winner to every other node whose filters accept it.
+ * Time is virtual: a step advances the bus clock by the stuffed bit length
+ * of the frame at the configured bitrate, so timestamps and bus load are
+ * reproducible. With an error rate set, transmissions fail at random from
+ * a seeded generator; the sender retransmits like a controller, counts
+ * transmit errors and goes bus-off above 255.
+ *
+ * The bus is driven either explicitly with {@link #step} and
+ * {@link #runUntilIdle}, which is fully deterministic from one thread, or
+ * by a background thread started with {@link #start}, optionally paced to
+ * real time.
+ */
+public final class SimulatedCanBus implements Closeable {
+    public static final int DEFAULT_QUEUE_FRAMES = 256;
+
+    /* interface indices well above those the kernel hands out */
+    private static final AtomicInteger NEXT_IF_INDEX =
+            new AtomicInteger(1 << 20);
+
+    private static final int CAN_EFF_FLAG = 0x80000000;
+    private static final int CAN_RTR_FLAG = 0x40000000;
+    private static final int CAN_ERR_FLAG = 0x20000000;
+    private static final int CAN_SFF_MASK = 0x000007ff;
+    private static final int CAN_EFF_MASK = 0x1fffffff;
+    /* data[3] of a protocol error, linux/can/error.h */
+    private static final byte CAN_ERR_PROT_LOC_CRC_SEQ = 0x08;
+    /* CRC delimiter, ACK slot and delimiter, EOF and intermission */
+    private static final int UNSTUFFED_TAIL_BITS = 13;
+    /* error flag, delimiter and intermission after a failed frame */
+    private static final int ERROR_FRAME_BITS = 17;
+    private static final int BUS_OFF_LIMIT = 255;
+
+    private final int bitrate;
+    private final CanInterface canIf;
+    private final Random random;
+    private final List<Node> nodes = new ArrayList<Node>();
+    private double errorRate;
+    private long bits;
+    private long frames;
+    private long errorFrames;
+    private long arbitrationLosses;
+    private Thread driver;
+    private boolean running;
+
+    /**
+     * @param bitrate nominal bitrate in bit/s
+     * @param seed seed of the error injection
+     */
+    public SimulatedCanBus(final int bitrate, final long seed) {
+        if (bitrate <= 0) {
+            throw new IllegalArgumentException("bitrate must be positive");
+        }
+        this.bitrate = bitrate;
+        this.random = new Random(seed);
+        this.canIf = new CanInterface(NEXT_IF_INDEX.getAndIncrement());
+    }
+
+    /** the interface all frames on this bus are received from */
+    public CanInterface getInterface() {
+        return canIf;
+    }
+
+    public int getBitrate() {
+        return bitrate;
+    }
+
+    /** probability that a transmission is destroyed by a bus error */
+    public synchronized void setErrorRate(final double rate) {
+        if (rate < 0 || rate > 1) {
+            throw new IllegalArgumentException("rate must be in [0, 1]");
+        }
+        this.errorRate = rate;
+    }
+
+    public Node attach() {
+        return attach(DEFAULT_QUEUE_FRAMES, DEFAULT_QUEUE_FRAMES);
+    }
+
+    /**
+     * @param txFrames frames a node may queue for sending
+     * @param rxFrames frames a node buffers before dropping
+     */
+    public synchronized Node attach(final int txFrames, final int rxFrames) {
+        if (txFrames <= 0 || rxFrames <= 0) {
+            throw new IllegalArgumentException("queues must not be empty");
+        }
+        final Node node = new Node(txFrames, rxFrames);
+        nodes.add(node);
+        return node;
+    }
+
+    /** virtual time in nanoseconds since the bus was created */
+    public synchronized long getTimeNanos() {
+        return timeNanos(bits);
+    }
+
+    private long timeNanos(final long atBits) {
+        return atBits * 1000000000L / bitrate;
+    }
+
+    /** bit times the bus was busy, error frames included */
+    public synchronized long getBits() {
+        return bits;
+    }
+
+    /** frames delivered */
+    public synchronized long getFrames() {
+        return frames;
+    }
+
+    public synchronized long getErrorFrames() {
+        return errorFrames;
+    }
+
+    /** pending frames that had to wait for a higher priority one */
+    public synchronized long getArbitrationLosses() {
+        return arbitrationLosses;
+    }
+
+    /* CAN_EFF_FLAG and CAN_RTR_FLAG of the frame, data as sent */
+    private static int rawId(final CanFrame frame) {
+        return frame.getCanId()._canId;
+    }
+
+    /*
+     * The arbitration field as an unsigned number whose order is the bus
+     * priority: base id, RTR or SRR, IDE, extended id, RTR. Dominant bits
+     * are 0 and win.
+     */
+    private static long arbitrationKey(final int rawId) {
+        final boolean rtr = (rawId & CAN_RTR_FLAG) != 0;
+        if ((rawId & CAN_EFF_FLAG) == 0) {
+            return (long) (rawId & CAN_SFF_MASK) << 21 | (rtr ? 1L << 20 : 0);
+        }
+        final int id = rawId & CAN_EFF_MASK;
+        return (long) (id >>> 18) << 21 | 3L << 19 | (id & 0x3ffffL) << 1
+                | (rtr ? 1 : 0);
+    }
+
+    /* appends bits msb first to the unstuffed frame and its CRC */
+    private static final class BitWriter {
+        final boolean[] bits = new boolean[160];
+        int length;
+        int crc;
+
+        void put(final long value, final int count) {
+            for (int i = count - 1; i >= 0; i--) {
+                final boolean bit = ((value >>> i) & 1) != 0;
+                final boolean next = bit ^ ((crc >>> 14) & 1) != 0;
+                crc = (crc << 1) & 0x7fff;
+                if (next) {
+                    crc ^= 0x4599;
+                }
+                bits[length++] = bit;
+            }
+        }
+
+        void putCrc() {
+            final int value = crc;
+            for (int i = 14; i >= 0; i--) {
+                bits[length++] = ((value >>> i) & 1) != 0;
+            }
+        }
+
+        int stuffedLength() {
+            int stuffed = length;
+            int run = 0;
+            boolean last = false;
+            for (int i = 0; i < length; i++) {
+                if (i > 0 && bits[i] == last) {
+                    run++;
+                } else {
+                    run = 1;
+                }
+                last = bits[i];
+                if (run == 5) {
+                    /* the complementary stuff bit starts the next run */
+                    stuffed++;
+                    last = !last;
+                    run = 1;
+                }
+            }
+            return stuffed;
+        }
+    }
+
+    /**
+     * Length of a classic data or remote frame on the wire, stuff bits and
+     * intermission included.
+     */
+    public static int wireBits(final CanFrame frame) {
+        final int raw = rawId(frame);
+        final boolean rtr = (raw & CAN_RTR_FLAG) != 0;
+        final byte[] data = frame.getData();
+        final BitWriter w = new BitWriter();
+        w.put(0, 1);
+        if ((raw & CAN_EFF_FLAG) == 0) {
+            w.put(raw & CAN_SFF_MASK, 11);
+            w.put(rtr ? 1 : 0, 1);
+            w.put(0, 2);
+        } else {
+            final int id = raw & CAN_EFF_MASK;
+            w.put(id >>> 18, 11);
+            w.put(3, 2);
+            w.put(id & 0x3ffff, 18);
+            w.put(rtr ? 1 : 0, 1);
+            w.put(0, 2);
+        }
+        w.put(data.length, 4);
+        if (!rtr) {
+            for (final byte b : data) {
+                w.put(b & 0xff, 8);
+            }
+        }
+        w.putCrc();
+        return w.stuffedLength() + UNSTUFFED_TAIL_BITS;
+    }
+
+    /**
+     * Transmits one frame: the winner of the arbitration between all
+     * nodes with pending frames.
+     *
+     * @return false if no node had anything to send
+     */
+    public synchronized boolean step() {
+        Node winner = null;
+        long winnerKey = 0;
+        int contenders = 0;
+        for (final Node node : nodes) {
+            final CanFrame head = node.tx.peek();
+            if (head == null) {
+                continue;
+            }
+            contenders++;
+            final long key = arbitrationKey(rawId(head));
+            if (winner == null || key < winnerKey) {
+                winner = node;
+                winnerKey = key;
+            }
+        }
+        if (winner == null) {
+            return false;
+        }
+        arbitrationLosses += contenders - 1;
+        final CanFrame frame = winner.tx.peek();
+        final int frameBits = wireBits(frame);
+        if (errorRate > 0 && random.nextDouble() < errorRate) {
+            bits += frameBits + ERROR_FRAME_BITS;
+            errorFrames++;
+            winner.transmitErrors += 8;
+            deliverError(CAN_ERR_FLAG | ErrorClass.PROTOCOL.mask()
+                    | ErrorClass.ERROR_COUNTERS.mask(), winner.transmitErrors);
+            if (winner.transmitErrors > BUS_OFF_LIMIT) {
+                winner.busOff = true;
+                winner.dropped += winner.tx.size();
+                winner.tx.clear();
+                deliverError(CAN_ERR_FLAG | ErrorClass.BUS_OFF.mask(),
+                        winner.transmitErrors);
+            }
+            notifyAll();
+            return true;
+        }
+        winner.tx.poll();
+        winner.transmitErrors = Math.max(0, winner.transmitErrors - 1);
+        bits += frameBits;
+        frames++;
+        final long now = timeNanos(bits);
+        final int raw = rawId(frame);
+        final CanFrame received = new CanFrame(canIf, frame.getCanId(),
+                frame.getData());
+        for (final Node node : nodes) {
+            if ((node != winner || node.recvOwnMsgs) && node.accepts(raw)) {
+                node.deliver(received, now);
+            }
+        }
+        notifyAll();
+        return true;
+    }
+
+    private void deliverError(final int canId, final int transmitErrors) {
+        final byte[] data = new byte[8];
+        data[3] = CAN_ERR_PROT_LOC_CRC_SEQ;
+        data[6] = (byte) Math.min(transmitErrors, 255);
+        final CanFrame frame = new CanFrame(canIf, new CanId(canId), data);
+        final long now = timeNanos(bits);
+        for (final Node node : nodes) {
+            if (node.receiveErrors) {
+                node.deliver(frame, now);
+            }
+        }
+    }
+
+    /** @return the number of steps until no node has frames pending */
+    public synchronized int runUntilIdle() {
+        int n = 0;
+        while (step()) {
+            n++;
+        }
+        return n;
+    }
+
+    /**
+     * Starts a thread that steps whenever frames are pending.
+     *
+     * @param realTime pace the steps to the bitrate instead of running as
+     *            fast as possible
+     */
+    public synchronized void start(final boolean realTime) {
+        if (driver != null) {
+            throw new IllegalStateException("bus already started");
+        }
+        running = true;
+        driver = new Thread(new Runnable() {
+            @Override
+            public void run() {
+                drive(realTime);
+            }
+        }, "SimulatedCanBus");
+        driver.setDaemon(true);
+        driver.start();
+    }
+
+    private void drive(final boolean realTime) {
+        final long origin = System.nanoTime();
+        final long originBits;
+        synchronized (this) {
+            originBits = bits;
+        }
+        for (;;) {
+            final long due;
+            synchronized (this) {
+                try {
+                    while (running && !step()) {
+                        wait();
+                    }
+                } catch (final InterruptedException e) {
+                    return;
+                }
+                if (!running) {
+                    return;
+                }
+                due = origin + timeNanos(bits - originBits);
+            }
+            if (realTime) {
+                long delay;
+                while ((delay = due - System.nanoTime()) > 0) {
+                    LockSupport.parkNanos(delay);
+                }
+            }
+        }
+    }
+
+    /** Stops the driver thread and closes all nodes. */
+    @Override
+    public void close() {
+        final Thread t;
+        synchronized (this) {
+            running = false;
+            t = driver;
+            driver = null;
+            for (final Node node : nodes) {
+                node.closed = true;
+            }
+            nodes.clear();
+            notifyAll();
+        }
+        if (t != null) {
+            boolean interrupted = false;
+            while (t.isAlive()) {
+                try {
+                    t.join();
+                } catch (final InterruptedException e) {
+                    interrupted = true;
+                }
+            }
+            if (interrupted) {
+                Thread.currentThread().interrupt();
+            }
+        }
+    }
+
+    /** A virtual controller on the bus, see {@link SimulatedCanBus#attach}. */
+    public final class Node implements CanChannel {
+        private final int txCapacity;
+        private final int rxCapacity;
+        private final ArrayDeque<CanFrame> tx = new ArrayDeque<CanFrame>();
+        private final ArrayDeque<CanFrame> rx = new ArrayDeque<CanFrame>();
+        private final ArrayDeque<Long> rxTimes = new ArrayDeque<Long>();
+        private int[] filterIds;
+        private int[] filterMasks;
+        private boolean recvOwnMsgs;
+        private boolean receiveErrors;
+        private boolean busOff;
+        private boolean closed;
+        private int transmitErrors;
+        private long dropped;
+        private long lastTimestamp;
+
+        private Node(final int txCapacity, final int rxCapacity) {
+            this.txCapacity = txCapacity;
+            this.rxCapacity = rxCapacity;
+        }
+
+        public SimulatedCanBus getBus() {
+            return SimulatedCanBus.this;
+        }
+
+        private boolean accepts(final int raw) {
+            if ((raw & CAN_ERR_FLAG) != 0) {
+                return receiveErrors;
+            }
+            if (filterIds == null) {
+                return true;
+            }
+            for (int i = 0; i < filterIds.length; i++) {
+                if ((raw & filterMasks[i]) == (filterIds[i] & filterMasks[i])) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        private void deliver(final CanFrame frame, final long time) {
+            if (rx.size() == rxCapacity) {
+                dropped++;
+                return;
+            }
+            rx.add(frame);
+            rxTimes.add(time);
+        }
+
+        private CanFrame take() {
+            lastTimestamp = rxTimes.poll();
+            return rx.poll();
+        }
+
+        private void checkOpen() throws IOException {
+            if (closed) {
+                throw new IOException("node closed");
+            }
+        }
+
+        /** Like {@link CanSocket#setFilters}, null ids accept every frame. */
+        public void setFilters(final int[] canIds, final int[] masks) {
+            if (canIds != null && (masks == null
+                    || masks.length != canIds.length)) {
+                throw new IllegalArgumentException("ids and masks differ");
+            }
+            synchronized (SimulatedCanBus.this) {
+                filterIds = canIds == null ? null : canIds.clone();
+                filterMasks = masks == null ? null : masks.clone();
+            }
+        }
+
+        public void setRecvOwnMsgsMode(final boolean on) {
+            synchronized (SimulatedCanBus.this) {
+                recvOwnMsgs = on;
+            }
+        }
+
+        /** deliver error frames of the bus, see {@link CanErrorEvent} */
+        public void setReceiveErrors(final boolean on) {
+            synchronized (SimulatedCanBus.this) {
+                receiveErrors = on;
+            }
+        }
+
+        @Override
+        public void send(final CanFrame frame) throws IOException {
+            final int status = trySend(frame);
+            if (status == -CanSocket.ENOBUFS) {
+                throw new IOException("No buffer space available");
+            } else if (status < 0) {
+                throw new IOException("Network is down");
+            }
+        }
+
+        /**
+         * Queues {@code frame} for arbitration.
+         *
+         * @return 1, -ENOBUFS if the transmit queue is full, or -ENETDOWN
+         *         while the node is bus-off
+         */
+        @Override
+        public int trySend(final CanFrame frame) throws IOException {
+            synchronized (SimulatedCanBus.this) {
+                checkOpen();
+                if (busOff) {
+                    return -CanSocket.ENETDOWN;
+                }
+                if (tx.size() == txCapacity) {
+                    return -CanSocket.ENOBUFS;
+                }
+                tx.add(frame);
+                SimulatedCanBus.this.notifyAll();
+                return 1;
+            }
+        }
+
+        @Override
+        public CanFrame recv() throws IOException {
+            synchronized (SimulatedCanBus.this) {
+                awaitFrame();
+                return take();
+            }
+        }
+
+        private void awaitFrame() throws IOException {
+            while (rx.isEmpty()) {
+                checkOpen();
+                try {
+                    SimulatedCanBus.this.wait();
+                } catch (final InterruptedException e) {
+                    Thread.currentThread().interrupt();
+                    throw new InterruptedIOException();
+                }
+            }
+        }
+
+        private int drain(final CanFrameBatch batch) {
+            batch.clear();
+            while (!rx.isEmpty() && batch.add(rx.peek())) {
+                take();
+            }
+            return batch.size;
+        }
+
+        @Override
+        public int recv(final CanFrameBatch batch) throws IOException {
+            synchronized (SimulatedCanBus.this) {
+                awaitFrame();
+                return drain(batch);
+            }
+        }
+
+        @Override
+        public int tryRecv(final CanFrameBatch batch) throws IOException {
+            synchronized (SimulatedCanBus.this) {
+                checkOpen();
+                batch.clear();
+                return rx.isEmpty() ? -CanSocket.EAGAIN : drain(batch);
+            }
+        }
+
+        /** bus time of the last frame received, see {@link #getTimeNanos} */
+        public long getLastTimestampNanos() {
+            synchronized (SimulatedCanBus.this) {
+                return lastTimestamp;
+            }
+        }
+
+        /** the transmit error counter of the controller */
+        public int getTransmitErrors() {
+            synchronized (SimulatedCanBus.this) {
+                return transmitErrors;
+            }
+        }
+
+        public boolean isBusOff() {
+            synchronized (SimulatedCanBus.this) {
+                return busOff;
+            }
+        }
+
+        /** Leaves bus-off with cleared error counters. */
+        public void restart() {
+            synchronized (SimulatedCanBus.this) {
+                busOff = false;
+                transmitErrors = 0;
+            }
+        }
+
+        /** frames lost to a full receive queue or to bus-off */
+        public long getDropped() {
+            synchronized (SimulatedCanBus.this) {
+                return dropped;
+            }
+        }
+
+        @Override
+        public void close() {
+            synchronized (SimulatedCanBus.this) {
+                closed = true;
+                nodes.remove(this);
+                SimulatedCanBus.this.notifyAll();
+            }
+        }
+    }
+}
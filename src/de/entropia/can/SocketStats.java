@@ -0,0 +1,101 @@
+package de.entropia.can;
+
+/**
+ * Reusable snapshot of the I/O counters of a {@link CanSocket}.
+ *
+ * The counters are kept in native code on every send and receive and cost
+ * a few relaxed atomic increments on a cache line private to the calling
+ * thread. Native call durations are sampled, one in 64 calls per thread is
+ * timed; for blocking receives the time includes waiting for frames.
+ */
+public final class SocketStats {
+    static final int FRAMES_IN = 0;
+    static final int BYTES_IN = 1;
+    static final int FRAMES_OUT = 2;
+    static final int BYTES_OUT = 3;
+    static final int RECV_CALLS = 4;
+    static final int SEND_CALLS = 5;
+    static final int WOULD_BLOCK = 6;
+    static final int NO_BUFFER = 7;
+    static final int RECV_NANOS = 8;
+    static final int RECV_SAMPLES = 9;
+    static final int SEND_NANOS = 10;
+    static final int SEND_SAMPLES = 11;
+    static final int EXCEPTIONS = 12;
+    static final int FIELDS = 13;
+
+    final long[] v = new long[FIELDS];
+
+    public long getFramesIn() {
+        return v[FRAMES_IN];
+    }
+
+    /** payload bytes received */
+    public long getBytesIn() {
+        return v[BYTES_IN];
+    }
+
+    public long getFramesOut() {
+        return v[FRAMES_OUT];
+    }
+
+    /** payload bytes sent */
+    public long getBytesOut() {
+        return v[BYTES_OUT];
+    }
+
+    /** receive system calls issued */
+    public long getRecvCalls() {
+        return v[RECV_CALLS];
+    }
+
+    /** send system calls issued */
+    public long getSendCalls() {
+        return v[SEND_CALLS];
+    }
+
+    public double getFramesPerRecvCall() {
+        return v[RECV_CALLS] == 0 ? 0 : (double) v[FRAMES_IN] / v[RECV_CALLS];
+    }
+
+    public double getFramesPerSendCall() {
+        return v[SEND_CALLS] == 0 ? 0
+                : (double) v[FRAMES_OUT] / v[SEND_CALLS];
+    }
+
+    /** calls that returned EAGAIN, e.g. while spinning */
+    public long getWouldBlockCount() {
+        return v[WOULD_BLOCK];
+    }
+
+    /** sends that failed with ENOBUFS */
+    public long getNoBufferCount() {
+        return v[NO_BUFFER];
+    }
+
+    /** mean duration of the sampled native receive calls */
+    public long getMeanRecvNanos() {
+        return v[RECV_SAMPLES] == 0 ? 0 : v[RECV_NANOS] / v[RECV_SAMPLES];
+    }
+
+    /** mean duration of the sampled native send calls */
+    public long getMeanSendNanos() {
+        return v[SEND_SAMPLES] == 0 ? 0 : v[SEND_NANOS] / v[SEND_SAMPLES];
+    }
+
+    /** exceptions thrown by native send and receive calls */
+    public long getExceptions() {
+        return v[EXCEPTIONS];
+    }
+
+    @Override
+    public String toString() {
+        return "SocketStats [framesIn=" + getFramesIn() + ", framesOut="
+                + getFramesOut() + ", recvCalls=" + getRecvCalls()
+                + ", sendCalls=" + getSendCalls() + ", wouldBlock="
+                + getWouldBlockCount() + ", noBuffer=" + getNoBufferCount()
+                + ", meanRecvNanos=" + getMeanRecvNanos()
+                + ", meanSendNanos=" + getMeanSendNanos() + ", exceptions="
+                + getExceptions() + "]";
+    }
+}
@@ -0,0 +1,101 @@
+package de.entropia.can;
+
+import jdk.jfr.Category;
+import jdk.jfr.DataAmount;
+import jdk.jfr.Description;
+import jdk.jfr.Event;
+import jdk.jfr.FlightRecorder;
+import jdk.jfr.Label;
+import jdk.jfr.Name;
+import jdk.jfr.Period;
+import jdk.jfr.StackTrace;
+import jdk.jfr.Timespan;
+
+/**
+ * Periodic JFR event with the counters of every open {@link CanSocket}.
+ * Counters are totals since the socket was opened.
+ */
+@Name("de.entropia.can.SocketStats")
+@Label("CAN Socket Statistics")
+@Category({ "SocketCAN" })
+@Description("I/O counters of an open CAN socket")
+@Period("1 s")
+@StackTrace(false)
+final class SocketStatsEvent extends Event {
+    @Label("File Descriptor")
+    int fd;
+
+    @Label("Interface")
+    String interfaceName;
+
+    @Label("Frames In")
+    long framesIn;
+
+    @Label("Bytes In")
+    @DataAmount
+    long bytesIn;
+
+    @Label("Frames Out")
+    long framesOut;
+
+    @Label("Bytes Out")
+    @DataAmount
+    long bytesOut;
+
+    @Label("Receive Calls")
+    long recvCalls;
+
+    @Label("Send Calls")
+    long sendCalls;
+
+    @Label("Would Block")
+    long wouldBlock;
+
+    @Label("No Buffer Space")
+    long noBuffer;
+
+    @Label("Mean Receive Time")
+    @Timespan(Timespan.NANOSECONDS)
+    long meanRecvNanos;
+
+    @Label("Mean Send Time")
+    @Timespan(Timespan.NANOSECONDS)
+    long meanSendNanos;
+
+    @Label("Exceptions")
+    long exceptions;
+
+    private static void emit() {
+        final SocketStats stats = new SocketStats();
+        for (final CanSocket socket : CanSocket.openSockets()) {
+            if (!socket.getStats(stats)) {
+                continue;
+            }
+            final SocketStatsEvent event = new SocketStatsEvent();
+            event.fd = socket._fd;
+            event.interfaceName = socket.getBoundInterfaceName();
+            event.framesIn = stats.getFramesIn();
+            event.bytesIn = stats.getBytesIn();
+            event.framesOut = stats.getFramesOut();
+            event.bytesOut = stats.getBytesOut();
+            event.recvCalls = stats.getRecvCalls();
+            event.sendCalls = stats.getSendCalls();
+            event.wouldBlock = stats.getWouldBlockCount();
+            event.noBuffer = stats.getNoBufferCount();
+            event.meanRecvNanos = stats.getMeanRecvNanos();
+            event.meanSendNanos = stats.getMeanSendNanos();
+            event.exceptions = stats.getExceptions();
+            event.commit();
+        }
+    }
+
+    static void register() {
+        FlightRecorder.addPeriodicEvent(SocketStatsEvent.class,
+                new Runnable() {
+            @Override
+            public void run() {
+                emit();
+            }
+        });
+    }
+}
@@ -0,0 +1,112 @@
+package de.entropia.can;
+
+import java.util.concurrent.ConcurrentLinkedQueue;
+
+/**
+ * Hashed timer wheel for large numbers of short timeouts.
+ *
+ * Any thread may {@link #schedule} a timeout; a single thread calls
+ * {@link #expire} at least once per tick. Scheduling is a queue insertion
+ * and expiring costs one bucket per elapsed tick, independent of the
+ * number of pending timeouts. Timeouts fire up to one tick late.
+ */
+final class TimerWheel<T> {
+
+    interface Handler<T> {
+        void onTimeout(T item);
+    }
+
+    private static final class Timeout<T> {
+        final T item;
+        final long deadline;
+        long rounds;
+        Timeout<T> next;
+
+        Timeout(final T item, final long deadline) {
+            this.item = item;
+            this.deadline = deadline;
+        }
+    }
+
+    private final long tickNanos;
+    private final Timeout<T>[] buckets;
+    private final int mask;
+    private final long startNanos;
+    private final ConcurrentLinkedQueue<Timeout<T>> inbox =
+            new ConcurrentLinkedQueue<Timeout<T>>();
+    private long tick;
+
+    /**
+     * @param slots number of buckets, a power of two; a tick times slots
+     *        should cover the usual timeouts
+     */
+    @SuppressWarnings("unchecked")
+    TimerWheel(final long tickNanos, final int slots, final long nowNanos) {
+        if (tickNanos <= 0) {
+            throw new IllegalArgumentException("tick must be positive");
+        }
+        if (slots <= 0 || (slots & (slots - 1)) != 0) {
+            throw new IllegalArgumentException("slots must be a power of two");
+        }
+        this.tickNanos = tickNanos;
+        this.buckets = new Timeout[slots];
+        this.mask = slots - 1;
+        this.startNanos = nowNanos;
+    }
+
+    void schedule(final T item, final long deadlineNanos) {
+        inbox.add(new Timeout<T>(item, deadlineNanos));
+    }
+
+    /** time from {@code nowNanos} until the next tick is due */
+    long nanosToNextTick(final long nowNanos) {
+        return Math.max(0, startNanos + (tick + 1) * tickNanos - nowNanos);
+    }
+
+    /**
+     * Processes all ticks up to {@code nowNanos}.
+     *
+     * @return number of expired timeouts
+     */
+    int expire(final long nowNanos, final Handler<T> handler) {
+        int expired = 0;
+        final long target = (nowNanos - startNanos) / tickNanos;
+        while (tick <= target) {
+            drainInbox();
+            final int slot = (int) (tick & mask);
+            Timeout<T> prev = null;
+            Timeout<T> t = buckets[slot];
+            while (t != null) {
+                final Timeout<T> next = t.next;
+                if (t.rounds <= 0) {
+                    if (prev == null) {
+                        buckets[slot] = next;
+                    } else {
+                        prev.next = next;
+                    }
+                    handler.onTimeout(t.item);
+                    expired++;
+                } else {
+                    t.rounds--;
+                    prev = t;
+                }
+                t = next;
+            }
+            tick++;
+        }
+        return expired;
+    }
+
+    private void drainInbox() {
+        Timeout<T> t;
+        while ((t = inbox.poll()) != null) {
+            /* round up, a timeout never fires early */
+            final long due = Math.max(tick, (t.deadline - startNanos
+                    + tickNanos - 1) / tickNanos);
+            t.rounds = (due - tick) / buckets.length;
+            final int slot = (int) (due & mask);
+            t.next = buckets[slot];
+            buckets[slot] = t;
+        }
+    }
+}
@@ -0,0 +1,239 @@
+package de.entropia.can;
+
+import java.io.Closeable;
+import java.io.IOException;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.locks.LockSupport;
+
+import de.entropia.can.CanSocket.CanFrame;
+
+/**
+ * Native transmit queue of a {@link CanSocket} that sends frames in CAN
+ * arbitration order.
+ *
+ * Any number of threads may {@link #offer} frames; they are handed to a
+ * native transmit thread through a lock-free ring without blocking. The
+ * thread always sends the pending frames with the lowest arbitration id
+ * first, coalesces up to 32 of them into one sendmmsg call and, when the
+ * interface queue is full (ENOBUFS), waits for POLLOUT instead of failing.
+ * A {@link TxShaper} attached to the socket applies as well: frames over
+ * budget stay queued and are retried shortly after, whatever the policy,
+ * except that {@link TxShaper.Policy#DROP} discards them.
+ * When the ring is full, {@link #offer} returns false, pushing the back
+ * pressure to the caller.
+ *
+ * The socket must stay open until the scheduler is closed, and
+ * {@link #close()} must not race with {@link #offer}.
+ */
+public final class TransmitScheduler implements Closeable {
+    static {
+        CanSocket.loadNativeLibrary();
+    }
+
+    public static final int DEFAULT_CAPACITY = 1024;
+
+    private static native long _create(final int fd, final long stats,
+            final int capacity) throws IOException;
+    private static native void _destroy(final long scheduler);
+    private static native boolean _offer(final long scheduler,
+            final int ifIndex, final int canId, final byte[] data);
+    private static native void _stats(final long scheduler,
+            final long[] stats);
+
+    private static final int STAT_SUBMITTED = 0;
+    private static final int STAT_REJECTED = 1;
+    private static final int STAT_SENT = 2;
+    private static final int STAT_DISCARDED = 3;
+    private static final int STAT_SEND_CALLS = 4;
+    private static final int STAT_ENOBUFS = 5;
+    private static final int STAT_POLLOUT_WAITS = 6;
+    private static final int STAT_POLLOUT_WAIT_NANOS = 7;
+    private static final int STAT_QUEUE_DEPTH = 8;
+    private static final int STAT_MAX_QUEUE_DEPTH = 9;
+    private static final int STAT_QUEUE_NANOS = 10;
+    private static final int STAT_MAX_QUEUE_NANOS = 11;
+    private static final int STAT_ERRORS = 12;
+    private static final int STAT_LAST_ERRNO = 13;
+    private static final int STAT_FIELDS = 14;
+
+    /**
+     * Snapshot of the scheduler counters. Counters are read one by one, so
+     * they may be off by frames in flight.
+     */
+    public final static class Stats {
+        private final long[] v;
+
+        private Stats(final long[] v) {
+            this.v = v;
+        }
+
+        /** frames accepted by {@link TransmitScheduler#offer} */
+        public long getSubmitted() {
+            return v[STAT_SUBMITTED];
+        }
+
+        /** frames refused because the queue was full */
+        public long getRejected() {
+            return v[STAT_REJECTED];
+        }
+
+        public long getSent() {
+            return v[STAT_SENT];
+        }
+
+        /** frames dropped by the shaper, after send errors or on close */
+        public long getDiscarded() {
+            return v[STAT_DISCARDED];
+        }
+
+        public long getSendCalls() {
+            return v[STAT_SEND_CALLS];
+        }
+
+        public double getFramesPerSendCall() {
+            return v[STAT_SEND_CALLS] == 0 ? 0
+                    : (double) v[STAT_SENT] / v[STAT_SEND_CALLS];
+        }
+
+        /** send calls that found the interface queue full */
+        public long getNoBufferCount() {
+            return v[STAT_ENOBUFS];
+        }
+
+        public long getPolloutWaits() {
+            return v[STAT_POLLOUT_WAITS];
+        }
+
+        public long getPolloutWaitNanos() {
+            return v[STAT_POLLOUT_WAIT_NANOS];
+        }
+
+        public long getQueueDepth() {
+            return v[STAT_QUEUE_DEPTH];
+        }
+
+        public long getMaxQueueDepth() {
+            return v[STAT_MAX_QUEUE_DEPTH];
+        }
+
+        /** mean time from offer to send of the sent frames */
+        public long getMeanQueueNanos() {
+            return v[STAT_SENT] == 0 ? 0 : v[STAT_QUEUE_NANOS] / v[STAT_SENT];
+        }
+
+        public long getMaxQueueNanos() {
+            return v[STAT_MAX_QUEUE_NANOS];
+        }
+
+        public long getErrors() {
+            return v[STAT_ERRORS];
+        }
+
+        /** errno of the last failed send, 0 if none failed */
+        public int getLastErrno() {
+            return (int) v[STAT_LAST_ERRNO];
+        }
+
+        @Override
+        public String toString() {
+            return "Stats [submitted=" + getSubmitted() + ", rejected="
+                    + getRejected() + ", sent=" + getSent() + ", discarded="
+                    + getDiscarded() + ", framesPerSendCall="
+                    + getFramesPerSendCall() + ", noBuffer="
+                    + getNoBufferCount() + ", queueDepth=" + getQueueDepth()
+                    + ", maxQueueDepth=" + getMaxQueueDepth()
+                    + ", meanQueueNanos=" + getMeanQueueNanos()
+                    + ", maxQueueNanos=" + getMaxQueueNanos() + ", errors="
+                    + getErrors() + "]";
+        }
+    }
+
+    private final CanSocket socket;
+    private volatile long _scheduler;
+
+    public TransmitScheduler(final CanSocket socket) throws IOException {
+        this(socket, DEFAULT_CAPACITY);
+    }
+
+    /**
+     * @param capacity number of frames that may be queued, a power of two
+     */
+    public TransmitScheduler(final CanSocket socket, final int capacity)
+            throws IOException {
+        this.socket = socket;
+        /* the descriptor stays pinned until the scheduler is closed */
+        socket.acquire();
+        try {
+            this._scheduler = _create(socket._fd, socket._stats, capacity);
+        } catch (final IOException | RuntimeException | Error e) {
+            socket.release();
+            throw e;
+        }
+    }
+
+    public CanSocket getSocket() {
+        return socket;
+    }
+
+    private long handle() {
+        final long scheduler = _scheduler;
+        if (scheduler == 0) {
+            throw new IllegalStateException("scheduler closed");
+        }
+        return scheduler;
+    }
+
+    /**
+     * Queues a frame for transmission without blocking.
+     *
+     * @return false if the queue is full
+     */
+    public boolean offer(final CanFrame frame) {
+        return _offer(handle(), frame.getCanInterfacae().getInterfaceIndex(),
+                frame.getCanId()._canId, frame.getData());
+    }
+
+    public Stats getStats() {
+        final long[] stats = new long[STAT_FIELDS];
+        _stats(handle(), stats);
+        return new Stats(stats);
+    }
+
+    /**
+     * Waits until all queued frames have been handed to the kernel.
+     *
+     * @return false if frames are still queued after the timeout
+     */
+    public boolean flush(final long timeout, final TimeUnit unit)
+            throws InterruptedException {
+        final long deadline = System.nanoTime() + unit.toNanos(timeout);
+        final long[] stats = new long[STAT_FIELDS];
+        for (;;) {
+            _stats(handle(), stats);
+            if (stats[STAT_QUEUE_DEPTH] == 0) {
+                return true;
+            }
+            if (System.nanoTime() - deadline >= 0) {
+                return false;
+            }
+            if (Thread.interrupted()) {
+                throw new InterruptedException();
+            }
+            LockSupport.parkNanos(TimeUnit.MICROSECONDS.toNanos(100));
+        }
+    }
+
+    /**
+     * Stops the transmit thread. Frames still queued are discarded, call
+     * {@link #flush} first to send them.
+     */
+    @Override
+    public synchronized void close() {
+        if (_scheduler != 0) {
+            final long scheduler = _scheduler;
+            _scheduler = 0;
+            _destroy(scheduler);
+            socket.release();
+        }
+    }
+}
@@ -0,0 +1,184 @@
+package de.entropia.can;
+
+import java.io.Closeable;
+
+import de.entropia.can.CanSocket.CanInterface;
+
+/**
+ * Token bucket shaping of the frames a {@link CanSocket} transmits, applied
+ * in native code once attached with {@link CanSocket#setShaper}: to the
+ * send calls of the socket, its {@link TransmitScheduler} and its
+ * {@link AsyncCanIo} submissions. J1939 messages are not shaped, the
+ * kernel segments and paces them itself.
+ *
+ * A frame has to fit into up to three buckets: the one of the first id
+ * rule whose range contains its id, the frame rate limit of its interface
+ * and the bus load budget of its interface. The bus load budget is charged
+ * with the nominal length of the frame on the wire, stuff bits included,
+ * so long payloads use up more of it than short ones. A frame over any
+ * budget is handled according to the {@link Policy}; frames not matched by
+ * any rule or limit pass unshaped.
+ *
+ * One shaper may be attached to several sockets, which then share its
+ * budgets. It stays alive until it is closed and detached from all of
+ * them.
+ */
+public final class TxShaper implements Closeable {
+    static {
+        CanSocket.loadNativeLibrary();
+    }
+
+    /** What happens to a frame that exceeds its budget. */
+    public static enum Policy {
+        /** blocking sends wait for tokens, non-blocking ones fail fast */
+        DELAY,
+        /** the frame is discarded and reported as sent */
+        DROP,
+        /** the send fails with EAGAIN: an exception from the blocking
+         * calls, {@code -EAGAIN} from the try* calls */
+        FAIL
+    }
+
+    private static native long _create(final int policy);
+    private static native void _release(final long shaper);
+    private static native int _addIdRule(final long shaper, final int low,
+            final int high, final double perSecond, final double burst);
+    private static native void _setInterfaceLimit(final long shaper,
+            final int ifIndex, final double perSecond, final double burst);
+    private static native void _setBusLoadLimit(final long shaper,
+            final int ifIndex, final int bitrate, final double maxLoad);
+    private static native void _stats(final long shaper, final long[] stats);
+    private static native long _ruleShaped(final long shaper, final int rule);
+
+    private static final int STAT_FRAMES = 0;
+    private static final int STAT_DELAYED = 1;
+    private static final int STAT_DELAY_NANOS = 2;
+    private static final int STAT_DROPPED = 3;
+    private static final int STAT_REJECTED = 4;
+    private static final int STAT_FIELDS = 5;
+
+    /**
+     * Snapshot of the shaper counters, shared by all sockets it is
+     * attached to.
+     */
+    public final static class Stats {
+        private final long[] v;
+
+        private Stats(final long[] v) {
+            this.v = v;
+        }
+
+        /** frames checked against the budgets */
+        public long getFrames() {
+            return v[STAT_FRAMES];
+        }
+
+        /** frames held back until the budget allowed them */
+        public long getDelayed() {
+            return v[STAT_DELAYED];
+        }
+
+        public long getDelayNanos() {
+            return v[STAT_DELAY_NANOS];
+        }
+
+        public long getMeanDelayNanos() {
+            return v[STAT_DELAYED] == 0 ? 0
+                    : v[STAT_DELAY_NANOS] / v[STAT_DELAYED];
+        }
+
+        public long getDropped() {
+            return v[STAT_DROPPED];
+        }
+
+        /** sends that failed fast because of the budget */
+        public long getRejected() {
+            return v[STAT_REJECTED];
+        }
+
+        @Override
+        public String toString() {
+            return "Stats [frames=" + getFrames() + ", delayed="
+                    + getDelayed() + ", meanDelayNanos="
+                    + getMeanDelayNanos() + ", dropped=" + getDropped()
+                    + ", rejected=" + getRejected() + "]";
+        }
+    }
+
+    private final Policy policy;
+    private volatile long _shaper;
+
+    public TxShaper(final Policy policy) {
+        this.policy = policy;
+        this._shaper = _create(policy.ordinal());
+    }
+
+    public Policy getPolicy() {
+        return policy;
+    }
+
+    long handle() {
+        final long shaper = _shaper;
+        if (shaper == 0) {
+            throw new IllegalStateException("shaper closed");
+        }
+        return shaper;
+    }
+
+    /**
+     * Limits the frames with ids in {@code [low, high]} to
+     * {@code perSecond} frames per second with bursts of {@code burst}
+     * frames. Rules are matched in the order they were added. Extended
+     * ids are matched including {@link CanSocket.CanId#setEFFSFF() the EFF
+     * flag}, so one rule does not cover both standard and extended ids;
+     * RTR and error flags are ignored.
+     *
+     * @return the index of the rule for {@link #getShapedFrames}
+     */
+    public int addIdRule(final int low, final int high,
+            final double perSecond, final double burst) {
+        return _addIdRule(handle(), low, high, perSecond, burst);
+    }
+
+    /** Limits all frames sent on {@code canif} to a frame rate. */
+    public void setInterfaceLimit(final CanInterface canif,
+            final double perSecond, final double burst) {
+        _setInterfaceLimit(handle(), canif.getInterfaceIndex(), perSecond,
+                burst);
+    }
+
+    /**
+     * Limits the share of the bus that the frames sent on {@code canif}
+     * occupy to {@code maxLoad}, a fraction of {@code bitrate}. Bursts of
+     * 10 ms worth of the budget are allowed.
+     */
+    public void setBusLoadLimit(final CanInterface canif, final int bitrate,
+            final double maxLoad) {
+        _setBusLoadLimit(handle(), canif.getInterfaceIndex(), bitrate,
+                maxLoad);
+    }
+
+    /** frames that exceeded the bucket of id rule {@code rule} */
+    public long getShapedFrames(final int rule) {
+        return _ruleShaped(handle(), rule);
+    }
+
+    public Stats getStats() {
+        final long[] stats = new long[STAT_FIELDS];
+        _stats(handle(), stats);
+        return new Stats(stats);
+    }
+
+    /**
+     * Releases the shaper. Sockets it is attached to keep shaping with it
+     * until they are closed or get another shaper.
+     */
+    @Override
+    public synchronized void close() {
+        if (_shaper != 0) {
+            final long shaper = _shaper;
+            _shaper = 0;
+            _release(shaper);
+        }
+    }
+}